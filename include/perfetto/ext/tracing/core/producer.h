@@ -120,6 +120,12 @@ class PERFETTO_EXPORT Producer {
   virtual void ClearIncrementalState(
       const DataSourceInstanceID* data_source_ids,
       size_t num_data_sources) = 0;
+
+  // Called by the service if it found the SMB commit ring (see
+  // SharedMemoryArbiter::EnableSmbCommitRing()) corrupted and stopped reading
+  // it. Only the transport layer needs to handle this, by calling
+  // SharedMemoryArbiter::DisableSmbCommitRing() on the producer side.
+  virtual void OnSmbCommitRingDisabled() {}
 };
 
 }  // namespace perfetto
@@ -154,6 +154,21 @@ class PERFETTO_EXPORT SharedMemoryArbiter {
   // and this method should always be called.
   virtual void SetDirectSMBPatchingSupportedByService() = 0;
 
+  // Reserves the last page of the SMB for the commit ring (see
+  // src/tracing/core/smb_commit_ring.h) and commits chunks through it rather
+  // than via CommitData() IPCs, which are then sent only when the service
+  // needs to be woken up. Must be called, before any TraceWriter is created,
+  // if the service set SetupTracing.smb_commit_ring (see producer_port.proto)
+  // or, in the in-process case, if
+  // ProducerEndpoint::IsSmbCommitRingEnabled() returns true.
+  virtual void EnableSmbCommitRing() = 0;
+
+  // Goes back to committing chunks via CommitData() IPCs, after the service
+  // stopped reading the commit ring (see
+  // Producer::OnSmbCommitRingDisabled()). The last page of the SMB stays
+  // reserved.
+  virtual void DisableSmbCommitRing() = 0;
+
   // Forces an immediate commit of the completed packets, without waiting for
   // the next task or for a batching period to end. Should only be called while
   // bound.
@@ -40,6 +40,7 @@ class TaskRunner;
 class Consumer;
 class Producer;
 class SharedMemoryArbiter;
+class TracePacket;
 class TraceWriter;
 
 // Exposed for testing.
@@ -124,6 +125,11 @@ class PERFETTO_EXPORT ProducerEndpoint {
   // producer.
   virtual bool IsShmemProvidedByProducer() const = 0;
 
+  // Whether the service reads the commits of the producer from the commit
+  // ring in the last page of the shared memory buffer. Valid after
+  // OnTracingSetup(). See SharedMemoryArbiter::EnableSmbCommitRing().
+  virtual bool IsSmbCommitRingEnabled() const { return false; }
+
   // Called in response to a Producer::Flush(request_id) call after all data
   // for the flush request has been committed.
   virtual void NotifyFlushComplete(FlushRequestID) = 0;
@@ -241,6 +247,22 @@ class PERFETTO_EXPORT ConsumerEndpoint {
   using SaveTraceForBugreportCallback =
       std::function<void(bool /*success*/, const std::string& /*msg*/)>;
   virtual void SaveTraceForBugreport(SaveTraceForBugreportCallback) = 0;
+
+  // Creates a read-only copy of the buffers of the tracing session |tsid|
+  // (see TracingServiceState.TracingSession.id) and attaches the copy to this
+  // consumer, as if it had been created with EnableTracing() and then
+  // stopped. The original session keeps recording. The copy can be read with
+  // ReadBuffers() and must be released with FreeBuffers().
+  // The data sources of the original session are flushed before taking the
+  // copy, if the session is running. The session must belong to the same uid
+  // of the consumer (unless the consumer is root) and the consumer must not
+  // be attached to any other session.
+  // Args:
+  // - success: if true, the copy is attached to the consumer.
+  // - error: human readable diagnostic message, in case of failure.
+  using CloneSessionCallback =
+      std::function<void(bool /*success*/, const std::string& /*error*/)>;
+  virtual void CloneSession(TracingSessionID, CloneSessionCallback) = 0;
 };  // class ConsumerEndpoint.
 
 // The public API of the tracing Service business logic.
@@ -317,6 +339,10 @@ class PERFETTO_EXPORT TracingService {
   // Producer::StartDataSource(). The |shm| will also be rejected when
   // connecting to a service that is too old (pre Android-11).
   //
+  // |smb_commit_ring_supported| tells whether the producer can commit chunks
+  // through the SMB commit ring (see TraceConfig.ProducerConfig.
+  // smb_commit_ring). The ring is always supported by in-process producers.
+  //
   // Can return null in the unlikely event that service has too many producers
   // connected.
   virtual std::unique_ptr<ProducerEndpoint> ConnectProducer(
@@ -330,7 +356,8 @@ class PERFETTO_EXPORT TracingService {
           ProducerSMBScrapingMode::kDefault,
       size_t shared_memory_page_size_hint_bytes = 0,
       std::unique_ptr<SharedMemory> shm = nullptr,
-      const std::string& sdk_version = {}) = 0;
+      const std::string& sdk_version = {},
+      bool smb_commit_ring_supported = false) = 0;
 
   // Connects a Consumer instance and obtains a ConsumerEndpoint, which is
   // essentially a 1:1 channel between one Consumer and the Service.
@@ -350,6 +377,19 @@ class PERFETTO_EXPORT TracingService {
   //
   // This feature is currently used by Chrome.
   virtual void SetSMBScrapingEnabled(bool enabled) = 0;
+
+  // Compresses in place the packets read from the buffers of a session, as
+  // requested by |config.compression_type()|. Must be safe to call on any
+  // thread. See ZlibCompressFn() in src/tracing/core/zlib_compressor.h.
+  using CompressorFn = void (*)(std::vector<TracePacket>*,
+                                const TraceConfig& config);
+
+  // Sets the function used to compress the trace of write_into_file sessions
+  // that set a compression_type. The compression runs on a background thread,
+  // overlapped with the reads from the buffers. If never called (the default)
+  // the service doesn't compress and leaves it to the consumer, which is not
+  // possible for write_into_file sessions.
+  virtual void SetCompressorFn(CompressorFn compressor_fn) = 0;
 };
 
 }  // namespace perfetto
@@ -118,6 +118,24 @@ struct PERFETTO_EXPORT Config {
   // Any built-in metric proto or sql files matching these paths are skipped
   // during trace processor metric initialization.
   std::vector<std::string> skip_builtin_metric_paths;
+
+  // When non-zero, bounds the memory used to buffer events while sorting them
+  // to approximately this many bytes. When the limit is hit, the oldest
+  // buffered events are parsed without waiting for the rest of the trace;
+  // this can cause events to be parsed out of order if the trace is not
+  // mostly sorted (e.g. ring-buffer traces with many producers).
+  //
+  // This option is intended for very large traces which would otherwise not
+  // fit in memory.
+  uint64_t sorter_memory_limit_bytes = 0;
+
+  // When non-zero, NotifyEndOfFile() opens this many additional, read-only
+  // SQLite connections over the loaded trace. These are used by
+  // TraceProcessor::ExecuteReadOnlyQuery() to run queries concurrently from
+  // multiple threads.
+  //
+  // This option is ignored if SQLite was not built with multi-thread support.
+  uint32_t read_only_connections = 0;
 };
 
 // Represents a dynamically typed value returned by SQL.
@@ -54,6 +54,24 @@ class PERFETTO_EXPORT TraceProcessor : public TraceProcessorStorage {
   // the returned iterator.
   virtual Iterator ExecuteQuery(const std::string& sql) = 0;
 
+  // Executes the SQL on one of the read-only connections opened when
+  // Config::read_only_connections is non-zero.
+  //
+  // Unlike all the other methods of this class, this function can be called
+  // concurrently from multiple threads, as long as no other method is being
+  // called and no Iterator returned by ExecuteQuery() is alive at the same
+  // time. The returned Iterator can be used on the calling thread. If all the
+  // read-only connections are in use, this function blocks until the Iterator
+  // of a previous call is destroyed.
+  //
+  // Read-only connections only see the tables, views and functions built into
+  // trace processor and only allow statements which don't modify the database.
+  // In particular, they do *not* see tables or views created through
+  // ExecuteQuery(). The returned Iterator has an error status if the query
+  // cannot run on a read-only connection (or no such connection exists); in
+  // that case the query should be retried with ExecuteQuery().
+  virtual Iterator ExecuteReadOnlyQuery(const std::string& sql) = 0;
+
   // Registers a metric at the given path which will run the specified SQL.
   virtual base::Status RegisterMetric(const std::string& path,
                                       const std::string& sql) = 0;
@@ -150,9 +150,11 @@ LazyKernelSymbolizer::LazyKernelSymbolizer() = default;
 LazyKernelSymbolizer::~LazyKernelSymbolizer() = default;
 
 KernelSymbolMap* LazyKernelSymbolizer::GetOrCreateKernelSymbolMap() {
-  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // Once created, the map can be used from other threads (e.g. the ftrace
+  // reader threads), as long as it isn't destroyed concurrently.
   if (symbol_map_)
     return symbol_map_.get();
+  PERFETTO_DCHECK_THREAD(thread_checker_);
 
   symbol_map_.reset(new KernelSymbolMap());
 
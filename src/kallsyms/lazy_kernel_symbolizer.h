@@ -44,6 +44,7 @@ class LazyKernelSymbolizer {
   ~LazyKernelSymbolizer();
 
   // Returns |instance_|, creating it if doesn't exist or was destroyed.
+  // Can be called on other threads only if |instance_| already exists.
   KernelSymbolMap* GetOrCreateKernelSymbolMap();
 
   bool is_valid() const { return !!symbol_map_; }
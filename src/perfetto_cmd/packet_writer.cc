@@ -57,6 +57,20 @@ constexpr uint32_t kCompressedPacketsId = 50;
 // room for the transport to add additional headers etc.
 const size_t kMaxPacketSize = 500 * 1024;
 
+// Level used for COMPRESSION_TYPE_DEFLATE.
+constexpr int kDefaultCompressionLevel = 6;
+
+int GetCompressionLevel(TraceConfig::CompressionType compression_type) {
+  switch (compression_type) {
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE_FAST:
+      return Z_BEST_SPEED;
+    case TraceConfig::COMPRESSION_TYPE_UNSPECIFIED:
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE:
+      break;
+  }
+  return kDefaultCompressionLevel;
+}
+
 // After every kPendingBytesLimit we do a Z_SYNC_FLUSH in the zlib stream.
 const size_t kPendingBytesLimit = 32 * 1024;
 
@@ -109,7 +123,7 @@ bool FilePacketWriter::WritePacket(const TracePacket& packet) {
 
 class ZipPacketWriter : public PacketWriter {
  public:
-  ZipPacketWriter(std::unique_ptr<PacketWriter>);
+  ZipPacketWriter(std::unique_ptr<PacketWriter>, int level);
   ~ZipPacketWriter() override;
   bool WritePacket(const TracePacket& packet) override;
 
@@ -125,6 +139,7 @@ class ZipPacketWriter : public PacketWriter {
   void Deflate(const uint8_t* ptr, size_t size);
 
   std::unique_ptr<PacketWriter> writer_;
+  const int level_;
   z_stream stream_{};
 
   base::PagedMemory buf_;
@@ -135,8 +150,10 @@ class ZipPacketWriter : public PacketWriter {
   size_t pending_bytes_ = 0;
 };
 
-ZipPacketWriter::ZipPacketWriter(std::unique_ptr<PacketWriter> writer)
+ZipPacketWriter::ZipPacketWriter(std::unique_ptr<PacketWriter> writer,
+                                 int level)
     : writer_(std::move(writer)),
+      level_(level),
       buf_(base::PagedMemory::Allocate(kMaxPacketSize)),
       start_(static_cast<uint8_t*>(buf_.Get())),
       end_(start_ + buf_.size()) {}
@@ -190,7 +207,7 @@ bool ZipPacketWriter::WritePacket(const TracePacket& packet) {
   // Reinitialize the compresser if needed:
   if (!is_compressing_) {
     memset(&stream_, 0, sizeof(stream_));
-    CheckEq(deflateInit(&stream_, 6), Z_OK);
+    CheckEq(deflateInit(&stream_, level_), Z_OK);
     is_compressing_ = true;
     stream_.next_out = start_;
     stream_.avail_out = static_cast<unsigned int>(end_ - start_);
@@ -262,8 +279,12 @@ std::unique_ptr<PacketWriter> CreateFilePacketWriter(FILE* fd) {
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 std::unique_ptr<PacketWriter> CreateZipPacketWriter(
-    std::unique_ptr<PacketWriter> writer) {
-  return std::unique_ptr<PacketWriter>(new ZipPacketWriter(std::move(writer)));
+    std::unique_ptr<PacketWriter> writer,
+    TraceConfig::CompressionType compression_type) {
+  PERFETTO_DCHECK(compression_type !=
+                  TraceConfig::COMPRESSION_TYPE_UNSPECIFIED);
+  return std::unique_ptr<PacketWriter>(new ZipPacketWriter(
+      std::move(writer), GetCompressionLevel(compression_type)));
 }
 #endif
 
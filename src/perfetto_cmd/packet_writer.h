@@ -23,6 +23,7 @@
 #include <stdio.h>
 
 #include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/tracing/core/trace_config.h"
 
 namespace perfetto {
 
@@ -42,8 +43,11 @@ class PacketWriter {
 };
 
 std::unique_ptr<PacketWriter> CreateFilePacketWriter(FILE*);
+// Deflates the packets into |compressed_packets|, using the compression level
+// implied by |compression_type| (which must not be UNSPECIFIED).
 std::unique_ptr<PacketWriter> CreateZipPacketWriter(
-    std::unique_ptr<PacketWriter>);
+    std::unique_ptr<PacketWriter>,
+    TraceConfig::CompressionType compression_type);
 
 }  // namespace perfetto
 
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include <random>
+#include <string>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/file_utils.h"
@@ -132,7 +133,8 @@ TEST(PacketWriterTest, ZipPacketWriter) {
 
     {
       std::unique_ptr<PacketWriter> writer =
-          CreateZipPacketWriter(CreateFilePacketWriter(*f));
+          CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                                TraceConfig::COMPRESSION_TYPE_DEFLATE);
       EXPECT_TRUE(writer->WritePackets(std::move(packets)));
     }
 
@@ -159,7 +161,8 @@ TEST(PacketWriterTest, ZipPacketWriter_Empty) {
 
   {
     std::unique_ptr<PacketWriter> writer =
-        CreateZipPacketWriter(CreateFilePacketWriter(*f));
+        CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                              TraceConfig::COMPRESSION_TYPE_DEFLATE);
   }
 
   EXPECT_EQ(fseek(*f, 0, SEEK_END), 0);
@@ -172,7 +175,8 @@ TEST(PacketWriterTest, ZipPacketWriter_EmptyWithEmptyWrite) {
 
   {
     std::unique_ptr<PacketWriter> writer =
-        CreateZipPacketWriter(CreateFilePacketWriter(*f));
+        CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                              TraceConfig::COMPRESSION_TYPE_DEFLATE);
     writer->WritePackets(std::vector<TracePacket>());
     writer->WritePackets(std::vector<TracePacket>());
     writer->WritePackets(std::vector<TracePacket>());
@@ -205,7 +209,8 @@ TEST(PacketWriterTest, ZipPacketWriter_ShouldCompress) {
 
   {
     std::unique_ptr<PacketWriter> writer =
-        CreateZipPacketWriter(CreateFilePacketWriter(*f));
+        CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                              TraceConfig::COMPRESSION_TYPE_DEFLATE);
     EXPECT_TRUE(writer->WritePackets(std::move(packets)));
   }
 
@@ -234,6 +239,52 @@ TEST(PacketWriterTest, ZipPacketWriter_ShouldCompress) {
   EXPECT_EQ(packet_count, 200 * 2u);
 }
 
+TEST(PacketWriterTest, ZipPacketWriter_DeflateFast) {
+  auto write_trace = [](TraceConfig::CompressionType compression_type) {
+    base::TempFile tmp = base::TempFile::CreateUnlinked();
+    base::ScopedResource<FILE*, fclose, nullptr> f(
+        fdopen(tmp.ReleaseFD().release(), "wb"));
+
+    std::vector<perfetto::TracePacket> packets;
+    for (uint32_t i = 0; i < 1000; i++) {
+      packets.push_back(CreateTracePacket([i](TracePacketProto* msg) {
+        auto* for_testing = msg->mutable_for_testing();
+        for_testing->set_seq_value(i % 7);
+        for_testing->set_str("abcdefghijklmn" + std::to_string(i % 13));
+      }));
+    }
+
+    {
+      std::unique_ptr<PacketWriter> writer =
+          CreateZipPacketWriter(CreateFilePacketWriter(*f), compression_type);
+      EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+    }
+
+    std::string s;
+    fseek(*f, 0, SEEK_SET);
+    EXPECT_TRUE(base::ReadFileStream(*f, &s));
+    return s;
+  };
+
+  std::string fast = write_trace(TraceConfig::COMPRESSION_TYPE_DEFLATE_FAST);
+  std::string deflate = write_trace(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+
+  // The two levels produce different streams for the same input...
+  protos::gen::Trace fast_trace;
+  protos::gen::Trace deflate_trace;
+  ASSERT_TRUE(fast_trace.ParseFromString(fast));
+  ASSERT_TRUE(deflate_trace.ParseFromString(deflate));
+  ASSERT_EQ(fast_trace.packet().size(), 1u);
+  ASSERT_EQ(deflate_trace.packet().size(), 1u);
+  const std::string& fast_data = fast_trace.packet()[0].compressed_packets();
+  const std::string& deflate_data =
+      deflate_trace.packet()[0].compressed_packets();
+  EXPECT_NE(fast_data, deflate_data);
+
+  // ...that inflate to the same packets.
+  EXPECT_EQ(Decompress(fast_data), Decompress(deflate_data));
+}
+
 TEST(PacketWriterTest, ZipPacketWriter_LargePacket) {
   base::TempFile tmp = base::TempFile::CreateUnlinked();
   base::ScopedResource<FILE*, fclose, nullptr> f(
@@ -258,7 +309,8 @@ TEST(PacketWriterTest, ZipPacketWriter_LargePacket) {
 
   {
     std::unique_ptr<PacketWriter> writer =
-        CreateZipPacketWriter(CreateFilePacketWriter(*f));
+        CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                              TraceConfig::COMPRESSION_TYPE_DEFLATE);
     EXPECT_TRUE(writer->WritePackets(std::move(packets)));
   }
 
@@ -288,7 +340,8 @@ TEST(PacketWriterTest, ZipPacketWriter_ShouldSplitPackets) {
 
   {
     std::unique_ptr<PacketWriter> writer =
-        CreateZipPacketWriter(CreateFilePacketWriter(*f));
+        CreateZipPacketWriter(CreateFilePacketWriter(*f),
+                              TraceConfig::COMPRESSION_TYPE_DEFLATE);
     EXPECT_TRUE(writer->WritePackets(std::move(packets)));
   }
 
@@ -757,17 +757,17 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       packet_writer_ = CreateFilePacketWriter(trace_out_stream_.get());
   }
 
-  if (trace_config_->compression_type() ==
-      TraceConfig::COMPRESSION_TYPE_DEFLATE) {
-    if (packet_writer_) {
+  // When tracing directly to file the compression, if any, is done by the
+  // tracing service.
+  if (trace_config_->compression_type() !=
+          TraceConfig::COMPRESSION_TYPE_UNSPECIFIED &&
+      packet_writer_) {
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
-      packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_));
+    packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_),
+                                           trace_config_->compression_type());
 #else
-      PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
+    PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
 #endif
-    } else {
-      PERFETTO_ELOG("Cannot compress when tracing directly to file.");
-    }
   }
 
   bool will_trace_indefinitely =
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/chunk_prefetcher.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#include <errno.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/thread_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+ChunkPrefetcher::ChunkPrefetcher(int fd,
+                                 size_t chunk_size,
+                                 size_t max_chunks_in_flight)
+    : fd_(fd),
+      chunk_size_(chunk_size),
+      max_chunks_in_flight_(max_chunks_in_flight) {
+  PERFETTO_CHECK(chunk_size_ > 0 && max_chunks_in_flight_ > 0);
+  thread_ = std::thread(&ChunkPrefetcher::ReaderMain, this);
+}
+
+ChunkPrefetcher::~ChunkPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+ChunkPrefetcher::Chunk ChunkPrefetcher::Pop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !chunks_.empty(); });
+  Chunk chunk = std::move(chunks_.front());
+  chunks_.pop_front();
+  cv_.notify_all();
+  return chunk;
+}
+
+void ChunkPrefetcher::ReaderMain() {
+  base::MaybeSetThreadName("TraceFileReader");
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+        return quit_ || chunks_.size() < max_chunks_in_flight_;
+      });
+      if (quit_)
+        return;
+    }
+
+    Chunk chunk(TraceBlob::Allocate(chunk_size_));
+    auto rsize = base::Read(fd_, chunk.blob.data(), chunk.blob.size());
+    bool done = rsize <= 0;
+    if (rsize < 0) {
+      chunk.err = errno;
+    } else {
+      chunk.size = static_cast<size_t>(rsize);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunks_.emplace_back(std::move(chunk));
+    }
+    cv_.notify_all();
+    if (done)
+      return;
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CHUNK_PREFETCHER_H_
+#define SRC_TRACE_PROCESSOR_CHUNK_PREFETCHER_H_
+
+#include "perfetto/base/build_config.h"
+
+// WASM builds have no threads and keep reading the trace synchronously.
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "perfetto/trace_processor/trace_blob.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Reads a file descriptor on a dedicated thread in chunks of up to
+// |chunk_size| bytes, staying at most |max_chunks_in_flight| chunks ahead of
+// the consumer. Only the read() calls move off the calling thread:
+// tokenization and parsing stay on the consumer, as TraceStorage and the
+// importers are not thread-safe.
+class ChunkPrefetcher {
+ public:
+  struct Chunk {
+    explicit Chunk(TraceBlob b) : blob(std::move(b)) {}
+
+    TraceBlob blob;
+    size_t size = 0;  // 0 on EOF or on error.
+    int err = 0;      // errno of the failed read(), 0 on success.
+  };
+
+  ChunkPrefetcher(int fd, size_t chunk_size, size_t max_chunks_in_flight);
+
+  // Stops the reader thread. It is fine to destroy the prefetcher before
+  // reaching the end of the file.
+  ~ChunkPrefetcher();
+
+  // Blocks until the next chunk is available. A chunk can be shorter than
+  // |chunk_size| even before the end of the file (e.g. when reading from a
+  // pipe). The last chunk always has size == 0 and marks either EOF or an
+  // error (|err| != 0): Pop() must not be called after it.
+  Chunk Pop();
+
+ private:
+  void ReaderMain();
+
+  const int fd_;
+  const size_t chunk_size_;
+  const size_t max_chunks_in_flight_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Chunk> chunks_;  // Guarded by |mutex_|.
+  bool quit_ = false;         // Guarded by |mutex_|.
+  std::thread thread_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#endif  // SRC_TRACE_PROCESSOR_CHUNK_PREFETCHER_H_
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/chunk_prefetcher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr size_t kChunkSize = 4096;
+
+std::string MakeData(size_t size) {
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = static_cast<char>('a' + (i % 26));
+  return data;
+}
+
+// Writes |data| to a temporary file and opens it for reading.
+base::ScopedFile WriteTempFile(const base::TempFile& file,
+                               const std::string& data) {
+  EXPECT_EQ(base::WriteAll(file.fd(), data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+  return base::OpenFile(file.path(), O_RDONLY);
+}
+
+// Pops chunks until EOF, returning their sizes and appending their contents
+// to |out|.
+std::vector<size_t> PopAll(ChunkPrefetcher* prefetcher, std::string* out) {
+  std::vector<size_t> sizes;
+  for (;;) {
+    ChunkPrefetcher::Chunk chunk = prefetcher->Pop();
+    EXPECT_EQ(chunk.err, 0);
+    if (chunk.size == 0)
+      break;
+    EXPECT_LE(chunk.size, kChunkSize);
+    sizes.push_back(chunk.size);
+    out->append(reinterpret_cast<const char*>(chunk.blob.data()), chunk.size);
+  }
+  return sizes;
+}
+
+TEST(ChunkPrefetcherTest, MultipleChunksWithPartialLastChunk) {
+  std::string data = MakeData(kChunkSize * 3 + kChunkSize / 2);
+  base::TempFile file = base::TempFile::Create();
+  base::ScopedFile fd = WriteTempFile(file, data);
+
+  std::string read_data;
+  ChunkPrefetcher prefetcher(*fd, kChunkSize, 2);
+  std::vector<size_t> sizes = PopAll(&prefetcher, &read_data);
+
+  ASSERT_THAT(sizes, testing::ElementsAre(kChunkSize, kChunkSize, kChunkSize,
+                                          kChunkSize / 2));
+  ASSERT_EQ(read_data, data);
+}
+
+TEST(ChunkPrefetcherTest, SizeMultipleOfChunkSize) {
+  std::string data = MakeData(kChunkSize * 2);
+  base::TempFile file = base::TempFile::Create();
+  base::ScopedFile fd = WriteTempFile(file, data);
+
+  std::string read_data;
+  ChunkPrefetcher prefetcher(*fd, kChunkSize, 1);
+  std::vector<size_t> sizes = PopAll(&prefetcher, &read_data);
+
+  ASSERT_THAT(sizes, testing::ElementsAre(kChunkSize, kChunkSize));
+  ASSERT_EQ(read_data, data);
+}
+
+TEST(ChunkPrefetcherTest, EmptyFile) {
+  base::TempFile file = base::TempFile::Create();
+  base::ScopedFile fd = WriteTempFile(file, "");
+
+  std::string read_data;
+  ChunkPrefetcher prefetcher(*fd, kChunkSize, 4);
+  ASSERT_TRUE(PopAll(&prefetcher, &read_data).empty());
+}
+
+TEST(ChunkPrefetcherTest, ReadError) {
+  base::TempFile file = base::TempFile::Create();
+  base::ScopedFile fd = base::OpenFile(file.path(), O_WRONLY);
+  ASSERT_TRUE(fd);
+
+  ChunkPrefetcher prefetcher(*fd, kChunkSize, 4);
+  ChunkPrefetcher::Chunk chunk = prefetcher.Pop();
+  ASSERT_EQ(chunk.size, 0u);
+  ASSERT_EQ(chunk.err, EBADF);
+}
+
+TEST(ChunkPrefetcherTest, DestroyBeforeEof) {
+  std::string data = MakeData(kChunkSize * 16);
+  base::TempFile file = base::TempFile::Create();
+  base::ScopedFile fd = WriteTempFile(file, data);
+
+  // The reader blocks once two chunks are queued: destroying the prefetcher
+  // must stop it rather than wait for the rest of the file.
+  ChunkPrefetcher prefetcher(*fd, kChunkSize, 2);
+  ChunkPrefetcher::Chunk chunk = prefetcher.Pop();
+  ASSERT_EQ(chunk.size, kChunkSize);
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+TEST(ChunkPrefetcherTest, ShortReadsFromPipe) {
+  base::Pipe pipe = base::Pipe::Create();
+  ChunkPrefetcher prefetcher(*pipe.rd, kChunkSize, 4);
+
+  // A read() on a pipe returns as soon as some data is available, so the
+  // first chunk only holds what was written so far.
+  std::string first = MakeData(100);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, first.data(), first.size()), 100);
+  ChunkPrefetcher::Chunk chunk = prefetcher.Pop();
+  ASSERT_EQ(chunk.err, 0);
+  ASSERT_EQ(chunk.size, 100u);
+  ASSERT_EQ(std::string(reinterpret_cast<const char*>(chunk.blob.data()),
+                        chunk.size),
+            first);
+
+  std::string rest = MakeData(kChunkSize * 2 + 7);
+  ASSERT_EQ(base::WriteAll(*pipe.wr, rest.data(), rest.size()),
+            static_cast<ssize_t>(rest.size()));
+  pipe.wr.reset();
+
+  std::string read_data;
+  PopAll(&prefetcher, &read_data);
+  ASSERT_EQ(read_data, rest);
+}
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -301,6 +301,39 @@ class BitVector {
     return bv;
   }
 
+  // Creates a BitVector of size |end| with the bits between |start| and |end|
+  // filled 64 at a time by calling the filler function |f(idx, count)|. The
+  // filler should return a word where bit |i| is the value of bit |idx + i|
+  // for all |i| < |count| and all other bits are unset.
+  //
+  // This is faster than |Range| when the filler can compute many bits at once
+  // (e.g. by comparing a contiguous array of values without branches).
+  template <typename WordFiller = uint64_t(uint32_t, uint32_t)>
+  static BitVector RangeByWord(uint32_t start, uint32_t end, WordFiller f) {
+    PERFETTO_DCHECK(start <= end);
+    std::vector<Block> blocks(BlockCeil(end));
+    for (uint32_t i = start; i < end;) {
+      uint32_t bit_idx = i % BitWord::kBits;
+      uint32_t count = std::min(BitWord::kBits - bit_idx, end - i);
+      uint64_t word = f(i, count);
+      PERFETTO_DCHECK(count == BitWord::kBits || word >> count == 0);
+
+      uint32_t word_idx = i / BitWord::kBits;
+      blocks[word_idx / Block::kWords].OrWord(word_idx % Block::kWords,
+                                              word << bit_idx);
+      i += count;
+    }
+
+    std::vector<uint32_t> counts(blocks.size());
+    uint32_t set_count = 0;
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+      counts[i] = set_count;
+      set_count += blocks[i].GetNumBitsSet(
+          BlockOffset{Block::kWords - 1, BitWord::kBits - 1});
+    }
+    return BitVector(std::move(blocks), std::move(counts), end);
+  }
+
   // Updates the ith set bit of this bitvector with the value of
   // |other.IsSet(i)|.
   //
@@ -634,6 +667,12 @@ class BitVector {
       words_[end.word_idx].Set(0, end.bit_idx);
     }
 
+    // Bitwise ors the given |mask| to the word at |word_idx|.
+    void OrWord(uint32_t word_idx, uint64_t mask) {
+      PERFETTO_DCHECK(word_idx < kWords);
+      words_[word_idx].Or(mask);
+    }
+
     template <typename Filler>
     static Block FromFiller(uint32_t offset, Filler f) {
       // We choose to iterate the bits as the outer loop as this allows us
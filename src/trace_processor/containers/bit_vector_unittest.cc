@@ -411,6 +411,27 @@ TEST(BitVectorUnittest, Range) {
   ASSERT_EQ(bv.GetNumBitsSet(), 341u);
 }
 
+TEST(BitVectorUnittest, RangeByWord) {
+  auto f = [](uint32_t t) { return t % 3 == 0; };
+  for (uint32_t start : {0u, 1u, 63u, 64u, 511u, 700u}) {
+    BitVector bv = BitVector::RangeByWord(
+        start, 1537, [&f](uint32_t idx, uint32_t count) {
+          uint64_t word = 0;
+          for (uint32_t i = 0; i < count; ++i)
+            word |= static_cast<uint64_t>(f(idx + i)) << i;
+          return word;
+        });
+    BitVector expected = BitVector::Range(start, 1537, f);
+
+    ASSERT_EQ(bv.size(), expected.size());
+    ASSERT_EQ(bv.GetNumBitsSet(), expected.GetNumBitsSet());
+    for (uint32_t i = 0; i < bv.size(); ++i) {
+      ASSERT_EQ(bv.IsSet(i), expected.IsSet(i));
+      ASSERT_EQ(bv.GetNumBitsSet(i), expected.GetNumBitsSet(i));
+    }
+  }
+}
+
 TEST(BitVectorUnittest, QueryStressTest) {
   BitVector bv;
   std::vector<bool> bool_vec;
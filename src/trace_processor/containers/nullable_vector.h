@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <deque>
 
 #include "perfetto/base/logging.h"
@@ -40,6 +41,14 @@ class NullableVectorBase {
 
   NullableVectorBase(NullableVectorBase&&) = default;
   NullableVectorBase& operator=(NullableVectorBase&&) noexcept = default;
+
+  // Returns a counter which changes every time the contents of the vector
+  // change. This allows data derived from the contents (e.g. indexes) to be
+  // invalidated.
+  uint64_t mutations() const { return mutations_; }
+
+ protected:
+  uint64_t mutations_ = 0;
 };
 
 // A data structure which compactly stores a list of possibly nullable data.
@@ -112,10 +121,38 @@ class NullableVector : public NullableVectorBase {
     }
   }
 
+  // Returns a BitVector of size |end| where the bits between |start| and |end|
+  // are set iff |p(GetNonNull(i))| returns true. Only supported for sparse
+  // NullableVectors.
+  //
+  // Values are copied out of the deque one word's worth at a time and
+  // compared as a contiguous array without any branches. For simple
+  // predicates, this allows the compiler to vectorize the comparisons.
+  template <typename Predicate>
+  BitVector FilterNonNull(uint32_t start, uint32_t end, Predicate p) const {
+    PERFETTO_DCHECK(mode_ == Mode::kSparse);
+    PERFETTO_DCHECK(end <= data_.size());
+    return BitVector::RangeByWord(
+        start, end, [this, &p](uint32_t idx, uint32_t count) {
+          constexpr uint32_t kBatchSize = 64;
+          T batch[kBatchSize];
+          auto it = data_.begin() + static_cast<ptrdiff_t>(idx);
+          std::copy(it, it + static_cast<ptrdiff_t>(count), batch);
+          if (PERFETTO_UNLIKELY(count < kBatchSize))
+            std::fill(batch + count, batch + kBatchSize, T());
+
+          uint64_t word = 0;
+          for (uint32_t i = 0; i < kBatchSize; ++i)
+            word |= static_cast<uint64_t>(p(batch[i])) << i;
+          return count < kBatchSize ? word & ((1ull << count) - 1) : word;
+        });
+  }
+
   // Adds the given value to the NullableVector.
   void Append(T val) {
     data_.emplace_back(val);
     valid_.Insert(size_++);
+    mutations_++;
   }
 
   // Adds a null value to the NullableVector.
@@ -124,6 +161,7 @@ class NullableVector : public NullableVectorBase {
       data_.emplace_back();
     }
     size_++;
+    mutations_++;
   }
 
   // Adds the given optional value to the NullableVector.
@@ -137,6 +175,7 @@ class NullableVector : public NullableVectorBase {
 
   // Sets the value at |idx| to the given |val|.
   void Set(uint32_t idx, T val) {
+    mutations_++;
     if (mode_ == Mode::kDense) {
       if (!valid_.Contains(idx)) {
         valid_.Insert(idx);
@@ -64,3 +64,36 @@ static void BM_NullableVectorGetNonNull(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_NullableVectorGetNonNull);
+
+static void BM_NullableVectorFilterNonNullPerRow(benchmark::State& state) {
+  perfetto::trace_processor::NullableVector<int64_t> sv;
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  for (uint32_t i = 0; i < kSize; ++i) {
+    sv.Append(static_cast<int64_t>(rnd_engine() % 1000));
+  }
+
+  // Mirrors how Column filters without batching: one lookup and comparision
+  // per row.
+  for (auto _ : state) {
+    auto bv = perfetto::trace_processor::BitVector::Range(
+        0, kSize, [&sv](uint32_t i) { return sv.GetNonNull(i) < 500; });
+    benchmark::DoNotOptimize(bv);
+  }
+}
+BENCHMARK(BM_NullableVectorFilterNonNullPerRow);
+
+static void BM_NullableVectorFilterNonNullBatched(benchmark::State& state) {
+  perfetto::trace_processor::NullableVector<int64_t> sv;
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  for (uint32_t i = 0; i < kSize; ++i) {
+    sv.Append(static_cast<int64_t>(rnd_engine() % 1000));
+  }
+
+  for (auto _ : state) {
+    auto bv = sv.FilterNonNull(0, kSize, [](int64_t v) { return v < 500; });
+    benchmark::DoNotOptimize(bv);
+  }
+}
+BENCHMARK(BM_NullableVectorFilterNonNullBatched);
@@ -98,6 +98,17 @@ TEST(NullableVector, Dense) {
   ASSERT_EQ(sv.GetNonNull(2), 2);
 }
 
+TEST(NullableVector, FilterNonNull) {
+  NullableVector<int64_t> sv;
+  for (int64_t i = 0; i < 1000; ++i)
+    sv.Append(i % 7);
+
+  BitVector bv = sv.FilterNonNull(10, 1000, [](int64_t v) { return v < 3; });
+  ASSERT_EQ(bv.size(), 1000u);
+  for (uint32_t i = 0; i < 1000; ++i)
+    ASSERT_EQ(bv.IsSet(i), i >= 10 && i % 7 < 3);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
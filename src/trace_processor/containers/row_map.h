@@ -516,6 +516,19 @@ class RowMap {
   // Returns if the RowMap is internally represented using a range.
   bool IsRange() const { return mode_ == Mode::kRange; }
 
+  // Returns an approximation of the heap memory used by this RowMap.
+  size_t ApproxBytesUsed() const {
+    switch (mode_) {
+      case Mode::kRange:
+        return 0;
+      case Mode::kBitVector:
+        return bit_vector_.size() / 8;
+      case Mode::kIndexVector:
+        return index_vector_.size() * sizeof(uint32_t);
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
  private:
   enum class Mode {
     kRange,
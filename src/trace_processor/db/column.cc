@@ -16,12 +16,168 @@
 
 #include "src/trace_processor/db/column.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
 #include "src/trace_processor/db/compare.h"
 #include "src/trace_processor/db/table.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+
+// Columns with fewer rows than this are cheap enough to scan that an index is
+// not worth its memory.
+constexpr uint32_t kMinRowsForIndex = 1024;
+
+// The number of filters which could use an index before we decide to build
+// one. Building the index costs O(n log n) so avoid doing it for columns which
+// are only filtered once.
+constexpr uint32_t kFiltersBeforeIndexing = 2;
+
+// Returns whether |v| is NaN; always false for integer types.
+template <typename T>
+bool IsNaN(T v) {
+  return std::isnan(static_cast<double>(v));
+}
+
+// Compares |v| against the numeric |value|. |value| is required to have the
+// same SqlValue type as the column (i.e. kDouble for double columns, kLong
+// otherwise).
+template <typename T>
+int CompareNumeric(T v, const SqlValue& value) {
+  // We static cast here as this code will be compiled for all T but only one
+  // of the branches is taken for any given type.
+  if (std::is_same<T, double>::value)
+    return compare::Numeric(static_cast<double>(v), value.double_value);
+  return compare::Numeric(static_cast<int64_t>(v), value.long_value);
+}
+
+// Filters with fewer rows than this are not worth batching as the benefit is
+// dwarfed by the cost of allocating the BitVector for the whole range.
+constexpr uint32_t kMinRowsForBatchedFilter = 1024;
+
+// Returns a BitVector where the bits in [start, end) are set iff the value at
+// that index of |nv| satisfies |op| when compared with |value|. The value is
+// cast to |C| before comparing.
+//
+// Note: the comparisions below are written in terms of < and > to exactly
+// match the semantics of compare::Numeric (e.g. for NaN).
+template <typename T, typename C>
+BitVector FilterNonNullWithOp(const NullableVector<T>& nv,
+                              uint32_t start,
+                              uint32_t end,
+                              FilterOp op,
+                              C value) {
+  switch (op) {
+    case FilterOp::kEq:
+      return nv.FilterNonNull(start, end, [value](T v) {
+        C c = static_cast<C>(v);
+        return !(c < value) && !(c > value);
+      });
+    case FilterOp::kNe:
+      return nv.FilterNonNull(start, end, [value](T v) {
+        C c = static_cast<C>(v);
+        return c < value || c > value;
+      });
+    case FilterOp::kLt:
+      return nv.FilterNonNull(
+          start, end, [value](T v) { return static_cast<C>(v) < value; });
+    case FilterOp::kLe:
+      return nv.FilterNonNull(
+          start, end, [value](T v) { return !(static_cast<C>(v) > value); });
+    case FilterOp::kGt:
+      return nv.FilterNonNull(
+          start, end, [value](T v) { return static_cast<C>(v) > value; });
+    case FilterOp::kGe:
+      return nv.FilterNonNull(
+          start, end, [value](T v) { return !(static_cast<C>(v) < value); });
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      PERFETTO_FATAL("Should be handled by caller");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace
+
+Column::SortedIndexCache::SortedIndexCache() = default;
+Column::SortedIndexCache::~SortedIndexCache() = default;
+
+Column::SortedIndexCache::SortedIndexCache(SortedIndexCache&& other) noexcept {
+  *this = std::move(other);
+}
+
+Column::SortedIndexCache& Column::SortedIndexCache::operator=(
+    SortedIndexCache&& other) noexcept {
+  max_indexes_ = other.max_indexes_;
+  max_bytes_ = other.max_bytes_;
+  entries_ = std::move(other.entries_);
+  bytes_used_ = other.bytes_used_;
+  other.entries_.clear();
+  other.bytes_used_ = 0;
+  return *this;
+}
+
+void Column::SortedIndexCache::SetLimits(size_t max_indexes,
+                                         size_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_indexes_ = max_indexes;
+  max_bytes_ = max_bytes;
+  Evict();
+}
+
+bool Column::SortedIndexCache::Fits(size_t bytes) const {
+  return max_indexes_ > 0 && bytes <= max_bytes_;
+}
+
+void Column::SortedIndexCache::Touch(const SortedIndex* index) {
+  auto it = Find(index);
+  if (it != entries_.end())
+    entries_.splice(entries_.begin(), entries_, it);
+}
+
+void Column::SortedIndexCache::Insert(std::shared_ptr<const SortedIndex> index,
+                                      const SortedIndex* replaced) {
+  auto it = Find(replaced);
+  if (it != entries_.end())
+    Erase(it);
+
+  bytes_used_ += Bytes(*index);
+  entries_.emplace_front(std::move(index));
+  Evict();
+}
+
+size_t Column::SortedIndexCache::Bytes(const SortedIndex& index) {
+  return sizeof(index) + (index.indices.capacity() +
+                          index.nan_indices.capacity()) *
+                             sizeof(uint32_t);
+}
+
+Column::SortedIndexCache::Entries::iterator Column::SortedIndexCache::Find(
+    const SortedIndex* index) {
+  return std::find_if(entries_.begin(), entries_.end(),
+                      [index](const std::shared_ptr<const SortedIndex>& entry) {
+                        return entry.get() == index;
+                      });
+}
+
+void Column::SortedIndexCache::Evict() {
+  while (entries_.size() > max_indexes_ || bytes_used_ > max_bytes_)
+    Erase(std::prev(entries_.end()));
+}
+
+void Column::SortedIndexCache::Erase(Entries::iterator it) {
+  PERFETTO_DCHECK(bytes_used_ >= Bytes(**it));
+  bytes_used_ -= Bytes(**it);
+  entries_.erase(it);
+}
+
+constexpr size_t Column::kDefaultMaxSortedIndexes;
+constexpr size_t Column::kDefaultMaxSortedIndexBytes;
+
 Column::Column(const Column& column,
                Table* table,
                uint32_t col_idx,
@@ -95,6 +251,260 @@ void Column::StableSort(bool desc, std::vector<uint32_t>* idx) const {
   }
 }
 
+bool Column::FilterIntoIndexed(FilterOp op, SqlValue value, RowMap* rm) const {
+  switch (op) {
+    case FilterOp::kEq:
+    case FilterOp::kLt:
+    case FilterOp::kLe:
+    case FilterOp::kGt:
+    case FilterOp::kGe:
+      break;
+    case FilterOp::kNe:
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      return false;
+  }
+  switch (type_) {
+    case ColumnType::kInt32:
+    case ColumnType::kUint32:
+    case ColumnType::kInt64:
+    case ColumnType::kDouble:
+      break;
+    case ColumnType::kString:
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      return false;
+  }
+  if (value.type != type())
+    return false;
+
+  // The index is in terms of indices into the storage; we can only cheaply
+  // translate them to rows if the RowMap is a range. This is always the case
+  // for the tables in TraceStorage which are the ones filtered repeatedly.
+  const RowMap& col_rm = row_map();
+  if (!col_rm.IsRange() || col_rm.size() < kMinRowsForIndex)
+    return false;
+
+  SortedIndexCache* cache = sorted_index_cache();
+  if (!cache)
+    return false;
+
+  std::shared_ptr<const SortedIndex> index = GetSortedIndex();
+  if (index) {
+    std::lock_guard<std::mutex> lock(cache->mutex_);
+    cache->Touch(index.get());
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(cache->mutex_);
+      if (++index_miss_count_ < kFiltersBeforeIndexing)
+        return false;
+      index_miss_count_ = 0;
+    }
+    switch (type_) {
+      case ColumnType::kInt32:
+        index = BuildSortedIndex<int32_t>(cache);
+        break;
+      case ColumnType::kUint32:
+        index = BuildSortedIndex<uint32_t>(cache);
+        break;
+      case ColumnType::kInt64:
+        index = BuildSortedIndex<int64_t>(cache);
+        break;
+      case ColumnType::kDouble:
+        index = BuildSortedIndex<double>(cache);
+        break;
+      case ColumnType::kString:
+      case ColumnType::kId:
+      case ColumnType::kDummy:
+        PERFETTO_FATAL("Should be handled above");
+    }
+    if (!index)
+      return false;
+
+    std::lock_guard<std::mutex> lock(cache->mutex_);
+    cache->Insert(index, sorted_index_.lock().get());
+    sorted_index_ = index;
+  }
+
+  switch (type_) {
+    case ColumnType::kInt32:
+      FilterIntoIndexedNumeric<int32_t>(*index, op, value, rm);
+      break;
+    case ColumnType::kUint32:
+      FilterIntoIndexedNumeric<uint32_t>(*index, op, value, rm);
+      break;
+    case ColumnType::kInt64:
+      FilterIntoIndexedNumeric<int64_t>(*index, op, value, rm);
+      break;
+    case ColumnType::kDouble:
+      FilterIntoIndexedNumeric<double>(*index, op, value, rm);
+      break;
+    case ColumnType::kString:
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Should be handled above");
+  }
+  return true;
+}
+
+std::shared_ptr<const Column::SortedIndex> Column::GetSortedIndex() const {
+  SortedIndexCache* cache = sorted_index_cache();
+  if (!cache)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(cache->mutex_);
+  std::shared_ptr<const SortedIndex> index = sorted_index_.lock();
+  if (!index || index->mutations != mutations())
+    return nullptr;
+  return index;
+}
+
+Column::SortedIndexCache* Column::sorted_index_cache() const {
+  return table_ ? &table_->sorted_indexes_ : nullptr;
+}
+
+template <typename T>
+std::shared_ptr<const Column::SortedIndex> Column::BuildSortedIndex(
+    SortedIndexCache* cache) const {
+  const auto& nv = nullable_vector<T>();
+  {
+    // Don't bother building an index which would be evicted straight away.
+    std::lock_guard<std::mutex> lock(cache->mutex_);
+    size_t bytes = sizeof(SortedIndex) + nv.size() * sizeof(uint32_t);
+    if (!cache->Fits(bytes))
+      return nullptr;
+  }
+
+  std::shared_ptr<SortedIndex> index(new SortedIndex());
+  index->mutations = nv.mutations();
+
+  // NaN is neither smaller nor greater than any value, so sorting it together
+  // with the other values would break the strict weak ordering required by
+  // std::stable_sort (and by the binary searches on the index). Keep it apart.
+  std::vector<uint32_t>& indices = index->indices;
+  indices.reserve(nv.size());
+  const bool is_nullable = IsNullable();
+  for (uint32_t i = 0; i < nv.size(); ++i) {
+    base::Optional<T> v = is_nullable ? nv.Get(i) : nv.GetNonNull(i);
+    if (!v.has_value())
+      continue;
+    if (IsNaN(*v)) {
+      index->nan_indices.push_back(i);
+    } else {
+      indices.push_back(i);
+    }
+  }
+  auto value_at = [&nv, is_nullable](uint32_t idx) {
+    return is_nullable ? *nv.Get(idx) : nv.GetNonNull(idx);
+  };
+  std::stable_sort(indices.begin(), indices.end(),
+                   [&value_at](uint32_t a, uint32_t b) {
+                     return compare::Numeric(value_at(a), value_at(b)) < 0;
+                   });
+  return index;
+}
+
+template <typename T>
+void Column::FilterIntoIndexedNumeric(const SortedIndex& index,
+                                      FilterOp op,
+                                      SqlValue value,
+                                      RowMap* rm) const {
+  PERFETTO_DCHECK(index.mutations == mutations());
+  PERFETTO_DCHECK(type_ == ToColumnType<T>());
+
+  const auto& nv = nullable_vector<T>();
+  const bool is_nullable = IsNullable();
+  auto cmp = [&nv, is_nullable, &value](uint32_t idx) {
+    T v = is_nullable ? *nv.Get(idx) : nv.GetNonNull(idx);
+    return CompareNumeric(v, value);
+  };
+
+  // Find the slice of the index which matches the constraint.
+  const std::vector<uint32_t>& indices = index.indices;
+  auto lower = std::lower_bound(
+      indices.begin(), indices.end(), value,
+      [&cmp](uint32_t idx, const SqlValue&) { return cmp(idx) < 0; });
+  auto upper = std::upper_bound(
+      lower, indices.end(), value,
+      [&cmp](const SqlValue&, uint32_t idx) { return cmp(idx) > 0; });
+
+  std::vector<uint32_t>::const_iterator begin;
+  std::vector<uint32_t>::const_iterator end;
+  switch (op) {
+    case FilterOp::kEq:
+      begin = lower;
+      end = upper;
+      break;
+    case FilterOp::kLt:
+      begin = indices.begin();
+      end = lower;
+      break;
+    case FilterOp::kLe:
+      begin = indices.begin();
+      end = upper;
+      break;
+    case FilterOp::kGt:
+      begin = upper;
+      end = indices.end();
+      break;
+    case FilterOp::kGe:
+      begin = lower;
+      end = indices.end();
+      break;
+    case FilterOp::kNe:
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      PERFETTO_FATAL("Should be handled by FilterIntoIndexed");
+  }
+
+  // compare::Numeric considers NaN equal to any value: like the full scan,
+  // match NaN for the ops which accept equal values.
+  const bool match_nans =
+      op == FilterOp::kEq || op == FilterOp::kLe || op == FilterOp::kGe;
+  const std::vector<uint32_t>& nans = index.nan_indices;
+  auto nans_end = match_nans ? nans.end() : nans.begin();
+
+  // Translate the storage indices into rows of this column.
+  const RowMap& col_rm = row_map();
+  PERFETTO_DCHECK(col_rm.IsRange());
+  const uint32_t row_count = col_rm.size();
+  const uint32_t start_idx = row_count == 0 ? 0 : col_rm.Get(0);
+  const uint32_t end_idx = start_idx + row_count;
+  const size_t match_count =
+      static_cast<size_t>(std::distance(begin, end)) +
+      static_cast<size_t>(std::distance(nans.begin(), nans_end));
+
+  // When only a few rows match and we're the first constraint (i.e. |rm| is
+  // still a range), avoid touching every row: just sort the matching rows.
+  // Otherwise, go through a BitVector which doesn't need any sorting.
+  if (rm->IsRange() && match_count < row_count / 32) {
+    const uint32_t rm_start = rm->empty() ? 0 : rm->Get(0);
+    const uint32_t rm_end = rm_start + rm->size();
+    std::vector<uint32_t> rows;
+    rows.reserve(match_count);
+    auto add_row = [&](uint32_t idx) {
+      if (idx < start_idx || idx >= end_idx)
+        return;
+      uint32_t row = idx - start_idx;
+      if (row >= rm_start && row < rm_end)
+        rows.push_back(row);
+    };
+    std::for_each(begin, end, add_row);
+    std::for_each(nans.begin(), nans_end, add_row);
+    std::sort(rows.begin(), rows.end());
+    *rm = RowMap(std::move(rows));
+    return;
+  }
+
+  BitVector bv(row_count, false);
+  auto set_row = [&](uint32_t idx) {
+    if (idx >= start_idx && idx < end_idx)
+      bv.Set(idx - start_idx);
+  };
+  std::for_each(begin, end, set_row);
+  std::for_each(nans.begin(), nans_end, set_row);
+  rm->Intersect(RowMap(std::move(bv)));
+}
+
 void Column::FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const {
   switch (type_) {
     case ColumnType::kInt32: {
@@ -170,6 +580,9 @@ void Column::FilterIntoNumericSlow(FilterOp op,
     return;
   }
 
+  if (!is_nullable && FilterIntoNumericBatched<T>(op, value, rm))
+    return;
+
   if (value.type == SqlValue::Type::kDouble) {
     double double_value = value.double_value;
     if (std::is_same<T, double>::value) {
@@ -214,6 +627,41 @@ void Column::FilterIntoNumericSlow(FilterOp op,
   }
 }
 
+template <typename T>
+bool Column::FilterIntoNumericBatched(FilterOp op,
+                                      SqlValue value,
+                                      RowMap* rm) const {
+  PERFETTO_DCHECK(!IsNullable());
+  PERFETTO_DCHECK(op != FilterOp::kIsNull && op != FilterOp::kIsNotNull);
+
+  // Batching requires the values for the rows being filtered to be stored
+  // contiguously in the NullableVector; this is the case for sparse (i.e. the
+  // default) vectors when the column's RowMap is a range starting at zero.
+  const auto& nv = nullable_vector<T>();
+  if (nv.IsDense() || !row_map().IsRange() || row_map().empty() ||
+      row_map().Get(0) != 0) {
+    return false;
+  }
+  if (!rm->IsRange() || rm->size() < kMinRowsForBatchedFilter)
+    return false;
+
+  // Mixed comparisions between doubles and longs need to be done using
+  // compare::LongToDouble: leave those to the slow path.
+  bool is_double = std::is_same<T, double>::value;
+  SqlValue::Type expected = is_double ? SqlValue::kDouble : SqlValue::kLong;
+  if (value.type != expected)
+    return false;
+
+  uint32_t start = rm->Get(0);
+  uint32_t end = start + rm->size();
+  BitVector bv =
+      is_double
+          ? FilterNonNullWithOp(nv, start, end, op, value.double_value)
+          : FilterNonNullWithOp(nv, start, end, op, value.long_value);
+  rm->Intersect(RowMap(std::move(bv)));
+  return true;
+}
+
 template <typename T, bool is_nullable, typename Comparator>
 void Column::FilterIntoNumericWithComparatorSlow(FilterOp op,
                                                  RowMap* rm,
@@ -17,8 +17,14 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_H_
 #define SRC_TRACE_PROCESSOR_DB_COLUMN_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/trace_processor/basic_types.h"
@@ -107,6 +113,72 @@ class Column {
     kDense = 1 << 3,
   };
 
+  // Limits on the number and on the total size of the sorted indexes kept
+  // alive across all the columns of a table (see |FilterIntoIndexed|).
+  static constexpr size_t kDefaultMaxSortedIndexes = 64;
+  static constexpr size_t kDefaultMaxSortedIndexBytes = 128 * 1024 * 1024;
+
+ private:
+  struct SortedIndex;
+
+ public:
+  // Owns the sorted indexes of the columns of a Table, so that they are freed
+  // together with it, and bounds their number and total size. As in
+  // QueryCache, the least recently used indexes are evicted once either limit
+  // is exceeded. Columns only keep a weak reference to their index.
+  class SortedIndexCache {
+   public:
+    SortedIndexCache();
+    ~SortedIndexCache();
+
+    // Moves the indexes but not the mutex. Only used when the owning Table is
+    // moved, which never happens while it is being filtered.
+    SortedIndexCache(SortedIndexCache&&) noexcept;
+    SortedIndexCache& operator=(SortedIndexCache&&) noexcept;
+
+    // Changes the limits, evicting indexes if they are now exceeded.
+    void SetLimits(size_t max_indexes, size_t max_bytes);
+
+   private:
+    friend class Column;
+
+    using Entries = std::list<std::shared_ptr<const SortedIndex>>;
+
+    // All the methods below must be called with |mutex_| held.
+
+    // Returns whether an index of |bytes| bytes can be cached at all.
+    bool Fits(size_t bytes) const;
+
+    // Moves |index| to the front of the LRU list.
+    void Touch(const SortedIndex* index);
+
+    // Adds |index| as the most recently used index, dropping |replaced| (the
+    // previous index of the same column, if any) and evicting indexes until
+    // the cache is back within its limits.
+    void Insert(std::shared_ptr<const SortedIndex> index,
+                const SortedIndex* replaced);
+
+    static size_t Bytes(const SortedIndex& index);
+
+    Entries::iterator Find(const SortedIndex* index);
+    void Evict();
+    void Erase(Entries::iterator it);
+
+    // Guards the indexes and the index state of the columns of the table
+    // (|sorted_index_| and |index_miss_count_|) as const tables can be
+    // filtered from multiple threads at the same time (see
+    // TraceProcessor::ExecuteReadOnlyQuery). It's only held to read or swap
+    // index pointers: indexes are built without holding it.
+    std::mutex mutex_;
+
+    size_t max_indexes_ = kDefaultMaxSortedIndexes;
+    size_t max_bytes_ = kDefaultMaxSortedIndexBytes;
+
+    // Ordered from most to least recently used.
+    Entries entries_;
+    size_t bytes_used_ = 0;
+  };
+
   // Iterator over a column which conforms to std iterator interface
   // to allow using std algorithms (e.g. upper_bound, lower_bound etc.).
   class Iterator {
@@ -300,9 +372,23 @@ class Column {
         return;
     }
 
+    if (!IsSorted() && FilterIntoIndexed(op, value, rm))
+      return;
+
     FilterIntoSlow(op, value, rm);
   }
 
+  // Returns true if this column has an up-to-date sorted index which will be
+  // used to speed up filters (see |FilterIntoIndexed|).
+  bool HasSortedIndex() const { return GetSortedIndex() != nullptr; }
+
+  // Returns the number of times values in this column have been appended or
+  // changed. Can be used to detect that data derived from this column is
+  // stale. Always returns 0 for id and dummy columns.
+  uint64_t mutations() const {
+    return nullable_vector_ ? nullable_vector_->mutations() : 0;
+  }
+
   // Returns the minimum value in this column. Returns nullopt if this column
   // is empty.
   base::Optional<SqlValue> Min() const {
@@ -538,6 +624,33 @@ class Column {
     return false;
   }
 
+  // Filter method for unsorted numeric columns which uses a sorted index of
+  // the column's values to avoid a full table scan. The index is built lazily
+  // once the column has been filtered on a few times and is rebuilt if the
+  // data in the column changes.
+  // Returns whether the constraint was handled by the method.
+  bool FilterIntoIndexed(FilterOp op, SqlValue value, RowMap* rm) const;
+
+  // Filters using |index| for a numeric column of type |T|.
+  template <typename T>
+  void FilterIntoIndexedNumeric(const SortedIndex& index,
+                                FilterOp op,
+                                SqlValue value,
+                                RowMap* rm) const;
+
+  // Builds a sorted index for a numeric column of type |T|. Returns nullptr if
+  // the index would be too large to be kept alive by |cache|.
+  template <typename T>
+  std::shared_ptr<const SortedIndex> BuildSortedIndex(
+      SortedIndexCache* cache) const;
+
+  // Returns |sorted_index_| if it's up-to-date or nullptr otherwise.
+  std::shared_ptr<const SortedIndex> GetSortedIndex() const;
+
+  // Returns the cache owning the sorted indexes of the table of this column or
+  // nullptr if this column doesn't belong to a table.
+  SortedIndexCache* sorted_index_cache() const;
+
   // Slow path filter method which will perform a full table scan.
   void FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const;
 
@@ -545,6 +658,12 @@ class Column {
   template <typename T, bool is_nullable>
   void FilterIntoNumericSlow(FilterOp op, SqlValue value, RowMap* rm) const;
 
+  // Filter method for non-null numerics which compares values in batches
+  // instead of one row at a time (see NullableVector::FilterNonNull). Returns
+  // false without modifying |rm| if the filter cannot be done this way.
+  template <typename T>
+  bool FilterIntoNumericBatched(FilterOp op, SqlValue value, RowMap* rm) const;
+
   // Slow path filter method for numerics with a comparator which will perform a
   // full table scan.
   template <typename T, bool is_nullable, typename Comparator = int(T)>
@@ -623,6 +742,33 @@ class Column {
   uint32_t col_idx_in_table_ = 0;
   uint32_t row_map_idx_ = 0;
   const StringPool* string_pool_ = nullptr;
+
+  // Index over the values of a column which is not sorted.
+  struct SortedIndex {
+    // The value of NullableVectorBase::mutations() when the index was built.
+    uint64_t mutations;
+
+    // The storage indices of all the non-null, non-NaN values in the column,
+    // stably sorted by value.
+    std::vector<uint32_t> indices;
+
+    // The storage indices of the NaN values in the column (only for double
+    // columns), in increasing order. They are kept out of |indices| as NaN
+    // can't be ordered: compare::Numeric considers it equal to any value.
+    std::vector<uint32_t> nan_indices;
+  };
+
+  // Lazily built by |FilterIntoIndexed|; not carried over to copies of this
+  // column as those are usually associated with a filtered table.
+  // The index is owned by the SortedIndexCache of |table_|, which bounds the
+  // memory used by the indexes of the table: it is rebuilt if it was evicted
+  // and is needed again.
+  // Guarded, together with |index_miss_count_|, by the mutex of that cache.
+  mutable std::weak_ptr<const SortedIndex> sorted_index_;
+
+  // The number of filters which could have used |sorted_index_| since it
+  // was last found to be missing or stale.
+  mutable uint32_t index_miss_count_ = 0;
 };
 
 }  // namespace trace_processor
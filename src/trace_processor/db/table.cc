@@ -43,6 +43,7 @@ Table& Table::operator=(Table&& other) noexcept {
   for (Column& col : columns_) {
     col.table_ = this;
   }
+  sorted_indexes_ = std::move(other.sorted_indexes_);
   return *this;
 }
 
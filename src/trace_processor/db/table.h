@@ -201,6 +201,12 @@ class Table {
   uint32_t row_count() const { return row_count_; }
   const std::vector<RowMap>& row_maps() const { return row_maps_; }
 
+  // Changes the limits on the sorted indexes of the columns of this table,
+  // evicting indexes if they are now exceeded.
+  void SetSortedIndexLimitsForTesting(size_t max_indexes, size_t max_bytes) {
+    sorted_indexes_.SetLimits(max_indexes, max_bytes);
+  }
+
  protected:
   Table(StringPool* pool, const Table* parent);
 
@@ -214,6 +220,10 @@ class Table {
   friend class Column;
 
   Table CopyExceptRowMaps() const;
+
+  // The sorted indexes of the columns of this table, built lazily when they
+  // are filtered (see Column::FilterIntoIndexed).
+  mutable Column::SortedIndexCache sorted_indexes_;
 };
 
 }  // namespace trace_processor
@@ -15,6 +15,9 @@
  */
 
 #include "src/trace_processor/db/table.h"
+
+#include <limits>
+
 #include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/db/typed_column.h"
 #include "src/trace_processor/tables/macros.h"
@@ -48,6 +51,36 @@ PERFETTO_TP_TABLE(PERFETTO_TP_TEST_EVENT_TABLE_DEF);
 
 TestEventTable::~TestEventTable() = default;
 
+#define PERFETTO_TP_TEST_COUNTER_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCounterTable, "counter")                         \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)              \
+  C(int64_t, track_id)                                      \
+  C(base::Optional<double>, value)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_COUNTER_TABLE_DEF);
+
+TestCounterTable::~TestCounterTable() = default;
+
+#define PERFETTO_TP_TEST_NUMERIC_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestNumericTable, "numeric")                         \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)              \
+  C(int32_t, i32)                                           \
+  C(uint32_t, u32)                                          \
+  C(int64_t, i64)                                           \
+  C(double, dbl)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_NUMERIC_TABLE_DEF);
+
+TestNumericTable::~TestNumericTable() = default;
+
+// Returns the rows of |table| after filtering it with |cs|.
+std::vector<uint32_t> FilteredRows(const Table& table,
+                                   const std::vector<Constraint>& cs) {
+  RowMap rm = table.FilterToRowMap(cs);
+  std::vector<uint32_t> rows;
+  for (auto it = rm.IterateRows(); it; it.Next())
+    rows.push_back(it.index());
+  return rows;
+}
+
 TEST(TableTest, ExtendingTableTwice) {
   StringPool pool;
   TestEventTable table{&pool, nullptr};
@@ -65,6 +98,336 @@ TEST(TableTest, ExtendingTableTwice) {
   ASSERT_TRUE(filtered_table.GetColumnByName("b")->Max().has_value());
 }
 
+TEST(TableTest, IndexedFilterMatchesScan) {
+  StringPool pool;
+  TestCounterTable table{&pool, nullptr};
+
+  constexpr uint32_t kRows = 4096;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestCounterTable::Row row;
+    row.track_id = (i * 7919) % 97;
+    if (i % 3 != 0)
+      row.value = static_cast<double>(i % 50) / 2;
+    table.Insert(row);
+  }
+
+  const auto& track_id = table.track_id();
+  const auto& value = table.value();
+  std::vector<std::vector<Constraint>> queries = {
+      {track_id.eq(5)},
+      {track_id.lt(3)},
+      {track_id.le(3)},
+      {track_id.gt(90)},
+      {track_id.ge(90)},
+      {value.eq(2.5)},
+      {value.gt(20.0)},
+      {value.le(0.5), track_id.ge(50)},
+      {track_id.ge(50), value.le(0.5)},
+  };
+
+  // The first filter on each column scans, afterwards the index is used.
+  std::vector<std::vector<uint32_t>> expected;
+  for (const auto& cs : queries)
+    expected.push_back(FilteredRows(table, cs));
+  ASSERT_TRUE(track_id.HasSortedIndex());
+  ASSERT_TRUE(value.HasSortedIndex());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    ASSERT_EQ(FilteredRows(table, queries[i]), expected[i]);
+
+    std::vector<uint32_t> slow;
+    for (uint32_t row = 0; row < kRows; ++row) {
+      bool matches = true;
+      for (const Constraint& c : queries[i]) {
+        SqlValue v = table.GetColumn(c.col_idx).Get(row);
+        int cmp = v.is_null() ? -1 : compare::SqlValue(v, c.value);
+        switch (c.op) {
+          case FilterOp::kEq:
+            matches &= !v.is_null() && cmp == 0;
+            break;
+          case FilterOp::kLt:
+            matches &= !v.is_null() && cmp < 0;
+            break;
+          case FilterOp::kLe:
+            matches &= !v.is_null() && cmp <= 0;
+            break;
+          case FilterOp::kGt:
+            matches &= !v.is_null() && cmp > 0;
+            break;
+          case FilterOp::kGe:
+            matches &= !v.is_null() && cmp >= 0;
+            break;
+          case FilterOp::kNe:
+          case FilterOp::kIsNull:
+          case FilterOp::kIsNotNull:
+            FAIL();
+        }
+      }
+      if (matches)
+        slow.push_back(row);
+    }
+    ASSERT_EQ(expected[i], slow);
+  }
+}
+
+TEST(TableTest, BatchedFilterMatchesScan) {
+  constexpr uint32_t kRows = 3000;
+  StringPool pool;
+  auto new_table = [&pool]() {
+    std::unique_ptr<TestNumericTable> table(
+        new TestNumericTable(&pool, nullptr));
+    for (uint32_t i = 0; i < kRows; ++i) {
+      TestNumericTable::Row row;
+      row.i32 = static_cast<int32_t>(i % 101) - 50;
+      row.u32 = i % 37;
+      row.i64 = (static_cast<int64_t>(i) % 13) << 33;
+      row.dbl = static_cast<double>(i % 17) / 4;
+      table->Insert(row);
+    }
+    return table;
+  };
+  std::unique_ptr<TestNumericTable> table = new_table();
+
+  // TypedColumn<int32_t> has no typed filter helpers.
+  uint32_t i32 = table->i32().index_in_table();
+  // Every operator on every numeric type.
+  std::vector<Constraint> cs = {
+      Constraint{i32, FilterOp::kEq, SqlValue::Long(-3)},
+      Constraint{i32, FilterOp::kNe, SqlValue::Long(0)},
+      Constraint{i32, FilterOp::kLt, SqlValue::Long(-40)},
+      Constraint{i32, FilterOp::kLe, SqlValue::Long(-40)},
+      Constraint{i32, FilterOp::kGt, SqlValue::Long(45)},
+      Constraint{i32, FilterOp::kGe, SqlValue::Long(45)},
+      table->u32().eq(7),
+      table->u32().ne(7),
+      table->u32().lt(5),
+      table->u32().le(5),
+      table->u32().gt(30),
+      table->u32().ge(30),
+      table->i64().eq(2ll << 33),
+      table->i64().ne(2ll << 33),
+      table->i64().lt(3ll << 33),
+      table->i64().le(3ll << 33),
+      table->i64().gt(8ll << 33),
+      table->i64().ge(8ll << 33),
+      table->dbl().eq(2.0),
+      table->dbl().ne(2.0),
+      table->dbl().lt(1.5),
+      table->dbl().le(1.5),
+      table->dbl().gt(3.75),
+      table->dbl().ge(3.75),
+  };
+
+  for (const Constraint& c : cs) {
+    const auto& col = table->GetColumn(c.col_idx);
+    std::vector<uint32_t> expected;
+    for (uint32_t row = 0; row < kRows; ++row) {
+      int cmp = compare::SqlValue(col.Get(row), c.value);
+      bool matches = false;
+      switch (c.op) {
+        case FilterOp::kEq:
+          matches = cmp == 0;
+          break;
+        case FilterOp::kNe:
+          matches = cmp != 0;
+          break;
+        case FilterOp::kLt:
+          matches = cmp < 0;
+          break;
+        case FilterOp::kLe:
+          matches = cmp <= 0;
+          break;
+        case FilterOp::kGt:
+          matches = cmp > 0;
+          break;
+        case FilterOp::kGe:
+          matches = cmp >= 0;
+          break;
+        case FilterOp::kIsNull:
+        case FilterOp::kIsNotNull:
+          FAIL();
+      }
+      if (matches)
+        expected.push_back(row);
+    }
+
+    // Filter a fresh table each time: filtering the same column again would
+    // build its sorted index and use that instead of scanning. Also filter a
+    // subset of the table to check that the range of rows being filtered is
+    // respected.
+    std::unique_ptr<TestNumericTable> full_table = new_table();
+    const auto& full_col = full_table->GetColumn(c.col_idx);
+    RowMap full(0, kRows);
+    full_col.FilterInto(c.op, c.value, &full);
+    ASSERT_FALSE(full_col.HasSortedIndex());
+
+    std::unique_ptr<TestNumericTable> partial_table = new_table();
+    const auto& partial_col = partial_table->GetColumn(c.col_idx);
+    RowMap partial(100, kRows - 100);
+    partial_col.FilterInto(c.op, c.value, &partial);
+    ASSERT_FALSE(partial_col.HasSortedIndex());
+
+    std::vector<uint32_t> full_rows;
+    for (auto it = full.IterateRows(); it; it.Next())
+      full_rows.push_back(it.index());
+    ASSERT_EQ(full_rows, expected);
+
+    std::vector<uint32_t> partial_rows;
+    for (auto it = partial.IterateRows(); it; it.Next())
+      partial_rows.push_back(it.index());
+    expected.erase(std::remove_if(expected.begin(), expected.end(),
+                                  [](uint32_t row) {
+                                    return row < 100 || row >= kRows - 100;
+                                  }),
+                   expected.end());
+    ASSERT_EQ(partial_rows, expected);
+  }
+}
+
+TEST(TableTest, IndexInvalidatedOnMutation) {
+  StringPool pool;
+  TestCounterTable table{&pool, nullptr};
+
+  constexpr uint32_t kRows = 2048;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestCounterTable::Row row;
+    row.track_id = i % 10;
+    table.Insert(row);
+  }
+
+  std::vector<Constraint> cs{table.track_id().eq(42)};
+  ASSERT_TRUE(FilteredRows(table, cs).empty());
+  ASSERT_TRUE(FilteredRows(table, cs).empty());
+  ASSERT_TRUE(table.track_id().HasSortedIndex());
+
+  TestCounterTable::Row row;
+  row.track_id = 42;
+  table.Insert(row);
+  ASSERT_FALSE(table.track_id().HasSortedIndex());
+  ASSERT_EQ(FilteredRows(table, cs), std::vector<uint32_t>{kRows});
+
+  table.mutable_track_id()->Set(0, 42);
+  ASSERT_FALSE(table.track_id().HasSortedIndex());
+  ASSERT_EQ(FilteredRows(table, cs), (std::vector<uint32_t>{0, kRows}));
+}
+
+TEST(TableTest, IndexesEvictedOverLimits) {
+  StringPool pool;
+  TestNumericTable table{&pool, nullptr};
+
+  constexpr uint32_t kRows = 2000;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestNumericTable::Row row;
+    row.i32 = static_cast<int32_t>(i % 10);
+    row.u32 = i % 10;
+    row.i64 = i % 10;
+    row.dbl = static_cast<double>(i % 10);
+    table.Insert(row);
+  }
+
+  auto index_column = [&table](const trace_processor::Column& col) {
+    SqlValue value = col.type() == SqlValue::Type::kDouble
+                         ? SqlValue::Double(3)
+                         : SqlValue::Long(3);
+    std::vector<Constraint> cs{
+        Constraint{col.index_in_table(), FilterOp::kEq, value}};
+    ASSERT_EQ(FilteredRows(table, cs).size(), kRows / 10);
+    ASSERT_EQ(FilteredRows(table, cs).size(), kRows / 10);
+  };
+
+  // Only keep two indexes alive: indexing a third column evicts the least
+  // recently used index.
+  table.SetSortedIndexLimitsForTesting(2, Column::kDefaultMaxSortedIndexBytes);
+  index_column(table.i32());
+  index_column(table.u32());
+  index_column(table.i32());
+  index_column(table.i64());
+  ASSERT_TRUE(table.i32().HasSortedIndex());
+  ASSERT_FALSE(table.u32().HasSortedIndex());
+  ASSERT_TRUE(table.i64().HasSortedIndex());
+
+  // Indexes which don't fit in the byte limit are never built.
+  table.SetSortedIndexLimitsForTesting(Column::kDefaultMaxSortedIndexes,
+                                       kRows * sizeof(uint32_t));
+  ASSERT_FALSE(table.i32().HasSortedIndex());
+  ASSERT_FALSE(table.i64().HasSortedIndex());
+  index_column(table.dbl());
+  ASSERT_FALSE(table.dbl().HasSortedIndex());
+
+  table.SetSortedIndexLimitsForTesting(Column::kDefaultMaxSortedIndexes,
+                                       Column::kDefaultMaxSortedIndexBytes);
+  index_column(table.dbl());
+  ASSERT_TRUE(table.dbl().HasSortedIndex());
+}
+
+TEST(TableTest, IndexedFilterWithNaNMatchesScan) {
+  constexpr uint32_t kRows = 2000;
+  StringPool pool;
+  auto new_table = [&pool]() {
+    std::unique_ptr<TestNumericTable> table(
+        new TestNumericTable(&pool, nullptr));
+    for (uint32_t i = 0; i < kRows; ++i) {
+      TestNumericTable::Row row;
+      row.dbl = i % 7 == 0 ? std::numeric_limits<double>::quiet_NaN()
+                           : static_cast<double>(i % 10);
+      table->Insert(row);
+    }
+    return table;
+  };
+  std::unique_ptr<TestNumericTable> indexed = new_table();
+  uint32_t dbl = indexed->dbl().index_in_table();
+
+  const double kNaN = std::numeric_limits<double>::quiet_NaN();
+  for (FilterOp op : {FilterOp::kEq, FilterOp::kLt, FilterOp::kLe,
+                      FilterOp::kGt, FilterOp::kGe}) {
+    for (double value : {3.0, kNaN}) {
+      std::vector<Constraint> cs{
+          Constraint{dbl, op, SqlValue::Double(value)}};
+
+      // A fresh table is scanned: a column is only indexed once it has been
+      // filtered a few times.
+      std::unique_ptr<TestNumericTable> scanned = new_table();
+      std::vector<uint32_t> expected = FilteredRows(*scanned, cs);
+      ASSERT_FALSE(scanned->dbl().HasSortedIndex());
+
+      FilteredRows(*indexed, cs);
+      ASSERT_EQ(FilteredRows(*indexed, cs), expected);
+      ASSERT_TRUE(indexed->dbl().HasSortedIndex());
+    }
+  }
+}
+
+TEST(TableTest, IndexesOwnedByTable) {
+  StringPool pool;
+  auto new_table = [&pool]() {
+    std::unique_ptr<TestCounterTable> table(
+        new TestCounterTable(&pool, nullptr));
+    for (uint32_t i = 0; i < 2000; ++i) {
+      TestCounterTable::Row row;
+      row.track_id = i % 10;
+      table->Insert(row);
+    }
+    return table;
+  };
+  std::unique_ptr<TestCounterTable> table = new_table();
+  std::unique_ptr<TestCounterTable> other = new_table();
+
+  // The limits of a table don't affect the indexes of other tables.
+  other->SetSortedIndexLimitsForTesting(0,
+                                        Column::kDefaultMaxSortedIndexBytes);
+  std::vector<Constraint> cs{table->track_id().eq(3)};
+  for (const Table* t : {static_cast<const Table*>(table.get()),
+                         static_cast<const Table*>(other.get())}) {
+    ASSERT_EQ(FilteredRows(*t, cs).size(), 200u);
+    ASSERT_EQ(FilteredRows(*t, cs).size(), 200u);
+  }
+  ASSERT_TRUE(table->track_id().HasSortedIndex());
+  ASSERT_FALSE(other->track_id().HasSortedIndex());
+
+  // The indexes follow the table when it's moved.
+  Table moved = std::move(*table);
+  ASSERT_TRUE(moved.GetColumnByName("track_id")->HasSortedIndex());
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
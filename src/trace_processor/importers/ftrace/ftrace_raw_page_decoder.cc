@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/message.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using protos::pbzero::GenericFtraceEvent;
+using RawFormat = protos::pbzero::FtraceEventBundle::RawFormat;
+
+// See the kernel's include/linux/ring_buffer.h and CpuReader, which decodes
+// the same records on the device.
+constexpr uint32_t kTypeDataTypeLengthMax = 28;
+constexpr uint32_t kTypePadding = 29;
+constexpr uint32_t kTypeTimeExtend = 30;
+constexpr uint32_t kTypeTimeStamp = 31;
+
+// Mask for the data length portion of the |commit| field of the page header.
+// See CpuReader::ParsePageHeader().
+constexpr uint64_t kDataSizeMask = (1ull << 27) - 1;
+
+template <typename T>
+bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
+  if (static_cast<size_t>(end - *ptr) < sizeof(T))
+    return false;
+  memcpy(out, *ptr, sizeof(T));
+  *ptr += sizeof(T);
+  return true;
+}
+
+// Reads a little endian unsigned integer of |size| bytes.
+bool ReadUnsigned(const uint8_t* ptr, uint32_t size, uint64_t* out) {
+  switch (size) {
+    case 1: {
+      uint8_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 2: {
+      uint16_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 4: {
+      uint32_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 8: {
+      uint64_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads a little endian signed integer of |size| bytes, sign extending it.
+bool ReadSigned(const uint8_t* ptr, uint32_t size, int64_t* out) {
+  switch (size) {
+    case 1: {
+      int8_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 2: {
+      int16_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 4: {
+      int32_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+    case 8: {
+      int64_t v;
+      memcpy(&v, ptr, sizeof(v));
+      *out = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+void AppendCString(const uint8_t* start,
+                   size_t max_len,
+                   uint32_t field_id,
+                   protozero::Message* out) {
+  size_t len = strnlen(reinterpret_cast<const char*>(start), max_len);
+  out->AppendBytes(field_id, start, len);
+}
+
+// Same as CpuReader::TranslateBlockDeviceIDToUserspace().
+uint64_t TranslateBlockDeviceIDToUserspace(uint64_t kernel_dev) {
+  uint64_t maj = kernel_dev >> 20;
+  uint64_t min = kernel_dev & ((1U << 20) - 1);
+  return ((maj & 0xfffff000ULL) << 32) | ((maj & 0xfffULL) << 8) |
+         ((min & 0xffffff00ULL) << 12) | ((min & 0xffULL));
+}
+
+}  // namespace
+
+FtraceRawPageDecoder::FtraceRawPageDecoder() = default;
+FtraceRawPageDecoder::~FtraceRawPageDecoder() = default;
+
+void FtraceRawPageDecoder::SetFormat(protozero::ConstBytes raw_format) {
+  RawFormat::Decoder decoder(raw_format);
+
+  auto parse_field = [](protozero::ConstBytes bytes) {
+    RawFormat::Field::Decoder field_decoder(bytes);
+    Field field;
+    field.name = field_decoder.name().ToStdString();
+    field.offset = field_decoder.offset();
+    field.size = field_decoder.size();
+    field.type = field_decoder.type();
+    field.proto_field_id = field_decoder.proto_field_id();
+    return field;
+  };
+
+  page_header_size_len_ = decoder.page_header_size_len();
+  common_fields_.clear();
+  for (auto it = decoder.common_field(); it; ++it)
+    common_fields_.push_back(parse_field(*it));
+
+  events_.Clear();
+  for (auto it = decoder.event(); it; ++it) {
+    RawFormat::Event::Decoder event_decoder(*it);
+    Event event;
+    event.name = event_decoder.name().ToStdString();
+    event.proto_field_id = event_decoder.proto_field_id();
+    event.size = event_decoder.size();
+    for (auto field_it = event_decoder.field(); field_it; ++field_it)
+      event.fields.push_back(parse_field(*field_it));
+    events_[event_decoder.id()] = std::move(event);
+  }
+}
+
+bool FtraceRawPageDecoder::DecodePage(
+    protozero::ConstBytes page,
+    protos::pbzero::FtraceEventBundle* bundle) const {
+  PERFETTO_DCHECK(has_format());
+  const uint8_t* ptr = page.data;
+  const uint8_t* const page_end = page.data + page.size;
+
+  // The page header: a timestamp, followed by the |commit| field, with the
+  // size of the data in its bottom bits.
+  uint64_t timestamp = 0;
+  uint32_t size_and_flags = 0;
+  if (!ReadAndAdvance(&ptr, page_end, &timestamp) ||
+      !ReadAndAdvance(&ptr, page_end, &size_and_flags)) {
+    return false;
+  }
+  if (page_header_size_len_ < 4 ||
+      static_cast<size_t>(page_end - ptr) < page_header_size_len_ - 4) {
+    return false;
+  }
+  ptr += page_header_size_len_ - 4;
+
+  const uint64_t data_size = size_and_flags & kDataSizeMask;
+  if (data_size > static_cast<size_t>(page_end - ptr))
+    return false;
+  const uint8_t* const end = ptr + data_size;
+
+  while (ptr < end) {
+    uint32_t event_header = 0;
+    if (!ReadAndAdvance(&ptr, end, &event_header))
+      return false;
+    // The bottom 5 bits are the type or length, the top 27 the time delta.
+    const uint32_t type_or_length = event_header & 0x1f;
+    const uint32_t time_delta = event_header >> 5;
+    timestamp += time_delta;
+
+    switch (type_or_length) {
+      case kTypePadding: {
+        // Left over page padding or discarded event.
+        uint32_t length = 0;
+        if (time_delta == 0 || !ReadAndAdvance(&ptr, end, &length) ||
+            length < 4 || length - 4 > static_cast<size_t>(end - ptr)) {
+          return false;
+        }
+        ptr += length - 4;
+        break;
+      }
+      case kTypeTimeExtend: {
+        uint32_t time_delta_ext = 0;
+        if (!ReadAndAdvance(&ptr, end, &time_delta_ext))
+          return false;
+        timestamp += static_cast<uint64_t>(time_delta_ext) << 27;
+        break;
+      }
+      case kTypeTimeStamp: {
+        // Absolute timestamp, with the 4.17+ layout (see CpuReader).
+        uint32_t time_delta_ext = 0;
+        if (!ReadAndAdvance(&ptr, end, &time_delta_ext))
+          return false;
+        timestamp = time_delta + (static_cast<uint64_t>(time_delta_ext) << 27);
+        break;
+      }
+      default: {
+        PERFETTO_DCHECK(type_or_length <= kTypeDataTypeLengthMax);
+        // Data record. If the length is 0, the size of the record is in the
+        // first word of the payload, and includes the word itself.
+        uint32_t event_size = 0;
+        if (type_or_length == 0) {
+          if (!ReadAndAdvance(&ptr, end, &event_size) || event_size < 4)
+            return false;
+          event_size -= 4;
+        } else {
+          event_size = 4 * type_or_length;
+        }
+        if (event_size > static_cast<size_t>(end - ptr))
+          return false;
+        const uint8_t* const event_start = ptr;
+        const uint8_t* const event_end = ptr + event_size;
+
+        uint16_t ftrace_event_id = 0;
+        if (!ReadAndAdvance(&ptr, event_end, &ftrace_event_id))
+          return false;
+
+        // Events without a format weren't enabled by the data source. Pages
+        // with such events are normally parsed on the device instead.
+        const Event* event = events_.Find(ftrace_event_id);
+        if (event) {
+          auto* out = bundle->add_event();
+          out->set_timestamp(timestamp);
+          if (!DecodeEvent(*event, event_start, event_end, out))
+            return false;
+        }
+        ptr = event_end;
+      }
+    }
+  }
+  return true;
+}
+
+bool FtraceRawPageDecoder::DecodeEvent(const Event& event,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       protozero::Message* out) const {
+  if (event.size > static_cast<size_t>(end - start))
+    return false;
+
+  bool success = true;
+  for (const Field& field : common_fields_)
+    success &= DecodeField(field, start, end, out);
+
+  protozero::Message* nested =
+      out->BeginNestedMessage<protozero::Message>(event.proto_field_id);
+  if (event.proto_field_id ==
+      protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+    nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber,
+                         event.name);
+    for (const Field& field : event.fields) {
+      auto* generic_field = nested->BeginNestedMessage<protozero::Message>(
+          GenericFtraceEvent::kFieldFieldNumber);
+      generic_field->AppendString(GenericFtraceEvent::Field::kNameFieldNumber,
+                                  field.name);
+      success &= DecodeField(field, start, end, generic_field);
+    }
+  } else {
+    for (const Field& field : event.fields)
+      success &= DecodeField(field, start, end, nested);
+  }
+  out->Finalize();
+  return success;
+}
+
+bool FtraceRawPageDecoder::DecodeField(const Field& field,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       protozero::Message* out) const {
+  const size_t event_size = static_cast<size_t>(end - start);
+  if (field.offset > event_size || field.size > event_size - field.offset)
+    return false;
+  const uint8_t* field_start = start + field.offset;
+  const uint32_t field_id = field.proto_field_id;
+
+  switch (field.type) {
+    case RawFormat::FIELD_TYPE_UINT: {
+      uint64_t value = 0;
+      if (!ReadUnsigned(field_start, field.size, &value))
+        return false;
+      out->AppendVarInt(field_id, value);
+      return true;
+    }
+    case RawFormat::FIELD_TYPE_INT: {
+      int64_t value = 0;
+      if (!ReadSigned(field_start, field.size, &value))
+        return false;
+      out->AppendVarInt(field_id, value);
+      return true;
+    }
+    case RawFormat::FIELD_TYPE_FIXED_CSTRING:
+      AppendCString(field_start, field.size, field_id, out);
+      return true;
+    case RawFormat::FIELD_TYPE_CSTRING:
+      AppendCString(field_start, static_cast<size_t>(end - field_start),
+                    field_id, out);
+      return true;
+    case RawFormat::FIELD_TYPE_DATA_LOC: {
+      uint32_t data = 0;
+      if (field.size != sizeof(data))
+        return false;
+      memcpy(&data, field_start, sizeof(data));
+      const uint16_t offset = data & 0xffff;
+      const uint16_t len = (data >> 16) & 0xffff;
+      if (len == 0)
+        return true;
+      if (offset > event_size || len > event_size - offset)
+        return false;
+      AppendCString(start + offset, len, field_id, out);
+      return true;
+    }
+    case RawFormat::FIELD_TYPE_DEV_ID: {
+      uint64_t kernel_dev = 0;
+      if (!ReadUnsigned(field_start, field.size, &kernel_dev))
+        return false;
+      out->AppendVarInt(field_id,
+                        TranslateBlockDeviceIDToUserspace(kernel_dev));
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/protozero/field.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+namespace trace_processor {
+
+// Decodes the raw ftrace ring buffer pages that traced_probes writes when
+// FtraceConfig.raw_pages is set (FtraceEventBundle.raw_page) into FtraceEvent
+// protos, the same way CpuReader does on the device when parsing the pages.
+// The layout of the events comes from FtraceEventBundle.raw_format. The
+// formats depend on the data source that wrote the pages, so there is one
+// decoder per packet sequence, owned by PacketSequenceState.
+class FtraceRawPageDecoder {
+ public:
+  FtraceRawPageDecoder();
+  ~FtraceRawPageDecoder();
+
+  // Replaces the formats with the ones described by a
+  // FtraceEventBundle.RawFormat.
+  void SetFormat(protozero::ConstBytes raw_format);
+
+  // Decodes the events of |page| into |bundle|, as FtraceEventBundle.event
+  // fields. Events without a known format are skipped. Returns false if the
+  // page is malformed, in which case the events before the error are kept.
+  bool DecodePage(protozero::ConstBytes page,
+                  protos::pbzero::FtraceEventBundle* bundle) const;
+
+  bool has_format() const { return page_header_size_len_ != 0; }
+
+ private:
+  struct Field {
+    std::string name;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    int32_t type = 0;
+    uint32_t proto_field_id = 0;
+  };
+
+  struct Event {
+    std::string name;
+    uint32_t proto_field_id = 0;
+    uint32_t size = 0;
+    std::vector<Field> fields;
+  };
+
+  bool DecodeEvent(const Event&,
+                   const uint8_t* start,
+                   const uint8_t* end,
+                   protozero::Message* out) const;
+  bool DecodeField(const Field&,
+                   const uint8_t* start,
+                   const uint8_t* end,
+                   protozero::Message* out) const;
+
+  // Size of the "commit" field of the page header, 0 until a format is added.
+  uint32_t page_header_size_len_ = 0;
+  std::vector<Field> common_fields_;
+  base::FlatHashMap<uint32_t, Event> events_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::FtraceEventBundle;
+using protos::pbzero::SchedSwitchFtraceEvent;
+using RawFormat = protos::pbzero::FtraceEventBundle::RawFormat;
+
+constexpr uint16_t kSchedSwitchId = 42;
+constexpr uint16_t kUnknownId = 7;
+
+// A sched_switch like event: the common fields, then a 16 bytes comm at 8 and
+// a prio at 24.
+std::vector<uint8_t> SerializeFormat(
+    uint16_t sched_switch_id = kSchedSwitchId) {
+  protozero::HeapBuffered<RawFormat> format;
+  format->set_page_header_size_len(8);
+  auto* common_pid = format->add_common_field();
+  common_pid->set_name("common_pid");
+  common_pid->set_offset(4);
+  common_pid->set_size(4);
+  common_pid->set_type(RawFormat::FIELD_TYPE_INT);
+  common_pid->set_proto_field_id(FtraceEvent::kPidFieldNumber);
+
+  auto* event = format->add_event();
+  event->set_id(sched_switch_id);
+  event->set_name("sched_switch");
+  event->set_proto_field_id(FtraceEvent::kSchedSwitchFieldNumber);
+  event->set_size(28);
+  auto* comm = event->add_field();
+  comm->set_name("prev_comm");
+  comm->set_offset(8);
+  comm->set_size(16);
+  comm->set_type(RawFormat::FIELD_TYPE_FIXED_CSTRING);
+  comm->set_proto_field_id(SchedSwitchFtraceEvent::kPrevCommFieldNumber);
+  auto* prio = event->add_field();
+  prio->set_name("prev_prio");
+  prio->set_offset(24);
+  prio->set_size(4);
+  prio->set_type(RawFormat::FIELD_TYPE_INT);
+  prio->set_proto_field_id(SchedSwitchFtraceEvent::kPrevPrioFieldNumber);
+  return format.SerializeAsArray();
+}
+
+class PageBuilder {
+ public:
+  explicit PageBuilder(uint64_t timestamp) {
+    Append(timestamp);
+    Append(uint64_t(0));  // The commit field, set by Finish().
+  }
+
+  template <typename T>
+  void Append(T value) {
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&value);
+    data_.insert(data_.end(), ptr, ptr + sizeof(T));
+  }
+
+  // Appends a record header with the payload length encoded in the bottom 5
+  // bits (0 for the extended length records).
+  void AppendHeader(uint32_t type_or_length, uint32_t time_delta) {
+    Append(uint32_t(type_or_length | (time_delta << 5)));
+  }
+
+  void AppendSchedSwitch(int32_t pid, const char* comm, int32_t prio) {
+    Append(kSchedSwitchId);
+    Append(uint16_t(0));  // common_flags and common_preempt_count.
+    Append(pid);
+    char comm_buf[16] = {};
+    strncpy(comm_buf, comm, sizeof(comm_buf) - 1);
+    data_.insert(data_.end(), comm_buf, comm_buf + sizeof(comm_buf));
+    Append(prio);
+  }
+
+  std::vector<uint8_t> Finish() {
+    uint64_t data_size = data_.size() - 16;
+    memcpy(&data_[8], &data_size, sizeof(data_size));
+    return std::move(data_);
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+std::vector<FtraceEvent::Decoder> GetEvents(
+    const std::vector<uint8_t>& bundle) {
+  std::vector<FtraceEvent::Decoder> events;
+  FtraceEventBundle::Decoder decoder(bundle.data(), bundle.size());
+  for (auto it = decoder.event(); it; ++it)
+    events.emplace_back(*it);
+  return events;
+}
+
+TEST(FtraceRawPageDecoderTest, DecodeEvents) {
+  FtraceRawPageDecoder decoder;
+  EXPECT_FALSE(decoder.has_format());
+  std::vector<uint8_t> format = SerializeFormat();
+  decoder.SetFormat(protozero::ConstBytes{format.data(), format.size()});
+  ASSERT_TRUE(decoder.has_format());
+
+  PageBuilder builder(/*timestamp=*/1000);
+  builder.AppendHeader(/*type_or_length=*/7, /*time_delta=*/10);
+  builder.AppendSchedSwitch(/*pid=*/123, "foo", /*prio=*/-5);
+  // An event without a format, skipped.
+  builder.AppendHeader(/*type_or_length=*/2, /*time_delta=*/5);
+  builder.Append(kUnknownId);
+  builder.Append(uint16_t(0));
+  builder.Append(uint32_t(0));
+  // A time extend record, then an extended length record.
+  builder.AppendHeader(/*type_or_length=*/30, /*time_delta=*/1);
+  builder.Append(uint32_t(1));
+  builder.AppendHeader(/*type_or_length=*/0, /*time_delta=*/0);
+  builder.Append(uint32_t(4 + 28));
+  builder.AppendSchedSwitch(/*pid=*/456, "a_much_longer_comm", /*prio=*/120);
+  std::vector<uint8_t> page = builder.Finish();
+
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  EXPECT_TRUE(decoder.DecodePage(
+      protozero::ConstBytes{page.data(), page.size()}, bundle.get()));
+  std::vector<uint8_t> serialized = bundle.SerializeAsArray();
+  auto events = GetEvents(serialized);
+  ASSERT_EQ(events.size(), 2u);
+
+  EXPECT_EQ(events[0].timestamp(), 1010u);
+  EXPECT_EQ(events[0].pid(), 123u);
+  ASSERT_TRUE(events[0].has_sched_switch());
+  SchedSwitchFtraceEvent::Decoder first(events[0].sched_switch());
+  EXPECT_EQ(first.prev_comm().ToStdString(), "foo");
+  EXPECT_EQ(first.prev_prio(), -5);
+
+  EXPECT_EQ(events[1].timestamp(), 1010u + 5u + 1u + (1u << 27));
+  EXPECT_EQ(events[1].pid(), 456u);
+  SchedSwitchFtraceEvent::Decoder second(events[1].sched_switch());
+  EXPECT_EQ(second.prev_comm().ToStdString(), "a_much_longer_c");
+  EXPECT_EQ(second.prev_prio(), 120);
+}
+
+TEST(FtraceRawPageDecoderTest, MalformedPage) {
+  FtraceRawPageDecoder decoder;
+  std::vector<uint8_t> format = SerializeFormat();
+  decoder.SetFormat(protozero::ConstBytes{format.data(), format.size()});
+
+  PageBuilder builder(/*timestamp=*/1000);
+  builder.AppendHeader(/*type_or_length=*/7, /*time_delta=*/10);
+  builder.AppendSchedSwitch(/*pid=*/123, "foo", /*prio=*/-5);
+  // Claims to be longer than the rest of the page.
+  builder.AppendHeader(/*type_or_length=*/0, /*time_delta=*/0);
+  builder.Append(uint32_t(4 + 1000));
+  builder.Append(kSchedSwitchId);
+  std::vector<uint8_t> page = builder.Finish();
+
+  // The events before the error are kept.
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  EXPECT_FALSE(decoder.DecodePage(
+      protozero::ConstBytes{page.data(), page.size()}, bundle.get()));
+  std::vector<uint8_t> serialized = bundle.SerializeAsArray();
+  EXPECT_EQ(GetEvents(serialized).size(), 1u);
+
+  // Truncated page header.
+  protozero::HeapBuffered<FtraceEventBundle> empty_bundle;
+  EXPECT_FALSE(decoder.DecodePage(protozero::ConstBytes{page.data(), 12},
+                                  empty_bundle.get()));
+}
+
+// The formats are replaced, not merged: each sequence has its own decoder,
+// and the event ids of a format only apply to the pages of its sequence.
+TEST(FtraceRawPageDecoderTest, SetFormatReplacesEvents) {
+  FtraceRawPageDecoder decoder;
+  std::vector<uint8_t> format = SerializeFormat();
+  decoder.SetFormat(protozero::ConstBytes{format.data(), format.size()});
+  std::vector<uint8_t> other_format = SerializeFormat(kUnknownId);
+  decoder.SetFormat(
+      protozero::ConstBytes{other_format.data(), other_format.size()});
+
+  PageBuilder builder(/*timestamp=*/1000);
+  builder.AppendHeader(/*type_or_length=*/7, /*time_delta=*/10);
+  builder.AppendSchedSwitch(/*pid=*/123, "foo", /*prio=*/-5);
+  std::vector<uint8_t> page = builder.Finish();
+
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  EXPECT_TRUE(decoder.DecodePage(
+      protozero::ConstBytes{page.data(), page.size()}, bundle.get()));
+  std::vector<uint8_t> serialized = bundle.SerializeAsArray();
+  EXPECT_EQ(GetEvents(serialized).size(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
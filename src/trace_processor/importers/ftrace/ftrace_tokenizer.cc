@@ -16,9 +16,16 @@
 
 #include "src/trace_processor/importers/ftrace/ftrace_tokenizer.h"
 
+#include <string.h>
+
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/trace_sorter.h"
@@ -26,6 +33,8 @@
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/irq.pbzero.h"
+#include "protos/perfetto/trace/ftrace/power.pbzero.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -52,6 +61,144 @@ PERFETTO_ALWAYS_INLINE base::Optional<int64_t> ResolveTraceTime(
   return context->clock_tracker->ToTraceTime(clock_id, ts);
 }
 
+// Describes how the events of a type are stored in
+// FtraceEventBundle.CompactIrqPower: the column of delta encoded timestamps
+// and, for each field of the event, the column holding its values.
+struct CompactEventLayout {
+  static constexpr size_t kMaxFields = 2;
+
+  struct Field {
+    uint32_t column_field_id;  // In CompactIrqPower, 0 if unused.
+    uint32_t event_field_id;   // In the event's proto.
+    bool interned_string;      // The column holds |intern_table| indexes.
+  };
+
+  uint32_t event_field_id;  // In FtraceEvent.
+  uint32_t timestamp_column_field_id;
+  Field fields[kMaxFields];
+};
+
+using protos::pbzero::CpuFrequencyFtraceEvent;
+using protos::pbzero::CpuIdleFtraceEvent;
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::IrqHandlerEntryFtraceEvent;
+using protos::pbzero::IrqHandlerExitFtraceEvent;
+using protos::pbzero::SoftirqEntryFtraceEvent;
+using protos::pbzero::SoftirqExitFtraceEvent;
+using protos::pbzero::SoftirqRaiseFtraceEvent;
+using CompactIrqPower = FtraceEventBundle::CompactIrqPower;
+
+constexpr CompactEventLayout kCompactIrqPowerEvents[] = {
+    {FtraceEvent::kIrqHandlerEntryFieldNumber,
+     CompactIrqPower::kIrqEntryTimestampFieldNumber,
+     {{CompactIrqPower::kIrqEntryIrqFieldNumber,
+       IrqHandlerEntryFtraceEvent::kIrqFieldNumber, false},
+      {CompactIrqPower::kIrqEntryNameIndexFieldNumber,
+       IrqHandlerEntryFtraceEvent::kNameFieldNumber, true}}},
+    {FtraceEvent::kIrqHandlerExitFieldNumber,
+     CompactIrqPower::kIrqExitTimestampFieldNumber,
+     {{CompactIrqPower::kIrqExitIrqFieldNumber,
+       IrqHandlerExitFtraceEvent::kIrqFieldNumber, false},
+      {CompactIrqPower::kIrqExitRetFieldNumber,
+       IrqHandlerExitFtraceEvent::kRetFieldNumber, false}}},
+    {FtraceEvent::kSoftirqEntryFieldNumber,
+     CompactIrqPower::kSoftirqEntryTimestampFieldNumber,
+     {{CompactIrqPower::kSoftirqEntryVecFieldNumber,
+       SoftirqEntryFtraceEvent::kVecFieldNumber, false},
+      {0, 0, false}}},
+    {FtraceEvent::kSoftirqExitFieldNumber,
+     CompactIrqPower::kSoftirqExitTimestampFieldNumber,
+     {{CompactIrqPower::kSoftirqExitVecFieldNumber,
+       SoftirqExitFtraceEvent::kVecFieldNumber, false},
+      {0, 0, false}}},
+    {FtraceEvent::kSoftirqRaiseFieldNumber,
+     CompactIrqPower::kSoftirqRaiseTimestampFieldNumber,
+     {{CompactIrqPower::kSoftirqRaiseVecFieldNumber,
+       SoftirqRaiseFtraceEvent::kVecFieldNumber, false},
+      {0, 0, false}}},
+    {FtraceEvent::kCpuIdleFieldNumber,
+     CompactIrqPower::kCpuIdleTimestampFieldNumber,
+     {{CompactIrqPower::kCpuIdleStateFieldNumber,
+       CpuIdleFtraceEvent::kStateFieldNumber, false},
+      {CompactIrqPower::kCpuIdleCpuIdFieldNumber,
+       CpuIdleFtraceEvent::kCpuIdFieldNumber, false}}},
+    {FtraceEvent::kCpuFrequencyFieldNumber,
+     CompactIrqPower::kCpuFrequencyTimestampFieldNumber,
+     {{CompactIrqPower::kCpuFrequencyStateFieldNumber,
+       CpuFrequencyFtraceEvent::kStateFieldNumber, false},
+      {CompactIrqPower::kCpuFrequencyCpuIdFieldNumber,
+       CpuFrequencyFtraceEvent::kCpuIdFieldNumber, false}}},
+};
+
+// All the columns of CompactIrqPower are packed varints. Signed (int32)
+// columns are read back as their two's complement, which AppendVarInt()
+// re-encodes as the original value.
+std::vector<int64_t> ReadCompactColumn(const CompactIrqPower::Decoder& compact,
+                                       uint32_t column_field_id,
+                                       bool* parse_error) {
+  std::vector<int64_t> values;
+  for (auto it = compact.GetPackedRepeated<
+                 protozero::proto_utils::ProtoWireType::kVarInt, uint64_t>(
+           column_field_id, parse_error);
+       it; ++it) {
+    values.push_back(static_cast<int64_t>(*it));
+  }
+  return values;
+}
+
+// Appends to |out| an FtraceEvent for each of the events described by
+// |layout|. Returns false, without appending any event, if the columns have
+// different lengths or reference strings outside of |intern_table|.
+bool DecodeCompactEvents(const CompactIrqPower::Decoder& compact,
+                         const CompactEventLayout& layout,
+                         const std::vector<protozero::ConstChars>& intern_table,
+                         bool* parse_error,
+                         FtraceEventBundle* out) {
+  std::vector<int64_t> timestamps =
+      ReadCompactColumn(compact, layout.timestamp_column_field_id, parse_error);
+  std::vector<int64_t> columns[CompactEventLayout::kMaxFields];
+  for (size_t f = 0; f < CompactEventLayout::kMaxFields; f++) {
+    const CompactEventLayout::Field& field = layout.fields[f];
+    if (!field.column_field_id)
+      continue;
+    columns[f] = ReadCompactColumn(compact, field.column_field_id, parse_error);
+    if (columns[f].size() != timestamps.size())
+      return false;
+    if (!field.interned_string)
+      continue;
+    for (int64_t index : columns[f]) {
+      if (static_cast<uint64_t>(index) >= intern_table.size())
+        return false;
+    }
+  }
+
+  int64_t timestamp_acc = 0;
+  for (size_t i = 0; i < timestamps.size(); i++) {
+    timestamp_acc += timestamps[i];
+    auto* event = out->add_event();
+    event->set_timestamp(static_cast<uint64_t>(timestamp_acc));
+    // The interrupted task isn't recorded, but FtraceParser requires a pid:
+    // attribute the events to the idle task.
+    event->set_pid(0);
+    auto* nested =
+        event->BeginNestedMessage<protozero::Message>(layout.event_field_id);
+    for (size_t f = 0; f < CompactEventLayout::kMaxFields; f++) {
+      const CompactEventLayout::Field& field = layout.fields[f];
+      if (!field.column_field_id)
+        continue;
+      int64_t value = columns[f][i];
+      if (!field.interned_string) {
+        nested->AppendVarInt(field.event_field_id, value);
+        continue;
+      }
+      const protozero::ConstChars& str =
+          intern_table[static_cast<size_t>(value)];
+      nested->AppendBytes(field.event_field_id, str.data, str.size);
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 PERFETTO_ALWAYS_INLINE
@@ -95,6 +242,19 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(
     TokenizeFtraceCompactSched(cpu, clock_id, decoder.compact_sched());
   }
 
+  if (decoder.has_compact_irq_power()) {
+    TokenizeFtraceCompactIrqPower(cpu, clock_id, decoder.compact_irq_power(),
+                                  state);
+  }
+
+  // The format of the raw pages precedes them, in the same or in an earlier
+  // bundle of the sequence.
+  if (PERFETTO_UNLIKELY(decoder.has_raw_format()))
+    state->ftrace_raw_page_decoder().SetFormat(decoder.raw_format());
+
+  if (PERFETTO_UNLIKELY(decoder.has_raw_page()))
+    TokenizeFtraceRawPages(cpu, clock_id, decoder, state);
+
   for (auto it = decoder.event(); it; ++it) {
     TokenizeFtraceEvent(cpu, clock_id, bundle.slice(it->data(), it->size()),
                         state);
@@ -148,6 +308,87 @@ void FtraceTokenizer::TokenizeFtraceEvent(uint32_t cpu,
   context_->sorter->PushFtraceEvent(cpu, *timestamp, std::move(event), state);
 }
 
+void FtraceTokenizer::TokenizeFtraceRawPages(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    const FtraceEventBundle::Decoder& bundle,
+    PacketSequenceState* state) {
+  const FtraceRawPageDecoder& raw_page_decoder =
+      state->ftrace_raw_page_decoder();
+  if (!raw_page_decoder.has_format()) {
+    for (auto it = bundle.raw_page(); it; ++it)
+      context_->storage->IncrementStats(stats::ftrace_raw_pages_without_format);
+    return;
+  }
+
+  // Decode the pages into FtraceEvent protos, as if traced_probes had parsed
+  // them, and tokenize those as usual. All the events of the bundle share
+  // the same blob.
+  protozero::HeapBuffered<FtraceEventBundle> decoded;
+  for (auto it = bundle.raw_page(); it; ++it) {
+    if (!raw_page_decoder.DecodePage(*it, decoded.get()))
+      context_->storage->IncrementStats(stats::ftrace_raw_page_parse_errors);
+  }
+  TokenizeDecodedFtraceEvents(cpu, clock_id, &decoded, state);
+}
+
+void FtraceTokenizer::TokenizeFtraceCompactIrqPower(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::ConstBytes packet,
+    PacketSequenceState* state) {
+  CompactIrqPower::Decoder compact(packet);
+  std::vector<protozero::ConstChars> intern_table;
+  for (auto it = compact.intern_table(); it; ++it)
+    intern_table.push_back(*it);
+
+  // Unlike compact_sched, these events don't have a dedicated inline form:
+  // rebuild the FtraceEvent protos that traced_probes would have written
+  // otherwise, and tokenize those as usual.
+  bool parse_error = false;
+  bool columns_valid = true;
+  protozero::HeapBuffered<FtraceEventBundle> decoded;
+  for (const CompactEventLayout& layout : kCompactIrqPowerEvents) {
+    if (!DecodeCompactEvents(compact, layout, intern_table, &parse_error,
+                             decoded.get())) {
+      columns_valid = false;
+    }
+  }
+  if (parse_error || !columns_valid) {
+    context_->storage->IncrementStats(
+        stats::compact_irq_power_has_parse_errors);
+  }
+
+  TokenizeDecodedFtraceEvents(cpu, clock_id, &decoded, state);
+}
+
+// All the events of |decoded| share the same blob.
+void FtraceTokenizer::TokenizeDecodedFtraceEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::HeapBuffered<FtraceEventBundle>* decoded,
+    PacketSequenceState* state) {
+  // Stitch the slices straight into the blob, rather than into a vector which
+  // would then be copied again.
+  const auto& slices = decoded->GetSlices();
+  size_t size = 0;
+  for (const auto& slice : slices)
+    size += slice.size() - slice.unused_bytes();
+  TraceBlob blob = TraceBlob::Allocate(size);
+  uint8_t* wptr = blob.data();
+  for (const auto& slice : slices) {
+    protozero::ContiguousMemoryRange range = slice.GetUsedRange();
+    memcpy(wptr, range.begin, range.size());
+    wptr += range.size();
+  }
+  TraceBlobView events(std::move(blob));
+  FtraceEventBundle::Decoder decoder(events.data(), events.length());
+  for (auto it = decoder.event(); it; ++it) {
+    TokenizeFtraceEvent(cpu, clock_id, events.slice(it->data(), it->size()),
+                        state);
+  }
+}
+
 PERFETTO_ALWAYS_INLINE
 void FtraceTokenizer::TokenizeFtraceCompactSched(uint32_t cpu,
                                                  ClockTracker::ClockId clock_id,
@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_TOKENIZER_H_
 
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -43,6 +44,20 @@ class FtraceTokenizer {
                            ClockTracker::ClockId,
                            TraceBlobView event,
                            PacketSequenceState* state);
+  void TokenizeFtraceRawPages(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      const protos::pbzero::FtraceEventBundle::Decoder& bundle,
+      PacketSequenceState* state);
+  void TokenizeFtraceCompactIrqPower(uint32_t cpu,
+                                     ClockTracker::ClockId,
+                                     protozero::ConstBytes,
+                                     PacketSequenceState* state);
+  void TokenizeDecodedFtraceEvents(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      protozero::HeapBuffered<protos::pbzero::FtraceEventBundle>* decoded,
+      PacketSequenceState* state);
   void TokenizeFtraceCompactSched(uint32_t cpu,
                                   ClockTracker::ClockId,
                                   protozero::ConstBytes);
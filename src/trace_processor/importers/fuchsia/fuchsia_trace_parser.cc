@@ -73,14 +73,12 @@ void FuchsiaTraceParser::ParseFtracePacket(uint32_t,
 
 void FuchsiaTraceParser::ParseTracePacket(int64_t, TimestampedTracePiece ttp) {
   PERFETTO_DCHECK(ttp.type == TimestampedTracePiece::Type::kFuchsiaRecord);
-  PERFETTO_DCHECK(ttp.fuchsia_record != nullptr);
 
   // The timestamp is also present in the record, so we'll ignore the one passed
   // as an argument.
-  fuchsia_trace_utils::RecordCursor cursor(
-      ttp.fuchsia_record->record_view()->data(),
-      ttp.fuchsia_record->record_view()->length());
-  FuchsiaRecord* record = ttp.fuchsia_record.get();
+  FuchsiaRecord* record = &ttp.fuchsia_record;
+  fuchsia_trace_utils::RecordCursor cursor(record->record_view()->data(),
+                                           record->record_view()->length());
   ProcessTracker* procs = context_->process_tracker.get();
   SliceTracker* slices = context_->slice_tracker.get();
 
@@ -26,6 +26,7 @@
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/trace_processor/ref_counted.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
 #include "src/trace_processor/importers/proto/stack_profile_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -197,6 +198,12 @@ class PacketSequenceState {
     return sequence_stack_profile_tracker_;
   }
 
+  // Formats of the raw ftrace pages written on this sequence, see
+  // FtraceEventBundle.raw_format.
+  FtraceRawPageDecoder& ftrace_raw_page_decoder() {
+    return ftrace_raw_page_decoder_;
+  }
+
   // Returns a ref-counted ptr to the current generation.
   RefPtr<PacketSequenceStateGeneration> current_generation() const {
     return current_generation_;
@@ -245,6 +252,7 @@ class PacketSequenceState {
 
   RefPtr<PacketSequenceStateGeneration> current_generation_;
   SequenceStackProfileTracker sequence_stack_profile_tracker_;
+  FtraceRawPageDecoder ftrace_raw_page_decoder_;
 };
 
 template <uint32_t FieldId, typename MessageType>
@@ -18,6 +18,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "src/trace_processor/importers/additional_modules.h"
@@ -431,6 +432,116 @@ TEST_F(ProtoTraceParserTest, LoadGenericFtrace) {
   ASSERT_EQ(args.int_value()[row++], 3);
 }
 
+TEST_F(ProtoTraceParserTest, LoadCompactIrqPower) {
+  auto* bundle = trace_->add_packet()->set_ftrace_events();
+  bundle->set_cpu(1);
+  auto* compact = bundle->set_compact_irq_power();
+  compact->add_intern_table("timer");
+  compact->add_intern_table("eth0");
+
+  // Timestamps are delta encoded: 1000, 1050 and 1075.
+  protozero::PackedVarInt irq_entry_ts;
+  irq_entry_ts.Append(1000);
+  irq_entry_ts.Append(50);
+  irq_entry_ts.Append(25);
+  protozero::PackedVarInt irq_entry_irq;
+  irq_entry_irq.Append(1);
+  irq_entry_irq.Append(2);
+  irq_entry_irq.Append(1);
+  protozero::PackedVarInt irq_entry_name;
+  irq_entry_name.Append(0);
+  irq_entry_name.Append(1);
+  irq_entry_name.Append(0);
+  compact->set_irq_entry_timestamp(irq_entry_ts);
+  compact->set_irq_entry_irq(irq_entry_irq);
+  compact->set_irq_entry_name_index(irq_entry_name);
+
+  protozero::PackedVarInt softirq_raise_ts;
+  softirq_raise_ts.Append(1100);
+  protozero::PackedVarInt softirq_raise_vec;
+  softirq_raise_vec.Append(3);
+  compact->set_softirq_raise_timestamp(softirq_raise_ts);
+  compact->set_softirq_raise_vec(softirq_raise_vec);
+
+  StringId timer = storage_->InternString("IRQ (timer)");
+  StringId eth0 = storage_->InternString("IRQ (eth0)");
+  InSequence in_sequence;
+  EXPECT_CALL(*slice_, Begin(1000, _, _, timer, _));
+  EXPECT_CALL(*slice_, Begin(1050, _, _, eth0, _));
+  EXPECT_CALL(*slice_, Begin(1075, _, _, timer, _));
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  const auto& raw = storage_->raw_table();
+  ASSERT_EQ(raw.row_count(), 4u);
+  EXPECT_EQ(raw.ts()[0], 1000);
+  EXPECT_EQ(raw.ts()[1], 1050);
+  EXPECT_EQ(raw.ts()[2], 1075);
+  EXPECT_EQ(raw.ts()[3], 1100);
+  EXPECT_EQ(raw.name().GetString(0), "irq_handler_entry");
+  EXPECT_EQ(raw.name().GetString(3), "softirq_raise");
+  EXPECT_EQ(raw.cpu()[3], 1u);
+  EXPECT_EQ(
+      storage_->stats()[stats::compact_irq_power_has_parse_errors].value, 0);
+}
+
+TEST_F(ProtoTraceParserTest, LoadCompactIrqPowerMalformed) {
+  auto* bundle = trace_->add_packet()->set_ftrace_events();
+  bundle->set_cpu(1);
+  auto* compact = bundle->set_compact_irq_power();
+  compact->add_intern_table("timer");
+
+  // The second event references a name outside of the intern table: none of
+  // the irq_handler_entry events are imported.
+  protozero::PackedVarInt irq_entry_ts;
+  irq_entry_ts.Append(1000);
+  irq_entry_ts.Append(10);
+  protozero::PackedVarInt irq_entry_irq;
+  irq_entry_irq.Append(1);
+  irq_entry_irq.Append(1);
+  protozero::PackedVarInt irq_entry_name;
+  irq_entry_name.Append(0);
+  irq_entry_name.Append(1);
+  compact->set_irq_entry_timestamp(irq_entry_ts);
+  compact->set_irq_entry_irq(irq_entry_irq);
+  compact->set_irq_entry_name_index(irq_entry_name);
+
+  // One irq for two timestamps: the irq_handler_exit events are dropped.
+  protozero::PackedVarInt irq_exit_ts;
+  irq_exit_ts.Append(1005);
+  irq_exit_ts.Append(10);
+  protozero::PackedVarInt irq_exit_irq;
+  irq_exit_irq.Append(1);
+  protozero::PackedVarInt irq_exit_ret;
+  irq_exit_ret.Append(1);
+  irq_exit_ret.Append(1);
+  compact->set_irq_exit_timestamp(irq_exit_ts);
+  compact->set_irq_exit_irq(irq_exit_irq);
+  compact->set_irq_exit_ret(irq_exit_ret);
+
+  // The well formed columns are still imported.
+  protozero::PackedVarInt softirq_raise_ts;
+  softirq_raise_ts.Append(1100);
+  protozero::PackedVarInt softirq_raise_vec;
+  softirq_raise_vec.Append(3);
+  compact->set_softirq_raise_timestamp(softirq_raise_ts);
+  compact->set_softirq_raise_vec(softirq_raise_vec);
+
+  EXPECT_CALL(*slice_, Begin(_, _, _, _, _)).Times(0);
+  EXPECT_CALL(*slice_, End(_, _, _, _, _)).Times(0);
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  const auto& raw = storage_->raw_table();
+  ASSERT_EQ(raw.row_count(), 1u);
+  EXPECT_EQ(raw.ts()[0], 1100);
+  EXPECT_EQ(raw.name().GetString(0), "softirq_raise");
+  EXPECT_EQ(
+      storage_->stats()[stats::compact_irq_power_has_parse_errors].value, 1);
+}
+
 TEST_F(ProtoTraceParserTest, LoadMultipleEvents) {
   auto* bundle = trace_->add_packet()->set_ftrace_events();
   bundle->set_cpu(10);
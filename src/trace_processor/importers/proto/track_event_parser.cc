@@ -182,7 +182,7 @@ class TrackEventParser::EventImporter {
  public:
   EventImporter(TrackEventParser* parser,
                 int64_t ts,
-                TrackEventData* event_data,
+                const TrackEventData* event_data,
                 ConstBytes blob)
       : context_(parser->context_),
         track_event_tracker_(parser->track_event_tracker_),
@@ -190,6 +190,8 @@ class TrackEventParser::EventImporter {
         parser_(parser),
         ts_(ts),
         event_data_(event_data),
+        thread_timestamp_(event_data->thread_timestamp),
+        thread_instruction_count_(event_data->thread_instruction_count),
         sequence_state_(event_data->sequence_state.get()),
         blob_(std::move(blob)),
         event_(blob_),
@@ -574,18 +576,17 @@ class TrackEventParser::EventImporter {
     // import the counter values from the end of a complete event, because the
     // EventTracker expects counters to be pushed in order of their timestamps.
     // One more reason to switch to split begin/end events.
-    if (event_data_->thread_timestamp) {
+    if (thread_timestamp_) {
       TrackId track_id = context_->track_tracker->InternThreadCounterTrack(
           parser_->counter_name_thread_time_id_, *utid_);
       context_->event_tracker->PushCounter(
-          ts_, static_cast<double>(*event_data_->thread_timestamp), track_id);
+          ts_, static_cast<double>(*thread_timestamp_), track_id);
     }
-    if (event_data_->thread_instruction_count) {
+    if (thread_instruction_count_) {
       TrackId track_id = context_->track_tracker->InternThreadCounterTrack(
           parser_->counter_name_thread_instruction_count_id_, *utid_);
       context_->event_tracker->PushCounter(
-          ts_, static_cast<double>(*event_data_->thread_instruction_count),
-          track_id);
+          ts_, static_cast<double>(*thread_instruction_count_), track_id);
     }
   }
 
@@ -643,10 +644,10 @@ class TrackEventParser::EventImporter {
     StringId counter_name =
         storage_->counter_track_table().name()[*counter_row];
     if (counter_name == parser_->counter_name_thread_time_id_) {
-      event_data_->thread_timestamp = static_cast<int64_t>(value);
+      thread_timestamp_ = static_cast<int64_t>(value);
     } else if (counter_name ==
                parser_->counter_name_thread_instruction_count_id_) {
-      event_data_->thread_instruction_count = static_cast<int64_t>(value);
+      thread_instruction_count_ = static_cast<int64_t>(value);
     }
   }
 
@@ -683,15 +684,15 @@ class TrackEventParser::EventImporter {
       PERFETTO_DCHECK(maybe_row.has_value());
       auto tts = thread_slices->thread_ts()[*maybe_row];
       if (tts) {
-        PERFETTO_DCHECK(event_data_->thread_timestamp);
+        PERFETTO_DCHECK(thread_timestamp_);
         thread_slices->mutable_thread_dur()->Set(
-            *maybe_row, *event_data_->thread_timestamp - *tts);
+            *maybe_row, *thread_timestamp_ - *tts);
       }
       auto tic = thread_slices->thread_instruction_count()[*maybe_row];
       if (tic) {
-        PERFETTO_DCHECK(event_data_->thread_instruction_count);
+        PERFETTO_DCHECK(thread_instruction_count_);
         thread_slices->mutable_thread_instruction_delta()->Set(
-            *maybe_row, *event_data_->thread_instruction_count - *tic);
+            *maybe_row, *thread_instruction_count_ - *tic);
       }
       MaybeParseFlowEvents(opt_slice_id.value());
     }
@@ -842,10 +843,10 @@ class TrackEventParser::EventImporter {
       auto* thread_slices = storage_->mutable_thread_slice_table();
       tables::ThreadSliceTable::Row row = MakeThreadSliceRow();
       row.dur = duration_ns;
-      if (event_data_->thread_timestamp) {
+      if (thread_timestamp_) {
         row.thread_dur = duration_ns;
       }
-      if (event_data_->thread_instruction_count) {
+      if (thread_instruction_count_) {
         row.thread_instruction_delta = tidelta;
       }
       opt_slice_id = context_->slice_tracker->ScopedTyped(
@@ -887,11 +888,8 @@ class TrackEventParser::EventImporter {
       auto* vtrack_slices = storage_->mutable_virtual_track_slices();
       PERFETTO_DCHECK(!vtrack_slices->slice_count() ||
                       vtrack_slices->slice_ids().back() < opt_slice_id.value());
-      int64_t tts =
-          event_data_->thread_timestamp ? *event_data_->thread_timestamp : 0;
-      int64_t tic = event_data_->thread_instruction_count
-                        ? *event_data_->thread_instruction_count
-                        : 0;
+      int64_t tts = thread_timestamp_ ? *thread_timestamp_ : 0;
+      int64_t tic = thread_instruction_count_ ? *thread_instruction_count_ : 0;
       vtrack_slices->AddVirtualTrackSlice(opt_slice_id.value(), tts,
                                           kPendingThreadDuration, tic,
                                           kPendingThreadInstructionDelta);
@@ -908,11 +906,8 @@ class TrackEventParser::EventImporter {
     MaybeParseFlowEvents(opt_slice_id.value());
     if (legacy_event_.use_async_tts()) {
       auto* vtrack_slices = storage_->mutable_virtual_track_slices();
-      int64_t tts =
-          event_data_->thread_timestamp ? *event_data_->thread_timestamp : 0;
-      int64_t tic = event_data_->thread_instruction_count
-                        ? *event_data_->thread_instruction_count
-                        : 0;
+      int64_t tts = thread_timestamp_ ? *thread_timestamp_ : 0;
+      int64_t tic = thread_instruction_count_ ? *thread_instruction_count_ : 0;
       vtrack_slices->UpdateThreadDeltasForSliceId(opt_slice_id.value(), tts,
                                                   tic);
     }
@@ -956,11 +951,8 @@ class TrackEventParser::EventImporter {
       auto* vtrack_slices = storage_->mutable_virtual_track_slices();
       PERFETTO_DCHECK(!vtrack_slices->slice_count() ||
                       vtrack_slices->slice_ids().back() < opt_slice_id.value());
-      int64_t tts =
-          event_data_->thread_timestamp ? *event_data_->thread_timestamp : 0;
-      int64_t tic = event_data_->thread_instruction_count
-                        ? *event_data_->thread_instruction_count
-                        : 0;
+      int64_t tts = thread_timestamp_ ? *thread_timestamp_ : 0;
+      int64_t tic = thread_instruction_count_ ? *thread_instruction_count_ : 0;
       vtrack_slices->AddVirtualTrackSlice(opt_slice_id.value(), tts,
                                           duration_ns, tic, tidelta);
     }
@@ -1049,9 +1041,9 @@ class TrackEventParser::EventImporter {
                       Variadic::Integer(legacy_event_.duration_us() * 1000));
     }
 
-    if (event_data_->thread_timestamp) {
+    if (thread_timestamp_) {
       inserter.AddArg(parser_->legacy_event_thread_timestamp_ns_key_id_,
-                      Variadic::Integer(*event_data_->thread_timestamp));
+                      Variadic::Integer(*thread_timestamp_));
       if (legacy_event_.has_thread_duration_us()) {
         inserter.AddArg(
             parser_->legacy_event_thread_duration_ns_key_id_,
@@ -1059,10 +1051,9 @@ class TrackEventParser::EventImporter {
       }
     }
 
-    if (event_data_->thread_instruction_count) {
-      inserter.AddArg(
-          parser_->legacy_event_thread_instruction_count_key_id_,
-          Variadic::Integer(*event_data_->thread_instruction_count));
+    if (thread_instruction_count_) {
+      inserter.AddArg(parser_->legacy_event_thread_instruction_count_key_id_,
+                      Variadic::Integer(*thread_instruction_count_));
       if (legacy_event_.has_thread_instruction_delta()) {
         inserter.AddArg(
             parser_->legacy_event_thread_instruction_delta_key_id_,
@@ -1272,9 +1263,9 @@ class TrackEventParser::EventImporter {
     row.track_id = track_id_;
     row.category = category_id_;
     row.name = name_id_;
-    row.thread_ts = event_data_->thread_timestamp;
+    row.thread_ts = thread_timestamp_;
     row.thread_dur = base::nullopt;
-    row.thread_instruction_count = event_data_->thread_instruction_count;
+    row.thread_instruction_count = thread_instruction_count_;
     row.thread_instruction_delta = base::nullopt;
     return row;
   }
@@ -1284,7 +1275,10 @@ class TrackEventParser::EventImporter {
   TraceStorage* storage_;
   TrackEventParser* parser_;
   int64_t ts_;
-  TrackEventData* event_data_;
+  const TrackEventData* event_data_;
+  // Initialized from |event_data_| but can be updated by extra counter values.
+  base::Optional<int64_t> thread_timestamp_;
+  base::Optional<int64_t> thread_instruction_count_;
   PacketSequenceStateGeneration* sequence_state_;
   ConstBytes blob_;
   TrackEvent::Decoder event_;
@@ -1590,7 +1584,7 @@ void TrackEventParser::ParseCounterDescriptor(
 }
 
 void TrackEventParser::ParseTrackEvent(int64_t ts,
-                                       TrackEventData* event_data,
+                                       const TrackEventData* event_data,
                                        ConstBytes blob) {
   util::Status status =
       EventImporter(this, ts, event_data, std::move(blob)).Import();
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/iterator_impl.h"
 
+#include <mutex>
+
 #include "perfetto/base/time.h"
 #include "perfetto/trace_processor/trace_processor_storage.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
@@ -30,27 +32,42 @@ IteratorImpl::IteratorImpl(TraceProcessorImpl* trace_processor,
                            base::Status status,
                            ScopedStmt stmt,
                            StmtMetadata metadata,
-                           uint32_t sql_stats_row)
+                           uint32_t sql_stats_row,
+                           bool read_only)
     : trace_processor_(trace_processor),
       db_(db),
       status_(std::move(status)),
       stmt_(std::move(stmt)),
       stmt_metadata_(std::move(metadata)),
-      sql_stats_row_(sql_stats_row) {}
+      sql_stats_row_(sql_stats_row),
+      read_only_(read_only) {}
 
 IteratorImpl::~IteratorImpl() {
   if (trace_processor_) {
+    TraceProcessorImpl* tp = trace_processor_.get();
     base::TimeNanos t_end = base::GetWallTimeNs();
-    auto* sql_stats =
-        trace_processor_.get()->context_.storage->mutable_sql_stats();
-    sql_stats->RecordQueryEnd(sql_stats_row_, t_end.count());
+    {
+      std::lock_guard<std::mutex> lock(tp->sql_stats_mutex_);
+      auto* sql_stats = tp->context_.storage->mutable_sql_stats();
+      sql_stats->RecordQueryEnd(sql_stats_row_, t_end.count());
+    }
+    if (read_only_) {
+      // The statement needs to be finalized before another thread can start
+      // using the connection.
+      stmt_.reset();
+      tp->ReleaseReadOnlyConnection(db_);
+    }
   }
 }
 
 void IteratorImpl::RecordFirstNextInSqlStats() {
+  // Null for iterators which failed before getting a connection.
+  if (!trace_processor_)
+    return;
+  TraceProcessorImpl* tp = trace_processor_.get();
   base::TimeNanos t_first_next = base::GetWallTimeNs();
-  auto* sql_stats =
-      trace_processor_.get()->context_.storage->mutable_sql_stats();
+  std::lock_guard<std::mutex> lock(tp->sql_stats_mutex_);
+  auto* sql_stats = tp->context_.storage->mutable_sql_stats();
   sql_stats->RecordQueryFirstNext(sql_stats_row_, t_first_next.count());
 }
 
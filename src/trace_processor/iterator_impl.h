@@ -43,12 +43,16 @@ class IteratorImpl {
     uint32_t statement_count_with_output = 0;
   };
 
+  // |read_only| should be true if |db| is one of the read-only connections
+  // leased by TraceProcessorImpl::ExecuteReadOnlyQuery(): it is then given
+  // back when this iterator is destroyed.
   IteratorImpl(TraceProcessorImpl* impl,
                sqlite3* db,
                base::Status,
                ScopedStmt,
                StmtMetadata,
-               uint32_t sql_stats_row);
+               uint32_t sql_stats_row,
+               bool read_only);
   ~IteratorImpl();
 
   IteratorImpl(IteratorImpl&) noexcept = delete;
@@ -161,6 +165,7 @@ class IteratorImpl {
 
   uint32_t sql_stats_row_ = 0;
   bool called_next_ = false;
+  bool read_only_ = false;
 };
 
 }  // namespace trace_processor
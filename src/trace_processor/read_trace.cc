@@ -16,6 +16,7 @@
 
 #include "perfetto/trace_processor/read_trace.h"
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -25,6 +26,7 @@
 
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/chunk_prefetcher.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
 #include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
@@ -47,6 +49,37 @@ namespace {
 // 1MB chunk size seems the best tradeoff on a MacBook Pro 2013 - i7 2.8 GHz.
 constexpr size_t kChunkSize = 1024 * 1024;
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+// Max number of chunks the reader thread is allowed to read ahead of the
+// parser. This bounds the extra memory used by the pipeline to
+// kChunkSize * kMaxChunksInFlight.
+constexpr size_t kMaxChunksInFlight = 16;
+
+util::Status ReadTraceUsingRead(
+    TraceProcessor* tp,
+    int fd,
+    uint64_t* file_size,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
+  ChunkPrefetcher prefetcher(fd, kChunkSize, kMaxChunksInFlight);
+  for (int i = 0;; i++) {
+    if (progress_callback && i % 128 == 0)
+      progress_callback(*file_size);
+
+    ChunkPrefetcher::Chunk chunk = prefetcher.Pop();
+    if (chunk.err) {
+      return util::ErrStatus("Reading trace file failed (errno: %d, %s)",
+                             chunk.err, strerror(chunk.err));
+    }
+    if (chunk.size == 0)
+      break;
+
+    *file_size += chunk.size;
+    TraceBlobView blob_view(std::move(chunk.blob), 0, chunk.size);
+    RETURN_IF_ERROR(tp->Parse(std::move(blob_view)));
+  }
+  return util::OkStatus();
+}
+#else   // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
 util::Status ReadTraceUsingRead(
     TraceProcessor* tp,
     int fd,
@@ -73,6 +106,7 @@ util::Status ReadTraceUsingRead(
   }
   return util::OkStatus();
 }
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
 
 class SerializingProtoTraceReader : public ChunkedTraceReader {
  public:
@@ -129,6 +163,9 @@ util::Status ReadTrace(
     const size_t whole_size = static_cast<size_t>(whole_size_64);
     void* file_mm = mmap(nullptr, whole_size, PROT_READ, MAP_PRIVATE, *fd, 0);
     if (file_mm != MAP_FAILED) {
+      // Let the kernel read ahead aggressively: the file is parsed strictly
+      // front to back.
+      madvise(file_mm, whole_size, MADV_SEQUENTIAL);
       TraceBlobView whole_mmap(TraceBlob::FromMmap(file_mm, whole_size));
       // Parse the file in chunks so we get some status update on stdio.
       static constexpr size_t kMmapChunkSize = 128ul * 1024 * 1024;
@@ -136,6 +173,17 @@ util::Status ReadTrace(
         progress_callback(bytes_read);
         const size_t bytes_read_z = static_cast<size_t>(bytes_read);
         size_t slice_size = std::min(whole_size - bytes_read_z, kMmapChunkSize);
+
+        // Start paging in the next slice while the current one is being
+        // parsed. kMmapChunkSize is a multiple of the page size, so the
+        // address passed to madvise() is always page-aligned.
+        size_t next_off = bytes_read_z + slice_size;
+        if (next_off < whole_size) {
+          size_t next_size = std::min(whole_size - next_off, kMmapChunkSize);
+          madvise(static_cast<char*>(file_mm) + next_off, next_size,
+                  MADV_WILLNEED);
+        }
+
         TraceBlobView slice = whole_mmap.slice_off(bytes_read_z, slice_size);
         RETURN_IF_ERROR(tp->Parse(std::move(slice)));
         bytes_read += slice_size;
@@ -20,14 +20,12 @@
 
 #include "src/trace_processor/rpc/httpd.h"
 
-#include "perfetto/ext/base/http/http_server.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_processor.h"
-#include "src/trace_processor/rpc/rpc.h"
 
 #include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
 
@@ -47,31 +45,39 @@ const char* kAllowedCORSOrigins[] = {
     "http://127.0.0.1:10000",
 };
 
-class Httpd : public base::HttpRequestHandler {
- public:
-  explicit Httpd(std::unique_ptr<TraceProcessor>);
-  ~Httpd() override;
-  void Run(int port);
-
- private:
-  // HttpRequestHandler implementation.
-  void OnHttpRequest(const base::HttpRequest&) override;
-  void OnWebsocketMessage(const base::WebsocketMessage&) override;
-
-  void ServeHelpPage(const base::HttpRequest&);
-
-  Rpc trace_processor_rpc_;
-  base::UnixTaskRunner task_runner_;
-  base::HttpServer http_srv_;
-};
-
 base::HttpServerConnection* g_cur_conn;
 
 base::StringView Vec2Sv(const std::vector<uint8_t>& v) {
   return base::StringView(reinterpret_cast<const char*>(v.data()), v.size());
 }
 
+// Starts the chunked reply to a /query request.
+void SendQueryResponseHeaders(base::HttpServerConnection* conn) {
+  conn->SendResponseHeaders("200 OK",
+                            {
+                                "Cache-Control: no-cache",               //
+                                "Content-Type: application/x-protobuf",  //
+                                "Transfer-Encoding: chunked",            //
+                            },
+                            base::HttpServerConnection::kOmitContentLength);
+}
+
 // Used both by websockets and /rpc chunked HTTP endpoints.
+// Appends |buf| to |out| as a HTTP chunk, followed by the terminating chunk if
+// |has_more| is false.
+void AppendHttpChunk(std::vector<uint8_t>* out,
+                     const uint8_t* buf,
+                     size_t len,
+                     bool has_more) {
+  base::StackString<32> chunk_hdr("%zx\r\n", len);
+  const char* hdr = chunk_hdr.c_str();
+  out->insert(out->end(), hdr, hdr + chunk_hdr.len());
+  out->insert(out->end(), buf, buf + len);
+  out->insert(out->end(), {'\r', '\n'});
+  if (!has_more)
+    out->insert(out->end(), {'0', '\r', '\n', '\r', '\n'});
+}
+
 void SendRpcChunk(const void* data, uint32_t len) {
   if (data == nullptr) {
     // Unrecoverable RPC error case.
@@ -90,12 +96,23 @@ void SendRpcChunk(const void* data, uint32_t len) {
   }
 }
 
-Httpd::Httpd(std::unique_ptr<TraceProcessor> preloaded_instance)
-    : trace_processor_rpc_(std::move(preloaded_instance)),
-      http_srv_(&task_runner_, this) {}
-Httpd::~Httpd() = default;
+}  // namespace
+
+Httpd::Httpd(std::unique_ptr<TraceProcessor> preloaded_instance,
+             uint32_t query_threads,
+             base::TaskRunner* task_runner)
+    : task_runner_(task_runner),
+      trace_processor_rpc_(std::move(preloaded_instance), query_threads),
+      http_srv_(task_runner_, this),
+      weak_factory_(this) {}
+
+Httpd::~Httpd() {
+  // The worker threads call PostFlushConcurrentQueries() on |this|. The
+  // flushes they posted already are dropped once |weak_factory_| is gone.
+  trace_processor_rpc_.WaitForConcurrentQueries();
+}
 
-void Httpd::Run(int port) {
+void Httpd::Start(int port) {
   PERFETTO_ILOG("[HTTP] Starting RPC server on localhost:%d", port);
   PERFETTO_LOG(
       "[HTTP] This server can be used by reloading https://ui.perfetto.dev and "
@@ -106,7 +123,6 @@ void Httpd::Run(int port) {
   for (size_t i = 0; i < base::ArraySize(kAllowedCORSOrigins); ++i)
     http_srv_.AddAllowedOrigin(kAllowedCORSOrigins[i]);
   http_srv_.Start(port);
-  task_runner_.Run();
 }
 
 void Httpd::OnHttpRequest(const base::HttpRequest& req) {
@@ -116,6 +132,10 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
     return ServeHelpPage(req);
   }
 
+  // Only /query requests can run concurrently with each other.
+  if (req.uri != "/query")
+    FinishConcurrentQueries();
+
   static int last_req_id = 0;
   auto seq_hdr = req.GetHeader("x-seq-id").value_or(base::StringView());
   int seq_id = base::StringToInt32(seq_hdr.ToStdString()).value_or(0);
@@ -198,31 +218,63 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
   // |batch_split_threshold_| in query_result_serializer.h.
   // This is temporary, it will be switched to WebSockets soon.
   if (req.uri == "/query") {
-    std::vector<uint8_t> response;
+    std::shared_ptr<ConcurrentQuery> query(new ConcurrentQuery());
+    query->conn = req.conn;
+    query->args = req.body.ToStdString();
+
+    // base::HttpServer needs the response to start before OnHttpRequest()
+    // returns. A query pipelined behind one still in flight on the same
+    // connection can't do that, so complete the queries before it first.
+    bool pipelined = false;
+    for (const auto& pending : concurrent_queries_)
+      pipelined |= pending->conn == req.conn;
+    if (pipelined)
+      FinishConcurrentQueries();
 
     // Start the chunked reply.
-    base::StringCopy(transfer_encoding_hdr, "Transfer-Encoding: chunked",
-                     sizeof(transfer_encoding_hdr));
-    conn.SendResponseHeaders("200 OK", headers,
-                             base::HttpServerConnection::kOmitContentLength);
+    SendQueryResponseHeaders(req.conn);
+
+    // Queries received after one which needs the main connection may depend
+    // on it: run them on the main connection too, once the queries before
+    // them are done.
+    bool after_fallback = false;
+    for (const auto& pending : concurrent_queries_) {
+      std::lock_guard<std::mutex> lock(pending->mutex);
+      after_fallback |= pending->fallback;
+    }
+    if (after_fallback) {
+      query->done = true;
+      query->fallback = true;
+      concurrent_queries_.emplace_back(std::move(query));
+      FlushConcurrentQueries();
+      return;
+    }
 
-    // |on_result_chunk| will be called nested within the same callstack of the
-    // rpc.Query() call. No further calls will be made once Query() returns.
-    auto on_result_chunk = [&](const uint8_t* buf, size_t len, bool has_more) {
-      PERFETTO_DLOG("Sending response chunk, len=%zu eof=%d", len, !has_more);
-      char chunk_hdr[32];
-      auto hdr_len = static_cast<size_t>(sprintf(chunk_hdr, "%zx\r\n", len));
-      conn.SendResponseBody(chunk_hdr, hdr_len);
-      conn.SendResponseBody(buf, len);
-      conn.SendResponseBody("\r\n", 2);
-      if (!has_more) {
-        hdr_len = static_cast<size_t>(sprintf(chunk_hdr, "0\r\n\r\n"));
-        conn.SendResponseBody(chunk_hdr, hdr_len);
+    // Both callbacks are invoked on a worker thread.
+    auto on_result_chunk = [this, query](const uint8_t* buf, size_t len,
+                                         bool has_more) {
+      {
+        std::lock_guard<std::mutex> lock(query->mutex);
+        AppendHttpChunk(&query->pending_body, buf, len, has_more);
+        query->done = !has_more;
       }
+      PostFlushConcurrentQueries();
     };
-    trace_processor_rpc_.Query(
-        reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size(),
-        on_result_chunk);
+    auto on_fallback = [this, query] {
+      {
+        std::lock_guard<std::mutex> lock(query->mutex);
+        query->done = true;
+        query->fallback = true;
+      }
+      PostFlushConcurrentQueries();
+    };
+    const auto* args = reinterpret_cast<const uint8_t*>(query->args.data());
+    if (trace_processor_rpc_.QueryConcurrently(args, query->args.size(),
+                                               on_result_chunk, on_fallback)) {
+      concurrent_queries_.emplace_back(std::move(query));
+      return;
+    }
+    RunQuery(req.conn, args, query->args.size());
     return;
   }
 
@@ -254,7 +306,89 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
   return conn.SendResponseAndClose("404 Not Found", headers);
 }
 
+void Httpd::RunQuery(base::HttpServerConnection* conn,
+                     const uint8_t* args,
+                     size_t len) {
+  // |on_result_chunk| will be called nested within the same callstack of the
+  // rpc.Query() call. No further calls will be made once Query() returns.
+  auto on_result_chunk = [&](const uint8_t* buf, size_t chunk_len,
+                             bool has_more) {
+    PERFETTO_DLOG("Sending response chunk, len=%zu eof=%d", chunk_len,
+                  !has_more);
+    std::vector<uint8_t> chunk;
+    AppendHttpChunk(&chunk, buf, chunk_len, has_more);
+    conn->SendResponseBody(chunk.data(), chunk.size());
+  };
+  trace_processor_rpc_.Query(args, len, on_result_chunk);
+}
+
+void Httpd::FlushConcurrentQueries() {
+  bool any_running = false;
+  for (auto it = concurrent_queries_.begin();
+       it != concurrent_queries_.end();) {
+    ConcurrentQuery* query = it->get();
+    std::vector<uint8_t> body;
+    bool done;
+    bool fallback;
+    {
+      std::lock_guard<std::mutex> lock(query->mutex);
+      body.swap(query->pending_body);
+      done = query->done;
+      fallback = query->fallback;
+    }
+    if (query->conn && !body.empty())
+      query->conn->SendResponseBody(body.data(), body.size());
+    any_running |= !done;
+    if (done && !fallback) {
+      it = concurrent_queries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Every query still running will post another flush when it's done.
+  if (any_running)
+    return;
+
+  // Only queries which need the main connection are left.
+  while (!concurrent_queries_.empty()) {
+    std::shared_ptr<ConcurrentQuery> query =
+        std::move(concurrent_queries_.front());
+    concurrent_queries_.pop_front();
+    if (!query->conn)
+      continue;
+    PERFETTO_DLOG("[HTTP] Running query on the main connection");
+    RunQuery(query->conn, reinterpret_cast<const uint8_t*>(query->args.data()),
+             query->args.size());
+  }
+}
+
+void Httpd::PostFlushConcurrentQueries() {
+  // The WeakPtr is only copied here. It's dereferenced on the main thread.
+  base::WeakPtr<Httpd> weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostTask([weak_this] {
+    if (weak_this)
+      weak_this->FlushConcurrentQueries();
+  });
+}
+
+void Httpd::FinishConcurrentQueries() {
+  if (concurrent_queries_.empty())
+    return;
+  trace_processor_rpc_.WaitForConcurrentQueries();
+  FlushConcurrentQueries();
+  PERFETTO_DCHECK(concurrent_queries_.empty());
+}
+
+void Httpd::OnHttpConnectionClosed(base::HttpServerConnection* conn) {
+  for (const auto& query : concurrent_queries_) {
+    if (query->conn == conn)
+      query->conn = nullptr;
+  }
+}
+
 void Httpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
+  FinishConcurrentQueries();
   PERFETTO_CHECK(g_cur_conn == nullptr);
   g_cur_conn = msg.conn;
   trace_processor_rpc_.SetRpcResponseFunction(SendRpcChunk);
@@ -264,14 +398,15 @@ void Httpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
   g_cur_conn = nullptr;
 }
 
-}  // namespace
-
 void RunHttpRPCServer(std::unique_ptr<TraceProcessor> preloaded_instance,
-                      std::string port_number) {
-  Httpd srv(std::move(preloaded_instance));
+                      std::string port_number,
+                      uint32_t query_threads) {
+  base::UnixTaskRunner task_runner;
+  Httpd srv(std::move(preloaded_instance), query_threads, &task_runner);
   base::Optional<int> port_opt = base::StringToInt32(port_number);
   int port = port_opt.has_value() ? *port_opt : kBindPort;
-  srv.Run(port);
+  srv.Start(port);
+  task_runner.Run();
 }
 
 void Httpd::ServeHelpPage(const base::HttpRequest& req) {
@@ -17,20 +17,106 @@
 #ifndef SRC_TRACE_PROCESSOR_RPC_HTTPD_H_
 #define SRC_TRACE_PROCESSOR_RPC_HTTPD_H_
 
+#include <stdint.h>
+
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include "perfetto/ext/base/http/http_server.h"
+#include "perfetto/ext/base/weak_ptr.h"
+#include "src/trace_processor/rpc/rpc.h"
 
 namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}  // namespace base
+
 namespace trace_processor {
 
 class TraceProcessor;
 
+// Serves the RPC endpoints over HTTP. Exposed for testing, everything else
+// should use RunHttpRPCServer() below.
+class Httpd : public base::HttpRequestHandler {
+ public:
+  // Requests are handled on |task_runner|, which must outlive this object.
+  Httpd(std::unique_ptr<TraceProcessor>,
+        uint32_t query_threads,
+        base::TaskRunner* task_runner);
+  ~Httpd() override;
+
+  // Starts listening on localhost:|port|. Doesn't run |task_runner|.
+  void Start(int port);
+
+ private:
+  // A /query request which is being run by Rpc::QueryConcurrently() on a
+  // worker thread. The worker appends the (chunk-encoded) response to
+  // |pending_body| and the main thread sends it in FlushConcurrentQueries().
+  // Queries which have to run on the main connection instead (|fallback|) are
+  // kept, in order, until no query is running on a worker thread.
+  struct ConcurrentQuery {
+    // Only accessed on the main thread. Null if the connection was closed
+    // before the query completed.
+    base::HttpServerConnection* conn = nullptr;
+    std::string args;
+
+    std::mutex mutex;
+    std::vector<uint8_t> pending_body;  // Guarded by |mutex|.
+    bool done = false;                  // Guarded by |mutex|.
+    bool fallback = false;              // Guarded by |mutex|.
+  };
+
+  // HttpRequestHandler implementation.
+  void OnHttpRequest(const base::HttpRequest&) override;
+  void OnWebsocketMessage(const base::WebsocketMessage&) override;
+  void OnHttpConnectionClosed(base::HttpServerConnection*) override;
+
+  void ServeHelpPage(const base::HttpRequest&);
+
+  // Runs a /query request synchronously, streaming the result to |conn|.
+  void RunQuery(base::HttpServerConnection* conn,
+                const uint8_t* args,
+                size_t len);
+
+  // Sends the responses buffered by the concurrent queries so far and
+  // completes the ones which are done. Those which could not be run on a
+  // read-only connection are re-run synchronously, but only once all the
+  // others are done: Rpc::Query() would otherwise block the main thread until
+  // they complete.
+  void FlushConcurrentQueries();
+
+  // Posts FlushConcurrentQueries() on |task_runner_|. Can be called on any
+  // thread.
+  void PostFlushConcurrentQueries();
+
+  // Waits for all the concurrent queries to complete and flushes them. Called
+  // before handling any request which must observe the effects of (or be
+  // ordered after) the queries received before it.
+  void FinishConcurrentQueries();
+
+  base::TaskRunner* const task_runner_;
+  Rpc trace_processor_rpc_;
+  std::list<std::shared_ptr<ConcurrentQuery>> concurrent_queries_;
+  base::HttpServer http_srv_;
+  base::WeakPtrFactory<Httpd> weak_factory_;  // Keep last.
+};
+
 // Starts a RPC server that handles requests using protobuf-over-HTTP.
 // It takes control of the calling thread and does not return.
 // The unique_ptr argument is optional. If non-null, the HTTP server will adopt
 // an existing instance with a pre-loaded trace. If null, it will create a new
 // instance when pushing data into the /parse endpoint.
-void RunHttpRPCServer(std::unique_ptr<TraceProcessor>, std::string);
+// If |query_threads| > 0, /query requests are run concurrently on that many
+// threads whenever possible (see Rpc::QueryConcurrently()). For this to apply
+// to the pre-loaded instance, it must have been created with
+// Config::read_only_connections = |query_threads|.
+void RunHttpRPCServer(std::unique_ptr<TraceProcessor>,
+                      std::string port_number,
+                      uint32_t query_threads);
 
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
+
+#include "src/trace_processor/rpc/httpd.h"
+
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/unix_socket.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "src/base/test/test_task_runner.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using testing::ElementsAre;
+
+constexpr int kTestPort = 5128;  // One above the base::HttpServer tests.
+
+// The cells and the error of a decoded /query response. Only integer cells
+// are supported.
+struct QueryResponse {
+  std::vector<int64_t> cells;
+  std::string error;
+};
+
+// Decodes the QueryResult protos of a /query response, one per HTTP chunk.
+QueryResponse DecodeQueryResponse(const std::vector<std::string>& chunks) {
+  QueryResponse response;
+  for (const std::string& chunk : chunks) {
+    protos::pbzero::QueryResult::Decoder result(chunk);
+    response.error += result.error().ToStdString();
+    for (auto batch_it = result.batch(); batch_it; ++batch_it) {
+      protos::pbzero::QueryResult::CellsBatch::Decoder batch(*batch_it);
+      bool parse_error = false;
+      for (auto it = batch.varint_cells(&parse_error); it; ++it)
+        response.cells.push_back(*it);
+      EXPECT_FALSE(parse_error);
+    }
+  }
+  return response;
+}
+
+// Splits |rxbuf| into chunked HTTP responses and decodes them into
+// |responses|. Returns false if |rxbuf| ends with an incomplete response.
+bool ParseResponses(const std::string& rxbuf,
+                    std::vector<QueryResponse>* responses) {
+  responses->clear();
+  for (size_t pos = 0; pos < rxbuf.size();) {
+    size_t hdr_end = rxbuf.find("\r\n\r\n", pos);
+    if (hdr_end == std::string::npos)
+      return false;
+    EXPECT_EQ(rxbuf.compare(pos, 15, "HTTP/1.1 200 OK"), 0);
+    pos = hdr_end + 4;
+    std::vector<std::string> chunks;
+    for (;;) {
+      size_t size_end = rxbuf.find("\r\n", pos);
+      if (size_end == std::string::npos)
+        return false;
+      size_t size = strtoul(rxbuf.substr(pos, size_end - pos).c_str(),
+                            nullptr, 16);
+      pos = size_end + 2;
+      if (rxbuf.size() < pos + size + 2)
+        return false;
+      if (size == 0) {
+        pos += 2;
+        break;
+      }
+      chunks.push_back(rxbuf.substr(pos, size));
+      pos += size + 2;
+    }
+    responses->push_back(DecodeQueryResponse(chunks));
+  }
+  return true;
+}
+
+class HttpCli {
+ public:
+  explicit HttpCli(base::TestTaskRunner* ttr) : task_runner_(ttr) {
+    sock_ = base::UnixSocketRaw::CreateMayFail(base::SockFamily::kInet,
+                                               base::SockType::kStream);
+    sock_.SetBlocking(true);
+    sock_.Connect("127.0.0.1:" + std::to_string(kTestPort));
+  }
+
+  // Sends a /query request for each of |queries| in one go, without waiting
+  // for the responses (i.e. pipelined).
+  void SendQueries(std::initializer_list<std::string> queries) {
+    std::string req;
+    for (const std::string& sql : queries) {
+      protozero::HeapBuffered<protos::pbzero::QueryArgs> args;
+      args->set_sql_query(sql);
+      std::string body = args.SerializeAsString();
+      req += "POST /query HTTP/1.1\r\n";
+      req += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+      req += body;
+    }
+    sock_.SendStr(req);
+  }
+
+  // Runs the task runner until |count| responses have been received.
+  std::vector<QueryResponse> RecvResponses(size_t count) {
+    static int n = 0;
+    auto checkpoint_name = "rx_" + std::to_string(n++);
+    auto checkpoint = task_runner_->CreateCheckpoint(checkpoint_name);
+    std::vector<QueryResponse> responses;
+    sock_.SetBlocking(false);
+    task_runner_->AddFileDescriptorWatch(sock_.watch_handle(), [&] {
+      char buf[1024]{};
+      auto rsize = PERFETTO_EINTR(sock_.Receive(buf, sizeof(buf)));
+      if (rsize < 0)
+        return;
+      rxbuf_.append(buf, static_cast<size_t>(rsize));
+      if (rsize == 0 || (ParseResponses(rxbuf_, &responses) &&
+                         responses.size() >= count)) {
+        checkpoint();
+      }
+    });
+    task_runner_->RunUntilCheckpoint(checkpoint_name);
+    task_runner_->RemoveFileDescriptorWatch(sock_.watch_handle());
+    sock_.SetBlocking(true);
+    rxbuf_.clear();
+    return responses;
+  }
+
+ private:
+  base::TestTaskRunner* task_runner_;
+  base::UnixSocketRaw sock_;
+  std::string rxbuf_;
+};
+
+class HttpdTest : public ::testing::Test {
+ public:
+  HttpdTest() {
+    Config config;
+    config.read_only_connections = kQueryThreads;
+    std::unique_ptr<TraceProcessor> tp = TraceProcessor::CreateInstance(config);
+    tp->NotifyEndOfFile();
+    httpd_.reset(new Httpd(std::move(tp), kQueryThreads, &task_runner_));
+    httpd_->Start(kTestPort);
+  }
+
+ protected:
+  static constexpr uint32_t kQueryThreads = 2;
+
+  base::TestTaskRunner task_runner_;
+  std::unique_ptr<Httpd> httpd_;
+};
+
+TEST_F(HttpdTest, ConcurrentQueries) {
+  HttpCli cli1(&task_runner_);
+  HttpCli cli2(&task_runner_);
+  cli1.SendQueries({"select 1 union all select 2"});
+  cli2.SendQueries({"select 3"});
+
+  std::vector<QueryResponse> res2 = cli2.RecvResponses(1);
+  std::vector<QueryResponse> res1 = cli1.RecvResponses(1);
+  ASSERT_EQ(res1.size(), 1u);
+  EXPECT_EQ(res1[0].error, "");
+  EXPECT_THAT(res1[0].cells, ElementsAre(1, 2));
+  ASSERT_EQ(res2.size(), 1u);
+  EXPECT_EQ(res2[0].error, "");
+  EXPECT_THAT(res2[0].cells, ElementsAre(3));
+}
+
+TEST_F(HttpdTest, PipelinedQueriesAreAnsweredInOrder) {
+  HttpCli cli(&task_runner_);
+  cli.SendQueries({"select 1", "select 2", "select 3"});
+
+  std::vector<QueryResponse> res = cli.RecvResponses(3);
+  ASSERT_EQ(res.size(), 3u);
+  EXPECT_THAT(res[0].cells, ElementsAre(1));
+  EXPECT_THAT(res[1].cells, ElementsAre(2));
+  EXPECT_THAT(res[2].cells, ElementsAre(3));
+}
+
+// Queries which write (or read what an earlier one wrote) can't run on a
+// read-only connection and fall back to the main one.
+TEST_F(HttpdTest, FallbackToMainConnection) {
+  HttpCli cli1(&task_runner_);
+  HttpCli cli2(&task_runner_);
+  cli1.SendQueries({"create table foo as select 42 as bar"});
+  cli2.SendQueries({"select bar from foo"});
+
+  std::vector<QueryResponse> res1 = cli1.RecvResponses(1);
+  ASSERT_EQ(res1.size(), 1u);
+  EXPECT_EQ(res1[0].error, "");
+  std::vector<QueryResponse> res2 = cli2.RecvResponses(1);
+  ASSERT_EQ(res2.size(), 1u);
+  EXPECT_EQ(res2[0].error, "");
+  EXPECT_THAT(res2[0].cells, ElementsAre(42));
+
+  // A query which fails on the main connection too reports its error.
+  cli1.SendQueries({"select bar from does_not_exist"});
+  res1 = cli1.RecvResponses(1);
+  ASSERT_EQ(res1.size(), 1u);
+  EXPECT_THAT(res1[0].error, testing::HasSubstr("does_not_exist"));
+}
+
+// A query received while a fallback one is pending runs after it, even if it
+// could have run on a read-only connection.
+TEST_F(HttpdTest, QueriesAfterFallbackAreOrdered) {
+  HttpCli cli(&task_runner_);
+  cli.SendQueries({"create table foo as select 1 as bar",
+                   "insert into foo values (2)", "select bar from foo"});
+
+  std::vector<QueryResponse> res = cli.RecvResponses(3);
+  ASSERT_EQ(res.size(), 3u);
+  EXPECT_EQ(res[0].error, "");
+  EXPECT_EQ(res[1].error, "");
+  EXPECT_EQ(res[2].error, "");
+  EXPECT_THAT(res[2].cells, ElementsAre(1, 2));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // PERFETTO_TP_HTTPD
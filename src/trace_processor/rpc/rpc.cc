@@ -29,6 +29,7 @@
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/protozero/proto_ring_buffer.h"
 #include "src/trace_processor/rpc/query_result_serializer.h"
+#include "src/trace_processor/rpc/thread_pool.h"
 #include "src/trace_processor/tp_metatrace.h"
 
 #include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
@@ -89,7 +90,18 @@ void Response::Send(Rpc::RpcResponseFunction send_fn) {
 }  // namespace
 
 Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance)
-    : trace_processor_(std::move(preloaded_instance)) {
+    : Rpc(std::move(preloaded_instance), 0) {}
+
+Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance,
+         uint32_t query_threads)
+    : trace_processor_(std::move(preloaded_instance)),
+      query_threads_(query_threads) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (query_threads_ > 0)
+    query_pool_.reset(new ThreadPool(query_threads_));
+#else
+  PERFETTO_CHECK(query_threads_ == 0);
+#endif
   if (!trace_processor_)
     ResetTraceProcessor();
 }
@@ -98,7 +110,10 @@ Rpc::Rpc() : Rpc(nullptr) {}
 Rpc::~Rpc() = default;
 
 void Rpc::ResetTraceProcessor() {
-  trace_processor_ = TraceProcessor::CreateInstance(Config());
+  WaitForConcurrentQueries();
+  Config config;
+  config.read_only_connections = query_threads_;
+  trace_processor_ = TraceProcessor::CreateInstance(config);
   bytes_parsed_ = bytes_last_progress_ = 0;
   t_parse_started_ = base::GetWallTimeNs().count();
   // Deliberately not resetting the RPC channel state (rxbuf_, {tx,rx}_seq_id_).
@@ -108,6 +123,7 @@ void Rpc::ResetTraceProcessor() {
 }
 
 void Rpc::OnRpcRequest(const void* data, size_t len) {
+  WaitForConcurrentQueries();
   rxbuf_.Append(data, len);
   for (;;) {
     auto msg = rxbuf_.ReadMessage();
@@ -264,6 +280,7 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
 }
 
 util::Status Rpc::Parse(const uint8_t* data, size_t len) {
+  WaitForConcurrentQueries();
   if (eof_) {
     // Reset the trace processor state if another trace has been previously
     // loaded.
@@ -284,6 +301,7 @@ util::Status Rpc::Parse(const uint8_t* data, size_t len) {
 }
 
 void Rpc::NotifyEndOfFile() {
+  WaitForConcurrentQueries();
   trace_processor_->NotifyEndOfFile();
   eof_ = true;
   MaybePrintProgress();
@@ -306,6 +324,7 @@ void Rpc::MaybePrintProgress() {
 void Rpc::Query(const uint8_t* args,
                 size_t len,
                 QueryResultBatchCallback result_callback) {
+  WaitForConcurrentQueries();
   auto it = QueryInternal(args, len);
   QueryResultSerializer serializer(std::move(it));
 
@@ -317,6 +336,51 @@ void Rpc::Query(const uint8_t* args,
   }
 }
 
+bool Rpc::QueryConcurrently(const uint8_t* args,
+                            size_t len,
+                            QueryResultBatchCallback result_callback,
+                            std::function<void()> fallback_callback) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (!query_pool_)
+    return false;
+
+  protos::pbzero::RawQueryArgs::Decoder query(args, len);
+  std::string sql = query.sql_query().ToStdString();
+  PERFETTO_DLOG("[RPC] Concurrent query < %s", sql.c_str());
+
+  TraceProcessor* tp = trace_processor_.get();
+  query_pool_->PostTask([tp, sql, result_callback, fallback_callback] {
+    {
+      auto it = tp->ExecuteReadOnlyQuery(sql);
+      if (it.Status().ok()) {
+        QueryResultSerializer serializer(std::move(it));
+        std::vector<uint8_t> res;
+        for (bool has_more = true; has_more;) {
+          has_more = serializer.Serialize(&res);
+          result_callback(res.data(), res.size(), has_more);
+          res.clear();
+        }
+        return;
+      }
+    }
+    // The iterator has been destroyed at this point, giving the connection
+    // back to |tp| before the caller re-issues the query.
+    fallback_callback();
+  });
+  return true;
+#else
+  base::ignore_result(args, len, result_callback, fallback_callback);
+  return false;
+#endif
+}
+
+void Rpc::WaitForConcurrentQueries() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (query_pool_)
+    query_pool_->WaitUntilIdle();
+#endif
+}
+
 Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
   protos::pbzero::RawQueryArgs::Decoder query(args, len);
   std::string sql = query.sql_query().ToStdString();
@@ -328,6 +392,7 @@ Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
 }
 
 std::vector<uint8_t> Rpc::RawQuery(const uint8_t* args, size_t len) {
+  WaitForConcurrentQueries();
   protozero::HeapBuffered<protos::pbzero::RawQueryResult> result;
   RawQueryInternal(args, len, result.get());
   return result.SerializeAsArray();
@@ -462,10 +527,12 @@ void Rpc::RawQueryInternal(const uint8_t* args,
 }
 
 void Rpc::RestoreInitialTables() {
+  WaitForConcurrentQueries();
   trace_processor_->RestoreInitialTables();
 }
 
 std::vector<uint8_t> Rpc::ComputeMetric(const uint8_t* args, size_t len) {
+  WaitForConcurrentQueries();
   protozero::HeapBuffered<protos::pbzero::ComputeMetricResult> result;
   ComputeMetricInternal(args, len, result.get());
   return result.SerializeAsArray();
@@ -518,10 +585,12 @@ void Rpc::ComputeMetricInternal(const uint8_t* data,
 }
 
 void Rpc::EnableMetatrace() {
+  WaitForConcurrentQueries();
   trace_processor_->EnableMetatrace();
 }
 
 std::vector<uint8_t> Rpc::DisableAndReadMetatrace() {
+  WaitForConcurrentQueries();
   protozero::HeapBuffered<protos::pbzero::DisableAndReadMetatraceResult> result;
   DisableAndReadMetatraceInternal(result.get());
   return result.SerializeAsArray();
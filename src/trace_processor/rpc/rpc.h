@@ -24,6 +24,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/protozero/proto_ring_buffer.h"
 
@@ -40,6 +41,7 @@ class DisableAndReadMetatraceResult;
 namespace trace_processor {
 
 class Iterator;
+class ThreadPool;
 class TraceProcessor;
 
 // This class handles the binary {,un}marshalling for the Trace Processor RPC
@@ -63,6 +65,12 @@ class Rpc {
   // created internally by calling Parse().
   explicit Rpc(std::unique_ptr<TraceProcessor>);
   Rpc();
+
+  // |query_threads| > 0 enables QueryConcurrently() (below). Each trace loaded
+  // through Parse() opens that many read-only connections (see
+  // Config::read_only_connections) once NotifyEndOfFile() is called. Must be 0
+  // in WASM builds, which have no threads.
+  Rpc(std::unique_ptr<TraceProcessor>, uint32_t query_threads);
   ~Rpc();
 
   // 1. TraceProcessor byte-pipe RPC interface.
@@ -130,6 +138,27 @@ class Rpc {
       void(const uint8_t* /*buf*/, size_t /*len*/, bool /*has_more*/)>;
   void Query(const uint8_t* args, size_t len, QueryResultBatchCallback);
 
+  // Like Query() but runs the query on a read-only connection on one of the
+  // |query_threads| worker threads, so that queries which don't depend on each
+  // other can run concurrently. Returns immediately.
+  // |result_callback| is invoked on the worker thread. If the query cannot be
+  // run on a read-only connection (e.g. it references a table created by a
+  // previous query) |fallback_callback| is invoked instead, also on the worker
+  // thread: the caller is expected to re-issue the query through Query() from
+  // its own thread.
+  // Returns false, without running anything, if concurrent queries are not
+  // enabled (or in WASM builds); in that case the caller should use Query().
+  // Any other method of this class waits for the queries issued through this
+  // method to complete before running.
+  bool QueryConcurrently(const uint8_t* args,
+                         size_t len,
+                         QueryResultBatchCallback result_callback,
+                         std::function<void()> fallback_callback);
+
+  // Blocks until all the queries issued through QueryConcurrently() have
+  // completed (i.e. all their callbacks have returned).
+  void WaitForConcurrentQueries();
+
   // DEPRECATED, only for legacy clients. Use |Query()| above.
   std::vector<uint8_t> RawQuery(const uint8_t* args, size_t len);
 
@@ -148,6 +177,13 @@ class Rpc {
       protos::pbzero::DisableAndReadMetatraceResult*);
 
   std::unique_ptr<TraceProcessor> trace_processor_;
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  // Declared after |trace_processor_| so that the worker threads are joined
+  // before the TraceProcessor they query is destroyed.
+  std::unique_ptr<ThreadPool> query_pool_;
+#endif
+  uint32_t query_threads_ = 0;
   RpcResponseFunction rpc_response_fn_;
   protozero::ProtoRingBuffer rxbuf_;
   int64_t tx_seq_id_ = 0;
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/thread_pool.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#include <string>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  PERFETTO_CHECK(num_threads > 0);
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    runners_.emplace_back(
+        new base::ThreadTaskRunner(base::ThreadTaskRunner::CreateAndStart(
+            "tp_query" + std::to_string(i))));
+    idle_runners_.push_back(runners_.back().get());
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  WaitUntilIdle();
+}
+
+void ThreadPool::PostTask(std::function<void()> task) {
+  base::ThreadTaskRunner* runner = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.emplace_back(std::move(task));
+    pending_tasks_++;
+    // Otherwise, all the runners are busy and the first one to finish its
+    // task picks this one up.
+    if (!idle_runners_.empty()) {
+      runner = idle_runners_.back();
+      idle_runners_.pop_back();
+    }
+  }
+  if (runner)
+    runner->PostTask([this, runner] { RunTasks(runner); });
+}
+
+void ThreadPool::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return pending_tasks_ == 0; });
+}
+
+void ThreadPool::RunTasks(base::ThreadTaskRunner* runner) {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (tasks_.empty()) {
+        idle_runners_.push_back(runner);
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      idle = --pending_tasks_ == 0;
+    }
+    if (idle)
+      idle_cv_.notify_all();
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
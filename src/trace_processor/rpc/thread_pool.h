@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_THREAD_POOL_H_
+#define SRC_TRACE_PROCESSOR_RPC_THREAD_POOL_H_
+
+#include "perfetto/base/build_config.h"
+
+// WASM builds have no threads and run all the queries on the main connection.
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "perfetto/ext/base/thread_task_runner.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A fixed-size pool of base::ThreadTaskRunner which run tasks in FIFO order.
+// Each task runs on whichever thread is free first, so a long task doesn't
+// hold up the tasks posted after it. Used by Rpc to run queries on the
+// read-only connections of TraceProcessor concurrently.
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t num_threads);
+
+  // Waits for all the posted tasks to complete before stopping the threads.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues |task| to be run on one of the threads of the pool.
+  void PostTask(std::function<void()> task);
+
+  // Blocks until all the tasks posted so far have completed.
+  void WaitUntilIdle();
+
+  uint32_t num_threads() const {
+    return static_cast<uint32_t>(runners_.size());
+  }
+
+ private:
+  // Runs the queued tasks on |runner| until there are none left, then puts
+  // |runner| back in |idle_runners_|.
+  void RunTasks(base::ThreadTaskRunner* runner);
+
+  std::mutex mutex_;
+
+  // Signalled when |pending_tasks_| drops to zero.
+  std::condition_variable idle_cv_;
+
+  std::deque<std::function<void()>> tasks_;
+
+  // The number of tasks either in |tasks_| or running.
+  uint32_t pending_tasks_ = 0;
+
+  // The runners which aren't running RunTasks().
+  std::vector<base::ThreadTaskRunner*> idle_runners_;
+
+  // Keep last: the threads are stopped before the state above is destroyed.
+  std::vector<std::unique_ptr<base::ThreadTaskRunner>> runners_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_THREAD_POOL_H_
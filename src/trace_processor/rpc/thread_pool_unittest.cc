@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/thread_pool.h"
+
+#include <atomic>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  std::atomic<uint32_t> count{0};
+  ThreadPool pool(3);
+  for (uint32_t i = 0; i < 100; ++i)
+    pool.PostTask([&count] { count++; });
+  pool.WaitUntilIdle();
+  ASSERT_EQ(count.load(), 100u);
+
+  pool.PostTask([&count] { count++; });
+  pool.WaitUntilIdle();
+  ASSERT_EQ(count.load(), 101u);
+}
+
+TEST(ThreadPoolTest, DestructorDrainsTasks) {
+  std::atomic<uint32_t> count{0};
+  {
+    ThreadPool pool(2);
+    for (uint32_t i = 0; i < 10; ++i)
+      pool.PostTask([&count] { count++; });
+  }
+  ASSERT_EQ(count.load(), 10u);
+}
+
+TEST(ThreadPoolTest, RunsTasksConcurrently) {
+  // Each task waits for the other one to start: this would deadlock if the
+  // tasks were run sequentially.
+  std::atomic<uint32_t> started{0};
+  ThreadPool pool(2);
+  for (uint32_t i = 0; i < 2; ++i) {
+    pool.PostTask([&started] {
+      started++;
+      while (started.load() < 2) {
+      }
+    });
+  }
+  pool.WaitUntilIdle();
+  ASSERT_EQ(started.load(), 2u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -175,7 +175,7 @@ SqliteTable::Schema DbSqliteTable::ComputeSchema(const Table::Schema& schema,
 int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
   switch (computation_) {
     case TableComputation::kStatic:
-      BestIndex(schema_, static_table_->row_count(), qc, info);
+      BestIndex(schema_, static_table_->row_count(), qc, info, static_table_);
       break;
     case TableComputation::kDynamic:
       base::Status status = generator_->ValidateConstraints(qc);
@@ -190,8 +190,9 @@ int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
 void DbSqliteTable::BestIndex(const Table::Schema& schema,
                               uint32_t row_count,
                               const QueryConstraints& qc,
-                              BestIndexInfo* info) {
-  auto cost_and_rows = EstimateCost(schema, row_count, qc);
+                              BestIndexInfo* info,
+                              const Table* static_table) {
+  auto cost_and_rows = EstimateCost(schema, row_count, qc, static_table);
   info->estimated_cost = cost_and_rows.cost;
   info->estimated_rows = cost_and_rows.rows;
 
@@ -270,7 +271,8 @@ void DbSqliteTable::ModifyConstraints(const Table::Schema& schema,
 DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
     const Table::Schema& schema,
     uint32_t row_count,
-    const QueryConstraints& qc) {
+    const QueryConstraints& qc,
+    const Table* static_table) {
   // Currently our cost estimation algorithm is quite simplistic but is good
   // enough for the simplest cases.
   // TODO(lalitm): replace hardcoded constants with either more heuristics
@@ -298,7 +300,13 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
   for (const auto& c : cs) {
     if (current_row_count < 2)
       break;
-    const auto& col_schema = schema.columns[static_cast<uint32_t>(c.column)];
+    uint32_t col_idx = static_cast<uint32_t>(c.column);
+    const auto& col_schema = schema.columns[col_idx];
+
+    // Columns with a sorted index can be filtered with a binary search, just
+    // like sorted columns.
+    bool is_indexed =
+        static_table && static_table->GetColumn(col_idx).HasSortedIndex();
     if (sqlite_utils::IsOpEq(c.op) && col_schema.is_id) {
       // If we have an id equality constraint, we can very efficiently filter
       // down to a single row in C++. However, if we're joining with another
@@ -313,10 +321,10 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
       // to sort by that column and then binary search if we see the constraint
       // set often. Model this by dividing by the log of the number of rows as
       // a good approximation. Otherwise, we'll need to do a full table scan.
-      // Alternatively, if the column is sorted, we can use the same binary
-      // search logic so we have the same low cost (even better because we don't
-      // have to sort at all).
-      filter_cost += cs.size() == 1 || col_schema.is_sorted
+      // Alternatively, if the column is sorted or indexed, we can use the same
+      // binary search logic so we have the same low cost (even better because
+      // we don't have to sort at all).
+      filter_cost += cs.size() == 1 || col_schema.is_sorted || is_indexed
                          ? log2(current_row_count)
                          : current_row_count;
 
@@ -325,12 +333,12 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
       // of rows.
       double estimated_rows = current_row_count / (2 * log2(current_row_count));
       current_row_count = std::max(static_cast<uint32_t>(estimated_rows), 1u);
-    } else if (col_schema.is_sorted &&
+    } else if ((col_schema.is_sorted || is_indexed) &&
                (sqlite_utils::IsOpLe(c.op) || sqlite_utils::IsOpLt(c.op) ||
                 sqlite_utils::IsOpGt(c.op) || sqlite_utils::IsOpGe(c.op))) {
-      // On a sorted column, if we see any partition constraints, we can do this
-      // filter very efficiently. Model this using the log of the  number of
-      // rows as a good approximation.
+      // On a sorted (or indexed) column, if we see any partition constraints,
+      // we can do this filter very efficiently. Model this using the log of
+      // the number of rows as a good approximation.
       filter_cost += log2(current_row_count);
 
       // As an extremely rough heuristic, assume that an partition constraint
@@ -424,6 +432,37 @@ void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
       });
 }
 
+RowMap DbSqliteTable::Cursor::FilterSourceTable(
+    RowMap::OptimizeFor optimize_for) {
+  const Table* source = SourceTable();
+
+  // Only cache filters on tables owned by TraceStorage: these outlive the
+  // cache while computed tables and |sorted_cache_table_| do not (and their
+  // address may be reused by a different table after they are freed).
+  // Filters on small tables are cheap enough that caching them is not
+  // worthwhile.
+  constexpr uint32_t kMinRowsForFilterCache = 16 * 1024;
+  bool is_static =
+      db_sqlite_table_->computation_ == TableComputation::kStatic &&
+      source == db_sqlite_table_->static_table_;
+  bool cacheable = cache_ && is_static && !constraints_.empty() &&
+                   source->row_count() >= kMinRowsForFilterCache;
+  if (!cacheable)
+    return source->FilterToRowMap(constraints_, optimize_for);
+
+  base::Optional<RowMap> cached =
+      cache_->GetFilterResult(source, constraints_, optimize_for);
+  if (cached)
+    return std::move(*cached);
+
+  RowMap filter_map = source->FilterToRowMap(constraints_, optimize_for);
+
+  // Ranges are already as cheap to compute as to look up.
+  if (!filter_map.IsRange())
+    cache_->CacheFilterResult(source, constraints_, optimize_for, filter_map);
+  return filter_map;
+}
+
 int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
                                   sqlite3_value** argv,
                                   FilterHistory history) {
@@ -568,7 +607,7 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
   RowMap::OptimizeFor optimize_for = orders_.empty()
                                          ? RowMap::OptimizeFor::kMemory
                                          : RowMap::OptimizeFor::kLookupSpeed;
-  RowMap filter_map = SourceTable()->FilterToRowMap(constraints_, optimize_for);
+  RowMap filter_map = FilterSourceTable(optimize_for);
 
   // If we have no order by constraints and it's cheap for us to use the
   // RowMap, just use the RowMap directoy.
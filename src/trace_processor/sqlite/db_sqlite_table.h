@@ -97,6 +97,10 @@ class DbSqliteTable : public SqliteTable {
     // constraint set matches the requirements.
     void TryCacheCreateSortedTable(const QueryConstraints&, FilterHistory);
 
+    // Filters |SourceTable()| using |constraints_|, reusing the result of a
+    // previous identical filter from |cache_| where possible.
+    RowMap FilterSourceTable(RowMap::OptimizeFor);
+
     const Table* SourceTable() const {
       // Try and use the sorted cache table (if it exists) to speed up the
       // sorting. Otherwise, just use the original table.
@@ -183,12 +187,16 @@ class DbSqliteTable : public SqliteTable {
   static void BestIndex(const Table::Schema&,
                         uint32_t row_count,
                         const QueryConstraints&,
-                        BestIndexInfo*);
+                        BestIndexInfo*,
+                        const Table* static_table = nullptr);
 
   // static for testing.
+  // If |static_table| is set, the cost takes into account the columns of the
+  // table which have a sorted index (see Column::HasSortedIndex).
   static QueryCost EstimateCost(const Table::Schema&,
                                 uint32_t row_count,
-                                const QueryConstraints& qc);
+                                const QueryConstraints& qc,
+                                const Table* static_table = nullptr);
 
  private:
   QueryCache* cache_ = nullptr;
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include <algorithm>
+
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+size_t ApproxTableBytes(const Table& table) {
+  size_t bytes = 0;
+  for (const RowMap& rm : table.row_maps())
+    bytes += rm.ApproxBytesUsed();
+  return bytes;
+}
+
+// Returns a value which changes whenever any column filtered by |cs| is
+// mutated.
+uint64_t MutationSignature(const Table* source,
+                           const std::vector<trace_processor::Constraint>& cs) {
+  uint64_t mutations = 0;
+  for (const auto& c : cs)
+    mutations += source->GetColumn(c.col_idx).mutations();
+  return mutations;
+}
+
+}  // namespace
+
+// static
+constexpr size_t QueryCache::kDefaultMaxEntries;
+constexpr size_t QueryCache::kDefaultMaxBytes;
+
+QueryCache::QueryCache(TraceStorage* storage,
+                       size_t max_entries,
+                       size_t max_bytes)
+    : storage_(storage), max_entries_(max_entries), max_bytes_(max_bytes) {}
+
+QueryCache::~QueryCache() = default;
+
+std::shared_ptr<Table> QueryCache::GetIfCached(
+    const Table* source,
+    const std::vector<Constraint>& cs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetIfCachedLocked(source, cs);
+}
+
+std::shared_ptr<Table> QueryCache::GetIfCachedLocked(
+    const Table* source,
+    const std::vector<Constraint>& cs) {
+  auto it = FindSortedTable(source, cs);
+  if (it == entries_.end()) {
+    IncrementStat(stats::query_cache_misses);
+    return nullptr;
+  }
+  IncrementStat(stats::query_cache_hits);
+  Touch(it);
+  return it->sorted_table;
+}
+
+std::shared_ptr<Table> QueryCache::GetOrCache(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    std::function<Table()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<Table> cached = GetIfCachedLocked(source, cs);
+    if (cached)
+      return cached;
+  }
+
+  // Sorting can be slow so don't block other threads while doing it. If
+  // another thread computes the same table in the meantime, the first one to
+  // finish wins.
+  Entry entry;
+  entry.type = Entry::Type::kSortedTable;
+  entry.source = source;
+  entry.source_row_count = source->row_count();
+  entry.sorted_constraints = cs;
+  entry.sorted_table.reset(new Table(fn()));
+  entry.bytes = ApproxTableBytes(*entry.sorted_table);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = FindSortedTable(source, cs);
+  if (it != entries_.end()) {
+    Touch(it);
+    return it->sorted_table;
+  }
+
+  // Note: the table is returned even if it's too big to be cached: the caller
+  // needs it regardless.
+  std::shared_ptr<Table> table = entry.sorted_table;
+  Insert(std::move(entry));
+  return table;
+}
+
+base::Optional<RowMap> QueryCache::GetFilterResult(
+    const Table* source,
+    const std::vector<trace_processor::Constraint>& cs,
+    RowMap::OptimizeFor optimize_for) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = FindFilterResult(source, cs, optimize_for);
+  if (it == entries_.end()) {
+    IncrementStat(stats::query_cache_misses);
+    return base::nullopt;
+  }
+  IncrementStat(stats::query_cache_hits);
+  Touch(it);
+  return it->filter_result.Copy();
+}
+
+void QueryCache::CacheFilterResult(
+    const Table* source,
+    const std::vector<trace_processor::Constraint>& cs,
+    RowMap::OptimizeFor optimize_for,
+    const RowMap& rm) {
+  Entry entry;
+  entry.type = Entry::Type::kFilterResult;
+  entry.source = source;
+  entry.source_row_count = source->row_count();
+  entry.source_mutations = MutationSignature(source, cs);
+  entry.optimize_for = optimize_for;
+  for (const auto& c : cs) {
+    CachedConstraint cached{c.col_idx, c.op, c.value.type, 0, 0, ""};
+    switch (c.value.type) {
+      case SqlValue::Type::kNull:
+        break;
+      case SqlValue::Type::kLong:
+        cached.long_value = c.value.long_value;
+        break;
+      case SqlValue::Type::kDouble:
+        cached.double_value = c.value.double_value;
+        break;
+      case SqlValue::Type::kString:
+        cached.string_value = c.value.string_value;
+        break;
+      case SqlValue::Type::kBytes:
+        // Filtering on bytes is rare enough that it's not worth the
+        // complexity of caching it.
+        return;
+    }
+    entry.filter_constraints.emplace_back(std::move(cached));
+  }
+  entry.filter_result = rm.Copy();
+  entry.bytes = entry.filter_result.ApproxBytesUsed();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = FindFilterResult(source, cs, optimize_for);
+  if (it != entries_.end())
+    Erase(it);
+  Insert(std::move(entry));
+}
+
+std::list<QueryCache::Entry>::iterator QueryCache::FindSortedTable(
+    const Table* source,
+    const std::vector<Constraint>& cs) {
+  auto p = [](const Constraint& a, const Constraint& b) {
+    return a.column == b.column && a.op == b.op;
+  };
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->type != Entry::Type::kSortedTable || it->source != source ||
+        it->sorted_constraints.size() != cs.size() ||
+        !std::equal(cs.begin(), cs.end(), it->sorted_constraints.begin(), p)) {
+      continue;
+    }
+    // If the source table has grown since the entry was created, the sorted
+    // copy is missing rows: drop it so that it gets recomputed.
+    if (it->source_row_count != source->row_count()) {
+      Erase(it);
+      return entries_.end();
+    }
+    return it;
+  }
+  return entries_.end();
+}
+
+std::list<QueryCache::Entry>::iterator QueryCache::FindFilterResult(
+    const Table* source,
+    const std::vector<trace_processor::Constraint>& cs,
+    RowMap::OptimizeFor optimize_for) {
+  auto p = [](const trace_processor::Constraint& a, const CachedConstraint& b) {
+    if (a.col_idx != b.col_idx || a.op != b.op || a.value.type != b.type)
+      return false;
+    switch (b.type) {
+      case SqlValue::Type::kNull:
+        return true;
+      case SqlValue::Type::kLong:
+        return a.value.long_value == b.long_value;
+      case SqlValue::Type::kDouble:
+        return a.value.double_value == b.double_value;
+      case SqlValue::Type::kString:
+        return b.string_value == a.value.string_value;
+      case SqlValue::Type::kBytes:
+        return false;
+    }
+    PERFETTO_FATAL("For GCC");
+  };
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->type != Entry::Type::kFilterResult || it->source != source ||
+        it->optimize_for != optimize_for ||
+        it->filter_constraints.size() != cs.size() ||
+        !std::equal(cs.begin(), cs.end(), it->filter_constraints.begin(), p)) {
+      continue;
+    }
+    // Any change to the source table (new rows or updated values in one of
+    // the filtered columns) can change the result of the filter.
+    if (it->source_row_count != source->row_count() ||
+        it->source_mutations != MutationSignature(source, cs)) {
+      Erase(it);
+      return entries_.end();
+    }
+    return it;
+  }
+  return entries_.end();
+}
+
+void QueryCache::Touch(std::list<Entry>::iterator it) {
+  entries_.splice(entries_.begin(), entries_, it);
+}
+
+void QueryCache::Insert(Entry entry) {
+  if (entry.bytes > max_bytes_ || max_entries_ == 0)
+    return;
+
+  bytes_used_ += entry.bytes;
+  entries_.emplace_front(std::move(entry));
+  while (entries_.size() > max_entries_ || bytes_used_ > max_bytes_) {
+    Erase(std::prev(entries_.end()));
+    IncrementStat(stats::query_cache_evictions);
+  }
+}
+
+void QueryCache::Erase(std::list<Entry>::iterator it) {
+  PERFETTO_DCHECK(bytes_used_ >= it->bytes);
+  bytes_used_ -= it->bytes;
+  entries_.erase(it);
+}
+
+void QueryCache::IncrementStat(size_t key) {
+  if (storage_)
+    storage_->IncrementStats(key);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
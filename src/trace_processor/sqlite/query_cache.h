@@ -17,15 +17,44 @@
 #ifndef SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 #define SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "perfetto/ext/base/optional.h"
 
+#include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/sqlite/query_constraints.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+class TraceStorage;
+
 // Implements a simple caching strategy for commonly executed queries.
+//
+// Two kinds of results are cached:
+//  1) copies of a table sorted on a column which is repeatedly filtered with
+//     an equality constraint, keyed on the table and the shape of the
+//     constraint set (i.e. ignoring the values).
+//  2) the RowMap obtained by filtering a table, keyed on the table and the
+//     constraints (including their values).
+//
+// Entries are evicted in least-recently-used order when either the number of
+// entries or the approximate memory used by them exceeds the configured
+// limits. Hits, misses and evictions are reported in the stats table.
+//
+// This class is thread-safe: a single instance is shared by all the SQLite
+// connections of a trace processor instance, including the read-only ones
+// which run queries concurrently.
+//
 // TODO(lalitm): the design of this class is very experimental. It was mainly
 // introduced to solve a specific problem (slow process summary tracks in the
 // Perfetto UI) and should not be modified without a full design discussion.
@@ -33,46 +62,120 @@ class QueryCache {
  public:
   using Constraint = QueryConstraints::Constraint;
 
+  static constexpr size_t kDefaultMaxEntries = 64;
+  static constexpr size_t kDefaultMaxBytes = 128 * 1024 * 1024;
+
+  // |storage| is used to report stats and can be nullptr.
+  explicit QueryCache(TraceStorage* storage,
+                      size_t max_entries = kDefaultMaxEntries,
+                      size_t max_bytes = kDefaultMaxBytes);
+  ~QueryCache();
+
   // Returns a cached table if the passed query set are currenly cached or
   // nullptr otherwise.
   std::shared_ptr<Table> GetIfCached(const Table* source,
-                                     const std::vector<Constraint>& cs) const {
-    if (cached_.source != source || cs.size() != cached_.constraints.size())
-      return nullptr;
-
-    auto p = [](const Constraint& a, const Constraint& b) {
-      return a.column == b.column && a.op == b.op;
-    };
-    bool same_cs =
-        std::equal(cs.begin(), cs.end(), cached_.constraints.begin(), p);
-    return same_cs ? cached_.table : nullptr;
-  }
+                                     const std::vector<Constraint>& cs);
 
   // Caches the table with the given source, constraint and order set. Returns
   // a pointer to the newly cached table.
-  std::shared_ptr<Table> GetOrCache(
+  std::shared_ptr<Table> GetOrCache(const Table* source,
+                                    const std::vector<Constraint>& cs,
+                                    std::function<Table()> fn);
+
+  // Returns a copy of the RowMap cached for filtering |source| with |cs| or
+  // base::nullopt if there is no such RowMap.
+  //
+  // |source| should outlive the cache (i.e. be one of the tables in
+  // TraceStorage) as the cache is keyed on its address.
+  base::Optional<RowMap> GetFilterResult(
       const Table* source,
-      const std::vector<QueryConstraints::Constraint>& cs,
-      std::function<Table()> fn) {
-    std::shared_ptr<Table> cached = GetIfCached(source, cs);
-    if (cached)
-      return cached;
-
-    cached_.source = source;
-    cached_.constraints = cs;
-    cached_.table.reset(new Table(fn()));
-    return cached_.table;
+      const std::vector<trace_processor::Constraint>& cs,
+      RowMap::OptimizeFor optimize_for);
+
+  // Caches |rm| as the result of filtering |source| with |cs|.
+  void CacheFilterResult(const Table* source,
+                         const std::vector<trace_processor::Constraint>& cs,
+                         RowMap::OptimizeFor optimize_for,
+                         const RowMap& rm);
+
+  size_t entry_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+  size_t bytes_used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_used_;
   }
 
  private:
-  struct CachedTable {
-    std::shared_ptr<Table> table;
+  // A copy of a trace_processor::Constraint which owns any string value.
+  struct CachedConstraint {
+    uint32_t col_idx;
+    FilterOp op;
+    SqlValue::Type type;
+    int64_t long_value;
+    double double_value;
+    std::string string_value;
+  };
 
+  struct Entry {
+    enum class Type {
+      kSortedTable,
+      kFilterResult,
+    };
+    Type type;
+
+    // The table this entry was computed from and its size (and, for filter
+    // results, the mutation count of the filtered columns) at that time.
+    // These are used to detect entries which became stale because |source|
+    // changed.
     const Table* source = nullptr;
-    std::vector<Constraint> constraints;
+    uint32_t source_row_count = 0;
+    uint64_t source_mutations = 0;
+
+    // Only valid for Type::kSortedTable.
+    std::vector<Constraint> sorted_constraints;
+    std::shared_ptr<Table> sorted_table;
+
+    // Only valid for Type::kFilterResult.
+    std::vector<CachedConstraint> filter_constraints;
+    RowMap::OptimizeFor optimize_for = RowMap::OptimizeFor::kMemory;
+    RowMap filter_result;
+
+    size_t bytes = 0;
   };
 
-  CachedTable cached_;
+  // Must be called with |mutex_| held.
+  std::shared_ptr<Table> GetIfCachedLocked(const Table* source,
+                                           const std::vector<Constraint>& cs);
+
+  // All the methods below must be called with |mutex_| held.
+  std::list<Entry>::iterator FindSortedTable(const Table* source,
+                                             const std::vector<Constraint>&);
+  std::list<Entry>::iterator FindFilterResult(
+      const Table* source,
+      const std::vector<trace_processor::Constraint>&,
+      RowMap::OptimizeFor);
+
+  // Moves |it| to the front of the LRU list.
+  void Touch(std::list<Entry>::iterator it);
+
+  // Adds |entry| as the most recently used entry and evicts entries until the
+  // cache is back within its limits.
+  void Insert(Entry entry);
+  void Erase(std::list<Entry>::iterator it);
+
+  void IncrementStat(size_t key);
+
+  TraceStorage* const storage_;
+  const size_t max_entries_;
+  const size_t max_bytes_;
+
+  mutable std::mutex mutex_;
+
+  // Ordered from most to least recently used.
+  std::list<Entry> entries_;
+  size_t bytes_used_ = 0;
 };
 
 }  // namespace trace_processor
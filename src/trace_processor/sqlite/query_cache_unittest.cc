@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include <sqlite3.h>
+
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_CACHE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCacheTable, "cache")                           \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(int64_t, track_id)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_CACHE_TABLE_DEF);
+
+TestCacheTable::~TestCacheTable() = default;
+
+class QueryCacheTest : public ::testing::Test {
+ protected:
+  QueryCacheTest() : table_(&pool_, nullptr) {
+    for (uint32_t i = 0; i < 1024; ++i)
+      table_.Insert(TestCacheTable::Row(i % 8));
+  }
+
+  std::vector<uint32_t> Rows(const RowMap& rm) {
+    std::vector<uint32_t> rows;
+    for (auto it = rm.IterateRows(); it; it.Next())
+      rows.push_back(it.index());
+    return rows;
+  }
+
+  StringPool pool_;
+  TestCacheTable table_;
+};
+
+TEST_F(QueryCacheTest, FilterResultHitAndMiss) {
+  QueryCache cache(nullptr);
+  auto opt = RowMap::OptimizeFor::kMemory;
+  std::vector<Constraint> cs = {table_.track_id().eq(3)};
+  ASSERT_FALSE(cache.GetFilterResult(&table_, cs, opt));
+
+  RowMap rm = table_.FilterToRowMap(cs, opt);
+  cache.CacheFilterResult(&table_, cs, opt, rm);
+
+  auto cached = cache.GetFilterResult(&table_, cs, opt);
+  ASSERT_TRUE(cached);
+  ASSERT_EQ(Rows(*cached), Rows(rm));
+
+  // Different values, ops or optimization targets should not match.
+  ASSERT_FALSE(
+      cache.GetFilterResult(&table_, {table_.track_id().eq(4)}, opt));
+  ASSERT_FALSE(
+      cache.GetFilterResult(&table_, {table_.track_id().ge(3)}, opt));
+  ASSERT_FALSE(cache.GetFilterResult(&table_, cs,
+                                     RowMap::OptimizeFor::kLookupSpeed));
+}
+
+TEST_F(QueryCacheTest, FilterResultInvalidatedOnChange) {
+  QueryCache cache(nullptr);
+  auto opt = RowMap::OptimizeFor::kMemory;
+  std::vector<Constraint> cs = {table_.track_id().eq(3)};
+  cache.CacheFilterResult(&table_, cs, opt, table_.FilterToRowMap(cs, opt));
+
+  table_.mutable_track_id()->Set(0, 3);
+  ASSERT_FALSE(cache.GetFilterResult(&table_, cs, opt));
+  ASSERT_EQ(cache.entry_count(), 0u);
+
+  cache.CacheFilterResult(&table_, cs, opt, table_.FilterToRowMap(cs, opt));
+  table_.Insert(TestCacheTable::Row(3));
+  ASSERT_FALSE(cache.GetFilterResult(&table_, cs, opt));
+}
+
+TEST_F(QueryCacheTest, EvictsLeastRecentlyUsed) {
+  QueryCache cache(nullptr, 2 /* max_entries */);
+  auto opt = RowMap::OptimizeFor::kMemory;
+  std::vector<Constraint> cs0 = {table_.track_id().eq(0)};
+  std::vector<Constraint> cs1 = {table_.track_id().eq(1)};
+  std::vector<Constraint> cs2 = {table_.track_id().eq(2)};
+
+  cache.CacheFilterResult(&table_, cs0, opt, table_.FilterToRowMap(cs0, opt));
+  cache.CacheFilterResult(&table_, cs1, opt, table_.FilterToRowMap(cs1, opt));
+
+  // Touch |cs0| so that |cs1| becomes the least recently used entry.
+  ASSERT_TRUE(cache.GetFilterResult(&table_, cs0, opt));
+  cache.CacheFilterResult(&table_, cs2, opt, table_.FilterToRowMap(cs2, opt));
+
+  ASSERT_EQ(cache.entry_count(), 2u);
+  ASSERT_TRUE(cache.GetFilterResult(&table_, cs0, opt));
+  ASSERT_FALSE(cache.GetFilterResult(&table_, cs1, opt));
+  ASSERT_TRUE(cache.GetFilterResult(&table_, cs2, opt));
+}
+
+TEST_F(QueryCacheTest, EvictsOverByteLimit) {
+  auto opt = RowMap::OptimizeFor::kMemory;
+  std::vector<Constraint> cs0 = {table_.track_id().eq(0)};
+  std::vector<Constraint> cs1 = {table_.track_id().eq(1)};
+  RowMap rm0 = table_.FilterToRowMap(cs0, opt);
+  RowMap rm1 = table_.FilterToRowMap(cs1, opt);
+
+  QueryCache cache(nullptr, QueryCache::kDefaultMaxEntries,
+                   rm0.ApproxBytesUsed() + rm1.ApproxBytesUsed() - 1);
+  cache.CacheFilterResult(&table_, cs0, opt, rm0);
+  cache.CacheFilterResult(&table_, cs1, opt, rm1);
+
+  ASSERT_EQ(cache.entry_count(), 1u);
+  ASSERT_LE(cache.bytes_used(), rm1.ApproxBytesUsed());
+  ASSERT_TRUE(cache.GetFilterResult(&table_, cs1, opt));
+}
+
+TEST_F(QueryCacheTest, MultipleSortedTables) {
+  QueryCache cache(nullptr);
+  uint32_t col = table_.track_id().index_in_table();
+  QueryConstraints::Constraint eq{static_cast<int>(col),
+                                  SQLITE_INDEX_CONSTRAINT_EQ, 0};
+  QueryConstraints::Constraint gt{static_cast<int>(col),
+                                  SQLITE_INDEX_CONSTRAINT_GT, 0};
+
+  uint32_t sort_count = 0;
+  auto sort = [this, col, &sort_count]() {
+    sort_count++;
+    return table_.Sort({Order{col, false}});
+  };
+  auto eq_table = cache.GetOrCache(&table_, {eq}, sort);
+  auto gt_table = cache.GetOrCache(&table_, {gt}, sort);
+  ASSERT_EQ(sort_count, 2u);
+
+  // Both tables should now be cached independently.
+  ASSERT_EQ(cache.GetIfCached(&table_, {eq}), eq_table);
+  ASSERT_EQ(cache.GetIfCached(&table_, {gt}), gt_table);
+  ASSERT_EQ(cache.GetOrCache(&table_, {eq}, sort), eq_table);
+  ASSERT_EQ(sort_count, 2u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
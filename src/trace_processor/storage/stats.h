@@ -57,6 +57,10 @@ namespace stats {
   F(ftrace_cpu_read_events_begin,       kIndexed, kInfo,     kTrace,    ""),   \
   F(ftrace_cpu_read_events_end,         kIndexed, kInfo,     kTrace,    ""),   \
   F(ftrace_cpu_read_events_delta,       kIndexed, kInfo,     kTrace,    ""),   \
+  F(ftrace_raw_page_parse_errors,       kSingle,  kError,    kTrace,    ""),   \
+  F(ftrace_raw_pages_without_format,    kSingle,  kDataLoss, kTrace,           \
+      "Raw ftrace pages (FtraceConfig.raw_pages) were found before the "       \
+      "description of their events. The events in those pages were lost."),    \
   F(ftrace_setup_errors,                kSingle,  kError,    kTrace,           \
   "One or more atrace/ftrace categories were not found or failed to enable. "  \
   "See ftrace_setup_errors in the metadata table for more details."),          \
@@ -77,6 +81,9 @@ namespace stats {
   F(parse_trace_duration_ns,            kSingle,  kInfo,     kAnalysis, ""),   \
   F(power_rail_unknown_index,           kSingle,  kError,    kTrace,    ""),   \
   F(proc_stat_unknown_counters,         kSingle,  kError,    kAnalysis, ""),   \
+  F(query_cache_evictions,              kSingle,  kInfo,     kAnalysis, ""),   \
+  F(query_cache_hits,                   kSingle,  kInfo,     kAnalysis, ""),   \
+  F(query_cache_misses,                 kSingle,  kInfo,     kAnalysis, ""),   \
   F(rss_stat_unknown_keys,              kSingle,  kError,    kAnalysis, ""),   \
   F(rss_stat_negative_size,             kSingle,  kInfo,     kAnalysis, ""),   \
   F(rss_stat_unknown_thread_for_mm_id,  kSingle,  kInfo,     kAnalysis, ""),   \
@@ -183,6 +190,7 @@ namespace stats {
   F(packages_list_has_parse_errors,     kSingle,  kError,    kTrace,    ""),   \
   F(packages_list_has_read_errors,      kSingle,  kError,    kTrace,    ""),   \
   F(compact_sched_has_parse_errors,     kSingle,  kError,    kTrace,    ""),   \
+  F(compact_irq_power_has_parse_errors, kSingle,  kError,    kTrace,    ""),   \
   F(misplaced_end_event,                kSingle,  kDataLoss, kAnalysis, ""),   \
   F(sched_waking_out_of_order,          kSingle,  kError,    kAnalysis, ""),   \
   F(compact_sched_switch_skipped,       kSingle,  kInfo,     kAnalysis, ""),   \
@@ -202,6 +210,10 @@ namespace stats {
       "cleared properly. These packets are silently dropped by trace "         \
       "processor."),                                                           \
   F(perf_guardrail_stop_ts,             kIndexed, kDataLoss, kTrace,    ""),   \
+  F(sorter_memory_limit_exceeded,       kSingle,  kInfo,     kAnalysis,        \
+      "The events buffered for sorting exceeded the configured sorter "        \
+      "memory limit so the oldest events were parsed before the rest of the "  \
+      "trace was seen. Events might be parsed out of order as a result."),     \
   F(sorter_push_event_out_of_order,     kSingle, kError,     kTrace,           \
       "Trace events are out of order event after sorting. This can happen "    \
       "due to many factors including clock sync drift, producers emitting "    \
@@ -77,19 +77,14 @@ struct TrackEventData : public TracePacketData {
   std::array<double, kMaxNumExtraCounters> extra_counter_values = {};
 };
 
-// On Windows std::aligned_storage was broken before VS 2017 15.8 and the
-// compiler (even clang-cl) requires -D_ENABLE_EXTENDED_ALIGNED_STORAGE. Given
-// the alignment here is purely a performance enhancment with no other
-// functional requirement, disable it on Win.
-#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-#define PERFETTO_TTS_ALIGNMENT alignas(64)
-#else
-#define PERFETTO_TTS_ALIGNMENT
-#endif
-
-// A TimestampedTracePiece is (usually a reference to) a piece of a trace that
-// is sorted by TraceSorter.
-struct PERFETTO_TTS_ALIGNMENT TimestampedTracePiece {
+// A TimestampedTracePiece is a piece of a trace (or a reference to it) which
+// has been sorted by TraceSorter and is being passed to the parsing stage.
+//
+// Note: TraceSorter doesn't buffer TimestampedTracePieces, but only their
+// payloads (see TraceSorter::TimestampedEvent), so the size of this struct
+// doesn't matter much. This allows to store all payloads by value without any
+// per-event heap allocation.
+struct TimestampedTracePiece {
   enum class Type {
     kInvalid = 0,
     kFtraceEvent,
@@ -100,63 +95,41 @@ struct PERFETTO_TTS_ALIGNMENT TimestampedTracePiece {
     kFuchsiaRecord,
     kTrackEvent,
     kSystraceLine,
+    kMax = kSystraceLine,
   };
 
-  TimestampedTracePiece(int64_t ts,
-                        uint64_t idx,
-                        TraceBlobView tbv,
-                        RefPtr<PacketSequenceStateGeneration> sequence_state)
-      : packet_data{std::move(tbv), std::move(sequence_state)},
-        timestamp(ts),
-        packet_idx(idx),
-        type(Type::kTracePacket) {}
+  TimestampedTracePiece(int64_t ts, TracePacketData tpd)
+      : packet_data(std::move(tpd)), timestamp(ts), type(Type::kTracePacket) {}
 
-  TimestampedTracePiece(int64_t ts, uint64_t idx, FtraceEventData fed)
-      : ftrace_event(std::move(fed)),
-        timestamp(ts),
-        packet_idx(idx),
-        type(Type::kFtraceEvent) {}
+  TimestampedTracePiece(int64_t ts, FtraceEventData fed)
+      : ftrace_event(std::move(fed)), timestamp(ts), type(Type::kFtraceEvent) {}
 
-  TimestampedTracePiece(int64_t ts, uint64_t idx, std::string value)
-      : json_value(std::move(value)),
-        timestamp(ts),
-        packet_idx(idx),
-        type(Type::kJsonValue) {}
+  TimestampedTracePiece(int64_t ts, std::string value)
+      : json_value(std::move(value)), timestamp(ts), type(Type::kJsonValue) {}
 
-  TimestampedTracePiece(int64_t ts,
-                        uint64_t idx,
-                        std::unique_ptr<FuchsiaRecord> fr)
+  TimestampedTracePiece(int64_t ts, FuchsiaRecord fr)
       : fuchsia_record(std::move(fr)),
         timestamp(ts),
-        packet_idx(idx),
         type(Type::kFuchsiaRecord) {}
 
-  TimestampedTracePiece(int64_t ts,
-                        uint64_t idx,
-                        std::unique_ptr<TrackEventData> ted)
+  TimestampedTracePiece(int64_t ts, TrackEventData ted)
       : track_event_data(std::move(ted)),
         timestamp(ts),
-        packet_idx(idx),
         type(Type::kTrackEvent) {}
 
-  TimestampedTracePiece(int64_t ts,
-                        uint64_t idx,
-                        std::unique_ptr<SystraceLine> ted)
-      : systrace_line(std::move(ted)),
+  TimestampedTracePiece(int64_t ts, SystraceLine sl)
+      : systrace_line(std::move(sl)),
         timestamp(ts),
-        packet_idx(idx),
         type(Type::kSystraceLine) {}
 
-  TimestampedTracePiece(int64_t ts, uint64_t idx, InlineSchedSwitch iss)
+  TimestampedTracePiece(int64_t ts, InlineSchedSwitch iss)
       : sched_switch(std::move(iss)),
         timestamp(ts),
-        packet_idx(idx),
         type(Type::kInlineSchedSwitch) {}
 
-  TimestampedTracePiece(int64_t ts, uint64_t idx, InlineSchedWaking isw)
+  TimestampedTracePiece(int64_t ts, InlineSchedWaking isw)
       : sched_waking(std::move(isw)),
         timestamp(ts),
-        packet_idx(idx),
         type(Type::kInlineSchedWaking) {}
 
   TimestampedTracePiece(TimestampedTracePiece&& ttp) noexcept {
@@ -182,19 +155,15 @@ struct PERFETTO_TTS_ALIGNMENT TimestampedTracePiece {
         new (&json_value) std::string(std::move(ttp.json_value));
         break;
       case Type::kFuchsiaRecord:
-        new (&fuchsia_record)
-            std::unique_ptr<FuchsiaRecord>(std::move(ttp.fuchsia_record));
+        new (&fuchsia_record) FuchsiaRecord(std::move(ttp.fuchsia_record));
         break;
       case Type::kTrackEvent:
-        new (&track_event_data)
-            std::unique_ptr<TrackEventData>(std::move(ttp.track_event_data));
+        new (&track_event_data) TrackEventData(std::move(ttp.track_event_data));
         break;
       case Type::kSystraceLine:
-        new (&systrace_line)
-            std::unique_ptr<SystraceLine>(std::move(ttp.systrace_line));
+        new (&systrace_line) SystraceLine(std::move(ttp.systrace_line));
     }
     timestamp = ttp.timestamp;
-    packet_idx = ttp.packet_idx;
     type = ttp.type;
 
     // Invalidate |ttp|.
@@ -230,46 +199,17 @@ struct PERFETTO_TTS_ALIGNMENT TimestampedTracePiece {
         json_value.~basic_string();
         break;
       case Type::kFuchsiaRecord:
-        fuchsia_record.~unique_ptr();
+        fuchsia_record.~FuchsiaRecord();
         break;
       case Type::kTrackEvent:
-        track_event_data.~unique_ptr();
+        track_event_data.~TrackEventData();
         break;
       case Type::kSystraceLine:
-        systrace_line.~unique_ptr();
+        systrace_line.~SystraceLine();
         break;
     }
   }
 
-  // For std::lower_bound().
-  static inline bool Compare(const TimestampedTracePiece& x, int64_t ts) {
-    return x.timestamp < ts;
-  }
-
-  // For std::sort().
-  inline bool operator<(const TimestampedTracePiece& o) const {
-    return timestamp < o.timestamp ||
-           (timestamp == o.timestamp && packet_idx < o.packet_idx);
-  }
-
-  // For std::sort(). Without this the compiler will fall back on invoking
-  // move operators on temporary objects.
-  friend void swap(TimestampedTracePiece& a, TimestampedTracePiece& b) {
-    // We know that TimestampedTracePiece is 64-byte aligned (because of the
-    // alignas(64) in the declaration above). We also know that swapping it is
-    // trivial and we can just swap the memory without invoking move operators.
-    // The cast to aligned_storage below allows the compiler to turn this into
-    // a bunch of movaps with large XMM registers (128/256/512 bit depending on
-    // -mavx).
-    using AS =
-        typename std::aligned_storage<sizeof(TimestampedTracePiece),
-                                      alignof(TimestampedTracePiece)>::type;
-    using std::swap;
-    swap(reinterpret_cast<AS&>(a), reinterpret_cast<AS&>(b));
-  }
-
-  // Fields ordered for packing.
-
   // Data for different types of TimestampedTracePiece.
   union {
     FtraceEventData ftrace_event;
@@ -277,24 +217,15 @@ struct PERFETTO_TTS_ALIGNMENT TimestampedTracePiece {
     InlineSchedSwitch sched_switch;
     InlineSchedWaking sched_waking;
     std::string json_value;
-    std::unique_ptr<FuchsiaRecord> fuchsia_record;
-    std::unique_ptr<TrackEventData> track_event_data;
-    std::unique_ptr<SystraceLine> systrace_line;
+    FuchsiaRecord fuchsia_record;
+    TrackEventData track_event_data;
+    SystraceLine systrace_line;
   };
 
   int64_t timestamp;
-  uint64_t packet_idx;
   Type type;
 };
 
-// std::sort<TTS> is an extremely hot path in TraceProcessor (in trace_sorter.h)
-// When TTS is 512-bit wide, we can leverage SIMD instructions to swap it by
-// declaring it aligned at its own size, without losing any space in the
-// CircularQueue due to fragmentation. This makes a 6% difference in the
-// ingestion time of a large trace. See the comments above in the swap() above.
-static_assert(sizeof(TimestampedTracePiece) <= 64,
-              "TimestampedTracePiece cannot grow beyond 64 bytes");
-
 }  // namespace trace_processor
 }  // namespace perfetto
 
@@ -142,7 +142,9 @@ void BuildBoundsTable(sqlite3* db, std::pair<int64_t, int64_t> bounds) {
   }
 }
 
-void CreateBuiltinTables(sqlite3* db) {
+// Creates the built-in tables which are also available on read-only
+// connections.
+void CreateReadOnlyBuiltinTables(sqlite3* db) {
   char* error = nullptr;
   sqlite3_exec(db, "CREATE TABLE perfetto_tables(name STRING)", 0, 0, &error);
   if (error) {
@@ -156,6 +158,14 @@ void CreateBuiltinTables(sqlite3* db) {
     PERFETTO_ELOG("Error initializing: %s", error);
     sqlite3_free(error);
   }
+}
+
+void CreateBuiltinTables(sqlite3* db) {
+  CreateReadOnlyBuiltinTables(db);
+
+  // The tables below are meant to be written by metrics and users so they
+  // only exist on the main connection.
+  char* error = nullptr;
   // Ensure that the entries in power_profile are unique to prevent duplicates
   // when the power_profile is augmented with additional profiles.
   sqlite3_exec(db,
@@ -779,7 +789,8 @@ base::Status PrepareAndStepUntilLastValidStmt(
     sqlite3* db,
     const std::string& sql,
     ScopedStmt* output_stmt,
-    IteratorImpl::StmtMetadata* metadata) {
+    IteratorImpl::StmtMetadata* metadata,
+    bool read_only) {
   ScopedStmt prev_stmt;
   // A sql string can contain several statements. Some of them might be comment
   // only, e.g. "SELECT 1; /* comment */; SELECT 2;". Here we process one
@@ -819,6 +830,12 @@ base::Status PrepareAndStepUntilLastValidStmt(
     if (!cur_stmt)
       continue;
 
+    if (read_only && !sqlite3_stmt_readonly(*cur_stmt)) {
+      return base::ErrStatus(
+          "Statement not allowed on read-only connection: %s",
+          sqlite3_sql(*cur_stmt));
+    }
+
     // Before stepping into |cur_stmt|, we need to finish iterating through
     // the previous statement so we don't have two clashing statements (e.g.
     // SELECT * FROM v and DROP VIEW v) partially stepped into.
@@ -879,14 +896,16 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   CreateBuiltinViews(db);
   db_.reset(std::move(db));
 
-  // New style function registration.
-  RegisterFunction<Glob>(db, "glob", 2);
-  RegisterFunction<Hash>(db, "HASH", -1);
-  RegisterFunction<Demangle>(db, "DEMANGLE", 1);
-  RegisterFunction<SourceGeq>(db, "SOURCE_GEQ", -1);
+  // Setup the query cache.
+  query_cache_.reset(new QueryCache(context_.storage.get()));
+
+  RegisterReadOnlyTablesAndFunctions(db);
+
+  // The functions and tables below either have side effects or depend on
+  // state which changes as queries run so they are only available on the main
+  // connection.
   RegisterFunction<ExportJson>(db, "EXPORT_JSON", 1, context_.storage.get(),
                                false);
-  RegisterFunction<ExtractArg>(db, "EXTRACT_ARG", 2, context_.storage.get());
   RegisterFunction<CreateFunction>(
       db, "CREATE_FUNCTION", 3,
       std::unique_ptr<CreateFunction::Context>(
@@ -896,133 +915,153 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
       std::unique_ptr<CreateViewFunction::Context>(
           new CreateViewFunction::Context{db_.get()}));
 
+  SetupMetrics(this, *db_, &sql_metrics_, cfg.skip_builtin_metric_paths);
+
+  const TraceStorage* storage = context_.storage.get();
+
+  SqlStatsTable::RegisterTable(*db_, storage);
+  StatsTable::RegisterTable(*db_, storage);
+
+  CreateViewFunction::RegisterTable(*db_, &create_view_function_state_);
+
+  // Tables dynamically generated at query time which intern strings in
+  // TraceStorage.
+  RegisterDynamicTable(db, std::unique_ptr<ExperimentalFlamegraphGenerator>(
+                               new ExperimentalFlamegraphGenerator(&context_)));
+  RegisterDynamicTable(db, std::unique_ptr<DescribeSliceGenerator>(
+                               new DescribeSliceGenerator(&context_)));
+  RegisterDynamicTable(
+      db, std::unique_ptr<ExperimentalSliceLayoutGenerator>(
+              new ExperimentalSliceLayoutGenerator(
+                  context_.storage.get()->mutable_string_pool(),
+                  &storage->slice_table())));
+  RegisterDynamicTable(db, std::unique_ptr<ThreadStateGenerator>(
+                               new ThreadStateGenerator(&context_)));
+  RegisterDynamicTable(
+      db, std::unique_ptr<ExperimentalAnnotatedStackGenerator>(
+              new ExperimentalAnnotatedStackGenerator(&context_)));
+  RegisterDynamicTable(db, std::unique_ptr<ExperimentalFlatSliceGenerator>(
+                               new ExperimentalFlatSliceGenerator(&context_)));
+}
+
+void TraceProcessorImpl::RegisterReadOnlyTablesAndFunctions(sqlite3* db) {
+  // New style function registration.
+  RegisterFunction<Glob>(db, "glob", 2);
+  RegisterFunction<Hash>(db, "HASH", -1);
+  RegisterFunction<Demangle>(db, "DEMANGLE", 1);
+  RegisterFunction<SourceGeq>(db, "SOURCE_GEQ", -1);
+  RegisterFunction<ExtractArg>(db, "EXTRACT_ARG", 2, context_.storage.get());
+
   // Old style function registration.
   // TODO(lalitm): migrate this over to using RegisterFunction once aggregate
   // functions are supported.
   RegisterLastNonNullFunction(db);
   RegisterValueAtMaxTsFunction(db);
 
-  SetupMetrics(this, *db_, &sql_metrics_, cfg.skip_builtin_metric_paths);
-
-  // Setup the query cache.
-  query_cache_.reset(new QueryCache());
-
   const TraceStorage* storage = context_.storage.get();
 
-  SqlStatsTable::RegisterTable(*db_, storage);
-  StatsTable::RegisterTable(*db_, storage);
-
   // Operator tables.
-  SpanJoinOperatorTable::RegisterTable(*db_, storage);
-  WindowOperatorTable::RegisterTable(*db_, storage);
-  CreateViewFunction::RegisterTable(*db_, &create_view_function_state_);
+  SpanJoinOperatorTable::RegisterTable(db, storage);
+  WindowOperatorTable::RegisterTable(db, storage);
 
   // New style tables but with some custom logic.
-  SqliteRawTable::RegisterTable(*db_, query_cache_.get(), &context_);
+  SqliteRawTable::RegisterTable(db, query_cache_.get(), &context_);
 
   // Tables dynamically generated at query time.
-  RegisterDynamicTable(std::unique_ptr<ExperimentalFlamegraphGenerator>(
-      new ExperimentalFlamegraphGenerator(&context_)));
-  RegisterDynamicTable(std::unique_ptr<ExperimentalCounterDurGenerator>(
-      new ExperimentalCounterDurGenerator(storage->counter_table())));
-  RegisterDynamicTable(std::unique_ptr<DescribeSliceGenerator>(
-      new DescribeSliceGenerator(&context_)));
-  RegisterDynamicTable(std::unique_ptr<ExperimentalSliceLayoutGenerator>(
-      new ExperimentalSliceLayoutGenerator(
-          context_.storage.get()->mutable_string_pool(),
-          &storage->slice_table())));
-  RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(
-      new AncestorGenerator(AncestorGenerator::Ancestor::kSlice, &context_)));
-  RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
-      AncestorGenerator::Ancestor::kStackProfileCallsite, &context_)));
-  RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
-      AncestorGenerator::Ancestor::kSliceByStack, &context_)));
+  RegisterDynamicTable(db, std::unique_ptr<ExperimentalCounterDurGenerator>(
+                               new ExperimentalCounterDurGenerator(
+                                   storage->counter_table())));
+  RegisterDynamicTable(
+      db, std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
+              AncestorGenerator::Ancestor::kSlice, &context_)));
+  RegisterDynamicTable(
+      db, std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
+              AncestorGenerator::Ancestor::kStackProfileCallsite, &context_)));
   RegisterDynamicTable(
-      std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
-          DescendantGenerator::Descendant::kSlice, &context_)));
+      db, std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
+              AncestorGenerator::Ancestor::kSliceByStack, &context_)));
   RegisterDynamicTable(
-      std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
-          DescendantGenerator::Descendant::kSliceByStack, &context_)));
+      db, std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
+              DescendantGenerator::Descendant::kSlice, &context_)));
   RegisterDynamicTable(
-      std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kDirectlyConnectedFlow, &context_)));
+      db, std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
+              DescendantGenerator::Descendant::kSliceByStack, &context_)));
   RegisterDynamicTable(
-      std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kPrecedingFlow, &context_)));
+      db, std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
+              ConnectedFlowGenerator::Mode::kDirectlyConnectedFlow,
+              &context_)));
   RegisterDynamicTable(
-      std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kFollowingFlow, &context_)));
-  RegisterDynamicTable(std::unique_ptr<ExperimentalSchedUpidGenerator>(
-      new ExperimentalSchedUpidGenerator(storage->sched_slice_table(),
-                                         storage->thread_table())));
-  RegisterDynamicTable(std::unique_ptr<ThreadStateGenerator>(
-      new ThreadStateGenerator(&context_)));
-  RegisterDynamicTable(std::unique_ptr<ExperimentalAnnotatedStackGenerator>(
-      new ExperimentalAnnotatedStackGenerator(&context_)));
-  RegisterDynamicTable(std::unique_ptr<ExperimentalFlatSliceGenerator>(
-      new ExperimentalFlatSliceGenerator(&context_)));
+      db, std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
+              ConnectedFlowGenerator::Mode::kPrecedingFlow, &context_)));
+  RegisterDynamicTable(
+      db, std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
+              ConnectedFlowGenerator::Mode::kFollowingFlow, &context_)));
+  RegisterDynamicTable(db, std::unique_ptr<ExperimentalSchedUpidGenerator>(
+                               new ExperimentalSchedUpidGenerator(
+                                   storage->sched_slice_table(),
+                                   storage->thread_table())));
 
   // New style db-backed tables.
-  RegisterDbTable(storage->arg_table());
-  RegisterDbTable(storage->thread_table());
-  RegisterDbTable(storage->process_table());
-
-  RegisterDbTable(storage->slice_table());
-  RegisterDbTable(storage->flow_table());
-  RegisterDbTable(storage->thread_slice_table());
-  RegisterDbTable(storage->sched_slice_table());
-  RegisterDbTable(storage->instant_table());
-  RegisterDbTable(storage->gpu_slice_table());
-
-  RegisterDbTable(storage->track_table());
-  RegisterDbTable(storage->thread_track_table());
-  RegisterDbTable(storage->process_track_table());
-  RegisterDbTable(storage->gpu_track_table());
-
-  RegisterDbTable(storage->counter_table());
-
-  RegisterDbTable(storage->counter_track_table());
-  RegisterDbTable(storage->process_counter_track_table());
-  RegisterDbTable(storage->thread_counter_track_table());
-  RegisterDbTable(storage->cpu_counter_track_table());
-  RegisterDbTable(storage->irq_counter_track_table());
-  RegisterDbTable(storage->softirq_counter_track_table());
-  RegisterDbTable(storage->gpu_counter_track_table());
-  RegisterDbTable(storage->gpu_counter_group_table());
-  RegisterDbTable(storage->perf_counter_track_table());
-
-  RegisterDbTable(storage->heap_graph_object_table());
-  RegisterDbTable(storage->heap_graph_reference_table());
-  RegisterDbTable(storage->heap_graph_class_table());
-
-  RegisterDbTable(storage->symbol_table());
-  RegisterDbTable(storage->heap_profile_allocation_table());
-  RegisterDbTable(storage->cpu_profile_stack_sample_table());
-  RegisterDbTable(storage->perf_sample_table());
-  RegisterDbTable(storage->stack_profile_callsite_table());
-  RegisterDbTable(storage->stack_profile_mapping_table());
-  RegisterDbTable(storage->stack_profile_frame_table());
-  RegisterDbTable(storage->package_list_table());
-  RegisterDbTable(storage->profiler_smaps_table());
-
-  RegisterDbTable(storage->android_log_table());
-
-  RegisterDbTable(storage->vulkan_memory_allocations_table());
-
-  RegisterDbTable(storage->graphics_frame_slice_table());
-
-  RegisterDbTable(storage->expected_frame_timeline_slice_table());
-  RegisterDbTable(storage->actual_frame_timeline_slice_table());
-
-  RegisterDbTable(storage->metadata_table());
-  RegisterDbTable(storage->cpu_table());
-  RegisterDbTable(storage->cpu_freq_table());
-  RegisterDbTable(storage->clock_snapshot_table());
-
-  RegisterDbTable(storage->memory_snapshot_table());
-  RegisterDbTable(storage->process_memory_snapshot_table());
-  RegisterDbTable(storage->memory_snapshot_node_table());
-  RegisterDbTable(storage->memory_snapshot_edge_table());
+  RegisterDbTable(db, storage->arg_table());
+  RegisterDbTable(db, storage->thread_table());
+  RegisterDbTable(db, storage->process_table());
+
+  RegisterDbTable(db, storage->slice_table());
+  RegisterDbTable(db, storage->flow_table());
+  RegisterDbTable(db, storage->thread_slice_table());
+  RegisterDbTable(db, storage->sched_slice_table());
+  RegisterDbTable(db, storage->instant_table());
+  RegisterDbTable(db, storage->gpu_slice_table());
+
+  RegisterDbTable(db, storage->track_table());
+  RegisterDbTable(db, storage->thread_track_table());
+  RegisterDbTable(db, storage->process_track_table());
+  RegisterDbTable(db, storage->gpu_track_table());
+
+  RegisterDbTable(db, storage->counter_table());
+
+  RegisterDbTable(db, storage->counter_track_table());
+  RegisterDbTable(db, storage->process_counter_track_table());
+  RegisterDbTable(db, storage->thread_counter_track_table());
+  RegisterDbTable(db, storage->cpu_counter_track_table());
+  RegisterDbTable(db, storage->irq_counter_track_table());
+  RegisterDbTable(db, storage->softirq_counter_track_table());
+  RegisterDbTable(db, storage->gpu_counter_track_table());
+  RegisterDbTable(db, storage->gpu_counter_group_table());
+  RegisterDbTable(db, storage->perf_counter_track_table());
+
+  RegisterDbTable(db, storage->heap_graph_object_table());
+  RegisterDbTable(db, storage->heap_graph_reference_table());
+  RegisterDbTable(db, storage->heap_graph_class_table());
+
+  RegisterDbTable(db, storage->symbol_table());
+  RegisterDbTable(db, storage->heap_profile_allocation_table());
+  RegisterDbTable(db, storage->cpu_profile_stack_sample_table());
+  RegisterDbTable(db, storage->perf_sample_table());
+  RegisterDbTable(db, storage->stack_profile_callsite_table());
+  RegisterDbTable(db, storage->stack_profile_mapping_table());
+  RegisterDbTable(db, storage->stack_profile_frame_table());
+  RegisterDbTable(db, storage->package_list_table());
+  RegisterDbTable(db, storage->profiler_smaps_table());
+
+  RegisterDbTable(db, storage->android_log_table());
+
+  RegisterDbTable(db, storage->vulkan_memory_allocations_table());
+
+  RegisterDbTable(db, storage->graphics_frame_slice_table());
+
+  RegisterDbTable(db, storage->expected_frame_timeline_slice_table());
+  RegisterDbTable(db, storage->actual_frame_timeline_slice_table());
+
+  RegisterDbTable(db, storage->metadata_table());
+  RegisterDbTable(db, storage->cpu_table());
+  RegisterDbTable(db, storage->cpu_freq_table());
+  RegisterDbTable(db, storage->clock_snapshot_table());
+
+  RegisterDbTable(db, storage->memory_snapshot_table());
+  RegisterDbTable(db, storage->process_memory_snapshot_table());
+  RegisterDbTable(db, storage->memory_snapshot_node_table());
+  RegisterDbTable(db, storage->memory_snapshot_edge_table());
 }
 
 TraceProcessorImpl::~TraceProcessorImpl() = default;
@@ -1065,6 +1104,35 @@ void TraceProcessorImpl::NotifyEndOfFile() {
     PERFETTO_CHECK(value.type == SqlValue::Type::kString);
     initial_tables_.push_back(value.string_value);
   }
+
+  CreateReadOnlyConnections(context_.config.read_only_connections);
+}
+
+void TraceProcessorImpl::CreateReadOnlyConnections(uint32_t count) {
+  if (count == 0 || !read_only_dbs_.empty())
+    return;
+  if (!sqlite3_threadsafe()) {
+    PERFETTO_ELOG(
+        "SQLite was built without multi-thread support, ignoring "
+        "read_only_connections");
+    return;
+  }
+
+  auto bounds = context_.storage->GetTraceTimestampBoundsNs();
+  for (uint32_t i = 0; i < count; ++i) {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    InitializeSqlite(db);
+    CreateReadOnlyBuiltinTables(db);
+    BuildBoundsTable(db, bounds);
+    CreateBuiltinViews(db);
+    RegisterReadOnlyTablesAndFunctions(db);
+    read_only_dbs_.emplace_back(db);
+  }
+
+  std::lock_guard<std::mutex> lock(read_only_dbs_mutex_);
+  for (const ScopedDb& db : read_only_dbs_)
+    free_read_only_dbs_.push_back(db.get());
 }
 
 size_t TraceProcessorImpl::RestoreInitialTables() {
@@ -1102,26 +1170,89 @@ size_t TraceProcessorImpl::RestoreInitialTables() {
 Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql) {
   PERFETTO_TP_TRACE("QUERY_EXECUTE");
 
-  uint32_t sql_stats_row =
-      context_.storage->mutable_sql_stats()->RecordQueryBegin(
-          sql, base::GetWallTimeNs().count());
+  uint32_t sql_stats_row;
+  {
+    std::lock_guard<std::mutex> lock(sql_stats_mutex_);
+    sql_stats_row = context_.storage->mutable_sql_stats()->RecordQueryBegin(
+        sql, base::GetWallTimeNs().count());
+  }
 
   ScopedStmt stmt;
   IteratorImpl::StmtMetadata metadata;
-  base::Status status =
-      PrepareAndStepUntilLastValidStmt(*db_, sql, &stmt, &metadata);
+  base::Status status = PrepareAndStepUntilLastValidStmt(
+      *db_, sql, &stmt, &metadata, /*read_only=*/false);
   PERFETTO_DCHECK((status.ok() && stmt) || (!status.ok() && !stmt));
 
-  std::unique_ptr<IteratorImpl> impl(new IteratorImpl(
-      this, *db_, status, std::move(stmt), std::move(metadata), sql_stats_row));
+  std::unique_ptr<IteratorImpl> impl(
+      new IteratorImpl(this, *db_, status, std::move(stmt), std::move(metadata),
+                       sql_stats_row, /*read_only=*/false));
   return Iterator(std::move(impl));
 }
 
+Iterator TraceProcessorImpl::ExecuteReadOnlyQuery(const std::string& sql) {
+  base::Status status;
+  if (read_only_dbs_.empty()) {
+    status = base::ErrStatus("No read-only connections available");
+  } else if (metatrace::g_enabled) {
+    // The metatrace buffer can only be written by one thread.
+    status = base::ErrStatus("Read-only queries are disabled by metatracing");
+  }
+  if (!status.ok()) {
+    std::unique_ptr<IteratorImpl> impl(
+        new IteratorImpl(nullptr, nullptr, status, ScopedStmt(),
+                         IteratorImpl::StmtMetadata(), 0, /*read_only=*/true));
+    return Iterator(std::move(impl));
+  }
+
+  sqlite3* db = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(read_only_dbs_mutex_);
+    read_only_dbs_cv_.wait(lock, [this] {
+      return !free_read_only_dbs_.empty();
+    });
+    db = free_read_only_dbs_.back();
+    free_read_only_dbs_.pop_back();
+  }
+
+  uint32_t sql_stats_row;
+  {
+    std::lock_guard<std::mutex> lock(sql_stats_mutex_);
+    sql_stats_row = context_.storage->mutable_sql_stats()->RecordQueryBegin(
+        sql, base::GetWallTimeNs().count());
+  }
+
+  ScopedStmt stmt;
+  IteratorImpl::StmtMetadata metadata;
+  status = PrepareAndStepUntilLastValidStmt(db, sql, &stmt, &metadata,
+                                            /*read_only=*/true);
+  PERFETTO_DCHECK((status.ok() && stmt) || (!status.ok() && !stmt));
+
+  // The iterator gives |db| back through ReleaseReadOnlyConnection() once
+  // it's destroyed.
+  std::unique_ptr<IteratorImpl> impl(
+      new IteratorImpl(this, db, status, std::move(stmt), std::move(metadata),
+                       sql_stats_row, /*read_only=*/true));
+  return Iterator(std::move(impl));
+}
+
+void TraceProcessorImpl::ReleaseReadOnlyConnection(sqlite3* db) {
+  {
+    std::lock_guard<std::mutex> lock(read_only_dbs_mutex_);
+    free_read_only_dbs_.push_back(db);
+  }
+  read_only_dbs_cv_.notify_one();
+}
+
 void TraceProcessorImpl::InterruptQuery() {
   if (!db_)
     return;
   query_interrupted_.store(true);
   sqlite3_interrupt(db_.get());
+
+  // Interrupting is safe even if the connection is being used by another
+  // thread.
+  for (const ScopedDb& db : read_only_dbs_)
+    sqlite3_interrupt(db.get());
 }
 
 bool TraceProcessorImpl::IsRootMetricField(const std::string& metric_name) {
@@ -20,8 +20,10 @@
 #include <sqlite3.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -64,6 +66,8 @@ class TraceProcessorImpl : public TraceProcessor,
   // TraceProcessor implementation:
   Iterator ExecuteQuery(const std::string& sql) override;
 
+  Iterator ExecuteReadOnlyQuery(const std::string& sql) override;
+
   base::Status RegisterMetric(const std::string& path,
                               const std::string& sql) override;
 
@@ -100,23 +104,48 @@ class TraceProcessorImpl : public TraceProcessor,
   friend class IteratorImpl;
 
   template <typename Table>
-  void RegisterDbTable(const Table& table) {
-    DbSqliteTable::RegisterTable(*db_, query_cache_.get(), Table::Schema(),
+  void RegisterDbTable(sqlite3* db, const Table& table) {
+    DbSqliteTable::RegisterTable(db, query_cache_.get(), Table::Schema(),
                                  &table, table.table_name());
   }
 
   void RegisterDynamicTable(
+      sqlite3* db,
       std::unique_ptr<DbSqliteTable::DynamicTableGenerator> generator) {
-    DbSqliteTable::RegisterTable(*db_, query_cache_.get(),
-                                 std::move(generator));
+    DbSqliteTable::RegisterTable(db, query_cache_.get(), std::move(generator));
   }
 
+  // Registers in |db| all the tables and functions which neither modify
+  // TraceStorage nor the state of this class. These are the only ones
+  // available on read-only connections.
+  void RegisterReadOnlyTablesAndFunctions(sqlite3* db);
+
+  // Opens the connections used by ExecuteReadOnlyQuery().
+  void CreateReadOnlyConnections(uint32_t count);
+
+  // Called by IteratorImpl when the iterator for a query on the read-only
+  // connection |db| is destroyed.
+  void ReleaseReadOnlyConnection(sqlite3* db);
+
   bool IsRootMetricField(const std::string& metric_name);
 
   // Keep this first: we need this to be destroyed after we clean up
   // everything else.
   ScopedDb db_;
 
+  // The connections used by ExecuteReadOnlyQuery(). Never modified after
+  // CreateReadOnlyConnections() returns.
+  std::vector<ScopedDb> read_only_dbs_;
+
+  // The subset of |read_only_dbs_| which is not being used by an iterator.
+  std::mutex read_only_dbs_mutex_;
+  std::condition_variable read_only_dbs_cv_;
+  std::vector<sqlite3*> free_read_only_dbs_;
+
+  // Guards TraceStorage::SqlStats which is updated by all queries, including
+  // the ones running on read-only connections.
+  std::mutex sql_stats_mutex_;
+
   // State necessary for CREATE_FUNCTION invocations. We store this here as we
   // need to finalize any prepared statements *before* we destroy the database.
   CreateFunction::State create_function_state_;
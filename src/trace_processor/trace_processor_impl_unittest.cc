@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/trace_processor/trace_processor.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+std::unique_ptr<TraceProcessor> CreateLoadedInstance(uint32_t connections) {
+  Config config;
+  config.read_only_connections = connections;
+  auto tp = TraceProcessor::CreateInstance(config);
+  tp->NotifyEndOfFile();
+  return tp;
+}
+
+TEST(TraceProcessorImplTest, ReadOnlyQueryWithoutConnections) {
+  auto tp = CreateLoadedInstance(0);
+  auto it = tp->ExecuteReadOnlyQuery("select 1");
+  ASSERT_FALSE(it.Next());
+  ASSERT_FALSE(it.Status().ok());
+}
+
+TEST(TraceProcessorImplTest, ReadOnlyQuery) {
+  auto tp = CreateLoadedInstance(2);
+  auto it = tp->ExecuteReadOnlyQuery(
+      "select count(*) from slice union all select count(*) from thread_track "
+      "union all select start_ts <= end_ts from trace_bounds");
+  ASSERT_TRUE(it.Next());
+  ASSERT_EQ(it.Get(0).long_value, 0);
+  ASSERT_TRUE(it.Next());
+  ASSERT_EQ(it.Get(0).long_value, 0);
+  ASSERT_TRUE(it.Next());
+  ASSERT_EQ(it.Get(0).long_value, 1);
+  ASSERT_FALSE(it.Next());
+  ASSERT_TRUE(it.Status().ok());
+}
+
+TEST(TraceProcessorImplTest, ReadOnlyQueryRejectsWrites) {
+  auto tp = CreateLoadedInstance(1);
+  {
+    auto it = tp->ExecuteReadOnlyQuery("create table foo(x int)");
+    ASSERT_FALSE(it.Status().ok());
+  }
+
+  // The connection must have been given back despite the error (otherwise
+  // this would block forever).
+  auto it = tp->ExecuteReadOnlyQuery("select 1");
+  ASSERT_TRUE(it.Next());
+  ASSERT_TRUE(it.Status().ok());
+}
+
+TEST(TraceProcessorImplTest, ReadOnlyQueryDoesNotSeeUserTables) {
+  auto tp = CreateLoadedInstance(1);
+  auto create = tp->ExecuteQuery("create view foo as select 1 as x");
+  ASSERT_FALSE(create.Next());
+  ASSERT_TRUE(create.Status().ok());
+
+  auto it = tp->ExecuteReadOnlyQuery("select x from foo");
+  ASSERT_FALSE(it.Status().ok());
+}
+
+TEST(TraceProcessorImplTest, ConcurrentReadOnlyQueries) {
+  constexpr uint32_t kThreads = 4;
+  auto tp = CreateLoadedInstance(2);
+
+  std::atomic<uint32_t> failures{0};
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&tp, &failures] {
+      for (uint32_t j = 0; j < 50; ++j) {
+        auto it = tp->ExecuteReadOnlyQuery(
+            "with recursive nums(x) as (select 0 union all select x + 1 from "
+            "nums where x < 99) select sum(x) from nums join (select count(*) "
+            "from slice)");
+        if (!it.Next() || it.Get(0).long_value != 4950 || it.Next() ||
+            !it.Status().ok()) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  ASSERT_EQ(failures.load(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -660,11 +660,13 @@ struct CommandLineOptions {
   std::string metric_output;
   std::string trace_file_path;
   std::string port_number;
+  uint32_t query_threads = 0;
   std::vector<std::string> raw_metric_extensions;
   bool launch_shell = false;
   bool enable_httpd = false;
   bool wide = false;
   bool force_full_sort = false;
+  uint64_t sorter_memory_limit_mb = 0;
   std::string metatrace_path;
   bool dev = false;
   bool no_ftrace_raw = false;
@@ -695,6 +697,10 @@ Options:
                                       metrics and can't output any results.
  -D, --httpd                          Enables the HTTP RPC server.
  --http-port PORT                     Specify what port to run HTTP RPC server.
+ --query-threads N                    Number of threads used by the HTTP RPC
+                                      server to run independent /query
+                                      requests concurrently (default: 0, i.e.
+                                      all requests run sequentially).
  -i, --interactive                    Starts interactive mode even after a query
                                       file is specified with -q or
                                       --run-metrics.
@@ -715,6 +721,12 @@ Options:
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
                                       logic.
+ --sorter-memory-limit-mb MB          Bounds the memory used for sorting
+                                      events to approximately MB megabytes.
+                                      Allows ingesting traces which would not
+                                      otherwise fit in memory at the cost of
+                                      possibly parsing some events out of
+                                      order.
  --metric-extension DISK_PATH@VIRTUAL_PATH
                                       Loads metric proto and sql files from
                                       DISK_PATH/protos and DISK_PATH/sql
@@ -740,7 +752,9 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_PRE_METRICS,
     OPT_METRICS_OUTPUT,
     OPT_FORCE_FULL_SORT,
+    OPT_SORTER_MEMORY_LIMIT_MB,
     OPT_HTTP_PORT,
+    OPT_QUERY_THREADS,
     OPT_METRIC_EXTENSION,
     OPT_DEV,
     OPT_NO_FTRACE_RAW,
@@ -761,7 +775,10 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"pre-metrics", required_argument, nullptr, OPT_PRE_METRICS},
       {"metrics-output", required_argument, nullptr, OPT_METRICS_OUTPUT},
       {"full-sort", no_argument, nullptr, OPT_FORCE_FULL_SORT},
+      {"sorter-memory-limit-mb", required_argument, nullptr,
+       OPT_SORTER_MEMORY_LIMIT_MB},
       {"http-port", required_argument, nullptr, OPT_HTTP_PORT},
+      {"query-threads", required_argument, nullptr, OPT_QUERY_THREADS},
       {"metric-extension", required_argument, nullptr, OPT_METRIC_EXTENSION},
       {"dev", no_argument, nullptr, OPT_DEV},
       {"no-ftrace-raw", no_argument, nullptr, OPT_NO_FTRACE_RAW},
@@ -846,11 +863,31 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_SORTER_MEMORY_LIMIT_MB) {
+      base::Optional<uint64_t> limit = base::CStringToUInt64(optarg);
+      if (!limit) {
+        PERFETTO_ELOG("Invalid value for --sorter-memory-limit-mb: %s", optarg);
+        exit(1);
+      }
+      command_line_options.sorter_memory_limit_mb = *limit;
+      continue;
+    }
+
     if (option == OPT_HTTP_PORT) {
       command_line_options.port_number = optarg;
       continue;
     }
 
+    if (option == OPT_QUERY_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --query-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.query_threads = *threads;
+      continue;
+    }
+
     if (option == OPT_METRIC_EXTENSION) {
       command_line_options.raw_metric_extensions.push_back(optarg);
       continue;
@@ -1299,6 +1336,9 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                             ? SortingMode::kForceFullSort
                             : SortingMode::kDefaultHeuristics;
   config.ingest_ftrace_in_raw_table = !options.no_ftrace_raw;
+  config.sorter_memory_limit_bytes =
+      options.sorter_memory_limit_mb * 1024 * 1024;
+  config.read_only_connections = options.query_threads;
 
   std::vector<MetricExtension> metric_extensions;
   RETURN_IF_ERROR(ParseMetricExtensionPaths(
@@ -1339,7 +1379,8 @@ base::Status TraceProcessorMain(int argc, char** argv) {
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
   if (options.enable_httpd) {
-    RunHttpRPCServer(std::move(tp), options.port_number);
+    RunHttpRPCServer(std::move(tp), options.port_number,
+                     options.query_threads);
     PERFETTO_FATAL("Should never return");
   }
 #endif
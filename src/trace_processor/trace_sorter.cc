@@ -15,6 +15,7 @@
  */
 
 #include <algorithm>
+#include <limits>
 #include <utility>
 
 #include "perfetto/ext/base/utils.h"
@@ -29,13 +30,26 @@ TraceSorter::TraceSorter(TraceProcessorContext* context,
                          SortingMode sorting_mode)
     : context_(context),
       parser_(std::move(parser)),
-      sorting_mode_(sorting_mode) {
+      sorting_mode_(sorting_mode),
+      // Clamp rather than truncate the limit on 32-bit platforms.
+      memory_limit_bytes_(static_cast<size_t>(
+          std::min<uint64_t>(context->config.sorter_memory_limit_bytes,
+                             std::numeric_limits<size_t>::max()))) {
   const char* env = getenv("TRACE_PROCESSOR_SORT_ONLY");
   bypass_next_stage_for_testing_ = env && !strcmp(env, "1");
   if (bypass_next_stage_for_testing_)
     PERFETTO_ELOG("TEST MODE: bypassing protobuf parsing stage");
 }
 
+TraceSorter::~TraceSorter() {
+  // Destroy the payloads of any event which was never extracted (e.g. if the
+  // trace failed to parse), as |allocator_| doesn't know their types.
+  for (auto& queue : queues_) {
+    for (const auto& event : queue.events_)
+      EvictEvent(event);
+  }
+}
+
 void TraceSorter::Queue::Sort() {
   PERFETTO_DCHECK(needs_sorting());
   PERFETTO_DCHECK(sort_start_idx_ < events_.size());
@@ -50,7 +64,7 @@ void TraceSorter::Queue::Sort() {
   auto sort_end = events_.begin() + static_cast<ssize_t>(sort_start_idx_);
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), sort_end));
   auto sort_begin = std::lower_bound(events_.begin(), sort_end, sort_min_ts_,
-                                     &TimestampedTracePiece::Compare);
+                                     &TimestampedEvent::Compare);
   std::sort(sort_begin, events_.end());
   sort_start_idx_ = 0;
   sort_min_ts_ = 0;
@@ -60,7 +74,7 @@ void TraceSorter::Queue::Sort() {
 }
 
 // Removes all the events in |queues_| that are earlier than the given
-// packet index and moves them to the next parser stages, respecting global
+// allocation id and moves them to the next parser stages, respecting global
 // timestamp order. This function is a "extract min from N sorted queues", with
 // some little cleverness: we know that events tend to be bursty, so events are
 // not going to be randomly distributed on the N |queues_|.
@@ -79,7 +93,9 @@ void TraceSorter::Queue::Sort() {
 // to avoid re-scanning all the queues all the times) but doesn't seem worth it.
 // With Android traces (that have 8 CPUs) this function accounts for ~1-3% cpu
 // time in a profiler.
-void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
+void TraceSorter::SortAndExtractEventsUntilAllocId(
+    BumpAllocator::AllocId limit_alloc_id,
+    size_t min_buffered_bytes) {
   constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
   for (;;) {
     size_t min_queue_idx = 0;  // The index of the queue with the min(ts).
@@ -116,21 +132,21 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
     auto& events = queue.events_;
     if (queue.needs_sorting())
       queue.Sort();
-    PERFETTO_DCHECK(queue.min_ts_ == events.front().timestamp);
+    PERFETTO_DCHECK(queue.min_ts_ == events.front().ts);
     PERFETTO_DCHECK(queue.min_ts_ == global_min_ts_);
 
     // Now that we identified the min-queue, extract all events from it until
-    // we hit either: (1) the min-ts of the 2nd queue or (2) the packet index
+    // we hit either: (1) the min-ts of the 2nd queue or (2) the allocation id
     // limit, whichever comes first.
     size_t num_extracted = 0;
-    for (auto& event : events) {
-      if (event.packet_idx >= limit_packet_idx ||
-          event.timestamp > min_queue_ts[1]) {
+    for (const auto& event : events) {
+      if (event.alloc_id >= limit_alloc_id || event.ts > min_queue_ts[1] ||
+          BufferedBytes() <= min_buffered_bytes) {
         break;
       }
 
       ++num_extracted;
-      MaybePushEvent(min_queue_idx, std::move(event));
+      MaybePushEvent(min_queue_idx, EvictEvent(event));
     }  // for (event: events)
 
     if (!num_extracted) {
@@ -156,7 +172,7 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
       for (auto& q : queues_)
         global_max_ts_ = std::max(global_max_ts_, q.max_ts_);
     } else {
-      queue.min_ts_ = queue.events_.front().timestamp;
+      queue.min_ts_ = queue.events_.front().ts;
       global_min_ts_ = std::min(queue.min_ts_, min_queue_ts[1]);
     }
   }  // for(;;)
@@ -174,6 +190,53 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
 #endif
 }
 
+void TraceSorter::ExtractEventsForMemoryLimit() {
+  context_->storage->IncrementStats(stats::sorter_memory_limit_exceeded);
+
+  // Extract a good chunk of events (rather than just enough to be under the
+  // limit) to avoid doing this again on the next event.
+  // This runs synchronously, from the Push*() call which hit the limit: it
+  // can't wait for the next NotifyReadBufferEvent() as only proto traces have
+  // one before the end of the trace.
+  SortAndExtractEventsUntilAllocId(allocator_.PastTheEndId(),
+                                   memory_limit_bytes_ / 4 * 3);
+}
+
+TimestampedTracePiece TraceSorter::EvictEvent(const TimestampedEvent& event) {
+  using Type = TimestampedTracePiece::Type;
+  switch (event.type()) {
+    case Type::kFtraceEvent:
+      return EvictPayload<FtraceEventData>(event);
+    case Type::kTracePacket:
+      return EvictPayload<TracePacketData>(event);
+    case Type::kInlineSchedSwitch:
+      return EvictPayload<InlineSchedSwitch>(event);
+    case Type::kInlineSchedWaking:
+      return EvictPayload<InlineSchedWaking>(event);
+    case Type::kJsonValue:
+      return EvictPayload<std::string>(event);
+    case Type::kFuchsiaRecord:
+      return EvictPayload<FuchsiaRecord>(event);
+    case Type::kTrackEvent:
+      return EvictPayload<TrackEventData>(event);
+    case Type::kSystraceLine:
+      return EvictPayload<SystraceLine>(event);
+    case Type::kInvalid:
+      break;
+  }
+  PERFETTO_FATAL("Invalid event type");
+}
+
+template <typename T>
+TimestampedTracePiece TraceSorter::EvictPayload(const TimestampedEvent& event) {
+  T* payload = static_cast<T*>(allocator_.GetPointer(event.alloc_id));
+  buffered_bytes_ -= ApproxBufferedBytes(*payload);
+  TimestampedTracePiece ttp(event.ts, std::move(*payload));
+  payload->~T();
+  allocator_.Free(event.alloc_id, PayloadSize<T>());
+  return ttp;
+}
+
 void TraceSorter::MaybePushEvent(size_t queue_idx, TimestampedTracePiece ttp) {
   int64_t timestamp = ttp.timestamp;
   if (timestamp < latest_pushed_event_ts_)
@@ -188,9 +251,10 @@ void TraceSorter::MaybePushEvent(size_t queue_idx, TimestampedTracePiece ttp) {
     // queues_[0] is for non-ftrace packets.
     parser_->ParseTracePacket(timestamp, std::move(ttp));
   } else {
-    // Ftrace queues start at offset 1. So queues_[1] = cpu[0] and so on.
-    uint32_t cpu = static_cast<uint32_t>(queue_idx - 1);
-    parser_->ParseFtracePacket(cpu, timestamp, std::move(ttp));
+    // Ftrace queues start at offset 1, two per cpu. So queues_[1] and
+    // queues_[2] = cpu[0] and so on.
+    parser_->ParseFtracePacket(QueueIdxToCpu(queue_idx), timestamp,
+                               std::move(ttp));
   }
 }
 
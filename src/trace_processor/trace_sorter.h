@@ -26,12 +26,12 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/timestamped_trace_piece.h"
+#include "src/trace_processor/util/bump_allocator.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 class PacketSequenceState;
-struct SystraceLine;
 
 // This class takes care of sorting events parsed from the trace stream in
 // arbitrary order and pushing them to the next pipeline stages (parsing) in
@@ -60,9 +60,17 @@ struct SystraceLine;
 // - Most events come from ftrace.
 // - Ftrace events are sorted within each cpu most of the times.
 //
-// Due to this, this class is oprerates as a streaming merge-sort of N+1 queues
-// (N = num cpus + 1 for non-ftrace events). Each queue in turn gets sorted (if
-// necessary) before proceeding with the global merge-sort-extract.
+// Due to this, this class is oprerates as a streaming merge-sort of 2N+1 queues
+// (N = num cpus, two queues per cpu + 1 for non-ftrace events). Each queue in
+// turn gets sorted (if necessary) before proceeding with the global
+// merge-sort-extract.
+//
+// Each cpu has two queues because ftrace bundles can contain both regular
+// ftrace events and "compact" (inline) sched events. The two are tokenized
+// separately so, while each sub-stream is sorted, interleaving them in one
+// queue would break the ordering of almost every bundle and require sorting
+// the queue on each extraction. Keeping them apart lets the merge-extract
+// below interleave them instead.
 //
 // When an event is pushed through, it is just appended to the end of one of
 // the N queues. While appending, we keep track of the fact that the queue
@@ -79,6 +87,32 @@ struct SystraceLine;
 // We use a logarithmic bound search operation to figure out what is the index
 // within the first partition where sorting should start, and sort all events
 // from there to the end.
+//
+// Event storage
+//
+// Events are buffered as 16 byte headers (TimestampedEvent) in the queues,
+// which is what gets sorted and merged. The payloads of the events live in a
+// bump allocator: as events are mostly extracted in the order in which they are
+// pushed, this makes buffering an event as cheap as bumping a pointer and
+// keeps the headers small and cheap to move around. The id of the allocation
+// doubles as the order in which events were pushed (used for extraction
+// windows and to keep sorting stable).
+//
+// Memory limit
+//
+// As ring-buffer traces are fully sorted in memory, the events buffered in the
+// queues can need a lot of memory for large traces. If
+// |Config::sorter_memory_limit_bytes| is set, the (approximate) size of the
+// buffered events is tracked and, when it goes over the limit, the oldest
+// events are extracted until the usage goes back below 3/4 of the limit.
+// The payloads are accounted as the chunks of the bump allocator they keep
+// alive, rather than by their size, as that's the memory actually used.
+// This bounds the memory used but any event pushed afterwards with a
+// timestamp older than the extracted events will reach the parser out of
+// order (and be recorded in the sorter_push_event_out_of_order stat).
+// The extraction happens synchronously inside the Push*() call which went
+// over the limit: tokenizers must be prepared for events to be parsed from
+// any Push*() call, as they already are for NotifyReadBufferEvent().
 class TraceSorter {
  public:
   enum class SortingMode {
@@ -89,76 +123,67 @@ class TraceSorter {
   TraceSorter(TraceProcessorContext* context,
               std::unique_ptr<TraceParser> parser,
               SortingMode);
+  ~TraceSorter();
 
   inline void PushTracePacket(int64_t timestamp,
                               PacketSequenceState* state,
                               TraceBlobView packet) {
-    AppendNonFtraceEvent(TimestampedTracePiece(timestamp, packet_idx_++,
-                                               std::move(packet),
-                                               state->current_generation()));
+    AppendToQueue(
+        0, timestamp, TimestampedTracePiece::Type::kTracePacket,
+        TracePacketData{std::move(packet), state->current_generation()});
   }
 
   inline void PushJsonValue(int64_t timestamp, std::string json_value) {
-    AppendNonFtraceEvent(
-        TimestampedTracePiece(timestamp, packet_idx_++, std::move(json_value)));
+    AppendToQueue(0, timestamp, TimestampedTracePiece::Type::kJsonValue,
+                  std::move(json_value));
   }
 
-  inline void PushFuchsiaRecord(int64_t timestamp,
-                                std::unique_ptr<FuchsiaRecord> record) {
-    AppendNonFtraceEvent(
-        TimestampedTracePiece(timestamp, packet_idx_++, std::move(record)));
+  inline void PushFuchsiaRecord(int64_t timestamp, FuchsiaRecord record) {
+    AppendToQueue(0, timestamp, TimestampedTracePiece::Type::kFuchsiaRecord,
+                  std::move(record));
   }
 
-  inline void PushSystraceLine(std::unique_ptr<SystraceLine> systrace_line) {
-    int64_t timestamp = systrace_line->ts;
-    AppendNonFtraceEvent(TimestampedTracePiece(timestamp, packet_idx_++,
-                                               std::move(systrace_line)));
+  inline void PushSystraceLine(SystraceLine systrace_line) {
+    int64_t timestamp = systrace_line.ts;
+    AppendToQueue(0, timestamp, TimestampedTracePiece::Type::kSystraceLine,
+                  std::move(systrace_line));
   }
 
-  inline void PushTrackEventPacket(int64_t timestamp,
-                                   std::unique_ptr<TrackEventData> data) {
-    AppendNonFtraceEvent(
-        TimestampedTracePiece(timestamp, packet_idx_++, std::move(data)));
+  inline void PushTrackEventPacket(int64_t timestamp, TrackEventData data) {
+    AppendToQueue(0, timestamp, TimestampedTracePiece::Type::kTrackEvent,
+                  std::move(data));
   }
 
   inline void PushFtraceEvent(uint32_t cpu,
                               int64_t timestamp,
                               TraceBlobView event,
                               PacketSequenceState* state) {
-    auto* queue = GetQueue(cpu + 1);
-    queue->Append(TimestampedTracePiece(
-        timestamp, packet_idx_++,
-        FtraceEventData{std::move(event), state->current_generation()}));
-    UpdateGlobalTs(queue);
+    AppendToQueue(
+        FtraceQueueIdx(cpu), timestamp,
+        TimestampedTracePiece::Type::kFtraceEvent,
+        FtraceEventData{std::move(event), state->current_generation()});
   }
   inline void PushInlineFtraceEvent(uint32_t cpu,
                                     int64_t timestamp,
                                     InlineSchedSwitch inline_sched_switch) {
-    // TODO(rsavitski): if a trace has a mix of normal & "compact" events (being
-    // pushed through this function), the ftrace batches will no longer be fully
-    // sorted by timestamp. In such situations, we will have to sort at the end
-    // of the batch. We can do better as both sub-sequences are sorted however.
-    // Consider adding extra queues, or pushing them in a merge-sort fashion
-    // instead.
-    auto* queue = GetQueue(cpu + 1);
-    queue->Append(
-        TimestampedTracePiece(timestamp, packet_idx_++, inline_sched_switch));
-    UpdateGlobalTs(queue);
+    AppendToQueue(InlineFtraceQueueIdx(cpu), timestamp,
+                  TimestampedTracePiece::Type::kInlineSchedSwitch,
+                  inline_sched_switch);
   }
   inline void PushInlineFtraceEvent(uint32_t cpu,
                                     int64_t timestamp,
                                     InlineSchedWaking inline_sched_waking) {
-    auto* queue = GetQueue(cpu + 1);
-    queue->Append(
-        TimestampedTracePiece(timestamp, packet_idx_++, inline_sched_waking));
-    UpdateGlobalTs(queue);
+    AppendToQueue(InlineFtraceQueueIdx(cpu), timestamp,
+                  TimestampedTracePiece::Type::kInlineSchedWaking,
+                  inline_sched_waking);
   }
 
   void ExtractEventsForced() {
-    SortAndExtractEventsUntilPacket(packet_idx_);
+    SortAndExtractEventsUntilAllocId(allocator_.PastTheEndId());
     queues_.resize(0);
+    PERFETTO_DCHECK(buffered_bytes_ == 0);
 
-    packet_idx_for_extraction_ = packet_idx_;
+    alloc_id_for_extraction_ = allocator_.PastTheEndId();
     flushes_since_extraction_ = 0;
   }
 
@@ -170,8 +195,8 @@ class TraceSorter {
       return;
     }
 
-    SortAndExtractEventsUntilPacket(packet_idx_for_extraction_);
-    packet_idx_for_extraction_ = packet_idx_;
+    SortAndExtractEventsUntilAllocId(alloc_id_for_extraction_);
+    alloc_id_for_extraction_ = allocator_.PastTheEndId();
     flushes_since_extraction_ = 0;
   }
 
@@ -180,10 +205,40 @@ class TraceSorter {
  private:
   static constexpr uint32_t kNoBatch = std::numeric_limits<uint32_t>::max();
 
+  // The header of an event buffered in the sorter. The payload of the event
+  // (i.e. the data passed to the parser in the TimestampedTracePiece) is stored
+  // in |allocator_| at |alloc_id|.
+  struct TimestampedEvent {
+    static constexpr uint32_t kTypeBits = 64 - BumpAllocator::kAllocIdBits;
+
+    TimestampedTracePiece::Type type() const {
+      return static_cast<TimestampedTracePiece::Type>(type_bits);
+    }
+
+    // For std::lower_bound().
+    static inline bool Compare(const TimestampedEvent& x, int64_t ts) {
+      return x.ts < ts;
+    }
+
+    // For std::sort(). Events with the same timestamp are kept in push order.
+    inline bool operator<(const TimestampedEvent& o) const {
+      return ts < o.ts || (ts == o.ts && alloc_id < o.alloc_id);
+    }
+
+    int64_t ts;
+    uint64_t alloc_id : BumpAllocator::kAllocIdBits;
+    uint64_t type_bits : kTypeBits;
+  };
+  static_assert(sizeof(TimestampedEvent) == 16,
+                "TimestampedEvent must be 16 bytes");
+  static_assert(static_cast<uint32_t>(TimestampedTracePiece::Type::kMax) <
+                    (1u << TimestampedEvent::kTypeBits),
+                "TimestampedTracePiece::Type does not fit in TimestampedEvent");
+
   struct Queue {
-    inline void Append(TimestampedTracePiece ttp) {
-      const int64_t timestamp = ttp.timestamp;
-      events_.emplace_back(std::move(ttp));
+    inline void Append(TimestampedEvent event) {
+      const int64_t timestamp = event.ts;
+      events_.emplace_back(event);
       min_ts_ = std::min(min_ts_, timestamp);
 
       // Events are often seen in order.
@@ -210,14 +265,73 @@ class TraceSorter {
     bool needs_sorting() const { return sort_start_idx_ != 0; }
     void Sort();
 
-    base::CircularQueue<TimestampedTracePiece> events_;
+    base::CircularQueue<TimestampedEvent> events_;
     int64_t min_ts_ = std::numeric_limits<int64_t>::max();
     int64_t max_ts_ = 0;
     size_t sort_start_idx_ = 0;
     int64_t sort_min_ts_ = std::numeric_limits<int64_t>::max();
   };
 
-  void SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx);
+  // Extracts events in timestamp order until either reaching an event pushed
+  // after |limit_alloc_id| or until |BufferedBytes()| is <=
+  // |min_buffered_bytes|.
+  void SortAndExtractEventsUntilAllocId(BumpAllocator::AllocId limit_alloc_id,
+                                        size_t min_buffered_bytes = 0);
+
+  // Extracts the oldest events when the memory limit has been exceeded.
+  void ExtractEventsForMemoryLimit();
+
+  // Moves the payload of |event| out of |allocator_| into a
+  // TimestampedTracePiece and frees it.
+  TimestampedTracePiece EvictEvent(const TimestampedEvent& event);
+
+  template <typename T>
+  TimestampedTracePiece EvictPayload(const TimestampedEvent& event);
+
+  template <typename T>
+  static constexpr uint32_t PayloadSize() {
+    return BumpAllocator::AlignUp(static_cast<uint32_t>(sizeof(T)));
+  }
+
+  // Returns an approximation of the memory used by buffering an event with
+  // |payload|, except for the payload itself (see |BufferedBytes|).
+  template <typename T>
+  static size_t ApproxBufferedBytes(const T& payload) {
+    return sizeof(TimestampedEvent) + ReferencedBytes(payload);
+  }
+
+  // Returns an approximation of the memory used by the buffered events.
+  size_t BufferedBytes() const {
+    return buffered_bytes_ + allocator_.resident_bytes();
+  }
+
+  // The size of the trace data referenced by the payload. The size of the
+  // TraceBlobViews is an overestimate if many events share the same TraceBlob
+  // but an underestimate if a small part of each blob is referenced: on
+  // average, it's a reasonable approximation of the memory kept alive.
+  static size_t ReferencedBytes(const TracePacketData& d) {
+    return d.packet.length();
+  }
+  static size_t ReferencedBytes(const FtraceEventData& d) {
+    return d.event.length();
+  }
+  static size_t ReferencedBytes(const TrackEventData& d) {
+    return d.packet.length();
+  }
+  static size_t ReferencedBytes(const std::string& s) { return s.size(); }
+  template <typename T>
+  static size_t ReferencedBytes(const T&) {
+    return 0;
+  }
+
+  static inline size_t FtraceQueueIdx(uint32_t cpu) { return 1 + 2 * cpu; }
+  static inline size_t InlineFtraceQueueIdx(uint32_t cpu) {
+    return 2 + 2 * cpu;
+  }
+  static inline uint32_t QueueIdxToCpu(size_t queue_idx) {
+    PERFETTO_DCHECK(queue_idx > 0);
+    return static_cast<uint32_t>((queue_idx - 1) / 2);
+  }
 
   inline Queue* GetQueue(size_t index) {
     if (PERFETTO_UNLIKELY(index >= queues_.size()))
@@ -225,10 +339,28 @@ class TraceSorter {
     return &queues_[index];
   }
 
-  inline void AppendNonFtraceEvent(TimestampedTracePiece ttp) {
-    Queue* queue = GetQueue(0);
-    queue->Append(std::move(ttp));
+  template <typename T>
+  inline void AppendToQueue(size_t queue_idx,
+                            int64_t ts,
+                            TimestampedTracePiece::Type type,
+                            T payload) {
+    static_assert(alignof(T) <= BumpAllocator::kAlignment,
+                  "Payload is not sufficiently aligned for BumpAllocator");
+    buffered_bytes_ += ApproxBufferedBytes(payload);
+    BumpAllocator::AllocId id = allocator_.Alloc(PayloadSize<T>());
+    new (allocator_.GetPointer(id)) T(std::move(payload));
+
+    TimestampedEvent event;
+    event.ts = ts;
+    event.alloc_id = id;
+    event.type_bits = static_cast<uint64_t>(type);
+    Queue* queue = GetQueue(queue_idx);
+    queue->Append(event);
     UpdateGlobalTs(queue);
+    if (PERFETTO_UNLIKELY(memory_limit_bytes_ &&
+                          BufferedBytes() > memory_limit_bytes_)) {
+      ExtractEventsForMemoryLimit();
+    }
   }
 
   inline void UpdateGlobalTs(Queue* queue) {
@@ -246,9 +378,17 @@ class TraceSorter {
   // forced extractionn at the end of the trace.
   SortingMode sorting_mode_ = SortingMode::kDefault;
 
-  // The packet index until which events should be extracted. Set based
-  // on the packet index in |OnReadBuffer|.
-  uint64_t packet_idx_for_extraction_ = 0;
+  // The limit on |BufferedBytes()| or 0 if there is no limit. See the class
+  // comment for details.
+  size_t memory_limit_bytes_ = 0;
+
+  // Approximate size of the events currently in |queues_|, excluding their
+  // payloads in |allocator_|.
+  size_t buffered_bytes_ = 0;
+
+  // The allocation id until which events should be extracted. Set based
+  // on the allocation id in |NotifyReadBufferEvent|.
+  BumpAllocator::AllocId alloc_id_for_extraction_ = 0;
 
   // The number of flushes which have happened since the last incremental
   // extraction.
@@ -256,7 +396,9 @@ class TraceSorter {
 
   // queues_[0] is the general (non-ftrace) queue.
   // queues_[1] is the ftrace queue for CPU(0).
-  // queues_[x] is the ftrace queue for CPU(x - 1).
+  // queues_[2] is the compact (inline sched) ftrace queue for CPU(0).
+  // queues_[2x + 1] is the ftrace queue for CPU(x).
+  // queues_[2x + 2] is the compact ftrace queue for CPU(x).
   std::vector<Queue> queues_;
 
   // max(e.timestamp for e in queues_).
@@ -265,8 +407,8 @@ class TraceSorter {
   // min(e.timestamp for e in queues_).
   int64_t global_min_ts_ = std::numeric_limits<int64_t>::max();
 
-  // Monotonic increasing value used to index timestamped trace pieces.
-  uint64_t packet_idx_ = 0;
+  // Stores the payloads of the events in |queues_|.
+  BumpAllocator allocator_;
 
   // Used for performance tests. True when setting TRACE_PROCESSOR_SORT_ONLY=1.
   bool bypass_next_stage_for_testing_ = false;
@@ -15,8 +15,10 @@
  */
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 
+#include <limits>
 #include <map>
 #include <random>
+#include <string>
 #include <vector>
 
 #include "perfetto/trace_processor/basic_types.h"
@@ -31,8 +33,10 @@ namespace trace_processor {
 namespace {
 
 using ::testing::_;
+using ::testing::AnyNumber;
 using ::testing::InSequence;
 using ::testing::Invoke;
+using ::testing::Lt;
 using ::testing::MockFunction;
 using ::testing::NiceMock;
 
@@ -58,7 +62,13 @@ class MockTraceParser : public ProtoTraceParser {
   MOCK_METHOD3(MOCK_ParseTracePacket,
                void(int64_t ts, const uint8_t* data, size_t length));
 
+  MOCK_METHOD2(MOCK_ParseJsonValue, void(int64_t ts, std::string value));
+
   void ParseTracePacket(int64_t ts, TimestampedTracePiece ttp) override {
+    if (ttp.type == TimestampedTracePiece::Type::kJsonValue) {
+      MOCK_ParseJsonValue(ts, std::move(ttp.json_value));
+      return;
+    }
     TraceBlobView& tbv = ttp.packet_data.packet;
     MOCK_ParseTracePacket(ts, tbv.data(), tbv.length());
   }
@@ -195,6 +205,136 @@ TEST_F(TraceSorterTest, IncrementalExtraction) {
   context_.sorter->ExtractEventsForced();
 }
 
+TEST_F(TraceSorterTest, MemoryLimit) {
+  // Each event below uses |kEventBytes| of the memory limit: a 16 byte header
+  // and the |kChunkSize| bytes of trace data it references. The payloads all
+  // fit in a single chunk of the bump allocator.
+  constexpr size_t kChunkSize = BumpAllocator::kChunkSize;
+  constexpr size_t kEventBytes = 16 + kChunkSize;
+  context_.config.sorter_memory_limit_bytes = 10 * kEventBytes + kChunkSize;
+  CreateSorter();
+
+  PacketSequenceState state(&context_);
+  TraceBlobView buffer(TraceBlob::Allocate(kChunkSize));
+
+  // The 11th event exceeds the limit: enough events should be extracted to
+  // go back below 3/4 of the limit.
+  {
+    InSequence s;
+    for (int64_t ts = 1000; ts < 1004; ++ts)
+      EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, ts, _, kChunkSize));
+  }
+  for (int64_t ts = 1000; ts < 1011; ++ts) {
+    context_.sorter->PushFtraceEvent(0 /*cpu*/, ts,
+                                     buffer.slice_off(0, kChunkSize), &state);
+  }
+  ::testing::Mock::VerifyAndClearExpectations(parser_);
+  EXPECT_EQ(
+      context_.storage->stats()[stats::sorter_memory_limit_exceeded].value, 1);
+
+  {
+    InSequence s;
+    for (int64_t ts = 1004; ts < 1011; ++ts)
+      EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, ts, _, kChunkSize));
+  }
+  context_.sorter->ExtractEventsForced();
+}
+
+// An event with a much later timestamp than the ones pushed after it stays
+// buffered for a long time. It must only keep its own payload alive, or the
+// memory of the events extracted after it is never reclaimed and it gets
+// extracted early, out of order.
+TEST_F(TraceSorterTest, MemoryLimitWithLongLivedEvent) {
+  constexpr size_t kChunkSize = BumpAllocator::kChunkSize;
+  context_.config.sorter_memory_limit_bytes = 8 * kChunkSize;
+  CreateSorter();
+
+  PacketSequenceState state(&context_);
+  constexpr int64_t kPinnedTs = std::numeric_limits<int64_t>::max() / 2;
+  context_.sorter->PushFtraceEvent(0 /*cpu*/, kPinnedTs,
+                                   test_buffer_.slice_off(0, 1), &state);
+
+  // Push enough events to fill the limit several times over with their
+  // payloads alone.
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, kPinnedTs, _, _)).Times(0);
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, Lt(kPinnedTs), _, _))
+      .Times(AnyNumber());
+  const int64_t kEvents =
+      static_cast<int64_t>(32 * kChunkSize / sizeof(FtraceEventData));
+  for (int64_t ts = 1; ts <= kEvents; ++ts) {
+    context_.sorter->PushFtraceEvent(0 /*cpu*/, ts,
+                                     test_buffer_.slice_off(0, 1), &state);
+  }
+  ::testing::Mock::VerifyAndClearExpectations(parser_);
+  EXPECT_GT(
+      context_.storage->stats()[stats::sorter_memory_limit_exceeded].value, 1);
+
+  {
+    InSequence s;
+    EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, Lt(kPinnedTs), _, _))
+        .Times(AnyNumber());
+    EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, kPinnedTs, _, _));
+  }
+  context_.sorter->ExtractEventsForced();
+}
+
+// Simulates ftrace bundles containing both regular and compact sched events.
+// Each sub-stream is sorted but they interleave on the same cpu: check that
+// they get merged in timestamp order and reported on the right cpu.
+TEST_F(TraceSorterTest, MixedCompactAndRegularFtrace) {
+  PacketSequenceState state(&context_);
+  TraceBlobView view_1 = test_buffer_.slice_off(0, 1);
+  TraceBlobView view_2 = test_buffer_.slice_off(0, 2);
+  TraceBlobView view_3 = test_buffer_.slice_off(0, 3);
+
+  InSequence s;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1000, view_1.data(), 1));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1001, nullptr, 0));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1002, view_2.data(), 2));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1003, nullptr, 0));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1004, nullptr, 0));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1005, nullptr, 0));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1006, view_3.data(), 3));
+
+  // As in a bundle: first the regular events, then the compact ones.
+  context_.sorter->PushFtraceEvent(1 /*cpu*/, 1000 /*timestamp*/,
+                                   std::move(view_1), &state);
+  context_.sorter->PushFtraceEvent(1 /*cpu*/, 1002 /*timestamp*/,
+                                   std::move(view_2), &state);
+  context_.sorter->PushFtraceEvent(1 /*cpu*/, 1006 /*timestamp*/,
+                                   std::move(view_3), &state);
+  context_.sorter->PushInlineFtraceEvent(1 /*cpu*/, 1001 /*timestamp*/,
+                                         InlineSchedSwitch{});
+  context_.sorter->PushInlineFtraceEvent(1 /*cpu*/, 1003 /*timestamp*/,
+                                         InlineSchedWaking{});
+  context_.sorter->PushInlineFtraceEvent(1 /*cpu*/, 1005 /*timestamp*/,
+                                         InlineSchedSwitch{});
+  context_.sorter->PushInlineFtraceEvent(0 /*cpu*/, 1004 /*timestamp*/,
+                                         InlineSchedSwitch{});
+  context_.sorter->ExtractEventsForced();
+}
+
+// Pushes enough events to span many chunks of memory in the sorter and checks
+// that their payloads are preserved.
+TEST_F(TraceSorterTest, ManyPayloads) {
+  constexpr int64_t kNumEvents = 10000;
+  int64_t expected_ts = 0;
+  EXPECT_CALL(*parser_, MOCK_ParseJsonValue(_, _))
+      .WillRepeatedly(Invoke([&expected_ts](int64_t ts, std::string value) {
+        EXPECT_EQ(ts, expected_ts);
+        EXPECT_EQ(value, std::to_string(expected_ts));
+        expected_ts++;
+      }));
+  // Push the events in blocks of 100 in reverse order.
+  for (int64_t block = kNumEvents / 100 - 1; block >= 0; --block) {
+    for (int64_t ts = block * 100; ts < (block + 1) * 100; ++ts)
+      context_.sorter->PushJsonValue(ts, std::to_string(ts));
+  }
+  context_.sorter->ExtractEventsForced();
+  EXPECT_EQ(expected_ts, kNumEvents);
+}
+
 // Simulate a producer bug where the third packet is emitted
 // out of order. Verify that we track the stats correctly.
 TEST_F(TraceSorterTest, OutOfOrder) {
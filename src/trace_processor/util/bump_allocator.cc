@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/bump_allocator.h"
+
+#include <utility>
+
+namespace perfetto {
+namespace trace_processor {
+
+BumpAllocator::BumpAllocator() = default;
+
+BumpAllocator::~BumpAllocator() {
+  for (auto& chunk : chunks_) {
+    PERFETTO_CHECK(chunk.unfreed_bytes == 0);
+  }
+}
+
+BumpAllocator::AllocId BumpAllocator::Alloc(uint32_t size) {
+  PERFETTO_CHECK(size % kAlignment == 0);
+  PERFETTO_CHECK(size > 0 && size <= kChunkSize);
+
+  if (chunks_.empty() || tail_chunk_offset_ + size > kChunkSize) {
+    uint64_t chunk_idx = erased_front_chunks_count_ + chunks_.size();
+    PERFETTO_CHECK(chunk_idx < (1ull << (kAllocIdBits - kChunkSizeLog2)));
+
+    Chunk chunk;
+    if (spare_chunk_) {
+      chunk.data = std::move(spare_chunk_);
+    } else {
+      chunk.data.reset(new uint8_t[kChunkSize]);
+    }
+    chunks_.emplace_back(std::move(chunk));
+    ++resident_chunks_;
+    tail_chunk_offset_ = 0;
+
+    // The previous tail chunk might have been fully freed while it was still
+    // being used for allocations: now that it's not the tail anymore it can
+    // be released.
+    if (chunks_.size() > 1) {
+      Chunk& prev_tail = chunks_.at(chunks_.size() - 2);
+      if (prev_tail.unfreed_bytes == 0)
+        ReleaseChunk(&prev_tail);
+    }
+    EraseFrontFreeChunks();
+  }
+
+  uint64_t chunk_idx = erased_front_chunks_count_ + chunks_.size() - 1;
+  AllocId id = (chunk_idx << kChunkSizeLog2) | tail_chunk_offset_;
+  chunks_.back().unfreed_bytes += size;
+  tail_chunk_offset_ += size;
+  return id;
+}
+
+void BumpAllocator::Free(AllocId id, uint32_t size) {
+  uint64_t chunk_idx = id >> kChunkSizeLog2;
+  PERFETTO_DCHECK(chunk_idx >= erased_front_chunks_count_);
+  size_t queue_idx =
+      static_cast<size_t>(chunk_idx - erased_front_chunks_count_);
+  Chunk& chunk = chunks_.at(queue_idx);
+  PERFETTO_DCHECK(chunk.unfreed_bytes >= size);
+  chunk.unfreed_bytes -= size;
+  // Never release the tail chunk: it's still being used for allocations.
+  if (chunk.unfreed_bytes != 0 || queue_idx + 1 == chunks_.size())
+    return;
+  ReleaseChunk(&chunk);
+  if (queue_idx == 0)
+    EraseFrontFreeChunks();
+}
+
+void BumpAllocator::ReleaseChunk(Chunk* chunk) {
+  PERFETTO_DCHECK(chunk->unfreed_bytes == 0);
+  if (!chunk->data)
+    return;
+  spare_chunk_ = std::move(chunk->data);
+  --resident_chunks_;
+}
+
+void BumpAllocator::EraseFrontFreeChunks() {
+  size_t to_erase = 0;
+  // Never erase the tail chunk: it's still being used for allocations.
+  for (size_t i = 0; i + 1 < chunks_.size(); ++i) {
+    Chunk& chunk = chunks_.at(i);
+    if (chunk.unfreed_bytes != 0)
+      break;
+    ReleaseChunk(&chunk);
+    ++to_erase;
+  }
+  if (to_erase == 0)
+    return;
+  chunks_.erase_front(to_erase);
+  erased_front_chunks_count_ += to_erase;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
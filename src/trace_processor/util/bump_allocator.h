@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_BUMP_ALLOCATOR_H_
+#define SRC_TRACE_PROCESSOR_UTIL_BUMP_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/circular_queue.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A simple memory allocator which "bumps" a pointer to service allocations.
+//
+// Memory is obtained from the system allocator in large chunks and every
+// allocation is carved out of the last chunk, as long as it fits. Once it
+// doesn't, a new chunk is requested. Each chunk keeps a count of its
+// unfreed bytes and its memory is returned to the system as soon as all the
+// allocations in it have been freed (unless it's the chunk currently used for
+// allocations). The bookkeeping entries of the chunks are then erased in FIFO
+// order.
+//
+// This makes allocations and frees very cheap (no per-allocation metadata, no
+// free lists) for workloads which free memory in *roughly* the same order in
+// which it was allocated (e.g. the events buffered by TraceSorter). A single
+// long-lived allocation only keeps alive its own chunk, plus a few bytes of
+// bookkeeping for each chunk allocated after it.
+//
+// Each allocation is identified by an AllocId. AllocIds increase monotonically
+// in allocation order so they can also be used to reason about the relative
+// order of allocations.
+//
+// IMPORTANT: all allocations are 8-byte aligned and all sizes must be a
+// multiple of 8 (see |AlignUp|) and smaller than |kChunkSize|.
+//
+// IMPORTANT: all allocations *must* be freed before destroying this object.
+class BumpAllocator {
+ public:
+  // Identifies an allocation. The top bits are the index of the chunk (counted
+  // from the first chunk ever allocated), the low |kChunkSizeLog2| bits are the
+  // offset of the allocation inside the chunk.
+  using AllocId = uint64_t;
+
+  static constexpr uint32_t kChunkSizeLog2 = 16;
+  static constexpr uint32_t kChunkSize = 1u << kChunkSizeLog2;
+  static constexpr uint32_t kAlignment = 8;
+
+  // The number of bits needed to represent any AllocId. Allows users of this
+  // class to pack AllocIds with other data (e.g. in a bitfield).
+  static constexpr uint32_t kAllocIdBits = 60;
+
+  BumpAllocator();
+  ~BumpAllocator();
+
+  BumpAllocator(const BumpAllocator&) = delete;
+  BumpAllocator& operator=(const BumpAllocator&) = delete;
+
+  // Returns |size| rounded up to the allocation alignment.
+  static constexpr uint32_t AlignUp(uint32_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  // Allocates |size| bytes (which must be a multiple of kAlignment) and returns
+  // the id of the allocation. Use |GetPointer| to access the memory.
+  AllocId Alloc(uint32_t size);
+
+  // Frees the allocation |id| of |size| bytes. |size| must match the size
+  // passed to |Alloc|.
+  void Free(AllocId id, uint32_t size);
+
+  // Returns a pointer to the memory of the allocation |id|.
+  void* GetPointer(AllocId id) {
+    uint64_t chunk_idx = id >> kChunkSizeLog2;
+    PERFETTO_DCHECK(chunk_idx >= erased_front_chunks_count_);
+    Chunk& chunk =
+        chunks_.at(static_cast<size_t>(chunk_idx - erased_front_chunks_count_));
+    return chunk.data.get() + (id & (kChunkSize - 1));
+  }
+
+  // Returns an id which is greater than the id of all the allocations done so
+  // far and less than or equal to the id of any future allocation.
+  AllocId PastTheEndId() const {
+    uint64_t chunk_idx = erased_front_chunks_count_ + chunks_.size();
+    if (chunks_.empty())
+      return chunk_idx << kChunkSizeLog2;
+    // Note: |tail_chunk_offset_| can be == kChunkSize so this can be the id of
+    // the first byte of the next chunk.
+    return ((chunk_idx - 1) << kChunkSizeLog2) + tail_chunk_offset_;
+  }
+
+  // Returns the number of chunks which have been returned to the system.
+  uint64_t erased_front_chunks_count() const {
+    return erased_front_chunks_count_;
+  }
+
+  // Returns the number of chunks which are currently allocated.
+  size_t chunk_count() const { return resident_chunks_; }
+
+  // Returns the memory currently allocated for chunks.
+  size_t resident_bytes() const { return resident_chunks_ * kChunkSize; }
+
+ private:
+  struct Chunk {
+    // Null once all the allocations in the chunk have been freed.
+    std::unique_ptr<uint8_t[]> data;
+    uint32_t unfreed_bytes = 0;
+  };
+
+  // Returns the memory of |chunk|, which has no unfreed allocations and isn't
+  // the tail chunk, to the system.
+  void ReleaseChunk(Chunk* chunk);
+
+  // Erases all the chunks at the front of |chunks_| which have no unfreed
+  // allocations, leaving the tail chunk alone.
+  void EraseFrontFreeChunks();
+
+  base::CircularQueue<Chunk> chunks_;
+
+  // The offset of the first free byte of the last element of |chunks_|.
+  uint32_t tail_chunk_offset_ = 0;
+
+  // The number of chunks erased from the front of |chunks_|. Needed to turn
+  // chunk indices in AllocIds into indices in |chunks_|.
+  uint64_t erased_front_chunks_count_ = 0;
+
+  // The number of elements of |chunks_| which still have their |data|.
+  size_t resident_chunks_ = 0;
+
+  // The most recently released chunk: kept around to avoid going back to the
+  // system allocator when the allocator is used as a FIFO.
+  std::unique_ptr<uint8_t[]> spare_chunk_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_BUMP_ALLOCATOR_H_
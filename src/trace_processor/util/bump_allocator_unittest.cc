@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/bump_allocator.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(BumpAllocatorUnittest, AllocAndFree) {
+  BumpAllocator allocator;
+
+  BumpAllocator::AllocId a = allocator.Alloc(8);
+  BumpAllocator::AllocId b = allocator.Alloc(16);
+  ASSERT_LT(a, b);
+  ASSERT_LE(b + 16, allocator.PastTheEndId());
+
+  memset(allocator.GetPointer(a), 'a', 8);
+  memset(allocator.GetPointer(b), 'b', 16);
+  ASSERT_EQ(static_cast<char*>(allocator.GetPointer(a))[7], 'a');
+  ASSERT_EQ(static_cast<char*>(allocator.GetPointer(b))[0], 'b');
+
+  allocator.Free(a, 8);
+  allocator.Free(b, 16);
+  ASSERT_EQ(allocator.chunk_count(), 1u);
+}
+
+TEST(BumpAllocatorUnittest, AlignUp) {
+  ASSERT_EQ(BumpAllocator::AlignUp(1), 8u);
+  ASSERT_EQ(BumpAllocator::AlignUp(8), 8u);
+  ASSERT_EQ(BumpAllocator::AlignUp(9), 16u);
+}
+
+TEST(BumpAllocatorUnittest, PastTheEndId) {
+  BumpAllocator allocator;
+  BumpAllocator::AllocId end = allocator.PastTheEndId();
+  BumpAllocator::AllocId a = allocator.Alloc(BumpAllocator::kChunkSize);
+  ASSERT_LE(end, a);
+  ASSERT_LT(a, allocator.PastTheEndId());
+
+  // The chunk is full: the next allocation goes in a new chunk but must still
+  // be >= the previous past-the-end id.
+  end = allocator.PastTheEndId();
+  BumpAllocator::AllocId b = allocator.Alloc(8);
+  ASSERT_LE(end, b);
+  ASSERT_EQ(allocator.chunk_count(), 2u);
+
+  allocator.Free(a, BumpAllocator::kChunkSize);
+  allocator.Free(b, 8);
+}
+
+TEST(BumpAllocatorUnittest, EraseFrontChunks) {
+  BumpAllocator allocator;
+  constexpr uint32_t kHalfChunk = BumpAllocator::kChunkSize / 2;
+
+  BumpAllocator::AllocId a = allocator.Alloc(kHalfChunk);
+  BumpAllocator::AllocId b = allocator.Alloc(kHalfChunk);
+  BumpAllocator::AllocId c = allocator.Alloc(kHalfChunk);
+  BumpAllocator::AllocId d = allocator.Alloc(kHalfChunk);
+  BumpAllocator::AllocId e = allocator.Alloc(kHalfChunk);
+  ASSERT_EQ(allocator.chunk_count(), 3u);
+
+  // Freeing the second chunk first releases its memory but must not erase
+  // anything as the first chunk is still in use.
+  allocator.Free(c, kHalfChunk);
+  allocator.Free(d, kHalfChunk);
+  ASSERT_EQ(allocator.chunk_count(), 2u);
+  ASSERT_EQ(allocator.erased_front_chunks_count(), 0u);
+
+  // Freeing the first chunk should erase both.
+  allocator.Free(b, kHalfChunk);
+  allocator.Free(a, kHalfChunk);
+  ASSERT_EQ(allocator.chunk_count(), 1u);
+  ASSERT_EQ(allocator.erased_front_chunks_count(), 2u);
+
+  // Allocations still work and the ids keep increasing.
+  memset(allocator.GetPointer(e), 'e', kHalfChunk);
+  BumpAllocator::AllocId f = allocator.Alloc(kHalfChunk);
+  BumpAllocator::AllocId g = allocator.Alloc(8);
+  ASSERT_LT(e, f);
+  ASSERT_LT(f, g);
+  ASSERT_EQ(static_cast<char*>(allocator.GetPointer(e))[0], 'e');
+
+  // The tail chunk (with e and f) becomes free only once it stops being the
+  // tail.
+  allocator.Free(e, kHalfChunk);
+  allocator.Free(f, kHalfChunk);
+  ASSERT_EQ(allocator.chunk_count(), 1u);
+  ASSERT_EQ(allocator.erased_front_chunks_count(), 3u);
+  allocator.Free(g, 8);
+}
+
+// A long-lived allocation must only keep its own chunk alive, not the chunks
+// allocated after it.
+TEST(BumpAllocatorUnittest, LongLivedAllocation) {
+  BumpAllocator allocator;
+  BumpAllocator::AllocId pinned = allocator.Alloc(16);
+  std::vector<BumpAllocator::AllocId> ids;
+  for (uint32_t i = 0; i < 100000; ++i) {
+    ids.push_back(allocator.Alloc(16));
+    if (i >= 1000) {
+      allocator.Free(ids[i - 1000], 16);
+      ASSERT_LE(allocator.chunk_count(), 3u);
+    }
+  }
+  ASSERT_EQ(allocator.erased_front_chunks_count(), 0u);
+  ASSERT_LE(allocator.resident_bytes(), 3u * BumpAllocator::kChunkSize);
+
+  for (uint32_t i = 100000 - 1000; i < 100000; ++i)
+    allocator.Free(ids[i], 16);
+  ASSERT_EQ(allocator.chunk_count(), 2u);
+
+  // Freeing the long-lived allocation erases all the chunks but the tail.
+  allocator.Free(pinned, 16);
+  ASSERT_EQ(allocator.chunk_count(), 1u);
+  ASSERT_EQ(allocator.erased_front_chunks_count(),
+            100001u * 16 / BumpAllocator::kChunkSize);
+}
+
+TEST(BumpAllocatorUnittest, Fifo) {
+  BumpAllocator allocator;
+  std::vector<BumpAllocator::AllocId> ids;
+  for (uint32_t i = 0; i < 100000; ++i) {
+    BumpAllocator::AllocId id = allocator.Alloc(16);
+    memcpy(allocator.GetPointer(id), &i, sizeof(i));
+    ids.push_back(id);
+    if (i >= 1000) {
+      BumpAllocator::AllocId front = ids[i - 1000];
+      uint32_t value;
+      memcpy(&value, allocator.GetPointer(front), sizeof(value));
+      ASSERT_EQ(value, i - 1000);
+      allocator.Free(front, 16);
+    }
+  }
+  // Only a window of 1000 allocations is alive at any time.
+  ASSERT_LE(allocator.chunk_count(), 2u);
+  for (uint32_t i = 100000 - 1000; i < 100000; ++i)
+    allocator.Free(ids[i], 16);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -21,6 +21,8 @@
 #include "perfetto/ext/base/optional.h"
 #include "protos/perfetto/config/ftrace/ftrace_config.gen.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/irq.pbzero.h"
+#include "protos/perfetto/trace/ftrace/power.pbzero.h"
 #include "protos/perfetto/trace/ftrace/sched.pbzero.h"
 #include "src/traced/probes/ftrace/event_info_constants.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
@@ -148,6 +150,80 @@ base::Optional<CompactSchedWakingFormat> ValidateSchedWakingFormat(
   return base::make_optional(waking_format);
 }
 
+// The compile-time assumptions about the format of a CompactIrqPowerEvent: the
+// proto field ids and the ftrace types of the fields that are recorded.
+struct CompactEventSpec {
+  uint32_t proto_field_id;
+  uint16_t num_fields;
+  uint32_t field_proto_ids[2];
+  FtraceFieldType field_types[2];
+};
+
+// Indexed by CompactIrqPowerEvent.
+constexpr CompactEventSpec kCompactIrqPowerSpecs[] = {
+    {protos::pbzero::FtraceEvent::kIrqHandlerEntryFieldNumber,
+     2,
+     {protos::pbzero::IrqHandlerEntryFtraceEvent::kIrqFieldNumber,
+      protos::pbzero::IrqHandlerEntryFtraceEvent::kNameFieldNumber},
+     {kFtraceInt32, kFtraceDataLoc}},
+    {protos::pbzero::FtraceEvent::kIrqHandlerExitFieldNumber,
+     2,
+     {protos::pbzero::IrqHandlerExitFtraceEvent::kIrqFieldNumber,
+      protos::pbzero::IrqHandlerExitFtraceEvent::kRetFieldNumber},
+     {kFtraceInt32, kFtraceInt32}},
+    {protos::pbzero::FtraceEvent::kSoftirqEntryFieldNumber,
+     1,
+     {protos::pbzero::SoftirqEntryFtraceEvent::kVecFieldNumber, 0},
+     {kFtraceUint32, kInvalidFtraceFieldType}},
+    {protos::pbzero::FtraceEvent::kSoftirqExitFieldNumber,
+     1,
+     {protos::pbzero::SoftirqExitFtraceEvent::kVecFieldNumber, 0},
+     {kFtraceUint32, kInvalidFtraceFieldType}},
+    {protos::pbzero::FtraceEvent::kSoftirqRaiseFieldNumber,
+     1,
+     {protos::pbzero::SoftirqRaiseFtraceEvent::kVecFieldNumber, 0},
+     {kFtraceUint32, kInvalidFtraceFieldType}},
+    {protos::pbzero::FtraceEvent::kCpuIdleFieldNumber,
+     2,
+     {protos::pbzero::CpuIdleFtraceEvent::kStateFieldNumber,
+      protos::pbzero::CpuIdleFtraceEvent::kCpuIdFieldNumber},
+     {kFtraceUint32, kFtraceUint32}},
+    {protos::pbzero::FtraceEvent::kCpuFrequencyFieldNumber,
+     2,
+     {protos::pbzero::CpuFrequencyFtraceEvent::kStateFieldNumber,
+      protos::pbzero::CpuFrequencyFtraceEvent::kCpuIdFieldNumber},
+     {kFtraceUint32, kFtraceUint32}},
+};
+
+static_assert(sizeof(kCompactIrqPowerSpecs) / sizeof(CompactEventSpec) ==
+                  kCompactIrqPowerEventCount,
+              "kCompactIrqPowerSpecs must have an entry per event");
+
+// Pre-parse the format of one of the CompactIrqPowerEvent, checking that the
+// fields to record have the expected types. Returns a format with a zero
+// |event_id| if they don't.
+CompactEventFormat ValidateCompactEventFormat(const Event& event,
+                                              const CompactEventSpec& spec) {
+  CompactEventFormat format;
+  format.size = event.size;
+  format.num_fields = spec.num_fields;
+  for (uint16_t i = 0; i < spec.num_fields; i++) {
+    bool field_valid = false;
+    for (const auto& field : event.fields) {
+      if (field.proto_field_id != spec.field_proto_ids[i])
+        continue;
+      format.field_offsets[i] = field.ftrace_offset;
+      format.field_types[i] = field.ftrace_type;
+      field_valid = field.ftrace_type == spec.field_types[i];
+      break;
+    }
+    if (!field_valid)
+      return CompactEventFormat{};
+  }
+  format.event_id = event.ftrace_event_id;
+  return format;
+}
+
 }  // namespace
 
 // TODO(rsavitski): could avoid looping over all events if the caller did the
@@ -159,6 +235,7 @@ CompactSchedEventFormat ValidateFormatForCompactSched(
 
   base::Optional<CompactSchedSwitchFormat> switch_format;
   base::Optional<CompactSchedWakingFormat> waking_format;
+  CompactIrqPowerFormat irq_power_format{};
   for (const Event& event : events) {
     if (event.proto_field_id == FtraceEvent::kSchedSwitchFieldNumber) {
       switch_format = ValidateSchedSwitchFormat(event);
@@ -166,23 +243,29 @@ CompactSchedEventFormat ValidateFormatForCompactSched(
     if (event.proto_field_id == FtraceEvent::kSchedWakingFieldNumber) {
       waking_format = ValidateSchedWakingFormat(event);
     }
+    for (size_t i = 0; i < kCompactIrqPowerEventCount; i++) {
+      if (event.proto_field_id == kCompactIrqPowerSpecs[i].proto_field_id) {
+        irq_power_format[i] =
+            ValidateCompactEventFormat(event, kCompactIrqPowerSpecs[i]);
+      }
+    }
   }
 
   if (switch_format.has_value() && waking_format.has_value()) {
     return CompactSchedEventFormat{/*format_valid=*/true, switch_format.value(),
-                                   waking_format.value()};
+                                   waking_format.value(), irq_power_format};
   } else {
     PERFETTO_ELOG("Unexpected sched_switch or sched_waking format.");
-    return CompactSchedEventFormat{/*format_valid=*/false,
-                                   CompactSchedSwitchFormat{},
-                                   CompactSchedWakingFormat{}};
+    return CompactSchedEventFormat{
+        /*format_valid=*/false, CompactSchedSwitchFormat{},
+        CompactSchedWakingFormat{}, irq_power_format};
   }
 }
 
 CompactSchedEventFormat InvalidCompactSchedEventFormatForTesting() {
-  return CompactSchedEventFormat{/*format_valid=*/false,
-                                 CompactSchedSwitchFormat{},
-                                 CompactSchedWakingFormat{}};
+  return CompactSchedEventFormat{
+      /*format_valid=*/false, CompactSchedSwitchFormat{},
+      CompactSchedWakingFormat{}, CompactIrqPowerFormat{}};
 }
 
 // TODO(rsavitski): find the correct place in the trace for, and method of,
@@ -194,10 +277,12 @@ CompactSchedConfig CreateCompactSchedConfig(
   if (!request.compact_sched().enabled())
     return CompactSchedConfig{/*enabled=*/false};
 
+  // The irq and power events have their own, per event, format checks.
+  bool irq_and_power_events = request.compact_sched().irq_and_power_events();
   if (!compact_format.format_valid)
-    return CompactSchedConfig{/*enabled=*/false};
+    return CompactSchedConfig{/*enabled=*/false, irq_and_power_events};
 
-  return CompactSchedConfig{/*enabled=*/true};
+  return CompactSchedConfig{/*enabled=*/true, irq_and_power_events};
 }
 
 CompactSchedConfig EnabledCompactSchedConfigForTesting() {
@@ -248,6 +333,72 @@ void CompactSchedWakingBuffer::Reset() {
   comm_index_.Reset();
 }
 
+void CompactEventColumns::Reset() {
+  last_timestamp_ = 0;
+  timestamp_.Reset();
+  for (protozero::PackedVarInt& field : fields_)
+    field.Reset();
+}
+
+void CompactIrqPowerBuffer::Write(
+    protos::pbzero::FtraceEventBundle::CompactIrqPower* compact_out) const {
+  for (const std::string& name : irq_names_)
+    compact_out->add_intern_table(name.data(), name.size());
+
+  const CompactEventColumns& irq_entry = events_[kCompactIrqHandlerEntry];
+  if (irq_entry.size() > 0) {
+    compact_out->set_irq_entry_timestamp(irq_entry.timestamp());
+    compact_out->set_irq_entry_irq(irq_entry.field(0));
+    compact_out->set_irq_entry_name_index(irq_entry.field(1));
+  }
+
+  const CompactEventColumns& irq_exit = events_[kCompactIrqHandlerExit];
+  if (irq_exit.size() > 0) {
+    compact_out->set_irq_exit_timestamp(irq_exit.timestamp());
+    compact_out->set_irq_exit_irq(irq_exit.field(0));
+    compact_out->set_irq_exit_ret(irq_exit.field(1));
+  }
+
+  const CompactEventColumns& softirq_entry = events_[kCompactSoftirqEntry];
+  if (softirq_entry.size() > 0) {
+    compact_out->set_softirq_entry_timestamp(softirq_entry.timestamp());
+    compact_out->set_softirq_entry_vec(softirq_entry.field(0));
+  }
+
+  const CompactEventColumns& softirq_exit = events_[kCompactSoftirqExit];
+  if (softirq_exit.size() > 0) {
+    compact_out->set_softirq_exit_timestamp(softirq_exit.timestamp());
+    compact_out->set_softirq_exit_vec(softirq_exit.field(0));
+  }
+
+  const CompactEventColumns& softirq_raise = events_[kCompactSoftirqRaise];
+  if (softirq_raise.size() > 0) {
+    compact_out->set_softirq_raise_timestamp(softirq_raise.timestamp());
+    compact_out->set_softirq_raise_vec(softirq_raise.field(0));
+  }
+
+  const CompactEventColumns& cpu_idle = events_[kCompactCpuIdle];
+  if (cpu_idle.size() > 0) {
+    compact_out->set_cpu_idle_timestamp(cpu_idle.timestamp());
+    compact_out->set_cpu_idle_state(cpu_idle.field(0));
+    compact_out->set_cpu_idle_cpu_id(cpu_idle.field(1));
+  }
+
+  const CompactEventColumns& cpu_frequency = events_[kCompactCpuFrequency];
+  if (cpu_frequency.size() > 0) {
+    compact_out->set_cpu_frequency_timestamp(cpu_frequency.timestamp());
+    compact_out->set_cpu_frequency_state(cpu_frequency.field(0));
+    compact_out->set_cpu_frequency_cpu_id(cpu_frequency.field(1));
+  }
+}
+
+void CompactIrqPowerBuffer::Reset() {
+  for (CompactEventColumns& columns : events_)
+    columns.Reset();
+  irq_names_.clear();
+  irq_name_indexes_.Clear();
+}
+
 void CommInterner::Write(
     protos::pbzero::FtraceEventBundle::CompactSched* compact_out) const {
   for (size_t i = 0; i < interned_comms_size_; i++) {
@@ -279,6 +430,12 @@ void CompactSchedBuffer::WriteAndReset(
   interner_.Reset();
   switch_.Reset();
   waking_.Reset();
+
+  if (irq_power_) {
+    if (irq_power_->size() > 0)
+      irq_power_->Write(bundle->set_compact_irq_power());
+    irq_power_->Reset();
+  }
 }
 
 }  // namespace perfetto
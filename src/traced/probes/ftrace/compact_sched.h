@@ -19,6 +19,14 @@
 
 #include <stdint.h>
 
+#include <array>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/protozero/packed_repeated_fields.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
@@ -57,6 +65,36 @@ struct CompactSchedWakingFormat {
   uint16_t comm_offset;
 };
 
+// The irq, softirq and power events that can be encoded in the compact format
+// (FtraceEventBundle.CompactIrqPower).
+enum CompactIrqPowerEvent : size_t {
+  kCompactIrqHandlerEntry = 0,
+  kCompactIrqHandlerExit,
+  kCompactSoftirqEntry,
+  kCompactSoftirqExit,
+  kCompactSoftirqRaise,
+  kCompactCpuIdle,
+  kCompactCpuFrequency,
+  kCompactIrqPowerEventCount,
+};
+
+// The subset of the format of one of the CompactIrqPowerEvent that is used
+// when encoding it into the compact format: the offsets and types of its (at
+// most two) recorded fields. An |event_id| of 0 means that the event isn't
+// available, or that its format doesn't match the compile-time assumptions,
+// in which case it is written as a normal FtraceEvent.
+struct CompactEventFormat {
+  uint32_t event_id = 0;
+  uint16_t size = 0;
+
+  uint16_t num_fields = 0;
+  std::array<uint16_t, 2> field_offsets{};
+  std::array<FtraceFieldType, 2> field_types{};
+};
+
+using CompactIrqPowerFormat =
+    std::array<CompactEventFormat, kCompactIrqPowerEventCount>;
+
 // Pre-parsed format of a subset of scheduling events, for use during ftrace
 // parsing if compact encoding is enabled. Holds a flag, |format_valid| to
 // state whether the compile-time assumptions about the format held at runtime.
@@ -67,6 +105,10 @@ struct CompactSchedEventFormat {
 
   const CompactSchedSwitchFormat sched_switch;
   const CompactSchedWakingFormat sched_waking;
+
+  // Unlike the above, valid regardless of |format_valid|, see
+  // CompactEventFormat.
+  const CompactIrqPowerFormat irq_power;
 };
 
 CompactSchedEventFormat ValidateFormatForCompactSched(
@@ -76,11 +118,15 @@ CompactSchedEventFormat InvalidCompactSchedEventFormatForTesting();
 
 // Compact encoding configuration used at ftrace reading & parsing time.
 struct CompactSchedConfig {
-  CompactSchedConfig(bool _enabled) : enabled(_enabled) {}
+  CompactSchedConfig(bool _enabled, bool _irq_and_power_events = false)
+      : enabled(_enabled), irq_and_power_events(_irq_and_power_events) {}
 
   // If true, and sched_switch and/or sched_waking events are enabled, encode
   // them in a compact format instead of the normal form.
   const bool enabled = false;
+
+  // If true, encode the CompactIrqPowerEvent events in a compact format too.
+  const bool irq_and_power_events = false;
 };
 
 CompactSchedConfig CreateCompactSchedConfig(
@@ -160,6 +206,76 @@ class CompactSchedWakingBuffer {
   protozero::PackedVarInt comm_index_;
 };
 
+// Collects the timestamps and the recorded fields of the events of one of the
+// CompactIrqPowerEvent types, see CompactIrqPowerBuffer.
+class CompactEventColumns {
+ public:
+  protozero::PackedVarInt& timestamp() { return timestamp_; }
+  protozero::PackedVarInt& field(size_t i) { return fields_[i]; }
+  const protozero::PackedVarInt& timestamp() const { return timestamp_; }
+  const protozero::PackedVarInt& field(size_t i) const { return fields_[i]; }
+
+  size_t size() const {
+    // Caller should fill all per-field buffers at the same rate.
+    return timestamp_.size();
+  }
+
+  inline void AppendTimestamp(uint64_t timestamp) {
+    timestamp_.Append(timestamp - last_timestamp_);
+    last_timestamp_ = timestamp;
+  }
+
+  void Reset();
+
+ private:
+  uint64_t last_timestamp_ = 0;
+
+  protozero::PackedVarInt timestamp_;
+  std::array<protozero::PackedVarInt, 2> fields_;
+};
+
+// As |CompactSchedSwitchBuffer|, but for all the CompactIrqPowerEvent types.
+// The irq names are interned here rather than in |CommInterner|: there are
+// only a few of them, but they can be longer than a comm.
+class CompactIrqPowerBuffer {
+ public:
+  CompactEventColumns& events(CompactIrqPowerEvent event) {
+    return events_[event];
+  }
+
+  size_t InternIrqName(base::StringView name) {
+    size_t* index = irq_name_indexes_.Find(name);
+    if (index)
+      return *index;
+    irq_names_.emplace_back(name.data(), name.size());
+    size_t new_index = irq_names_.size() - 1;
+    irq_name_indexes_.Insert(base::StringView(irq_names_.back()), new_index);
+    return new_index;
+  }
+
+  size_t interned_irq_names_size() const { return irq_names_.size(); }
+
+  size_t size() const {
+    size_t size = 0;
+    for (const CompactEventColumns& columns : events_)
+      size += columns.size();
+    return size;
+  }
+
+  void Write(
+      protos::pbzero::FtraceEventBundle::CompactIrqPower* compact_out) const;
+  void Reset();
+
+ private:
+  std::array<CompactEventColumns, kCompactIrqPowerEventCount> events_;
+
+  // A deque, so that the views in |irq_name_indexes_| stay valid as names are
+  // added. As with |CommInterner|, the ftrace reader flushes the buffer once
+  // it holds too many names.
+  std::deque<std::string> irq_names_;
+  base::FlatHashMap<base::StringView, size_t> irq_name_indexes_;
+};
+
 class CommInterner {
  public:
   static constexpr size_t kExpectedCommLength = 16;
@@ -221,6 +337,18 @@ class CompactSchedBuffer {
   CompactSchedWakingBuffer& sched_waking() { return waking_; }
   CommInterner& interner() { return interner_; }
 
+  // Allocated on first use, as it's only needed if
+  // CompactSchedConfig.irq_and_power_events is set.
+  CompactIrqPowerBuffer& irq_power() {
+    if (PERFETTO_UNLIKELY(!irq_power_))
+      irq_power_.reset(new CompactIrqPowerBuffer());
+    return *irq_power_;
+  }
+
+  size_t interned_irq_names_size() const {
+    return irq_power_ ? irq_power_->interned_irq_names_size() : 0;
+  }
+
   // Writes out the currently buffered events, and starts the next batch
   // internally.
   void WriteAndReset(protos::pbzero::FtraceEventBundle* bundle);
@@ -229,6 +357,7 @@ class CompactSchedBuffer {
   CommInterner interner_;
   CompactSchedSwitchBuffer switch_;
   CompactSchedWakingBuffer waking_;
+  std::unique_ptr<CompactIrqPowerBuffer> irq_power_;
 };
 
 }  // namespace perfetto
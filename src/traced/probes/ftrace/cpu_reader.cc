@@ -131,6 +131,171 @@ static int64_t ReadSignedFtraceValue(const uint8_t* ptr,
   PERFETTO_FATAL("unexpected ftrace type");
 }
 
+// Parses |field| as if its translation strategy was |strategy|. When inlined
+// with a constant |strategy| the switch is resolved at compile time, leaving
+// only the code for that strategy (see ParseFieldsWithStrategies()).
+PERFETTO_ALWAYS_INLINE bool ParseFieldWithStrategy(
+    TranslationStrategy strategy,
+    const Field& field,
+    const uint8_t* start,
+    const uint8_t* end,
+    const ProtoTranslationTable* table,
+    protozero::Message* message,
+    FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
+  const uint8_t* field_start = start + field.ftrace_offset;
+  uint32_t field_id = field.proto_field_id;
+
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+      CpuReader::ReadIntoVarInt<uint8_t>(field_start, field_id, message);
+      return true;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      CpuReader::ReadIntoVarInt<uint16_t>(field_start, field_id, message);
+      return true;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      CpuReader::ReadIntoVarInt<uint32_t>(field_start, field_id, message);
+      return true;
+    case kUint64ToUint64:
+      CpuReader::ReadIntoVarInt<uint64_t>(field_start, field_id, message);
+      return true;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      CpuReader::ReadIntoVarInt<int8_t>(field_start, field_id, message);
+      return true;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      CpuReader::ReadIntoVarInt<int16_t>(field_start, field_id, message);
+      return true;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      CpuReader::ReadIntoVarInt<int32_t>(field_start, field_id, message);
+      return true;
+    case kInt64ToInt64:
+      CpuReader::ReadIntoVarInt<int64_t>(field_start, field_id, message);
+      return true;
+    case kFixedCStringToString:
+      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
+      ReadIntoString(field_start, field.ftrace_size, field_id, message);
+      return true;
+    case kCStringToString:
+      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
+      ReadIntoString(field_start, static_cast<size_t>(end - field_start),
+                     field_id, message);
+      return true;
+    case kStringPtrToString: {
+      uint64_t n = 0;
+      // The ftrace field may be 8 or 4 bytes and we need to copy it into the
+      // bottom of n. In the unlikely case where the field is >8 bytes we
+      // should avoid making things worse by corrupting the stack but we
+      // don't need to handle it correctly.
+      size_t size = std::min<size_t>(field.ftrace_size, sizeof(n));
+      memcpy(base::AssumeLittleEndian(&n),
+             reinterpret_cast<const void*>(field_start), size);
+      // Look up the adddress in the printk format map and write it into the
+      // proto.
+      base::StringView name = table->LookupTraceString(n);
+      message->AppendBytes(field_id, name.begin(), name.size());
+      return true;
+    }
+    case kDataLocToString:
+      return ReadDataLoc(start, field_start, end, field, message);
+    case kBoolToUint32:
+    case kBoolToUint64:
+      CpuReader::ReadIntoVarInt<uint8_t>(field_start, field_id, message);
+      return true;
+    case kInode32ToUint64:
+      CpuReader::ReadInode<uint32_t>(field_start, field_id, message,
+                                     metadata);
+      return true;
+    case kInode64ToUint64:
+      CpuReader::ReadInode<uint64_t>(field_start, field_id, message,
+                                     metadata);
+      return true;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      CpuReader::ReadPid(field_start, field_id, message, metadata);
+      return true;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      CpuReader::ReadCommonPid(field_start, field_id, message, metadata);
+      return true;
+    case kDevId32ToUint64:
+      CpuReader::ReadDevId<uint32_t>(field_start, field_id, message,
+                                     metadata);
+      return true;
+    case kDevId64ToUint64:
+      CpuReader::ReadDevId<uint64_t>(field_start, field_id, message,
+                                     metadata);
+      return true;
+    case kFtraceSymAddr64ToUint64:
+      CpuReader::ReadSymbolAddr<uint64_t>(field_start, field_id, message,
+                                          metadata);
+      return true;
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  PERFETTO_FATAL("Unexpected translation strategy");
+}
+
+// Parses the fields of an event whose translation strategies are, in order,
+// |kStrategies|. This saves the switch on the strategy of each field and the
+// loop over the fields that ParseField() and ParseEvent() do otherwise.
+template <TranslationStrategy... kStrategies>
+bool ParseFieldsWithStrategies(const Field* fields,
+                               const uint8_t* start,
+                               const uint8_t* end,
+                               const ProtoTranslationTable* table,
+                               protozero::Message* message,
+                               FtraceMetadata* metadata) {
+  const Field* field = fields;
+  // The elements of a braced initializer list are evaluated in order, so the
+  // fields are written in the same order as by ParseEvent().
+  const bool results[] = {ParseFieldWithStrategy(
+      kStrategies, *field++, start, end, table, message, metadata)...};
+  bool success = true;
+  for (bool result : results)
+    success &= result;
+  return success;
+}
+
+// Sets |*parser| to ParseFieldsWithStrategies<kStrategies...> if these are the
+// translation strategies of |fields|.
+template <TranslationStrategy... kStrategies>
+bool TryCompile(const std::vector<Field>& fields,
+                CompiledFieldsParser* parser) {
+  static constexpr TranslationStrategy kExpected[] = {kStrategies...};
+  if (fields.size() != sizeof...(kStrategies))
+    return false;
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (fields[i].strategy != kExpected[i])
+      return false;
+  }
+  *parser = &ParseFieldsWithStrategies<kStrategies...>;
+  return true;
+}
+
+// Parses |fields| with |compiled| if there is one, one by one otherwise.
+bool ParseFields(const std::vector<Field>& fields,
+                 CompiledFieldsParser compiled,
+                 const uint8_t* start,
+                 const uint8_t* end,
+                 const ProtoTranslationTable* table,
+                 protozero::Message* message,
+                 FtraceMetadata* metadata) {
+  if (compiled)
+    return compiled(fields.data(), start, end, table, message, metadata);
+  bool success = true;
+  for (const Field& field : fields) {
+    success &= CpuReader::ParseField(field, start, end, table, message,
+                                     metadata);
+  }
+  return success;
+}
+
 bool SetBlocking(int fd, bool is_blocking) {
   int flags = fcntl(fd, F_GETFL, 0);
   flags = (is_blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
@@ -212,6 +377,11 @@ size_t CpuReader::ReadAndProcessBatch(
   {
     metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                                metatrace::FTRACE_CPU_READ_BATCH);
+    // splice() only moves the pages that the kernel has finished writing. The
+    // read() loop below picks up whatever is left: the partially written page
+    // once we've caught up, or everything if splice() isn't usable.
+    if (splice_batch_pages_ > 0 && !splice_unsupported_)
+      pages_read = SplicePages(parsing_buf, max_pages);
     for (; pages_read < max_pages;) {
       uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
       ssize_t res =
@@ -282,7 +452,8 @@ size_t CpuReader::ReadAndProcessBatch(
 
   for (FtraceDataSource* data_source : started_data_sources) {
     size_t pages_parsed_ok = ProcessPagesForDataSource(
-        data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
+        data_source->trace_writer_for_cpu(cpu_),
+        data_source->metadata_for_cpu(cpu_), cpu_,
         data_source->parsing_config(), parsing_buf, pages_read, table_,
         symbolizer_, ftrace_clock_snapshot_, ftrace_clock_);
     // If this happens, it means that we did not know how to parse the kernel
@@ -301,6 +472,81 @@ size_t CpuReader::ReadAndProcessBatch(
   return pages_read;
 }
 
+void CpuReader::set_splice_batch_pages(size_t batch_pages) {
+  if (batch_pages == splice_batch_pages_)
+    return;
+  splice_batch_pages_ = batch_pages;
+  // The next SplicePages() creates a pipe of the new size.
+  splice_pipe_ = base::Pipe();
+  splice_pipe_pages_ = 0;
+}
+
+// Reading trace_pipe_raw costs a read() syscall per page, as the kernel
+// returns at most a page per read(). Instead, splice() can move many pages
+// into a pipe in one go, and a single read() copies them all out of the pipe.
+// This doesn't save the copy into |parsing_buf| (that happens in the read()
+// from the pipe instead of the one from trace_pipe_raw), but it amortizes the
+// syscalls over the whole batch. Kernel source pointer: see
+// |tracing_buffers_splice_read|, which only moves whole, fully written pages.
+size_t CpuReader::SplicePages(uint8_t* parsing_buf, size_t max_pages) {
+  if (!splice_pipe_.rd) {
+    splice_pipe_ = base::Pipe::Create(base::Pipe::kBothNonBlock);
+    // Try to fit a whole batch in the pipe. This fails if the batch is bigger
+    // than /proc/sys/fs/pipe-max-size, in which case the pipe keeps its
+    // default size and a batch takes a few splice() calls.
+    fcntl(*splice_pipe_.wr, F_SETPIPE_SZ,
+          static_cast<int>(splice_batch_pages_ * base::kPageSize));
+    int pipe_size = fcntl(*splice_pipe_.wr, F_GETPIPE_SZ);
+    splice_pipe_pages_ =
+        pipe_size > 0 ? static_cast<size_t>(pipe_size) / base::kPageSize : 0;
+    if (splice_pipe_pages_ == 0) {
+      PERFETTO_PLOG("[cpu%zu]: can't size the ftrace splice pipe", cpu_);
+      splice_unsupported_ = true;
+      return 0;
+    }
+  }
+
+  size_t pages_read = 0;
+  while (pages_read < max_pages) {
+    size_t max_bytes =
+        std::min(max_pages - pages_read, splice_pipe_pages_) * base::kPageSize;
+    ssize_t res = PERFETTO_EINTR(splice(*trace_fd_, nullptr, *splice_pipe_.wr,
+                                        nullptr, max_bytes,
+                                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    if (res < 0) {
+      // EAGAIN: no fully written page. The other expected errors are the same
+      // as for read() (see ReadAndProcessBatch()).
+      if (errno == EINVAL || errno == ENOSYS) {
+        PERFETTO_PLOG("[cpu%zu]: splice() not supported on ftrace pipe", cpu_);
+        splice_unsupported_ = true;
+      } else if (errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
+                 errno != ENODEV) {
+        PERFETTO_PLOG("Unexpected error on raw ftrace splice");
+      }
+      break;
+    }
+    if (res == 0)
+      break;
+    size_t bytes = static_cast<size_t>(res);
+    PERFETTO_CHECK(bytes % base::kPageSize == 0);
+
+    // The pages are in the pipe now, read them all back in one go.
+    uint8_t* dst = parsing_buf + (pages_read * base::kPageSize);
+    for (size_t off = 0; off < bytes;) {
+      ssize_t rd =
+          PERFETTO_EINTR(read(*splice_pipe_.rd, dst + off, bytes - off));
+      PERFETTO_CHECK(rd > 0);
+      off += static_cast<size_t>(rd);
+    }
+    pages_read += bytes / base::kPageSize;
+
+    // Caught up with the fully written pages.
+    if (bytes < max_bytes)
+      break;
+  }
+  return pages_read;
+}
+
 // static
 size_t CpuReader::ProcessPagesForDataSource(
     TraceWriter* trace_writer,
@@ -324,15 +570,16 @@ size_t CpuReader::ProcessPagesForDataSource(
   // This function is called after the contents of a FtraceBundle are written.
   auto finalize_cur_packet = [&] {
     PERFETTO_DCHECK(packet);
-    if (compact_sched_enabled)
+    if (compact_sched_enabled || ds_config->compact_sched.irq_and_power_events)
       compact_sched.WriteAndReset(bundle);
 
     bundle->Finalize();
     bundle = nullptr;
 
     // Write the kernel symbol index (mangled address) -> name table.
-    // |metadata| is shared across all cpus, is distinct per |data_source| (i.e.
-    // tracing session) and is cleared after each FtraceController::ReadTick().
+    // |metadata| is distinct per |data_source| (i.e. tracing session), is
+    // shared across all cpus unless the data source has per-cpu writers, and
+    // is cleared after each FtraceController::ReadTick().
     if (ds_config->symbolize_ksyms) {
       // Symbol indexes are assigned mononically as |kernel_addrs.size()|,
       // starting from index 1 (no symbol has index 0). Here we remember the
@@ -408,6 +655,15 @@ size_t CpuReader::ProcessPagesForDataSource(
     bundle->set_cpu(static_cast<uint32_t>(cpu));
     if (lost_events)
       bundle->set_lost_events(true);
+
+    // The layout of the raw pages is written at most once per read tick (see
+    // FtraceMetadata::Clear()), before the first raw page of the sequence.
+    if (ds_config->raw_pages && !metadata->raw_format_written) {
+      bundle->AppendBytes(FtraceEventBundle::kRawFormatFieldNumber,
+                          ds_config->raw_format.data(),
+                          ds_config->raw_format.size());
+      metadata->raw_format_written = true;
+    }
   };
 
   start_new_packet(/*lost_events=*/false);
@@ -431,15 +687,32 @@ size_t CpuReader::ProcessPagesForDataSource(
     //   a single |lost_events| field per bundle, so start a new packet.
     // * The compact_sched buffer is holding more unique interned strings than
     //   a threshold. We need to flush the compact buffer to make the
-    //   interning lookups cheap again.
+    //   interning lookups cheap again (and, for irq names, to bound the size
+    //   of the intern table).
     bool interner_past_threshold =
-        compact_sched_enabled &&
-        compact_sched.interner().interned_comms_size() >
+        (compact_sched_enabled &&
+         compact_sched.interner().interned_comms_size() >
+             kCompactSchedInternerThreshold) ||
+        compact_sched.interned_irq_names_size() >
             kCompactSchedInternerThreshold;
 
     if (page_header->lost_events || interner_past_threshold)
       start_new_packet(page_header->lost_events);
 
+    // Raw pages mode: leave the parsing to trace_processor. Only the page
+    // header and the |page_header->size| committed data bytes are emitted,
+    // the unused tail of the page is dropped, so the decoder gets a buffer
+    // shorter than the ftrace page size. The pages holding events that this
+    // data source didn't enable (because a concurrent one did) are parsed
+    // below instead, to filter those out.
+    if (ds_config->raw_pages &&
+        HasOnlyEnabledEvents(parse_pos, &page_header.value(),
+                             ds_config->event_filter)) {
+      size_t header_size = static_cast<size_t>(parse_pos - curr_page);
+      bundle->add_raw_page(curr_page, header_size + page_header->size);
+      continue;
+    }
+
     size_t evt_size =
         ParsePagePayload(parse_pos, &page_header.value(), table, ds_config,
                          &compact_sched, bundle, metadata);
@@ -622,6 +895,13 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
             ParseSchedWakingCompact(start, timestamp, &sched_waking_format,
                                     compact_sched_buffer, metadata);
 
+            // compact irq, softirq and power events
+          } else if (ds_config->compact_sched.irq_and_power_events &&
+                     ParseIrqPowerCompact(
+                         ftrace_event_id, start, next, timestamp,
+                         table->compact_sched_format().irq_power,
+                         compact_sched_buffer)) {
+            // Buffered by ParseIrqPowerCompact, nothing else to do.
           } else {
             // Common case: parse all other types of enabled events.
             protos::pbzero::FtraceEvent* event = bundle->add_event();
@@ -640,6 +920,63 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
   return static_cast<size_t>(ptr - start_of_payload);
 }
 
+// Walks the records of the page in the same way as ParsePagePayload(), but
+// only looks at the ids of the data records.
+//
+// static
+bool CpuReader::HasOnlyEnabledEvents(const uint8_t* start_of_payload,
+                                     const PageHeader* page_header,
+                                     const EventFilter& event_filter) {
+  const uint8_t* ptr = start_of_payload;
+  const uint8_t* const end = ptr + page_header->size;
+
+  while (ptr < end) {
+    EventHeader event_header;
+    if (!ReadAndAdvance(&ptr, end, &event_header))
+      return false;
+
+    switch (event_header.type_or_length) {
+      case kTypePadding: {
+        uint32_t length = 0;
+        if (!ReadAndAdvance<uint32_t>(&ptr, end, &length) || length < 4)
+          return false;
+        ptr += length - 4;
+        break;
+      }
+      case kTypeTimeExtend:
+      case kTypeTimeStamp: {
+        uint32_t time_delta_ext = 0;
+        if (!ReadAndAdvance<uint32_t>(&ptr, end, &time_delta_ext))
+          return false;
+        break;
+      }
+      default: {
+        uint32_t event_size = 0;
+        if (event_header.type_or_length == 0) {
+          if (!ReadAndAdvance<uint32_t>(&ptr, end, &event_size) ||
+              event_size < 4) {
+            return false;
+          }
+          event_size -= 4;
+        } else {
+          event_size = 4 * event_header.type_or_length;
+        }
+        const uint8_t* next = ptr + event_size;
+        if (next > end)
+          return false;
+
+        uint16_t ftrace_event_id;
+        if (!ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id) ||
+            !event_filter.IsEventEnabled(ftrace_event_id)) {
+          return false;
+        }
+        ptr = next;
+      }
+    }
+  }
+  return true;
+}
+
 // |start| is the start of the current event.
 // |end| is the end of the buffer.
 bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
@@ -661,9 +998,9 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
     return false;
   }
 
-  bool success = true;
-  for (const Field& field : table->common_fields())
-    success &= ParseField(field, start, end, table, message, metadata);
+  bool success = ParseFields(table->common_fields(),
+                             table->compiled_common_fields_parser(), start,
+                             end, table, message, metadata);
 
   protozero::Message* nested =
       message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
@@ -680,9 +1017,9 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
       success &= ParseField(field, start, end, table, generic_field, metadata);
     }
   } else {  // Parse all other events.
-    for (const Field& field : info.fields) {
-      success &= ParseField(field, start, end, table, nested, metadata);
-    }
+    success &= ParseFields(info.fields,
+                           table->GetCompiledFieldsParser(ftrace_event_id),
+                           start, end, table, nested, metadata);
   }
 
   if (PERFETTO_UNLIKELY(info.proto_field_id ==
@@ -711,98 +1048,45 @@ bool CpuReader::ParseField(const Field& field,
                            const ProtoTranslationTable* table,
                            protozero::Message* message,
                            FtraceMetadata* metadata) {
-  PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
-  const uint8_t* field_start = start + field.ftrace_offset;
-  uint32_t field_id = field.proto_field_id;
+  return ParseFieldWithStrategy(field.strategy, field, start, end, table,
+                                message, metadata);
+}
 
-  switch (field.strategy) {
-    case kUint8ToUint32:
-    case kUint8ToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
-      return true;
-    case kUint16ToUint32:
-    case kUint16ToUint64:
-      ReadIntoVarInt<uint16_t>(field_start, field_id, message);
-      return true;
-    case kUint32ToUint32:
-    case kUint32ToUint64:
-      ReadIntoVarInt<uint32_t>(field_start, field_id, message);
-      return true;
-    case kUint64ToUint64:
-      ReadIntoVarInt<uint64_t>(field_start, field_id, message);
-      return true;
-    case kInt8ToInt32:
-    case kInt8ToInt64:
-      ReadIntoVarInt<int8_t>(field_start, field_id, message);
-      return true;
-    case kInt16ToInt32:
-    case kInt16ToInt64:
-      ReadIntoVarInt<int16_t>(field_start, field_id, message);
-      return true;
-    case kInt32ToInt32:
-    case kInt32ToInt64:
-      ReadIntoVarInt<int32_t>(field_start, field_id, message);
-      return true;
-    case kInt64ToInt64:
-      ReadIntoVarInt<int64_t>(field_start, field_id, message);
-      return true;
-    case kFixedCStringToString:
-      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
-      ReadIntoString(field_start, field.ftrace_size, field_id, message);
-      return true;
-    case kCStringToString:
-      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
-      ReadIntoString(field_start, static_cast<size_t>(end - field_start),
-                     field_id, message);
-      return true;
-    case kStringPtrToString: {
-      uint64_t n = 0;
-      // The ftrace field may be 8 or 4 bytes and we need to copy it into the
-      // bottom of n. In the unlikely case where the field is >8 bytes we
-      // should avoid making things worse by corrupting the stack but we
-      // don't need to handle it correctly.
-      size_t size = std::min<size_t>(field.ftrace_size, sizeof(n));
-      memcpy(base::AssumeLittleEndian(&n),
-             reinterpret_cast<const void*>(field_start), size);
-      // Look up the adddress in the printk format map and write it into the
-      // proto.
-      base::StringView name = table->LookupTraceString(n);
-      message->AppendBytes(field_id, name.begin(), name.size());
-      return true;
-    }
-    case kDataLocToString:
-      return ReadDataLoc(start, field_start, end, field, message);
-    case kBoolToUint32:
-    case kBoolToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
-      return true;
-    case kInode32ToUint64:
-      ReadInode<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kInode64ToUint64:
-      ReadInode<uint64_t>(field_start, field_id, message, metadata);
-      return true;
-    case kPid32ToInt32:
-    case kPid32ToInt64:
-      ReadPid(field_start, field_id, message, metadata);
-      return true;
-    case kCommonPid32ToInt32:
-    case kCommonPid32ToInt64:
-      ReadCommonPid(field_start, field_id, message, metadata);
-      return true;
-    case kDevId32ToUint64:
-      ReadDevId<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kDevId64ToUint64:
-      ReadDevId<uint64_t>(field_start, field_id, message, metadata);
-      return true;
-    case kFtraceSymAddr64ToUint64:
-      ReadSymbolAddr<uint64_t>(field_start, field_id, message, metadata);
-      return true;
-    case kInvalidTranslationStrategy:
-      break;
+// static
+CompiledFieldsParser CpuReader::CompileFieldsParser(
+    const std::vector<Field>& fields) {
+  CompiledFieldsParser parser = nullptr;
+  // The common fields.
+  if (TryCompile<kCommonPid32ToInt32>(fields, &parser))
+    return parser;
+  // sched_switch, with a 64 and a 32 bit long prev_state.
+  if (TryCompile<kFixedCStringToString, kPid32ToInt32, kInt32ToInt32,
+                 kInt64ToInt64, kFixedCStringToString, kPid32ToInt32,
+                 kInt32ToInt32>(fields, &parser) ||
+      TryCompile<kFixedCStringToString, kPid32ToInt32, kInt32ToInt32,
+                 kInt32ToInt64, kFixedCStringToString, kPid32ToInt32,
+                 kInt32ToInt32>(fields, &parser)) {
+    return parser;
   }
-  PERFETTO_FATAL("Unexpected translation strategy");
+  // sched_waking, sched_wakeup and sched_wakeup_new, with and without the
+  // success field removed in kernel 4.14.
+  if (TryCompile<kFixedCStringToString, kPid32ToInt32, kInt32ToInt32,
+                 kInt32ToInt32, kInt32ToInt32>(fields, &parser) ||
+      TryCompile<kFixedCStringToString, kPid32ToInt32, kInt32ToInt32,
+                 kInt32ToInt32>(fields, &parser)) {
+    return parser;
+  }
+  // cpu_frequency, cpu_idle and softirq_{entry,exit,raise}.
+  if (TryCompile<kUint32ToUint32, kUint32ToUint32>(fields, &parser) ||
+      TryCompile<kUint32ToUint32>(fields, &parser)) {
+    return parser;
+  }
+  // irq_handler_entry and irq_handler_exit.
+  if (TryCompile<kInt32ToInt32, kDataLocToString>(fields, &parser) ||
+      TryCompile<kInt32ToInt32, kInt32ToInt32>(fields, &parser)) {
+    return parser;
+  }
+  return nullptr;
 }
 
 // Parse a sched_switch event according to pre-validated format, and buffer the
@@ -862,4 +1146,55 @@ void CpuReader::ParseSchedWakingCompact(const uint8_t* start,
   compact_buf->sched_waking().comm_index().Append(iid);
 }
 
+// Encode one of the CompactIrqPowerEvent in the current compact batch. See
+// ValidateCompactEventFormat for the assumptions made around the format.
+// static
+bool CpuReader::ParseIrqPowerCompact(uint16_t ftrace_event_id,
+                                     const uint8_t* start,
+                                     const uint8_t* end,
+                                     uint64_t timestamp,
+                                     const CompactIrqPowerFormat& formats,
+                                     CompactSchedBuffer* compact_buf) {
+  for (size_t i = 0; i < kCompactIrqPowerEventCount; i++) {
+    const CompactEventFormat& format = formats[i];
+    if (format.event_id != ftrace_event_id)
+      continue;
+    if (end - start < format.size)
+      return false;
+
+    // Resolve the __data_loc (irq name) first, so that an out of bounds one
+    // leaves the columns untouched and is reported by ParseEvent instead.
+    base::StringView name;
+    for (uint16_t f = 0; f < format.num_fields; f++) {
+      if (format.field_types[f] != kFtraceDataLoc)
+        continue;
+      uint32_t data = ReadValue<uint32_t>(start + format.field_offsets[f]);
+      const uint8_t* name_start = start + (data & 0xffff);
+      const uint16_t len = (data >> 16) & 0xffff;
+      if (PERFETTO_UNLIKELY(name_start + len > end))
+        return false;
+      name = base::StringView(
+          reinterpret_cast<const char*>(name_start),
+          strnlen(reinterpret_cast<const char*>(name_start), len));
+    }
+
+    CompactIrqPowerBuffer& irq_power = compact_buf->irq_power();
+    CompactEventColumns& columns =
+        irq_power.events(static_cast<CompactIrqPowerEvent>(i));
+    columns.AppendTimestamp(timestamp);
+    for (uint16_t f = 0; f < format.num_fields; f++) {
+      const uint8_t* field_start = start + format.field_offsets[f];
+      if (format.field_types[f] == kFtraceDataLoc) {
+        columns.field(f).Append(irq_power.InternIrqName(name));
+      } else if (format.field_types[f] == kFtraceInt32) {
+        columns.field(f).Append(ReadValue<int32_t>(field_start));
+      } else {
+        columns.field(f).Append(ReadValue<uint32_t>(field_start));
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
 }  // namespace perfetto
@@ -194,6 +194,15 @@ class CpuReader {
                                  FtraceEventBundle* bundle,
                                  FtraceMetadata* metadata);
 
+  // Returns true if all the events in the payload of the page are enabled in
+  // |event_filter|, false if any isn't or if the page is malformed. Used in
+  // raw pages mode to decide whether a page can be written without parsing.
+  // The caller is responsible for validating that the page_header->size stays
+  // within the current page.
+  static bool HasOnlyEnabledEvents(const uint8_t* start_of_payload,
+                                   const PageHeader* page_header,
+                                   const EventFilter& event_filter);
+
   // Parse a single raw ftrace event beginning at |start| and ending at |end|
   // and write it into the provided bundle as a proto.
   // |table| contains the mix of compile time (e.g. proto field ids) and
@@ -215,6 +224,14 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  // Returns a routine that parses |fields| the same way as calling
+  // ParseField() on each of them, but specialized at compile time for their
+  // sequence of translation strategies. Only the sequences of the most
+  // frequent events (e.g. sched_switch, sched_waking, cpu_frequency, irq_*)
+  // are specialized, returns nullptr for the others.
+  static CompiledFieldsParser CompileFieldsParser(
+      const std::vector<Field>& fields);
+
   // Parse a sched_switch event according to pre-validated format, and buffer
   // the individual fields in the given compact encoding batch.
   static void ParseSchedSwitchCompact(const uint8_t* start,
@@ -231,6 +248,18 @@ class CpuReader {
                                       CompactSchedBuffer* compact_buf,
                                       FtraceMetadata* metadata);
 
+  // Parse one of the CompactIrqPowerEvent (irq_handler_*, softirq_*, cpu_idle,
+  // cpu_frequency) according to the pre-validated |formats|, and buffer its
+  // fields in the given compact encoding batch. Returns false, without
+  // buffering anything, if the event isn't one of them (or its format didn't
+  // validate): it should then be parsed with ParseEvent().
+  static bool ParseIrqPowerCompact(uint16_t ftrace_event_id,
+                                   const uint8_t* start,
+                                   const uint8_t* end,
+                                   uint64_t timestamp,
+                                   const CompactIrqPowerFormat& formats,
+                                   CompactSchedBuffer* compact_buf);
+
   // Parses & encodes the given range of contiguous tracing pages. Called by
   // |ReadAndProcessBatch| for each active data source.
   //
@@ -255,6 +284,11 @@ class CpuReader {
     ftrace_clock_ = clock;
   }
 
+  // If |batch_pages| > 0, the fully written pages are moved out of the kernel
+  // buffer with splice(), in batches of up to |batch_pages| pages, rather than
+  // with a read() per page. See SplicePages().
+  void set_splice_batch_pages(size_t batch_pages);
+
  private:
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
@@ -269,12 +303,27 @@ class CpuReader {
       bool first_batch_in_cycle,
       const std::set<FtraceDataSource*>& started_data_sources);
 
+  // Moves at most |max_pages| fully written pages from |trace_fd_| into
+  // |splice_pipe_| with splice(), and reads them back into |parsing_buf|.
+  // Returns the number of pages read, which is less than |max_pages| once
+  // only the page currently being written by the kernel is left.
+  size_t SplicePages(uint8_t* parsing_buf, size_t max_pages);
+
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
   LazyKernelSymbolizer* const symbolizer_;
   const FtraceClockSnapshot* const ftrace_clock_snapshot_;
   base::ScopedFile trace_fd_;
   protos::pbzero::FtraceClock ftrace_clock_{};
+
+  // The number of pages |splice_pipe_| is sized for, 0 if splice() is not
+  // used.
+  size_t splice_batch_pages_ = 0;
+  // Set if splice() failed on |trace_fd_| in a way that suggests it isn't
+  // supported (e.g. by an old kernel): keep using read() from then on.
+  bool splice_unsupported_ = false;
+  base::Pipe splice_pipe_;
+  size_t splice_pipe_pages_ = 0;
 };
 
 }  // namespace perfetto
@@ -12,17 +12,34 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include <benchmark/benchmark.h>
 
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/root_message.h"
 #include "perfetto/protozero/scattered_stream_null_delegate.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
+#include "src/traced/probes/ftrace/ftrace_data_source.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "src/tracing/core/null_trace_writer.h"
 
 namespace {
 
@@ -288,6 +305,69 @@ perfetto::ExamplePage g_full_page_sched_switch{
     )",
 };
 
+// Size of the simulated per-cpu kernel buffers.
+constexpr size_t kCpuBufferPages = 64;
+
+// Rate at which the simulated kernel fills each per-cpu buffer (16 MB/s).
+constexpr size_t kPagesPerMsPerCpu = 4;
+
+constexpr size_t kParsingBufferSizePages = 32;
+
+// Simulates the per-cpu kernel ftrace buffers with pipes, which a thread fills
+// with |page| at a constant rate. Like the kernel, when a buffer is full it
+// drops the new pages, counting them as overruns.
+class FakeKernelBuffers {
+ public:
+  FakeKernelBuffers(size_t num_cpus, const uint8_t* page) : page_(page) {
+    for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+      pipes_.emplace_back(
+          perfetto::base::Pipe::Create(perfetto::base::Pipe::kBothNonBlock));
+      PERFETTO_CHECK(fcntl(*pipes_.back().wr, F_SETPIPE_SZ,
+                           kCpuBufferPages * perfetto::base::kPageSize) >= 0);
+    }
+    thread_ = std::thread([this] { WriteLoop(); });
+  }
+
+  ~FakeKernelBuffers() {
+    quit_ = true;
+    thread_.join();
+  }
+
+  perfetto::base::ScopedFile TakeReadFd(size_t cpu) {
+    return std::move(pipes_[cpu].rd);
+  }
+
+  uint64_t pages_written() const { return pages_written_; }
+  uint64_t overruns() const { return overruns_; }
+
+ private:
+  void WriteLoop() {
+    auto next_write = std::chrono::steady_clock::now();
+    while (!quit_) {
+      for (size_t i = 0; i < kPagesPerMsPerCpu; i++) {
+        for (auto& pipe : pipes_) {
+          // A write of a page into a pipe is atomic: all or nothing.
+          ssize_t res = write(*pipe.wr, page_, perfetto::base::kPageSize);
+          if (res == static_cast<ssize_t>(perfetto::base::kPageSize)) {
+            pages_written_++;
+          } else {
+            overruns_++;
+          }
+        }
+      }
+      next_write += std::chrono::milliseconds(1);
+      std::this_thread::sleep_until(next_write);
+    }
+  }
+
+  const uint8_t* const page_;
+  std::vector<perfetto::base::Pipe> pipes_;
+  std::atomic<bool> quit_{false};
+  std::atomic<uint64_t> pages_written_{0};
+  std::atomic<uint64_t> overruns_{0};
+  std::thread thread_;
+};
+
 }  // namespace
 
 using perfetto::CompactSchedBuffer;
@@ -295,18 +375,25 @@ using perfetto::CpuReader;
 using perfetto::DisabledCompactSchedConfigForTesting;
 using perfetto::EventFilter;
 using perfetto::ExamplePage;
+using perfetto::FtraceDataSource;
 using perfetto::FtraceDataSourceConfig;
 using perfetto::FtraceMetadata;
 using perfetto::GetTable;
 using perfetto::GroupAndName;
+using perfetto::NullTraceWriter;
 using perfetto::PageFromXxd;
 using perfetto::ProtoTranslationTable;
+using perfetto::TraceWriter;
 using perfetto::protos::pbzero::FtraceEventBundle;
 using protozero::ScatteredStreamWriter;
 using protozero::ScatteredStreamWriterNullDelegate;
 
-// Benchmark for the core logic of the ftrace binary format decoding.
-static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+// Benchmark for the core logic of the ftrace binary format decoding. If
+// |compiled_parsers| is false, all the fields are parsed one by one with
+// CpuReader::ParseField() rather than with the parsers specialized for the
+// sched_switch fields.
+static void ParsePageFullOfSchedSwitch(benchmark::State& state,
+                                       bool compiled_parsers) {
   const ExamplePage* test_case = &g_full_page_sched_switch;
 
   ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
@@ -315,6 +402,8 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
 
   ProtoTranslationTable* table = GetTable(test_case->name);
   auto page = PageFromXxd(test_case->data);
+  if (!compiled_parsers)
+    table->ClearCompiledFieldsParsersForTesting();
 
   FtraceDataSourceConfig ds_config{EventFilter{},
                                    DisabledCompactSchedConfigForTesting(),
@@ -335,7 +424,7 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
         CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
 
     if (!page_header.has_value())
-      return;
+      break;
 
     CpuReader::ParsePagePayload(parse_pos, &page_header.value(), table,
                                 &ds_config, compact_buffer.get(), &writer,
@@ -343,5 +432,189 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
 
     metadata.Clear();
   }
+
+  table->CompileFieldsParsers();
+}
+
+static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, /*compiled_parsers=*/true);
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+static void BM_ParsePageFullOfSchedSwitch_ParseField(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, /*compiled_parsers=*/false);
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitch_ParseField);
+
+// Drains the simulated kernel buffers of |num_cpus| cpus, filled with
+// sched_switch events, either one cpu after the other on the same thread (as
+// FtraceController::ReadTick() does by default) or concurrently, with a thread
+// per cpu (as with FtraceConfig.use_dedicated_reader_threads). Each iteration
+// is a drain of all the cpus. Reports the ratio of pages lost because a
+// per-cpu buffer was full.
+static void BM_DrainCpus(benchmark::State& state, bool reader_threads) {
+  const size_t num_cpus = static_cast<size_t>(state.range(0));
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceDataSource data_source(
+      perfetto::base::WeakPtr<perfetto::FtraceController>(),
+      /*session_id=*/0, perfetto::FtraceConfig(),
+      std::unique_ptr<TraceWriter>(new NullTraceWriter()),
+      [](perfetto::BufferExhaustedPolicy) {
+        return std::unique_ptr<TraceWriter>(new NullTraceWriter());
+      });
+  data_source.Initialize(/*config_id=*/1, &ds_config);
+  data_source.CreatePerCpuSinks(num_cpus);
+  const std::set<FtraceDataSource*> data_sources{&data_source};
+
+  FakeKernelBuffers kernel_buffers(num_cpus, page.get());
+  perfetto::LazyKernelSymbolizer symbolizer;
+  std::vector<std::unique_ptr<CpuReader>> readers;
+  std::vector<perfetto::base::PagedMemory> parsing_mems;
+  std::vector<std::unique_ptr<perfetto::base::ThreadTaskRunner>> threads;
+  for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+    readers.emplace_back(new CpuReader(cpu, table, &symbolizer,
+                                       /*ftrace_clock_snapshot=*/nullptr,
+                                       kernel_buffers.TakeReadFd(cpu)));
+    parsing_mems.emplace_back(perfetto::base::PagedMemory::Allocate(
+        perfetto::base::kPageSize * kParsingBufferSizePages));
+    if (reader_threads) {
+      threads.emplace_back(new perfetto::base::ThreadTaskRunner(
+          perfetto::base::ThreadTaskRunner::CreateAndStart()));
+    }
+  }
+  auto read_cpu = [&](size_t cpu) {
+    readers[cpu]->ReadCycle(
+        reinterpret_cast<uint8_t*>(parsing_mems[cpu].Get()),
+        kParsingBufferSizePages, kCpuBufferPages, data_sources);
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t pending_cpus = 0;
+  const uint64_t overruns_at_start = kernel_buffers.overruns();
+  const uint64_t pages_written_at_start = kernel_buffers.pages_written();
+  for (auto _ : state) {
+    if (!reader_threads) {
+      for (size_t cpu = 0; cpu < num_cpus; cpu++)
+        read_cpu(cpu);
+    } else {
+      pending_cpus = num_cpus;
+      for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+        threads[cpu]->PostTask([&, cpu] {
+          read_cpu(cpu);
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--pending_cpus == 0)
+            cv.notify_one();
+        });
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return pending_cpus == 0; });
+    }
+    data_source.MergePerCpuMetadata();
+    data_source.mutable_metadata()->Clear();
+  }
+
+  const uint64_t overruns = kernel_buffers.overruns() - overruns_at_start;
+  const uint64_t pages_written =
+      kernel_buffers.pages_written() - pages_written_at_start;
+  state.counters["overrun_ratio"] =
+      static_cast<double>(overruns) /
+      static_cast<double>(std::max<uint64_t>(overruns + pages_written, 1));
+}
+
+static void BM_DrainCpus_Serial(benchmark::State& state) {
+  BM_DrainCpus(state, /*reader_threads=*/false);
+}
+
+static void BM_DrainCpus_ReaderThreads(benchmark::State& state) {
+  BM_DrainCpus(state, /*reader_threads=*/true);
+}
+
+static void CpuCountArgs(benchmark::internal::Benchmark* b) {
+  for (int num_cpus : {1, 4, 8, 16})
+    b->Arg(num_cpus);
+  b->UseRealTime();
+}
+
+BENCHMARK(BM_DrainCpus_Serial)->Apply(CpuCountArgs);
+BENCHMARK(BM_DrainCpus_ReaderThreads)->Apply(CpuCountArgs);
+
+// Reads |state.range(0)| pages of sched_switch events from a file standing in
+// for trace_pipe_raw, either by splice()ing each batch into a pipe and reading
+// it back with a single read() (as with FtraceConfig.use_splice_reads) or with
+// a read() per page. Like the pages of the kernel ring buffer, the pages of
+// the file are already in memory (the page cache), so splice() moves them
+// into the pipe without copying. Rewinding the file is not timed.
+static void BM_ReadCycle(benchmark::State& state, bool use_splice) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  const size_t num_pages = static_cast<size_t>(state.range(0));
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceDataSource data_source(
+      perfetto::base::WeakPtr<perfetto::FtraceController>(),
+      /*session_id=*/0, perfetto::FtraceConfig(),
+      std::unique_ptr<TraceWriter>(new NullTraceWriter()));
+  data_source.Initialize(/*config_id=*/1, &ds_config);
+  const std::set<FtraceDataSource*> data_sources{&data_source};
+
+  perfetto::base::TempFile file = perfetto::base::TempFile::CreateUnlinked();
+  for (size_t i = 0; i < num_pages; i++) {
+    PERFETTO_CHECK(perfetto::base::WriteAll(*file, page.get(),
+                                            perfetto::base::kPageSize) ==
+                   static_cast<ssize_t>(perfetto::base::kPageSize));
+  }
+
+  // The reader and |file| share the file offset, which is rewound below.
+  perfetto::base::ScopedFile reader_fd(dup(*file));
+  PERFETTO_CHECK(reader_fd);
+  perfetto::LazyKernelSymbolizer symbolizer;
+  CpuReader reader(/*cpu=*/0, table, &symbolizer,
+                   /*ftrace_clock_snapshot=*/nullptr, std::move(reader_fd));
+  reader.set_splice_batch_pages(use_splice ? kParsingBufferSizePages : 0);
+  auto parsing_mem = perfetto::base::PagedMemory::Allocate(
+      perfetto::base::kPageSize * kParsingBufferSizePages);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    PERFETTO_CHECK(lseek(*file, 0, SEEK_SET) == 0);
+    state.ResumeTiming();
+
+    size_t pages_read = reader.ReadCycle(
+        reinterpret_cast<uint8_t*>(parsing_mem.Get()), kParsingBufferSizePages,
+        num_pages, data_sources);
+    PERFETTO_CHECK(pages_read == num_pages);
+    data_source.mutable_metadata()->Clear();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * num_pages * perfetto::base::kPageSize));
+}
+
+static void BM_ReadCycle_Splice(benchmark::State& state) {
+  BM_ReadCycle(state, /*use_splice=*/true);
+}
+BENCHMARK(BM_ReadCycle_Splice)->Arg(kCpuBufferPages)->Arg(1024);
+
+static void BM_ReadCycle_ReadPerPage(benchmark::State& state) {
+  BM_ReadCycle(state, /*use_splice=*/false);
+}
+BENCHMARK(BM_ReadCycle_ReadPerPage)->Arg(kCpuBufferPages)->Arg(1024);
@@ -20,12 +20,14 @@
 #include <sys/stat.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
+#include "src/traced/probes/ftrace/ftrace_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
@@ -931,6 +933,96 @@ TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
   EXPECT_EQ("sleep", next_comm);
 }
 
+TEST(CpuReaderTest, ParseIrqPowerCompact) {
+  constexpr uint16_t kSoftirqEntryId = 10;
+  constexpr uint16_t kIrqHandlerEntryId = 11;
+  CompactIrqPowerFormat formats{};
+  // softirq_entry: the common fields, then vec at 8.
+  formats[kCompactSoftirqEntry].event_id = kSoftirqEntryId;
+  formats[kCompactSoftirqEntry].size = 12;
+  formats[kCompactSoftirqEntry].num_fields = 1;
+  formats[kCompactSoftirqEntry].field_offsets[0] = 8;
+  formats[kCompactSoftirqEntry].field_types[0] = kFtraceUint32;
+  // irq_handler_entry: the common fields, irq at 8 and a __data_loc name at
+  // 12, pointing after the event.
+  formats[kCompactIrqHandlerEntry].event_id = kIrqHandlerEntryId;
+  formats[kCompactIrqHandlerEntry].size = 16;
+  formats[kCompactIrqHandlerEntry].num_fields = 2;
+  formats[kCompactIrqHandlerEntry].field_offsets = {{8, 12}};
+  formats[kCompactIrqHandlerEntry].field_types = {
+      {kFtraceInt32, kFtraceDataLoc}};
+
+  uint8_t softirq[12] = {};
+  uint32_t vec = 3;
+  memcpy(&softirq[8], &vec, sizeof(vec));
+
+  uint8_t irq[24] = {};
+  int32_t irq_num = 42;
+  uint32_t name_loc = 16 | (8 << 16);  // offset 16, length 8.
+  memcpy(&irq[8], &irq_num, sizeof(irq_num));
+  memcpy(&irq[12], &name_loc, sizeof(name_loc));
+  memcpy(&irq[16], "arch_tm", 8);
+
+  CompactSchedBuffer compact_buffer;
+  EXPECT_TRUE(CpuReader::ParseIrqPowerCompact(
+      kSoftirqEntryId, softirq, softirq + sizeof(softirq), 1000, formats,
+      &compact_buffer));
+  EXPECT_TRUE(CpuReader::ParseIrqPowerCompact(
+      kIrqHandlerEntryId, irq, irq + sizeof(irq), 1500, formats,
+      &compact_buffer));
+  EXPECT_TRUE(CpuReader::ParseIrqPowerCompact(
+      kIrqHandlerEntryId, irq, irq + sizeof(irq), 1800, formats,
+      &compact_buffer));
+
+  // Not one of the compact events: left to ParseEvent().
+  size_t size = compact_buffer.irq_power().size();
+  EXPECT_FALSE(CpuReader::ParseIrqPowerCompact(
+      12, softirq, softirq + sizeof(softirq), 2000, formats, &compact_buffer));
+  // The name points past the end of the event.
+  EXPECT_FALSE(CpuReader::ParseIrqPowerCompact(
+      kIrqHandlerEntryId, irq, irq + 20, 2000, formats, &compact_buffer));
+  EXPECT_EQ(size, compact_buffer.irq_power().size());
+
+  BundleProvider bundle_provider(base::kPageSize);
+  compact_buffer.WriteAndReset(bundle_provider.writer());
+  bundle_provider.writer()->Finalize();
+  auto bundle = bundle_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  EXPECT_FALSE(bundle->has_compact_sched());
+
+  const auto& compact = bundle->compact_irq_power();
+  EXPECT_THAT(compact.intern_table(), ElementsAre("arch_tm"));
+  EXPECT_THAT(compact.softirq_entry_timestamp(), ElementsAre(1000u));
+  EXPECT_THAT(compact.softirq_entry_vec(), ElementsAre(3u));
+  // Delta encoded timestamps.
+  EXPECT_THAT(compact.irq_entry_timestamp(), ElementsAre(1500u, 300u));
+  EXPECT_THAT(compact.irq_entry_irq(), ElementsAre(42, 42));
+  EXPECT_THAT(compact.irq_entry_name_index(), ElementsAre(0u, 0u));
+  EXPECT_TRUE(compact.irq_exit_timestamp().empty());
+  EXPECT_TRUE(compact.cpu_idle_timestamp().empty());
+  EXPECT_EQ(0u, compact_buffer.irq_power().size());
+}
+
+TEST(CpuReaderTest, CompactIrqPowerInternIrqName) {
+  CompactSchedBuffer compact_buffer;
+  EXPECT_EQ(0u, compact_buffer.interned_irq_names_size());
+
+  CompactIrqPowerBuffer& irq_power = compact_buffer.irq_power();
+  std::string name = "arch_timer";
+  EXPECT_EQ(0u, irq_power.InternIrqName(base::StringView(name)));
+  EXPECT_EQ(1u, irq_power.InternIrqName("eth0"));
+  // A different buffer holding the same name.
+  EXPECT_EQ(0u, irq_power.InternIrqName(base::StringView("arch_timer")));
+  name = "dwc3";
+  EXPECT_EQ(2u, irq_power.InternIrqName(base::StringView(name)));
+  EXPECT_EQ(1u, irq_power.InternIrqName("eth0"));
+  EXPECT_EQ(3u, compact_buffer.interned_irq_names_size());
+
+  irq_power.Reset();
+  EXPECT_EQ(0u, compact_buffer.interned_irq_names_size());
+  EXPECT_EQ(0u, irq_power.InternIrqName("eth0"));
+}
+
 TEST_F(CpuReaderTableTest, ParseAllFields) {
   using FakeEventProvider =
       ProtoProvider<pbzero::FakeFtraceEvent, gen::FakeFtraceEvent>;
@@ -1304,6 +1396,133 @@ TEST(CpuReaderTest, NewPacketOnLostEvents) {
   EXPECT_EQ(4u, packets[2].ftrace_events().event().size());
 }
 
+// In raw pages mode, the pages are written as they are, split in bundles in
+// the same way as the parsed events.
+TEST(CpuReaderTest, RawPagesOnLostEvents) {
+  auto page_ok = PageFromXxd(g_switch_page);
+  auto page_loss = PageFromXxd(g_switch_page_lost_events);
+
+  std::vector<const void*> test_page_order = {
+      page_ok.get(),   page_ok.get(), page_ok.get(), page_loss.get(),
+      page_loss.get(), page_ok.get(), page_ok.get(), page_ok.get()};
+
+  static constexpr size_t kTestPages = 8;
+
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[base::kPageSize * kTestPages]());
+  for (size_t i = 0; i < kTestPages; i++) {
+    void* dest = buf.get() + (i * base::kPageSize);
+    memcpy(dest, static_cast<const void*>(test_page_order[i]), base::kPageSize);
+  }
+
+  ProtoTranslationTable* table = GetTable("synthetic");
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle::RawFormat>
+      raw_format;
+  raw_format->set_page_header_size_len(table->page_header_size_len());
+  FtraceMetadata metadata{};
+  EventFilter event_filter;
+  event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  FtraceDataSourceConfig ds_config{std::move(event_filter),
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   /*symbolize_ksyms=*/false,
+                                   /*raw_pages=*/true,
+                                   raw_format.SerializeAsString()};
+
+  TraceWriterForTesting trace_writer;
+  size_t processed_pages = CpuReader::ProcessPagesForDataSource(
+      &trace_writer, &metadata, /*cpu=*/1, &ds_config, buf.get(), kTestPages,
+      table, /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+  ASSERT_EQ(processed_pages, kTestPages);
+
+  auto packets = trace_writer.GetAllTracePackets();
+  ASSERT_EQ(3u, packets.size());
+  EXPECT_EQ(3u, packets[0].ftrace_events().raw_page().size());
+  EXPECT_EQ(1u, packets[1].ftrace_events().raw_page().size());
+  EXPECT_EQ(4u, packets[2].ftrace_events().raw_page().size());
+  EXPECT_TRUE(packets[1].ftrace_events().lost_events());
+  for (const auto& packet : packets)
+    EXPECT_EQ(0u, packet.ftrace_events().event().size());
+
+  // The pages are trimmed after the end of their data.
+  const std::string& raw_page = packets[0].ftrace_events().raw_page()[0];
+  EXPECT_LT(raw_page.size(), base::kPageSize);
+  EXPECT_EQ(0, memcmp(raw_page.data(), page_ok.get(), raw_page.size()));
+
+  // The format is written only once until the metadata is cleared.
+  EXPECT_TRUE(packets[0].ftrace_events().has_raw_format());
+  EXPECT_FALSE(packets[1].ftrace_events().has_raw_format());
+  EXPECT_FALSE(packets[2].ftrace_events().has_raw_format());
+  EXPECT_EQ(packets[0].ftrace_events().raw_format().page_header_size_len(),
+            table->page_header_size_len());
+
+  metadata.Clear();
+  CpuReader::ProcessPagesForDataSource(
+      &trace_writer, &metadata, /*cpu=*/1, &ds_config, buf.get(),
+      /*pages_read=*/1, table, /*symbolizer=*/nullptr,
+      /*ftrace_clock_snapshot=*/nullptr,
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+  packets = trace_writer.GetAllTracePackets();
+  ASSERT_EQ(4u, packets.size());
+  EXPECT_TRUE(packets[3].ftrace_events().has_raw_format());
+}
+
+// The pages that contain events not enabled by the data source are parsed
+// rather than written raw, so that the events enabled by concurrent data
+// sources are filtered out as usual.
+TEST(CpuReaderTest, RawPagesWithEventsOfOtherDataSources) {
+  auto page = PageFromXxd(g_switch_page);
+  ProtoTranslationTable* table = GetTable("synthetic");
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle::RawFormat>
+      raw_format;
+  raw_format->set_page_header_size_len(table->page_header_size_len());
+  FtraceMetadata metadata{};
+  EventFilter event_filter;
+  event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_waking")));
+  FtraceDataSourceConfig ds_config{std::move(event_filter),
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   /*symbolize_ksyms=*/false,
+                                   /*raw_pages=*/true,
+                                   raw_format.SerializeAsString()};
+
+  TraceWriterForTesting trace_writer;
+  size_t processed_pages = CpuReader::ProcessPagesForDataSource(
+      &trace_writer, &metadata, /*cpu=*/1, &ds_config, page.get(),
+      /*pages_read=*/1, table, /*symbolizer=*/nullptr,
+      /*ftrace_clock_snapshot=*/nullptr,
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+  ASSERT_EQ(processed_pages, 1u);
+
+  // The sched_switch event of the page isn't enabled by this data source, so
+  // neither the page nor the event are in the trace.
+  auto packets = trace_writer.GetAllTracePackets();
+  ASSERT_EQ(1u, packets.size());
+  EXPECT_EQ(0u, packets[0].ftrace_events().raw_page().size());
+  EXPECT_EQ(0u, packets[0].ftrace_events().event().size());
+}
+
+TEST(CpuReaderTest, HasOnlyEnabledEvents) {
+  auto page = PageFromXxd(g_switch_page);
+  ProtoTranslationTable* table = GetTable("synthetic");
+  const uint8_t* parse_pos = page.get();
+  base::Optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  ASSERT_TRUE(page_header.has_value());
+
+  EventFilter event_filter;
+  EXPECT_FALSE(CpuReader::HasOnlyEnabledEvents(parse_pos, &*page_header,
+                                               event_filter));
+  event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  EXPECT_TRUE(CpuReader::HasOnlyEnabledEvents(parse_pos, &*page_header,
+                                              event_filter));
+}
+
 TEST(CpuReaderTest, ProcessPagesForDataSourceError) {
   auto page_ok = PageFromXxd(g_switch_page);
   auto page_err = PageFromXxd(g_invalid_page);
@@ -2042,6 +2261,101 @@ TEST(CpuReaderTest, ParseFullPageSchedSwitch) {
   EXPECT_EQ(bundle->event().size(), 59u);
 }
 
+// Parses the same page with the compiled fields parsers and with ParseField()
+// alone, and checks that the output is the same.
+TEST(CpuReaderTest, CompiledFieldsParsersMatchParseField) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  ds_config.event_filter.AddEnabledEvent(sched_switch_id);
+  ASSERT_TRUE(table->GetCompiledFieldsParser(sched_switch_id));
+
+  auto parse_page = [&] {
+    BundleProvider bundle_provider(base::kPageSize);
+    FtraceMetadata metadata{};
+    std::unique_ptr<CompactSchedBuffer> compact_buffer(
+        new CompactSchedBuffer());
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    EXPECT_TRUE(page_header.has_value());
+    EXPECT_LT(0u, CpuReader::ParsePagePayload(
+                      parse_pos, &page_header.value(), table, &ds_config,
+                      compact_buffer.get(), bundle_provider.writer(),
+                      &metadata));
+    auto bundle = bundle_provider.ParseProto();
+    EXPECT_TRUE(bundle);
+    return std::make_pair(
+        bundle->SerializeAsString(),
+        std::vector<int32_t>(metadata.pids.begin(), metadata.pids.end()));
+  };
+
+  auto compiled = parse_page();
+  table->ClearCompiledFieldsParsersForTesting();
+  auto interpreted = parse_page();
+  table->CompileFieldsParsers();
+
+  EXPECT_FALSE(compiled.first.empty());
+  EXPECT_EQ(compiled.first, interpreted.first);
+  EXPECT_EQ(compiled.second, interpreted.second);
+}
+
+// Reads the same pages with splice() and read(), from a pipe that stands in
+// for trace_pipe_raw, and checks that the trace contents are the same.
+TEST(CpuReaderTest, ReadCycleWithSplice) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  // More pages than the parsing buffer, to read them in a few batches.
+  static constexpr size_t kNumPages = 5;
+  static constexpr size_t kParsingBufPages = 2;
+  auto read_pages = [&](bool use_splice) {
+    base::Pipe pipe = base::Pipe::Create();
+    for (size_t i = 0; i < kNumPages; i++) {
+      EXPECT_EQ(base::WriteAll(*pipe.wr, page.get(), base::kPageSize),
+                static_cast<ssize_t>(base::kPageSize));
+    }
+    TraceWriterForTesting* writer = new TraceWriterForTesting();
+    FtraceDataSource data_source(base::WeakPtr<FtraceController>(),
+                                 /*session_id=*/0, FtraceConfig(),
+                                 std::unique_ptr<TraceWriter>(writer));
+    data_source.Initialize(/*config_id=*/1, &ds_config);
+
+    CpuReader reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                     /*ftrace_clock_snapshot=*/nullptr, std::move(pipe.rd));
+    reader.set_splice_batch_pages(use_splice ? kParsingBufPages : 0);
+    auto parsing_mem =
+        base::PagedMemory::Allocate(base::kPageSize * kParsingBufPages);
+    EXPECT_EQ(reader.ReadCycle(static_cast<uint8_t*>(parsing_mem.Get()),
+                               kParsingBufPages, /*max_pages=*/100,
+                               {&data_source}),
+              kNumPages);
+    return writer->GetAllTracePackets();
+  };
+
+  auto spliced_packets = read_pages(/*use_splice=*/true);
+  auto read_packets = read_pages(/*use_splice=*/false);
+  EXPECT_EQ(spliced_packets, read_packets);
+
+  // One bundle per batch of pages.
+  EXPECT_EQ(spliced_packets.size(),
+            (kNumPages + kParsingBufPages - 1) / kParsingBufPages);
+  size_t num_events = 0;
+  for (const auto& packet : spliced_packets)
+    num_events += packet.ftrace_events().event().size();
+  EXPECT_EQ(num_events, kNumPages * 59u);
+}
+
 // clang-format off
 // # tracer: nop
 // #
@@ -26,11 +26,13 @@
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/traced/probes/ftrace/atrace_wrapper.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_stats.h"
 
 #include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 
 namespace perfetto {
 namespace {
@@ -73,6 +75,106 @@ std::pair<std::string, std::string> EventToStringGroupAndName(
                         event.substr(slash_pos + 1));
 }
 
+using RawFormat = protos::pbzero::FtraceEventBundle::RawFormat;
+
+// Maps the translation strategy of a field to how trace_processor should read
+// it out of the raw event. Kernel addresses and string pointers have no raw
+// type: see HasKernelAddressFields().
+RawFormat::FieldType ToRawFieldType(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+    case kUint64ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+    case kInode32ToUint64:
+    case kInode64ToUint64:
+      return RawFormat::FIELD_TYPE_UINT;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+    case kInt64ToInt64:
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return RawFormat::FIELD_TYPE_INT;
+    case kFixedCStringToString:
+      return RawFormat::FIELD_TYPE_FIXED_CSTRING;
+    case kCStringToString:
+      return RawFormat::FIELD_TYPE_CSTRING;
+    case kDataLocToString:
+      return RawFormat::FIELD_TYPE_DATA_LOC;
+    case kDevId32ToUint64:
+    case kDevId64ToUint64:
+      return RawFormat::FIELD_TYPE_DEV_ID;
+    case kStringPtrToString:
+    case kFtraceSymAddr64ToUint64:
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  return RawFormat::FIELD_TYPE_UNSPECIFIED;
+}
+
+void AddRawField(const Field& field, RawFormat::Field* raw_field) {
+  raw_field->set_name(field.ftrace_name);
+  raw_field->set_offset(field.ftrace_offset);
+  raw_field->set_size(field.ftrace_size);
+  raw_field->set_type(ToRawFieldType(field.strategy));
+  raw_field->set_proto_field_id(field.proto_field_id);
+}
+
+// Describes the layout of the events enabled in |filter|, for the raw_pages
+// mode. See FtraceEventBundle.RawFormat.
+std::string SerializeRawFormat(const ProtoTranslationTable* table,
+                               const EventFilter& filter) {
+  protozero::HeapBuffered<RawFormat> raw_format;
+  raw_format->set_page_header_size_len(table->page_header_size_len());
+  for (const Field& field : table->common_fields())
+    AddRawField(field, raw_format->add_common_field());
+
+  for (size_t id : filter.GetEnabledEvents()) {
+    const Event* event = table->GetEventById(id);
+    if (!event)
+      continue;
+    auto* raw_event = raw_format->add_event();
+    raw_event->set_id(event->ftrace_event_id);
+    raw_event->set_name(event->name);
+    raw_event->set_proto_field_id(event->proto_field_id);
+    raw_event->set_size(event->size);
+    for (const Field& field : event->fields)
+      AddRawField(field, raw_event->add_field());
+  }
+  return raw_format.SerializeAsString();
+}
+
+// Returns true if any event enabled in |filter| has a field holding a kernel
+// address, either a symbol or a printk format string. Writing those as they
+// are would leak the layout of the kernel (KASLR) into the trace, so they
+// can only be parsed (and symbolized or resolved) on the device.
+bool HasKernelAddressFields(const ProtoTranslationTable* table,
+                            const EventFilter& filter) {
+  for (size_t id : filter.GetEnabledEvents()) {
+    const Event* event = table->GetEventById(id);
+    if (!event)
+      continue;
+    for (const Field& field : event->fields) {
+      if (field.strategy == kFtraceSymAddr64ToUint64 ||
+          field.strategy == kStringPtrToString) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void UnionInPlace(const std::vector<std::string>& unsorted_a,
                   std::vector<std::string>* out) {
   std::vector<std::string> a = unsorted_a;
@@ -571,13 +673,25 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request,
   auto compact_sched =
       CreateCompactSchedConfig(request, table_->compact_sched_format());
 
+  bool raw_pages = request.raw_pages();
+  if (raw_pages && HasKernelAddressFields(table_, filter)) {
+    PERFETTO_ELOG(
+        "raw_pages ignored: the enabled events contain kernel addresses");
+    raw_pages = false;
+  }
+  std::string raw_format;
+  if (raw_pages)
+    raw_format = SerializeRawFormat(table_, filter);
+
   std::vector<std::string> apps(request.atrace_apps());
   std::vector<std::string> categories(request.atrace_categories());
   FtraceConfigId id = ++last_id_;
   ds_configs_.emplace(
       std::piecewise_construct, std::forward_as_tuple(id),
       std::forward_as_tuple(std::move(filter), compact_sched, std::move(apps),
-                            std::move(categories), request.symbolize_ksyms()));
+                            std::move(categories),
+                            request.symbolize_ksyms() && !raw_pages,
+                            raw_pages, std::move(raw_format)));
   return id;
 }
 
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <set>
+#include <string>
 
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
@@ -43,12 +44,16 @@ struct FtraceDataSourceConfig {
                          CompactSchedConfig _compact_sched,
                          std::vector<std::string> _atrace_apps,
                          std::vector<std::string> _atrace_categories,
-                         bool _symbolize_ksyms)
+                         bool _symbolize_ksyms,
+                         bool _raw_pages = false,
+                         std::string _raw_format = {})
       : event_filter(std::move(_event_filter)),
         compact_sched(_compact_sched),
         atrace_apps(std::move(_atrace_apps)),
         atrace_categories(std::move(_atrace_categories)),
-        symbolize_ksyms(_symbolize_ksyms) {}
+        symbolize_ksyms(_symbolize_ksyms),
+        raw_pages(_raw_pages),
+        raw_format(std::move(_raw_format)) {}
 
   // The event filter allows to quickly check if a certain ftrace event with id
   // x is enabled for this data source.
@@ -63,6 +68,14 @@ struct FtraceDataSourceConfig {
 
   // When enabled will turn on the kallsyms symbolizer in CpuReader.
   const bool symbolize_ksyms;
+
+  // When enabled, CpuReader writes the raw ftrace pages into the trace rather
+  // than parsing them.
+  const bool raw_pages;
+
+  // Serialized FtraceEventBundle.RawFormat of the enabled events, written
+  // alongside the raw pages. Empty if |raw_pages| is false.
+  const std::string raw_format;
 };
 
 // Ftrace is a bunch of globally modifiable persistent state.
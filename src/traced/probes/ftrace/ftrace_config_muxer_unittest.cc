@@ -26,6 +26,8 @@
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "test/gtest_and_gmock.h"
 
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+
 using testing::_;
 using testing::AnyNumber;
 using testing::Contains;
@@ -45,6 +47,7 @@ namespace {
 constexpr int kFakeSchedSwitchEventId = 1;
 constexpr int kCgroupMkdirEventId = 12;
 constexpr int kFakePrintEventId = 20;
+constexpr int kFakeWorkqueueExecuteStartEventId = 21;
 
 class MockFtraceProcfs : public FtraceProcfs {
  public:
@@ -184,6 +187,18 @@ class FtraceConfigMuxerTest : public ::testing::Test {
       events.push_back(event);
     }
 
+    {
+      Event event = {};
+      event.name = "workqueue_execute_start";
+      event.group = "workqueue";
+      event.ftrace_event_id = kFakeWorkqueueExecuteStartEventId;
+      Field function = {};
+      function.ftrace_name = "function";
+      function.strategy = kFtraceSymAddr64ToUint64;
+      event.fields.push_back(function);
+      events.push_back(event);
+    }
+
     return std::unique_ptr<ProtoTranslationTable>(new ProtoTranslationTable(
         &table_procfs_, events, std::move(common_fields),
         ProtoTranslationTable::DefaultPageHeaderSpecForTesting(),
@@ -947,7 +962,8 @@ TEST_F(FtraceConfigMuxerTest, CompactSchedConfig) {
   // doesn't need to be sensible, as the tests won't use it.
   auto valid_compact_format =
       CompactSchedEventFormat{/*format_valid=*/true, CompactSchedSwitchFormat{},
-                              CompactSchedWakingFormat{}};
+                              CompactSchedWakingFormat{},
+                              CompactIrqPowerFormat{}};
 
   NiceMock<MockFtraceProcfs> ftrace;
   table_ = CreateFakeTable(valid_compact_format);
@@ -987,6 +1003,7 @@ TEST_F(FtraceConfigMuxerTest, CompactSchedConfigWithInvalidFormat) {
   // Request compact encoding.
   FtraceConfig config = CreateFtraceConfig({"sched/sched_switch"});
   config.mutable_compact_sched()->set_enabled(true);
+  config.mutable_compact_sched()->set_irq_and_power_events(true);
 
   FtraceConfigId id = model.SetupConfig(config);
   ASSERT_TRUE(id);
@@ -999,6 +1016,58 @@ TEST_F(FtraceConfigMuxerTest, CompactSchedConfigWithInvalidFormat) {
   EXPECT_THAT(ds_config->event_filter.GetEnabledEvents(),
               Contains(kFakeSchedSwitchEventId));
   EXPECT_FALSE(ds_config->compact_sched.enabled);
+  // The irq and power events formats are validated individually instead.
+  EXPECT_TRUE(ds_config->compact_sched.irq_and_power_events);
+}
+
+TEST_F(FtraceConfigMuxerTest, RawPagesConfig) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get(), {});
+
+  FtraceConfig config = CreateFtraceConfig({"sched/sched_switch"});
+  config.set_raw_pages(true);
+  config.set_symbolize_ksyms(true);
+
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  const FtraceDataSourceConfig* ds_config = model.GetDataSourceConfig(id);
+  ASSERT_TRUE(ds_config);
+  EXPECT_TRUE(ds_config->raw_pages);
+  // Kernel addresses can't be symbolized without parsing the events.
+  EXPECT_FALSE(ds_config->symbolize_ksyms);
+
+  // The format describes only the enabled events.
+  protos::pbzero::FtraceEventBundle::RawFormat::Decoder raw_format(
+      ds_config->raw_format);
+  EXPECT_EQ(raw_format.page_header_size_len(), table_->page_header_size_len());
+  std::vector<uint32_t> event_ids;
+  for (auto it = raw_format.event(); it; ++it) {
+    protos::pbzero::FtraceEventBundle::RawFormat::Event::Decoder event(*it);
+    event_ids.push_back(event.id());
+    EXPECT_EQ(event.name().ToStdString(), "sched_switch");
+  }
+  EXPECT_THAT(event_ids, UnorderedElementsAre(kFakeSchedSwitchEventId));
+}
+
+TEST_F(FtraceConfigMuxerTest, RawPagesRefusedWithKernelAddresses) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get(), {});
+
+  FtraceConfig config = CreateFtraceConfig(
+      {"sched/sched_switch", "workqueue/workqueue_execute_start"});
+  config.set_raw_pages(true);
+  config.set_symbolize_ksyms(true);
+
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  const FtraceDataSourceConfig* ds_config = model.GetDataSourceConfig(id);
+  ASSERT_TRUE(ds_config);
+  // The events are parsed (and the addresses symbolized) on the device.
+  EXPECT_FALSE(ds_config->raw_pages);
+  EXPECT_TRUE(ds_config->raw_format.empty());
+  EXPECT_TRUE(ds_config->symbolize_ksyms);
+  EXPECT_THAT(ds_config->event_filter.GetEnabledEvents(),
+              Contains(kFakeWorkqueueExecuteStartEventId));
 }
 
 TEST_F(FtraceConfigMuxerTest, SkipGenericEventsOption) {
@@ -27,6 +27,7 @@
 #include <array>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
@@ -176,6 +177,7 @@ FtraceController::FtraceController(std::unique_ptr<FtraceProcfs> ftrace_procfs,
       weak_factory_(this) {}
 
 FtraceController::~FtraceController() {
+  WaitForReaderThreads();
   for (const auto* data_source : data_sources_)
     ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   data_sources_.clear();
@@ -252,6 +254,15 @@ void FtraceController::StartIfNeeded() {
 // drain period. Therefore we introduce |per_cpu_.period_page_quota|. If the
 // consumer wants to handle a high bandwidth of ftrace events, they should set
 // the config values appropriately.
+//
+// If all the started data sources set |use_dedicated_reader_threads|, the cpus
+// are instead read concurrently, each on its own thread and into its own
+// writers, and ReadTick() only posts the reads. With many cpus and high event
+// rates, reading the cpus one after the other can't keep up with the kernel.
+// The reader threads are bound by the same per-tick cap and per-period quota:
+// the primary thread can block waiting for them (see WaitForReaderThreads()).
+// Once all the reader threads are done, OnReaderThreadsDone() continues on the
+// primary thread, notifying the observer and scheduling the next ReadTick().
 void FtraceController::ReadTick(int generation) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_READ_TICK);
@@ -269,6 +280,11 @@ void FtraceController::ReadTick(int generation) {
   }
 #endif
 
+  if (ShouldUseReaderThreads()) {
+    PostReadsToReaderThreads(generation);
+    return;
+  }
+
   // Read all cpu buffers with remaining per-period quota.
   bool all_cpus_done = true;
   uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
@@ -283,21 +299,33 @@ void FtraceController::ReadTick(int generation) {
     cpu_reader.set_ftrace_clock(ftrace_clock);
     size_t pages_read = cpu_reader.ReadCycle(
         parsing_buf, kParsingBufferSizePages, max_pages, started_data_sources_);
-
-    size_t new_quota = (pages_read >= orig_quota) ? 0 : orig_quota - pages_read;
-    per_cpu_[i].period_page_quota = new_quota;
-
-    // Reader got stopped by the cap on the number of pages (to not do too much
-    // work on the shared thread at once), but can read more in this drain
-    // period. Repost the ReadTick (on the immediate queue) to iterate over all
-    // cpus again. In other words, we will keep reposting work for all cpus as
-    // long as at least one of them hits the read page cap each tick. If all
-    // readers catch up to the event stream (pages_read < max_pages), or exceed
-    // their quota, we will stop for the given period.
-    PERFETTO_DCHECK(pages_read <= max_pages);
-    if (pages_read == max_pages && new_quota > 0)
+    if (!ChargePeriodQuota(&per_cpu_[i], max_pages, pages_read))
       all_cpus_done = false;
   }
+  FinishReadTick(generation, all_cpus_done);
+}
+
+// static
+bool FtraceController::ChargePeriodQuota(PerCpuState* per_cpu,
+                                         size_t max_pages,
+                                         size_t pages_read) {
+  size_t orig_quota = per_cpu->period_page_quota;
+  size_t new_quota = (pages_read >= orig_quota) ? 0 : orig_quota - pages_read;
+  per_cpu->period_page_quota = new_quota;
+
+  // Reader got stopped by the cap on the number of pages (to not do too much
+  // work on the shared thread at once), but can read more in this drain
+  // period. Repost the ReadTick (on the immediate queue) to iterate over all
+  // cpus again. In other words, we will keep reposting work for all cpus as
+  // long as at least one of them hits the read page cap each tick. If all
+  // readers catch up to the event stream (pages_read < max_pages), or exceed
+  // their quota, we will stop for the given period.
+  PERFETTO_DCHECK(pages_read <= max_pages);
+  return pages_read < max_pages || new_quota == 0;
+}
+
+void FtraceController::FinishReadTick(int generation, bool all_cpus_done) {
+  MergePerCpuMetadata();
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
   // More work to do in this period.
@@ -328,6 +356,118 @@ void FtraceController::ReadTick(int generation) {
   }
 }
 
+bool FtraceController::ShouldUseReaderThreads() {
+  if (started_data_sources_.empty())
+    return false;
+  for (FtraceDataSource* data_source : started_data_sources_) {
+    if (!data_source->has_per_cpu_sinks())
+      return false;
+  }
+  return true;
+}
+
+void FtraceController::PostReadsToReaderThreads(
+    base::Optional<int> generation) {
+  // The reader threads can use the kernel symbol map, but can't create it.
+  for (FtraceDataSource* data_source : started_data_sources_) {
+    if (data_source->parsing_config()->symbolize_ksyms) {
+      symbolizer_->GetOrCreateKernelSymbolMap();
+      break;
+    }
+  }
+
+  // A ReadTick() reads each cpu up to the per-tick cap and its remaining
+  // per-period quota, like the reads on the primary thread. A Flush() reads
+  // up to the size of the buffer.
+  std::vector<size_t> max_pages(per_cpu_.size());
+  size_t num_reads = 0;
+  for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++) {
+    max_pages[cpu] =
+        generation ? std::min(per_cpu_[cpu].period_page_quota,
+                              kMaxPagesPerCpuPerReadTick)
+                   : ftrace_config_muxer_->GetPerCpuBufferSizePages();
+    if (max_pages[cpu] > 0)
+      num_reads++;
+  }
+  if (num_reads == 0) {
+    if (generation)
+      FinishReadTick(*generation, /*all_cpus_done=*/true);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(reader_threads_mutex_);
+    PERFETTO_DCHECK(pending_cpu_reads_ == 0);
+    pending_cpu_reads_ = num_reads;
+    reader_threads_all_cpus_done_ = true;
+  }
+
+  const auto ftrace_clock = ftrace_config_muxer_->ftrace_clock();
+  auto weak_this = weak_factory_.GetWeakPtr();
+  for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++) {
+    if (max_pages[cpu] == 0)
+      continue;
+    PerCpuState* per_cpu = &per_cpu_[cpu];
+    if (!per_cpu->reader_thread) {
+      per_cpu->reader_thread.reset(
+          new base::ThreadTaskRunner(base::ThreadTaskRunner::CreateAndStart(
+              "ftrace_cpu" + std::to_string(cpu))));
+      per_cpu->parsing_mem = base::PagedMemory::Allocate(
+          base::kPageSize * kParsingBufferSizePages);
+    }
+    per_cpu->reader->set_ftrace_clock(ftrace_clock);
+
+    // |this| outlives the task: WaitForReaderThreads() is called before
+    // destroying |per_cpu_| and the reader threads. The task is the only one
+    // touching |per_cpu| until it decrements |pending_cpu_reads_|.
+    size_t cpu_max_pages = max_pages[cpu];
+    per_cpu->reader_thread->PostTask([this, per_cpu, cpu_max_pages, generation,
+                                      weak_this] {
+      uint8_t* parsing_buf =
+          reinterpret_cast<uint8_t*>(per_cpu->parsing_mem.Get());
+      size_t pages_read =
+          per_cpu->reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
+                                     cpu_max_pages, started_data_sources_);
+      bool cpu_done = true;
+      if (generation)
+        cpu_done = ChargePeriodQuota(per_cpu, cpu_max_pages, pages_read);
+
+      std::lock_guard<std::mutex> lock(reader_threads_mutex_);
+      if (!cpu_done)
+        reader_threads_all_cpus_done_ = false;
+      PERFETTO_DCHECK(pending_cpu_reads_ > 0);
+      if (--pending_cpu_reads_ > 0)
+        return;
+      reader_threads_cv_.notify_all();
+      if (generation) {
+        int gen = *generation;
+        bool all_cpus_done = reader_threads_all_cpus_done_;
+        task_runner_->PostTask([weak_this, gen, all_cpus_done] {
+          if (weak_this)
+            weak_this->OnReaderThreadsDone(gen, all_cpus_done);
+        });
+      }
+    });
+  }
+}
+
+void FtraceController::OnReaderThreadsDone(int generation,
+                                           bool all_cpus_done) {
+  if (started_data_sources_.empty() || generation != generation_)
+    return;
+  FinishReadTick(generation, all_cpus_done);
+}
+
+void FtraceController::WaitForReaderThreads() {
+  std::unique_lock<std::mutex> lock(reader_threads_mutex_);
+  reader_threads_cv_.wait(lock, [this] { return pending_cpu_reads_ == 0; });
+}
+
+void FtraceController::MergePerCpuMetadata() {
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->MergePerCpuMetadata();
+}
+
 uint32_t FtraceController::GetDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
@@ -360,12 +500,19 @@ void FtraceController::Flush(FlushRequestID flush_id) {
   // events.
   size_t per_cpu_buf_size_pages =
       ftrace_config_muxer_->GetPerCpuBufferSizePages();
-  uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
-  for (size_t i = 0; i < per_cpu_.size(); i++) {
-    per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
-                                  per_cpu_buf_size_pages,
-                                  started_data_sources_);
+  WaitForReaderThreads();
+  if (ShouldUseReaderThreads()) {
+    PostReadsToReaderThreads(base::nullopt);
+    WaitForReaderThreads();
+  } else {
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    for (size_t i = 0; i < per_cpu_.size(); i++) {
+      per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
+                                    per_cpu_buf_size_pages,
+                                    started_data_sources_);
+    }
   }
+  MergePerCpuMetadata();
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
   for (FtraceDataSource* data_source : started_data_sources_)
@@ -380,6 +527,7 @@ void FtraceController::StopIfNeeded() {
   // ask for an explicit flush before stopping, unless it needs to perform a
   // non-graceful stop.
 
+  WaitForReaderThreads();
   per_cpu_.clear();
   symbolizer_->Destroy();
   cpu_zero_stats_fd_.reset();
@@ -393,6 +541,9 @@ bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
   if (!ValidConfig(data_source->config()))
     return false;
 
+  // Setting up the config can add events to the translation table.
+  WaitForReaderThreads();
+
   auto config_id = ftrace_config_muxer_->SetupConfig(
       data_source->config(), data_source->mutable_setup_errors());
   if (!config_id)
@@ -412,17 +563,21 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
   FtraceConfigId config_id = data_source->config_id();
   PERFETTO_CHECK(config_id);
 
+  WaitForReaderThreads();
   if (!ftrace_config_muxer_->ActivateConfig(config_id))
     return false;
 
+  if (data_source->config().use_dedicated_reader_threads())
+    data_source->CreatePerCpuSinks(ftrace_procfs_->NumberOfCpus());
   started_data_sources_.insert(data_source);
   StartIfNeeded();
+  UpdateSpliceReads();
 
   // If the config is requesting to symbolize kernel addresses, create the
   // symbolizer and parse /proc/kallsyms (it will take 200-300 ms). This is not
   // strictly required here but is to avoid hitting the parsing cost while
   // processing the first ftrace event batch in CpuReader.
-  if (data_source->config().symbolize_ksyms()) {
+  if (data_source->parsing_config()->symbolize_ksyms) {
     if (data_source->config().initialize_ksyms_synchronously_for_testing()) {
       symbolizer_->GetOrCreateKernelSymbolMap();
     } else {
@@ -438,12 +593,31 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
 }
 
 void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
+  // The reader threads might be writing into the data source.
+  WaitForReaderThreads();
   started_data_sources_.erase(data_source);
   size_t removed = data_sources_.erase(data_source);
   if (!removed)
     return;  // Can happen if AddDataSource failed (e.g. too many sessions).
   ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   StopIfNeeded();
+  UpdateSpliceReads();
+}
+
+void FtraceController::UpdateSpliceReads() {
+  bool use_splice = false;
+  for (FtraceDataSource* data_source : started_data_sources_)
+    use_splice |= data_source->config().use_splice_reads();
+
+  // A batch never holds more pages than the parsing buffer, nor than the
+  // kernel buffer of a cpu: size the splice pipes for that many pages.
+  size_t batch_pages = 0;
+  if (use_splice) {
+    batch_pages = std::min(kParsingBufferSizePages,
+                           ftrace_config_muxer_->GetPerCpuBufferSizePages());
+  }
+  for (auto& per_cpu : per_cpu_)
+    per_cpu.reader->set_splice_batch_pages(batch_pages);
 }
 
 void FtraceController::DumpFtraceStats(FtraceStats* stats) {
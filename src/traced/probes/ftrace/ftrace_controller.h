@@ -21,14 +21,19 @@
 #include <unistd.h>
 
 #include <bitset>
+#include <condition_variable>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
@@ -113,6 +118,10 @@ class FtraceController {
         : reader(std::move(_reader)), period_page_quota(_period_page_quota) {}
     std::unique_ptr<CpuReader> reader;
     size_t period_page_quota = 0;
+
+    // Only used with dedicated reader threads, created on the first read.
+    std::unique_ptr<base::ThreadTaskRunner> reader_thread;
+    base::PagedMemory parsing_mem;
   };
 
   FtraceController(const FtraceController&) = delete;
@@ -121,6 +130,42 @@ class FtraceController {
   // Periodic task that reads all per-cpu ftrace buffers.
   void ReadTick(int generation);
 
+  // Schedules the next ReadTick(), either immediately or at the next drain
+  // period, after all cpus have been read.
+  void FinishReadTick(int generation, bool all_cpus_done);
+
+  // Subtracts |pages_read| from the per-period quota of |per_cpu|, after a
+  // read of up to |max_pages|. Returns false if the cpu should be read again
+  // in this drain period.
+  static bool ChargePeriodQuota(PerCpuState* per_cpu,
+                                size_t max_pages,
+                                size_t pages_read);
+
+  // Dedicated reader threads: when all the started data sources have per-cpu
+  // writers, each cpu is read on its own thread, rather than one cpu after the
+  // other on |task_runner_|. The state that the reader threads use (the
+  // started data sources, the translation table, the symbolizer) can't change
+  // while they're reading: all the methods that change it call
+  // WaitForReaderThreads() first.
+  bool ShouldUseReaderThreads();
+
+  // Posts a read of each cpu to its reader thread. If |generation| is set,
+  // these are the reads of a ReadTick(): they are charged to the per-period
+  // quota, and the last reader thread to finish posts OnReaderThreadsDone() on
+  // |task_runner_|. Otherwise, these are the reads of a Flush().
+  void PostReadsToReaderThreads(base::Optional<int> generation);
+  void OnReaderThreadsDone(int generation, bool all_cpus_done);
+  void WaitForReaderThreads();
+
+  // Moves the metadata collected by the per-cpu writers into the data sources'
+  // metadata, before notifying the |observer_|.
+  void MergePerCpuMetadata();
+
+  // Switches the cpu readers to splice() if any of the started data sources
+  // sets |use_splice_reads|, and sizes their splice pipes. Called when the
+  // started data sources change.
+  void UpdateSpliceReads();
+
   uint32_t GetDrainPeriodMs();
 
   void StartIfNeeded();
@@ -142,6 +187,15 @@ class FtraceController {
   std::vector<PerCpuState> per_cpu_;  // empty if tracing isn't active
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
+
+  // Number of cpus that the reader threads are still reading.
+  std::mutex reader_threads_mutex_;
+  std::condition_variable reader_threads_cv_;
+  size_t pending_cpu_reads_ = 0;  // Guarded by |reader_threads_mutex_|.
+  // Whether all the cpus read by the ReadTick() in flight are done for this
+  // drain period. Guarded by |reader_threads_mutex_|.
+  bool reader_threads_all_cpus_done_ = true;
+
   base::WeakPtrFactory<FtraceController> weak_factory_;  // Keep last.
 };
 
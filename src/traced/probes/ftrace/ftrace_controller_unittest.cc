@@ -17,10 +17,13 @@
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/tracing/core/shared_memory_arbiter.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
@@ -29,6 +32,9 @@
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/tracing/core/trace_writer_for_testing.h"
+#include "src/tracing/core/trace_writer_impl.h"
+#include "src/tracing/test/fake_producer_endpoint.h"
+#include "src/tracing/test/test_shared_memory.h"
 #include "test/gtest_and_gmock.h"
 
 #include "protos/perfetto/trace/ftrace/ftrace_stats.gen.h"
@@ -47,6 +53,7 @@ using testing::Mock;
 using testing::NiceMock;
 using testing::Pair;
 using testing::Return;
+using testing::SaveArg;
 using testing::UnorderedElementsAre;
 
 using Table = perfetto::ProtoTranslationTable;
@@ -145,7 +152,7 @@ class MockFtraceProcfs : public FtraceProcfs {
   }
 
   base::ScopedFile OpenPipeForCpu(size_t /*cpu*/) override {
-    return base::ScopedFile(base::OpenFile("/dev/null", O_RDONLY));
+    return base::ScopedFile(base::OpenFile(cpu_pipe_path, O_RDONLY));
   }
 
   MOCK_METHOD2(WriteToFile,
@@ -157,10 +164,33 @@ class MockFtraceProcfs : public FtraceProcfs {
 
   bool is_tracing_on() { return tracing_on_; }
 
+  // The file that the readers of all the cpus read, in place of their
+  // trace_pipe_raw.
+  std::string cpu_pipe_path = "/dev/null";
+
  private:
   bool tracing_on_ = false;
 };
 
+// Writes |num_pages| ftrace pages to |fd|. Each one holds a single discarded
+// event, filling the page.
+void WritePaddingPages(int fd, size_t num_pages) {
+  std::vector<uint8_t> page(base::kPageSize);
+  // Page header: an 8 bytes timestamp, then the 8 bytes size of the payload.
+  const uint64_t payload_size = base::kPageSize - 16;
+  memcpy(&page[8], &payload_size, sizeof(payload_size));
+  // Event header (type 29: padding, with a non-zero time delta), then the
+  // length of the event, not counting the event header.
+  const uint32_t event_header = 29 | (1 << 5);
+  const uint32_t padding_length = static_cast<uint32_t>(payload_size - 4);
+  memcpy(&page[16], &event_header, sizeof(event_header));
+  memcpy(&page[20], &padding_length, sizeof(padding_length));
+  for (size_t i = 0; i < num_pages; i++) {
+    PERFETTO_CHECK(base::WriteAll(fd, page.data(), page.size()) ==
+                   static_cast<ssize_t>(page.size()));
+  }
+}
+
 }  // namespace
 
 class TestFtraceController : public FtraceController,
@@ -183,10 +213,14 @@ class TestFtraceController : public FtraceController,
   MockFtraceProcfs* procfs() { return procfs_; }
   uint64_t NowMs() const override { return now_ms; }
   uint32_t drain_period_ms() { return GetDrainPeriodMs(); }
+  void WaitForReaderThreadsToFinish() { WaitForReaderThreads(); }
 
-  std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
+  std::unique_ptr<FtraceDataSource> AddFakeDataSource(
+      const FtraceConfig& cfg,
+      FtraceDataSource::TraceWriterFactory writer_factory = nullptr) {
     std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
-        GetWeakPtr(), 0 /* session id */, cfg, nullptr /* trace_writer */));
+        GetWeakPtr(), 0 /* session id */, cfg, nullptr /* trace_writer */,
+        std::move(writer_factory)));
     if (!AddDataSource(data_source.get()))
       return nullptr;
     return data_source;
@@ -472,6 +506,160 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, DedicatedReaderThreads) {
+  auto controller = CreateTestController(true /* nice procfs */, 2 /* cpus */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_use_dedicated_reader_threads(true);
+  size_t writers_created = 0;
+  auto data_source =
+      controller->AddFakeDataSource(config, [&](BufferExhaustedPolicy) {
+        writers_created++;
+        return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+      });
+  ASSERT_TRUE(data_source);
+
+  std::function<void()> read_tick;
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _))
+      .WillOnce(SaveArg<0>(&read_tick));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->runner());
+  ASSERT_TRUE(data_source->has_per_cpu_sinks());
+  EXPECT_EQ(writers_created, 2u);
+
+  // Pretend that the reader of cpu 1 has seen a pid.
+  data_source->metadata_for_cpu(1)->AddPid(42);
+
+  // The ReadTick only posts the reads to the reader threads. The last one to
+  // finish posts a task back on the main thread.
+  std::function<void()> reads_done;
+  EXPECT_CALL(*controller->runner(), PostTask(_))
+      .WillOnce(SaveArg<0>(&reads_done));
+  read_tick();
+  controller->WaitForReaderThreadsToFinish();
+  Mock::VerifyAndClearExpectations(controller->runner());
+  ASSERT_TRUE(reads_done);
+
+  // That task merges the per-cpu metadata and schedules the next ReadTick.
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  reads_done();
+  Mock::VerifyAndClearExpectations(controller->runner());
+  EXPECT_THAT(data_source->mutable_metadata()->pids, ElementsAre(42));
+  EXPECT_THAT(data_source->metadata_for_cpu(1)->pids, IsEmpty());
+}
+
+TEST(FtraceControllerTest, ReaderThreadsHonorPeriodQuota) {
+  auto controller = CreateTestController(true /* nice procfs */, 1 /* cpus */);
+  base::TempFile cpu_pipe = base::TempFile::Create();
+  WritePaddingPages(cpu_pipe.fd(), 600);
+  controller->procfs()->cpu_pipe_path = cpu_pipe.path();
+
+  // The per-period quota is the size of the per-cpu buffer: 512 pages.
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_use_dedicated_reader_threads(true);
+  config.set_buffer_size_kb(2048);
+  auto data_source =
+      controller->AddFakeDataSource(config, [](BufferExhaustedPolicy) {
+        return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+      });
+  ASSERT_TRUE(data_source);
+
+  std::function<void()> read_tick;
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _))
+      .WillOnce(SaveArg<0>(&read_tick));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->runner());
+
+  // The first tick stops at the per-tick cap (256 pages). There is quota left,
+  // so the next tick is posted right away.
+  std::function<void()> reads_done;
+  EXPECT_CALL(*controller->runner(), PostTask(_))
+      .WillOnce(SaveArg<0>(&reads_done));
+  read_tick();
+  controller->WaitForReaderThreadsToFinish();
+  Mock::VerifyAndClearExpectations(controller->runner());
+
+  std::function<void()> next_tick;
+  EXPECT_CALL(*controller->runner(), PostTask(_))
+      .WillOnce(SaveArg<0>(&next_tick));
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(0);
+  reads_done();
+  Mock::VerifyAndClearExpectations(controller->runner());
+
+  // The second tick uses up the quota. The remaining 88 pages wait for the
+  // next drain period.
+  EXPECT_CALL(*controller->runner(), PostTask(_))
+      .WillOnce(SaveArg<0>(&reads_done));
+  next_tick();
+  controller->WaitForReaderThreadsToFinish();
+  Mock::VerifyAndClearExpectations(controller->runner());
+
+  EXPECT_CALL(*controller->runner(), PostTask(_)).Times(0);
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  reads_done();
+  Mock::VerifyAndClearExpectations(controller->runner());
+}
+
+TEST(FtraceControllerTest, ReaderThreadsDropWhenSharedMemoryIsFull) {
+  auto controller = CreateTestController(true /* nice procfs */, 2 /* cpus */);
+  base::TempFile cpu_pipe = base::TempFile::Create();
+  WritePaddingPages(cpu_pipe.fd(), 64);
+  controller->procfs()->cpu_pipe_path = cpu_pipe.path();
+
+  // Nothing frees up the chunks of this buffer: they are committed on the main
+  // thread (|controller->runner()|), and the test holds it in Flush() below,
+  // as traced_probes does while it waits for the reader threads.
+  TestSharedMemory shmem(4 * base::kPageSize);
+  FakeProducerEndpoint endpoint;
+  auto arbiter = SharedMemoryArbiter::CreateInstance(
+      &shmem, base::kPageSize, &endpoint, controller->runner());
+
+  // Each cpu writes its 64 pages verbatim, 256 KB into a 16 KB buffer.
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_use_dedicated_reader_threads(true);
+  config.set_raw_pages(true);
+  std::vector<TraceWriterImpl*> writers;
+  auto data_source = controller->AddFakeDataSource(
+      config, [&](BufferExhaustedPolicy policy) {
+        EXPECT_EQ(policy, BufferExhaustedPolicy::kDrop);
+        std::unique_ptr<TraceWriter> writer =
+            arbiter->CreateTraceWriter(/*target_buffer=*/1, policy);
+        writers.push_back(static_cast<TraceWriterImpl*>(writer.get()));
+        return writer;
+      });
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  ASSERT_EQ(writers.size(), 2u);
+
+  // With writers that stall, the reader threads would wait for the main
+  // thread, and Flush() would never return.
+  controller->Flush(/*flush_id=*/1);
+  for (TraceWriterImpl* writer : writers)
+    EXPECT_TRUE(writer->drop_packets_for_testing());
+}
+
+TEST(FtraceControllerTest, NoReaderThreadsWithoutPerCpuWriters) {
+  auto controller = CreateTestController(true /* nice procfs */, 2 /* cpus */);
+
+  // Without a writer factory the data source can't create per-cpu writers,
+  // and the cpus are read on the main thread.
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_use_dedicated_reader_threads(true);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  std::function<void()> read_tick;
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _))
+      .WillOnce(SaveArg<0>(&read_tick));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->runner());
+  EXPECT_FALSE(data_source->has_per_cpu_sinks());
+
+  EXPECT_CALL(*controller->runner(), PostTask(_)).Times(0);
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  read_tick();
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
@@ -84,10 +84,12 @@ FtraceDataSource::FtraceDataSource(
     base::WeakPtr<FtraceController> controller_weak,
     TracingSessionID session_id,
     const FtraceConfig& config,
-    std::unique_ptr<TraceWriter> writer)
+    std::unique_ptr<TraceWriter> writer,
+    TraceWriterFactory writer_factory)
     : ProbesDataSource(session_id, &descriptor),
       config_(config),
       writer_(std::move(writer)),
+      writer_factory_(std::move(writer_factory)),
       controller_weak_(std::move(controller_weak)) {}
 
 FtraceDataSource::~FtraceDataSource() {
@@ -103,6 +105,30 @@ void FtraceDataSource::Initialize(
   parsing_config_ = parsing_config;
 }
 
+void FtraceDataSource::CreatePerCpuSinks(size_t num_cpus) {
+  if (!writer_factory_ || !per_cpu_sinks_.empty())
+    return;
+  per_cpu_sinks_.reserve(num_cpus);
+  for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+    std::unique_ptr<PerCpuSink> sink(new PerCpuSink());
+    sink->writer = writer_factory_(BufferExhaustedPolicy::kDrop);
+    per_cpu_sinks_.emplace_back(std::move(sink));
+  }
+}
+
+void FtraceDataSource::MergePerCpuMetadata() {
+  for (auto& sink : per_cpu_sinks_) {
+    FtraceMetadata& cpu_metadata = sink->metadata;
+    for (int32_t pid : cpu_metadata.rename_pids)
+      metadata_.AddRenamePid(pid);
+    for (int32_t pid : cpu_metadata.pids)
+      metadata_.AddPid(pid);
+    for (const auto& inode_and_device : cpu_metadata.inode_and_device)
+      metadata_.inode_and_device.insert(inode_and_device);
+    cpu_metadata.Clear();
+  }
+}
+
 void FtraceDataSource::Start() {
   FtraceController* ftrace = controller_weak_.get();
   if (!ftrace)
@@ -147,6 +173,10 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   }
   auto callback = std::move(it->second);
   pending_flushes_.erase(it);
+  // The per-cpu writers commit their chunks before |writer_| does, so
+  // |callback| runs after all of them have been committed.
+  for (auto& sink : per_cpu_sinks_)
+    sink->writer->Flush();
   if (writer_) {
     WriteStats();
     writer_->Flush(std::move(callback));
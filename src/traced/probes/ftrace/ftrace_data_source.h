@@ -23,12 +23,14 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/protozero/message_handle.h"
+#include "perfetto/tracing/buffer_exhausted_policy.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 #include "src/traced/probes/ftrace/ftrace_stats.h"
@@ -56,10 +58,16 @@ class FtraceDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
+  using TraceWriterFactory =
+      std::function<std::unique_ptr<TraceWriter>(BufferExhaustedPolicy)>;
+
+  // |writer_factory| is used to create the per-cpu writers, when the config
+  // asks for dedicated reader threads (see CreatePerCpuSinks()).
   FtraceDataSource(base::WeakPtr<FtraceController>,
                    TracingSessionID,
                    const FtraceConfig&,
-                   std::unique_ptr<TraceWriter>);
+                   std::unique_ptr<TraceWriter>,
+                   TraceWriterFactory writer_factory = nullptr);
   ~FtraceDataSource() override;
 
   // Called by FtraceController soon after ProbesProducer creates the data
@@ -84,6 +92,34 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceSetupErrors* mutable_setup_errors() { return &setup_errors_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // Creates a writer and a metadata container for each of the |num_cpus|, so
+  // that the events of different cpus can be parsed concurrently. Called by
+  // FtraceController when the data source starts, if the config asks for
+  // dedicated reader threads. Does nothing if there is no writer factory.
+  // The per-cpu writers drop data rather than stall when the shared memory
+  // buffer is full: the main thread can be blocked waiting for the reader
+  // threads (see FtraceController::WaitForReaderThreads()), and so can't
+  // commit the chunks that would free up the buffer.
+  void CreatePerCpuSinks(size_t num_cpus);
+  bool has_per_cpu_sinks() const { return !per_cpu_sinks_.empty(); }
+
+  // The writer and the metadata used for the events of |cpu|: either the
+  // per-cpu ones or, if there are none, the ones shared by all cpus.
+  TraceWriter* trace_writer_for_cpu(size_t cpu) {
+    return per_cpu_sinks_.empty() ? writer_.get()
+                                  : per_cpu_sinks_[cpu]->writer.get();
+  }
+  FtraceMetadata* metadata_for_cpu(size_t cpu) {
+    return per_cpu_sinks_.empty() ? &metadata_
+                                  : &per_cpu_sinks_[cpu]->metadata;
+  }
+
+  // Moves the pids and inodes collected in the per-cpu metadata into
+  // |metadata_|, where the other data sources look for them, and clears the
+  // per-cpu metadata (including the kernel symbols, which are interned per
+  // writer).
+  void MergePerCpuMetadata();
+
  private:
   // Hands out internal pointers to callbacks.
   FtraceDataSource(const FtraceDataSource&) = delete;
@@ -91,6 +127,11 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceDataSource(FtraceDataSource&&) = delete;
   FtraceDataSource& operator=(FtraceDataSource&&) = delete;
 
+  struct PerCpuSink {
+    std::unique_ptr<TraceWriter> writer;
+    FtraceMetadata metadata;
+  };
+
   void WriteStats();
   void DumpFtraceStats(FtraceStats*);
 
@@ -103,6 +144,8 @@ class FtraceDataSource : public ProbesDataSource {
   // -- Fields initialized by the Initialize() call:
   FtraceConfigId config_id_ = 0;
   std::unique_ptr<TraceWriter> writer_;
+  TraceWriterFactory writer_factory_;
+  std::vector<std::unique_ptr<PerCpuSink>> per_cpu_sinks_;
   base::WeakPtr<FtraceController> controller_weak_;
   // Muxer-held state for parsing ftrace according to this data source's
   // configuration. Not the raw FtraceConfig proto (held by |config_|).
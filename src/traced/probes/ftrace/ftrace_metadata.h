@@ -126,6 +126,7 @@ struct FtraceMetadata {
     pids_cache.reset();
     kernel_addrs.clear();
     last_kernel_addr_index_written = 0;
+    raw_format_written = false;
     FinishEvent();
   }
 
@@ -143,6 +144,7 @@ struct FtraceMetadata {
 #endif
   int32_t last_seen_common_pid = 0;
   uint32_t last_kernel_addr_index_written = 0;
+  bool raw_format_written = false;
 
   base::FlatSet<InodeBlockPair> inode_and_device;
   base::FlatSet<int32_t> rename_pids;
@@ -23,6 +23,7 @@
 
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 
@@ -500,6 +501,30 @@ ProtoTranslationTable::ProtoTranslationTable(
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
   }
+  CompileFieldsParsers();
+}
+
+void ProtoTranslationTable::CompileFieldsParsers() {
+  compiled_common_fields_parser_ =
+      CpuReader::CompileFieldsParser(common_fields_);
+  compiled_fields_parsers_.assign(events_.size(), nullptr);
+  for (const Event& event : events_) {
+    // Generic events are parsed field by field, as each field is wrapped in
+    // its own GenericFtraceEvent.Field message. The events created later by
+    // GetOrCreateEvent() are all generic.
+    if (!event.ftrace_event_id ||
+        event.proto_field_id ==
+            protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+      continue;
+    }
+    compiled_fields_parsers_[event.ftrace_event_id] =
+        CpuReader::CompileFieldsParser(event.fields);
+  }
+}
+
+void ProtoTranslationTable::ClearCompiledFieldsParsersForTesting() {
+  compiled_common_fields_parser_ = nullptr;
+  compiled_fields_parsers_.clear();
 }
 
 const Event* ProtoTranslationTable::GetOrCreateEvent(
@@ -33,9 +33,15 @@
 #include "src/traced/probes/ftrace/format_parser/format_parser.h"
 #include "src/traced/probes/ftrace/printk_formats_parser.h"
 
+namespace protozero {
+class Message;
+}  // namespace protozero
+
 namespace perfetto {
 
 class FtraceProcfs;
+class ProtoTranslationTable;
+struct FtraceMetadata;
 
 namespace protos {
 namespace pbzero {
@@ -43,6 +49,16 @@ class FtraceEventBundle;
 }  // namespace pbzero
 }  // namespace protos
 
+// Parses all the |fields| of an event at once. These routines are generated at
+// compile time by CpuReader for the most common sequences of translation
+// strategies (see CpuReader::CompileFieldsParser()).
+using CompiledFieldsParser = bool (*)(const Field* fields,
+                                      const uint8_t* start,
+                                      const uint8_t* end,
+                                      const ProtoTranslationTable* table,
+                                      protozero::Message* message,
+                                      FtraceMetadata* metadata);
+
 // Used when reading the config to store the group and name info for the
 // ftrace event.
 class GroupAndName {
@@ -170,6 +186,27 @@ class ProtoTranslationTable {
     return printk_formats_.at(address);
   }
 
+  // Returns the routine that parses the fields of the event with the given
+  // id, or nullptr if there is none and the fields must be parsed one by one
+  // with CpuReader::ParseField().
+  CompiledFieldsParser GetCompiledFieldsParser(size_t id) const {
+    if (id >= compiled_fields_parsers_.size())
+      return nullptr;
+    return compiled_fields_parsers_[id];
+  }
+
+  CompiledFieldsParser compiled_common_fields_parser() const {
+    return compiled_common_fields_parser_;
+  }
+
+  // Looks up the compiled parsers of the common fields and of the known
+  // events. Called by the constructor.
+  void CompileFieldsParsers();
+
+  // Makes CpuReader fall back to ParseField() for all the events, until
+  // CompileFieldsParsers() is called again.
+  void ClearCompiledFieldsParsersForTesting();
+
  private:
   ProtoTranslationTable(const ProtoTranslationTable&) = delete;
   ProtoTranslationTable& operator=(const ProtoTranslationTable&) = delete;
@@ -191,6 +228,10 @@ class ProtoTranslationTable {
   std::set<std::string> interned_strings_;
   CompactSchedEventFormat compact_sched_format_;
   PrintkMap printk_formats_;
+
+  // Indexed by ftrace event id, see GetCompiledFieldsParser().
+  std::vector<CompiledFieldsParser> compiled_fields_parsers_;
+  CompiledFieldsParser compiled_common_fields_parser_ = nullptr;
 };
 
 // Class for efficient 'is event with id x enabled?' checks.
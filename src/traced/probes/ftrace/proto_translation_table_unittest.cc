@@ -313,6 +313,38 @@ TEST(TranslationTableTest, CompactSchedFormatParsingSeedData) {
   ASSERT_FALSE(format.format_valid);
 }
 
+TEST(TranslationTableTest, CompiledFieldsParsersRavenData) {
+  std::string path = base::GetTestDataPath(
+      "src/traced/probes/ftrace/test/data/"
+      "android_raven_AOSP.MASTER_5.10.43/");
+  FtraceProcfs ftrace_procfs(path);
+  auto table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+  PERFETTO_CHECK(table);
+
+  EXPECT_TRUE(table->compiled_common_fields_parser());
+  for (const GroupAndName& event : {GroupAndName("sched", "sched_switch"),
+                                     GroupAndName("sched", "sched_waking"),
+                                     GroupAndName("power", "cpu_frequency"),
+                                     GroupAndName("power", "cpu_idle"),
+                                     GroupAndName("irq", "irq_handler_entry"),
+                                     GroupAndName("irq", "irq_handler_exit"),
+                                     GroupAndName("irq", "softirq_entry")}) {
+    size_t id = table->EventToFtraceId(event);
+    ASSERT_NE(id, 0u) << event.ToString();
+    EXPECT_TRUE(table->GetCompiledFieldsParser(id)) << event.ToString();
+  }
+
+  // No specialized parser for print's uint64 + C string fields.
+  size_t print_id = table->EventToFtraceId(GroupAndName("ftrace", "print"));
+  ASSERT_NE(print_id, 0u);
+  EXPECT_FALSE(table->GetCompiledFieldsParser(print_id));
+
+  table->ClearCompiledFieldsParsersForTesting();
+  EXPECT_FALSE(table->compiled_common_fields_parser());
+  EXPECT_FALSE(table->GetCompiledFieldsParser(print_id));
+}
+
 TEST(TranslationTableTest, InferFtraceType) {
   FtraceFieldType type;
 
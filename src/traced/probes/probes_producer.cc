@@ -142,7 +142,10 @@ ProbesProducer::CreateDSInstance<FtraceDataSource>(
   ftrace_config.ParseFromString(config.ftrace_config_raw());
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, std::move(ftrace_config),
-      endpoint_->CreateTraceWriter(buffer_id)));
+      endpoint_->CreateTraceWriter(buffer_id),
+      [this, buffer_id](BufferExhaustedPolicy policy) {
+        return endpoint_->CreateTraceWriter(buffer_id, policy);
+      }));
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG("Failed to setup ftrace");
     return nullptr;
@@ -28,6 +28,7 @@
 #include "perfetto/ext/tracing/ipc/default_socket.h"
 #include "perfetto/ext/tracing/ipc/service_ipc_host.h"
 #include "src/traced/service/builtin_producer.h"
+#include "src/tracing/core/zlib_compressor.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
@@ -199,6 +200,12 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
     return 1;
   }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  // Honor compression_type for write_into_file sessions, which perfetto_cmd
+  // can't compress as it never sees the data.
+  svc->service()->SetCompressorFn(ZlibCompressFn);
+#endif
+
   // Advertise builtin producers only on in-tree builds. These producers serve
   // only to dynamically start heapprofd and other services via sysprops, but
   // that can only ever happen in in-tree builds.
@@ -75,6 +75,35 @@ static void BM_TracingDataSourceLambda(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+std::unique_ptr<perfetto::TracingSession> g_multi_thread_session;
+
+// Like BM_TracingDataSourceLambda, but with |state.threads| threads writing
+// concurrently, each through its own TraceWriter. Measures how chunk
+// acquisition and return in the shared memory arbiter scale with the number
+// of writers.
+static void BM_TracingDataSourceLambdaMultiThread(benchmark::State& state) {
+  // The benchmark library synchronizes all the threads before the first and
+  // after the last iteration, so only the first thread needs to start and
+  // stop tracing.
+  if (state.thread_index == 0)
+    g_multi_thread_session = StartTracing("benchmark");
+
+  while (state.KeepRunning()) {
+    BenchmarkDataSource::Trace([&](BenchmarkDataSource::TraceContext ctx) {
+      auto packet = ctx.NewTracePacket();
+      packet->set_timestamp(42);
+      packet->set_for_testing()->set_str("benchmark");
+    });
+    benchmark::ClobberMemory();
+  }
+
+  if (state.thread_index == 0) {
+    g_multi_thread_session->StopBlocking();
+    PERFETTO_CHECK(!g_multi_thread_session->ReadTraceBlocking().empty());
+    g_multi_thread_session.reset();
+  }
+}
+
 static void BM_TracingTrackEventDisabled(benchmark::State& state) {
   while (state.KeepRunning()) {
     TRACE_EVENT_BEGIN("benchmark", "DisabledEvent");
@@ -126,6 +155,9 @@ static void BM_TracingTrackEventLambda(benchmark::State& state) {
 
 BENCHMARK(BM_TracingDataSourceDisabled);
 BENCHMARK(BM_TracingDataSourceLambda);
+BENCHMARK(BM_TracingDataSourceLambdaMultiThread)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
 BENCHMARK(BM_TracingTrackEventBasic);
 BENCHMARK(BM_TracingTrackEventDebugAnnotations);
 BENCHMARK(BM_TracingTrackEventDisabled);
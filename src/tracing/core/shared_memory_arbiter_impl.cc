@@ -87,6 +87,7 @@ SharedMemoryArbiterImpl::SharedMemoryArbiterImpl(
       shmem_abi_(reinterpret_cast<uint8_t*>(start), size, page_size),
       active_writer_ids_(kMaxWriterID),
       fully_bound_(initially_bound_),
+      commit_threshold_bytes_(shmem_abi_.size() / 2),
       weak_ptr_factory_(this) {}
 
 Chunk SharedMemoryArbiterImpl::GetNewChunk(
@@ -109,78 +110,84 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
   static const int kFlushCommitsAfterEveryNStalls = 2;
   static const int kAssertAtNStalls = 200;
 
-  for (;;) {
-    // TODO(primiano): Probably this lock is not really required and this code
-    // could be rewritten leveraging only the Try* atomic operations in
-    // SharedMemoryABI. But let's not be too adventurous for the moment.
-    {
-      std::unique_lock<std::mutex> scoped_lock(lock_);
-
-      task_runner_runs_on_current_thread =
-          task_runner_ && task_runner_->RunsTasksOnCurrentThread();
-
-      // If more than half of the SMB.size() is filled with completed chunks for
-      // which we haven't notified the service yet (i.e. they are still enqueued
-      // in |commit_data_req_|), force a synchronous CommitDataRequest() even if
-      // we acquire a chunk, to reduce the likeliness of stalling the writer.
-      //
-      // We can only do this if we're writing on the same thread that we access
-      // the producer endpoint on, since we cannot notify the producer endpoint
-      // to commit synchronously on a different thread. Attempting to flush
-      // synchronously on another thread will lead to subtle bugs caused by
-      // out-of-order commit requests (crbug.com/919187#c28).
-      bool should_commit_synchronously =
-          task_runner_runs_on_current_thread &&
-          buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
-          commit_data_req_ && bytes_pending_commit_ >= shmem_abi_.size() / 2;
-
-      const size_t initial_page_idx = page_idx_;
-      for (size_t i = 0; i < shmem_abi_.num_pages(); i++) {
-        page_idx_ = (initial_page_idx + i) % shmem_abi_.num_pages();
-        bool is_new_page = false;
-
-        // TODO(primiano): make the page layout dynamic.
-        auto layout = SharedMemoryArbiterImpl::default_page_layout;
-
-        if (shmem_abi_.is_page_free(page_idx_)) {
-          // TODO(primiano): Use the |size_hint| here to decide the layout.
-          is_new_page = shmem_abi_.TryPartitionPage(page_idx_, layout);
-        }
-        uint32_t free_chunks;
-        if (is_new_page) {
-          free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
-        } else {
-          free_chunks = shmem_abi_.GetFreeChunks(page_idx_);
-        }
+  // Stalling is only supported when the arbiter was bound at construction
+  // time (see DCHECK above), in which case |task_runner_| never changes and
+  // can be read without holding |lock_|.
+  if (buffer_exhausted_policy == BufferExhaustedPolicy::kStall) {
+    task_runner_runs_on_current_thread =
+        task_runner_ && task_runner_->RunsTasksOnCurrentThread();
+  }
 
-        for (uint32_t chunk_idx = 0; free_chunks;
-             chunk_idx++, free_chunks >>= 1) {
-          if (!(free_chunks & 1))
-            continue;
-          // We found a free chunk.
-          Chunk chunk = shmem_abi_.TryAcquireChunkForWriting(
-              page_idx_, chunk_idx, &header);
-          if (!chunk.is_valid())
-            continue;
-          if (stall_count > kLogAfterNStalls) {
-            PERFETTO_LOG("Recovered from stall after %d iterations",
-                         stall_count);
-          }
+  for (;;) {
+    // Chunks are acquired without taking |lock_|: the page partitioning and
+    // the chunk state transitions are CAS operations on the page headers in
+    // SharedMemoryABI, so concurrent writers racing for the same chunk can't
+    // both win. |lock_| is only taken when returning chunks, to build the
+    // CommitDataRequest.
+    //
+    // If more than half of the SMB.size() is filled with completed chunks for
+    // which we haven't notified the service yet (i.e. they are still enqueued
+    // in |commit_data_req_|), force a synchronous CommitDataRequest() even if
+    // we acquire a chunk, to reduce the likeliness of stalling the writer.
+    //
+    // We can only do this if we're writing on the same thread that we access
+    // the producer endpoint on, since we cannot notify the producer endpoint
+    // to commit synchronously on a different thread. Attempting to flush
+    // synchronously on another thread will lead to subtle bugs caused by
+    // out-of-order commit requests (crbug.com/919187#c28).
+    bool should_commit_synchronously =
+        task_runner_runs_on_current_thread &&
+        bytes_pending_commit_.load(std::memory_order_relaxed) >=
+            shmem_abi_.size() / 2;
+
+    // |page_idx_| is only a hint of where the last chunk was found, to avoid
+    // rescanning the pages that are likely to be full. Racing writers might
+    // scan the same pages, but only one of them will acquire each chunk.
+    const size_t num_pages = shmem_abi_.num_pages();
+    const size_t initial_page_idx = page_idx_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_pages; i++) {
+      const size_t page_idx = (initial_page_idx + i) % num_pages;
+      bool is_new_page = false;
+
+      // TODO(primiano): make the page layout dynamic.
+      auto layout = SharedMemoryArbiterImpl::default_page_layout;
+
+      if (shmem_abi_.is_page_free(page_idx)) {
+        // TODO(primiano): Use the |size_hint| here to decide the layout.
+        is_new_page = shmem_abi_.TryPartitionPage(page_idx, layout);
+      }
+      uint32_t free_chunks;
+      if (is_new_page) {
+        free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
+      } else {
+        free_chunks = shmem_abi_.GetFreeChunks(page_idx);
+      }
 
-          if (should_commit_synchronously) {
-            // We can't flush while holding the lock.
-            scoped_lock.unlock();
-            FlushPendingCommitDataRequests();
-            return chunk;
-          } else {
-            return chunk;
-          }
+      for (uint32_t chunk_idx = 0; free_chunks;
+           chunk_idx++, free_chunks >>= 1) {
+        if (!(free_chunks & 1))
+          continue;
+        // We found a free chunk.
+        Chunk chunk =
+            shmem_abi_.TryAcquireChunkForWriting(page_idx, chunk_idx, &header);
+        if (!chunk.is_valid())
+          continue;
+        if (page_idx != initial_page_idx)
+          page_idx_.store(page_idx, std::memory_order_relaxed);
+        if (stall_count > kLogAfterNStalls) {
+          PERFETTO_LOG("Recovered from stall after %d iterations",
+                       stall_count);
         }
+
+        if (should_commit_synchronously)
+          FlushPendingCommitDataRequests();
+        return chunk;
       }
-    }  // scoped_lock
+    }
 
     if (buffer_exhausted_policy == BufferExhaustedPolicy::kDrop) {
       PERFETTO_DLOG("Shared memory buffer exhaused, returning invalid Chunk!");
+      num_chunks_dropped_.fetch_add(1, std::memory_order_relaxed);
       return Chunk();
     }
 
@@ -192,6 +199,15 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
       PERFETTO_LOG("Shared memory buffer overrun! Stalling");
     }
 
+    if (stall_count == 1) {
+      num_stalls_.fetch_add(1, std::memory_order_relaxed);
+      // Some of the chunks might be batched in |commit_data_req_|, waiting
+      // for the end of the batching period. Don't wait for it: ask the IPC
+      // thread to commit them now (see below for the IPC thread itself).
+      if (!task_runner_runs_on_current_thread)
+        FlushPendingCommitDataRequests();
+    }
+
     if (stall_count == kAssertAtNStalls) {
       PERFETTO_FATAL(
           "Shared memory buffer max stall count exceeded; possible deadlock");
@@ -264,7 +280,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       if (fully_bound_ && !delayed_flush_scheduled_) {
         weak_this = weak_ptr_factory_.GetWeakPtr();
         task_runner_to_post_delayed_callback_on = task_runner_;
-        flush_delay_ms = batch_commits_duration_ms_;
+        flush_delay_ms = NextBatchDelayLocked();
         delayed_flush_scheduled_ = true;
       }
     }
@@ -357,7 +373,9 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     // service will not know of the patch and won't be able to reconstruct the
     // trace.
     if (fully_bound_ &&
-        (last_patch_req || bytes_pending_commit_ >= shmem_abi_.size() / 2)) {
+        (last_patch_req || bytes_pending_commit_ >= commit_threshold_bytes_)) {
+      if (!last_patch_req && delayed_flush_scheduled_)
+        batch_cut_short_ = true;
       weak_this = weak_ptr_factory_.GetWeakPtr();
       task_runner_to_post_delayed_callback_on = task_runner_;
       flush_delay_ms = 0;
@@ -454,10 +472,35 @@ bool SharedMemoryArbiterImpl::TryDirectPatchLocked(
   return true;
 }
 
+uint32_t SharedMemoryArbiterImpl::NextBatchDelayLocked() {
+  if (batch_cut_short_) {
+    batch_delay_ms_ /= 2;
+  } else if (batch_delay_ms_ < batch_commits_duration_ms_ / 2) {
+    batch_delay_ms_ = std::max(1u, batch_delay_ms_ * 2);
+  } else {
+    batch_delay_ms_ = batch_commits_duration_ms_;
+  }
+  batch_cut_short_ = false;
+  return batch_delay_ms_;
+}
+
+void SharedMemoryArbiterImpl::AdaptCommitThresholdLocked(bool smb_exhausted) {
+  const size_t max_threshold = shmem_abi_.size() / 2;
+  const size_t min_threshold = std::min(shmem_abi_.page_size(), max_threshold);
+  if (smb_exhausted) {
+    commit_threshold_bytes_ =
+        std::max(min_threshold, commit_threshold_bytes_ / 2);
+  } else {
+    commit_threshold_bytes_ = std::min(
+        max_threshold, commit_threshold_bytes_ + shmem_abi_.page_size());
+  }
+}
+
 void SharedMemoryArbiterImpl::SetBatchCommitsDuration(
     uint32_t batch_commits_duration_ms) {
   std::lock_guard<std::mutex> scoped_lock(lock_);
   batch_commits_duration_ms_ = batch_commits_duration_ms;
+  batch_delay_ms_ = batch_commits_duration_ms;
 }
 
 bool SharedMemoryArbiterImpl::EnableDirectSMBPatching() {
@@ -474,6 +517,25 @@ void SharedMemoryArbiterImpl::SetDirectSMBPatchingSupportedByService() {
   direct_patching_supported_by_service_ = true;
 }
 
+void SharedMemoryArbiterImpl::EnableSmbCommitRing() {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  // The SMB layout can't change under the feet of existing writers.
+  PERFETTO_CHECK(active_writer_ids_.IsEmpty() && !commit_data_req_);
+  PERFETTO_CHECK(shmem_abi_.num_pages() >= 2);
+  const size_t page_size = shmem_abi_.page_size();
+  const size_t size = (shmem_abi_.num_pages() - 1) * page_size;
+  uint8_t* start = shmem_abi_.start();
+  shmem_abi_.Initialize(start, size, page_size);
+  commit_ring_.Initialize(start + size, page_size);
+  commit_threshold_bytes_ = std::min(commit_threshold_bytes_, size / 2);
+  page_idx_.store(0, std::memory_order_relaxed);
+}
+
+void SharedMemoryArbiterImpl::DisableSmbCommitRing() {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  commit_ring_.Reset();
+}
+
 // This function is quite subtle. When making changes keep in mind these two
 // challenges:
 // 1) If the producer stalls and we happen to be on the |task_runner_| IPC
@@ -547,6 +609,38 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
 
       req = std::move(commit_data_req_);
       bytes_pending_commit_ = 0;
+
+      uint32_t stalls = num_stalls_.exchange(0, std::memory_order_relaxed);
+      uint32_t dropped =
+          num_chunks_dropped_.exchange(0, std::memory_order_relaxed);
+      if (stalls)
+        req->set_smb_writer_stalls(stalls);
+      if (dropped)
+        req->set_smb_chunks_dropped(dropped);
+      AdaptCommitThresholdLocked(stalls || dropped);
+    }
+
+    // With the commit ring, the chunks and patches are passed to the service
+    // through the SMB. The IPC is still needed to wake up the service, if it
+    // has already consumed the ring, or to pass the other fields of the
+    // request. If the ring is full, the whole request is sent via IPC.
+    if (req && commit_ring_.is_valid()) {
+      bool was_empty = false;
+      if (commit_ring_.Write(*req, &was_empty)) {
+        req->clear_chunks_to_move();
+        req->clear_chunks_to_patch();
+        if (!was_empty && !callback && !req->has_flush_request_id() &&
+            !req->has_smb_writer_stalls() && !req->has_smb_chunks_dropped()) {
+          req.reset();
+        }
+      }
+    }
+
+    // Tell the service which records of the ring precede the request.
+    if (commit_ring_.is_valid() && (req || callback)) {
+      if (!req)
+        req.reset(new CommitDataRequest());
+      req->set_commit_ring_write_index(commit_ring_.write_index());
     }
   }  // scoped_lock
 
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -31,6 +32,7 @@
 #include "perfetto/ext/tracing/core/shared_memory_arbiter.h"
 #include "perfetto/tracing/core/forward_decls.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/core/smb_commit_ring.h"
 
 namespace perfetto {
 
@@ -46,8 +48,10 @@ class TaskRunner;
 // This class handles the shared memory buffer on the producer side. It is used
 // to obtain thread-local chunks and to partition pages from several threads.
 // There is one arbiter instance per Producer.
-// This class is thread-safe and uses locks to do so. Data sources are supposed
-// to interact with this sporadically, only when they run out of space on their
+// This class is thread-safe. Chunks are acquired lock-free, relying on the
+// atomic operations of SharedMemoryABI, while returning chunks takes a lock to
+// batch them into the next CommitDataRequest. Data sources are supposed to
+// interact with this sporadically, only when they run out of space on their
 // current thread-local chunk.
 //
 // When the arbiter is created using CreateUnboundInstance(), the following
@@ -154,6 +158,9 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   void SetDirectSMBPatchingSupportedByService() override;
 
+  void EnableSmbCommitRing() override;
+  void DisableSmbCommitRing() override;
+
   void FlushPendingCommitDataRequests(
       std::function<void()> callback = {}) override;
   bool TryShutdown() override;
@@ -227,8 +234,27 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // state.
   bool UpdateFullyBoundLocked();
 
+  // Returns the delay of the batching period that is about to start, see
+  // |batch_delay_ms_|.
+  uint32_t NextBatchDelayLocked();
+
+  // Updates |commit_threshold_bytes_| when a CommitDataRequest is sent.
+  // |smb_exhausted| is true if any writer stalled or dropped data since the
+  // previous request.
+  void AdaptCommitThresholdLocked(bool smb_exhausted);
+
   const bool initially_bound_;
 
+  // Index of the page where GetNewChunk() last found a free chunk. Accessed
+  // without holding |lock_|: it is only a hint for where to start scanning.
+  std::atomic<size_t> page_idx_{0};
+
+  // Num. of GetNewChunk() calls that stalled (kStall) or failed (kDrop)
+  // because the SMB was full, since the last CommitDataRequest. Updated
+  // without holding |lock_| and reported to the service in the next request.
+  std::atomic<uint32_t> num_stalls_{0};
+  std::atomic<uint32_t> num_chunks_dropped_{0};
+
   // Only accessed on |task_runner_| after the producer endpoint was bound.
   TracingService::ProducerEndpoint* producer_endpoint_ = nullptr;
 
@@ -238,9 +264,11 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   base::TaskRunner* task_runner_ = nullptr;
   SharedMemoryABI shmem_abi_;
-  size_t page_idx_ = 0;
   std::unique_ptr<CommitDataRequest> commit_data_req_;
-  size_t bytes_pending_commit_ = 0;  // SUM(chunk.size() : commit_data_req_).
+
+  // SUM(chunk.size() : commit_data_req_). Only modified while holding |lock_|,
+  // but also read without it by GetNewChunk().
+  std::atomic<size_t> bytes_pending_commit_{0};
   IdAllocator<WriterID> active_writer_ids_;
   bool did_shutdown_ = false;
 
@@ -262,12 +290,32 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // See SharedMemoryArbiter::SetBatchCommitsDuration.
   uint32_t batch_commits_duration_ms_ = 0;
 
+  // Commit batching adapts to the load of the writers:
+  // - |batch_delay_ms_| is the duration of the current batching period, at
+  //   most |batch_commits_duration_ms_|. It is halved when the chunks returned
+  //   during a period reach |commit_threshold_bytes_| before the end of the
+  //   period (i.e. the commit rate is too high for the period), and doubled
+  //   back otherwise.
+  // - |commit_threshold_bytes_| is the value of |bytes_pending_commit_| that
+  //   triggers an immediate commit, regardless of the batching period. It
+  //   starts at half the SMB size and is halved (down to a page) whenever the
+  //   writers stall or drop data because the SMB is full, growing back by a
+  //   page after each request sent without any.
+  uint32_t batch_delay_ms_ = 0;
+  size_t commit_threshold_bytes_;
+  bool batch_cut_short_ = false;
+
   // See SharedMemoryArbiter::EnableDirectSMBPatching.
   bool direct_patching_enabled_ = false;
 
   // See SharedMemoryArbiter::SetDirectSMBPatchingSupportedByService.
   bool direct_patching_supported_by_service_ = false;
 
+  // See SharedMemoryArbiter::EnableSmbCommitRing. Only written on
+  // |task_runner_|, by FlushPendingCommitDataRequests(), and reset by
+  // DisableSmbCommitRing().
+  SmbCommitRing commit_ring_;
+
   // Indicates whether we have already scheduled a delayed flush for the
   // purposes of batching. Set to true at the beginning of a batching period and
   // cleared at the end of the period. Immediate flushes that happen during a
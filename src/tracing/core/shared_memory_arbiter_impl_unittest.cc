@@ -17,6 +17,10 @@
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include <bitset>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/commit_data_request.h"
@@ -75,6 +79,18 @@ class SharedMemoryArbiterImplTest : public AlignedBufferTest {
   }
 
   bool IsArbiterFullyBound() { return arbiter_->fully_bound_; }
+  uint32_t batch_delay_ms() { return arbiter_->batch_delay_ms_; }
+  size_t commit_threshold_bytes() { return arbiter_->commit_threshold_bytes_; }
+
+  // Does what the delayed task posted at the beginning of a batching period
+  // does, as the tests can't control the passage of time in |task_runner_|.
+  void EndBatchingPeriod() {
+    {
+      std::lock_guard<std::mutex> scoped_lock(arbiter_->lock_);
+      arbiter_->delayed_flush_scheduled_ = false;
+    }
+    arbiter_->FlushPendingCommitDataRequests();
+  }
 
   void TearDown() override {
     arbiter_.reset();
@@ -148,6 +164,57 @@ TEST_P(SharedMemoryArbiterImplTest, GetAndReturnChunks) {
   task_runner_->RunUntilCheckpoint("on_commit_2");
 }
 
+// Acquires and returns all the chunks of the SMB from several threads at the
+// same time. Each chunk must be handed out to exactly one thread and every
+// returned chunk must end up in the CommitDataRequest.
+TEST_P(SharedMemoryArbiterImplTest, ConcurrentGetAndReturnChunks) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv14);
+  static constexpr size_t kTotChunks = kNumPages * 14;
+  static constexpr size_t kNumThreads = 8;
+  std::vector<SharedMemoryABI::Chunk> chunks[kNumThreads];
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([this, &chunks, t] {
+      for (;;) {
+        SharedMemoryABI::Chunk chunk =
+            arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+        if (!chunk.is_valid())
+          break;
+        chunks[t].emplace_back(std::move(chunk));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  std::set<uint8_t*> chunk_begins;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    for (const auto& chunk : chunks[t])
+      ASSERT_TRUE(chunk_begins.insert(chunk.begin()).second);
+  }
+  ASSERT_EQ(kTotChunks, chunk_begins.size());
+
+  threads.clear();
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([this, &chunks, t] {
+      PatchList ignored;
+      for (auto& chunk : chunks[t])
+        arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(static_cast<int>(kTotChunks), req.chunks_to_move_size());
+      }));
+  arbiter_->FlushPendingCommitDataRequests();
+}
+
 TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   SharedMemoryArbiterImpl::set_default_layout_for_testing(
       SharedMemoryABI::PageLayout::kPageDiv1);
@@ -225,6 +292,179 @@ TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   arbiter_->FlushPendingCommitDataRequests();
 }
 
+// Checks that the batching period is shortened when the returned chunks fill
+// half of the SMB before its end, and restored when they don't.
+TEST_P(SharedMemoryArbiterImplTest, AdaptiveBatchCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  arbiter_->SetBatchCommitsDuration(100000);
+  PatchList ignored;
+  auto return_chunk = [this, &ignored] {
+    SharedMemoryABI::Chunk chunk =
+        arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+    ASSERT_TRUE(chunk.is_valid());
+    arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  };
+
+  // Filling half of the SMB triggers an immediate commit, before the end of
+  // the batching period. Chunks are slightly smaller than pages.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(static_cast<int>(kNumPages / 2 + 1),
+                  req.chunks_to_move_size());
+      }));
+  for (size_t i = 0; i < kNumPages / 2 + 1; i++)
+    return_chunk();
+  EXPECT_EQ(batch_delay_ms(), 100000u);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // As the previous period was cut short, the next one is halved.
+  return_chunk();
+  EXPECT_EQ(batch_delay_ms(), 50000u);
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(1);
+  EndBatchingPeriod();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // That one ended without reaching the threshold: the next one is doubled.
+  return_chunk();
+  EXPECT_EQ(batch_delay_ms(), 100000u);
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(1);
+  EndBatchingPeriod();
+}
+
+// Checks that stalls are reported in the next CommitDataRequest and make the
+// arbiter commit earlier.
+TEST_P(SharedMemoryArbiterImplTest, StallsAreReported) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  arbiter_->SetBatchCommitsDuration(UINT32_MAX);
+  const size_t initial_threshold = commit_threshold_bytes();
+  EXPECT_EQ(initial_threshold, buf_size() / 2);
+
+  SharedMemoryABI::Chunk chunks[kNumPages];
+  for (size_t i = 0; i < kNumPages; i++) {
+    chunks[i] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall);
+    ASSERT_TRUE(chunks[i].is_valid());
+  }
+  PatchList ignored;
+  arbiter_->ReturnCompletedChunk(std::move(chunks[0]), 1, &ignored);
+
+  // The SMB is full, so the writer stalls. As it runs on the IPC thread, it
+  // commits the batched chunk synchronously. Pretend that the service frees it
+  // straight away.
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([abi](const CommitDataRequest& req,
+                             MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(1, req.chunks_to_move_size());
+        EXPECT_EQ(1u, req.smb_writer_stalls());
+        EXPECT_FALSE(req.has_smb_chunks_dropped());
+        SharedMemoryABI::Chunk chunk = abi->TryAcquireChunkForReading(
+            req.chunks_to_move()[0].page(), req.chunks_to_move()[0].chunk());
+        ASSERT_TRUE(chunk.is_valid());
+        abi->ReleaseChunkAsFree(std::move(chunk));
+      }));
+  chunks[0] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall);
+  ASSERT_TRUE(chunks[0].is_valid());
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  EXPECT_EQ(commit_threshold_bytes(), initial_threshold / 2);
+
+  // Failures in kDrop mode are reported too.
+  ASSERT_FALSE(arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop)
+                   .is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_FALSE(req.has_smb_writer_stalls());
+        EXPECT_EQ(1u, req.smb_chunks_dropped());
+      }));
+  arbiter_->ReturnCompletedChunk(std::move(chunks[1]), 1, &ignored);
+  arbiter_->FlushPendingCommitDataRequests();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  EXPECT_EQ(commit_threshold_bytes(), initial_threshold / 4);
+
+  // Requests without stalls let the threshold grow back.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(1);
+  arbiter_->ReturnCompletedChunk(std::move(chunks[2]), 1, &ignored);
+  arbiter_->FlushPendingCommitDataRequests();
+  EXPECT_EQ(commit_threshold_bytes(), initial_threshold / 4 + page_size());
+}
+
+TEST_P(SharedMemoryArbiterImplTest, SmbCommitRing) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv14);
+  arbiter_->EnableSmbCommitRing();
+  ASSERT_EQ(arbiter_->num_pages(), kNumPages - 1);
+
+  // The service's view of the ring.
+  SmbCommitRing service_ring;
+  service_ring.Initialize(buf() + (kNumPages - 1) * page_size(), page_size());
+
+  // The ring is empty: the commit IPC is needed to wake up the service, but
+  // the chunk is passed through the ring.
+  PatchList ignored;
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_EQ(req.chunks_to_move_size(), 0);
+        EXPECT_EQ(req.commit_ring_write_index(), 1u);
+      }));
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  arbiter_->FlushPendingCommitDataRequests();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // The service hasn't consumed the ring yet, so no IPC is needed.
+  chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(0);
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 2, &ignored);
+  arbiter_->FlushPendingCommitDataRequests();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  CommitDataRequest req;
+  ASSERT_TRUE(service_ring.Read(&req, base::nullopt));
+  ASSERT_EQ(req.chunks_to_move_size(), 2);
+  EXPECT_EQ(req.chunks_to_move()[0].page(), 0u);
+  EXPECT_EQ(req.chunks_to_move()[0].chunk(), 0u);
+  EXPECT_EQ(req.chunks_to_move()[0].target_buffer(), 1u);
+  EXPECT_EQ(req.chunks_to_move()[1].page(), 0u);
+  EXPECT_EQ(req.chunks_to_move()[1].chunk(), 1u);
+  EXPECT_EQ(req.chunks_to_move()[1].target_buffer(), 2u);
+
+  // Flush requests always need an IPC.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_EQ(req.flush_request_id(), 42u);
+        EXPECT_EQ(req.commit_ring_write_index(), 2u);
+      }));
+  arbiter_->NotifyFlushComplete(42);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // Once the service stopped reading the ring, the chunks are committed via
+  // IPC again, in the pages before the ring.
+  arbiter_->DisableSmbCommitRing();
+  ASSERT_EQ(arbiter_->num_pages(), kNumPages - 1);
+  chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(req.chunks_to_move_size(), 1);
+        EXPECT_EQ(req.chunks_to_move()[0].target_buffer(), 3u);
+        EXPECT_FALSE(req.has_commit_ring_write_index());
+      }));
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 3, &ignored);
+  arbiter_->FlushPendingCommitDataRequests();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+}
+
 // Helper for verifying trace writer id allocations.
 class TraceWriterIdChecker : public FakeProducerEndpoint {
  public:
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/smb_commit_ring.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/shared_memory_abi.h"
+
+namespace perfetto {
+
+namespace {
+using Record = SmbCommitRing::Record;
+
+static_assert(sizeof(Record) == 24, "Record size");
+static_assert(sizeof(Record::patch_data) == SharedMemoryABI::kPacketHeaderSize,
+              "Record::patch_data size");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "Incompatible STL <atomic> implementation");
+}  // namespace
+
+// static
+constexpr size_t SmbCommitRing::kHeaderSize;
+
+SmbCommitRing::SmbCommitRing() = default;
+SmbCommitRing::~SmbCommitRing() = default;
+
+void SmbCommitRing::Initialize(uint8_t* start, size_t size) {
+  PERFETTO_CHECK(size >= kHeaderSize + sizeof(Record));
+  PERFETTO_CHECK(reinterpret_cast<uintptr_t>(start) % alignof(Record) == 0);
+  const size_t max_records = (size - kHeaderSize) / sizeof(Record);
+  uint32_t capacity = 1;
+  while (capacity * 2 <= max_records)
+    capacity *= 2;
+  start_ = start;
+  capacity_ = capacity;
+  local_index_ = 0;
+}
+
+void SmbCommitRing::Reset() {
+  start_ = nullptr;
+  capacity_ = 0;
+  local_index_ = 0;
+}
+
+bool SmbCommitRing::Write(const CommitDataRequest& req, bool* was_empty) {
+  PERFETTO_DCHECK(is_valid());
+  size_t num_records = req.chunks_to_move().size();
+  for (const auto& chunk : req.chunks_to_patch()) {
+    num_records += std::max<size_t>(chunk.patches().size(), 1);
+    for (const auto& patch : chunk.patches()) {
+      if (patch.data().size() != sizeof(Record::patch_data))
+        return false;
+    }
+  }
+
+  // The service never moves |read_index| past |write_index|, unless it's
+  // misbehaving. Check anyways, as the ring would be unusable.
+  const uint32_t read_index = read_index_ptr()->load(std::memory_order_acquire);
+  const uint32_t used = local_index_ - read_index;
+  if (used > capacity_ || num_records > capacity_ - used)
+    return false;
+
+  uint32_t index = local_index_;
+  for (const auto& chunk : req.chunks_to_move()) {
+    Record rec{};
+    rec.type = Record::kMoveChunk;
+    rec.target_buffer = chunk.target_buffer();
+    rec.page_or_chunk_id = chunk.page();
+    rec.chunk_idx_or_offset = chunk.chunk();
+    memcpy(record_at(index++), &rec, sizeof(rec));
+  }
+  for (const auto& chunk : req.chunks_to_patch()) {
+    Record rec{};
+    rec.type = Record::kPatch;
+    rec.flags = Record::kFirstPatch;
+    if (chunk.has_more_patches())
+      rec.flags |= Record::kHasMorePatches;
+    rec.writer_id = static_cast<uint16_t>(chunk.writer_id());
+    rec.target_buffer = chunk.target_buffer();
+    rec.page_or_chunk_id = chunk.chunk_id();
+    if (chunk.patches().empty()) {
+      rec.flags |= Record::kNoPatch;
+      memcpy(record_at(index++), &rec, sizeof(rec));
+      continue;
+    }
+    for (const auto& patch : chunk.patches()) {
+      rec.chunk_idx_or_offset = patch.offset();
+      memcpy(rec.patch_data, patch.data().data(), sizeof(rec.patch_data));
+      memcpy(record_at(index++), &rec, sizeof(rec));
+      rec.flags &= static_cast<uint8_t>(~Record::kFirstPatch);
+    }
+  }
+
+  // The store publishes the records (it has release semantics). Together with
+  // the load below, it pairs with the store of |read_index| and the load of
+  // |write_index| in Read(): either the service sees the new records before
+  // going idle, or this sees that the service has consumed all the previous
+  // records and needs to be woken up.
+  const uint32_t prev_index = local_index_;
+  local_index_ = index;
+  write_index_ptr()->store(index, std::memory_order_seq_cst);
+  *was_empty = read_index_ptr()->load(std::memory_order_seq_cst) == prev_index;
+  return true;
+}
+
+bool SmbCommitRing::Read(CommitDataRequest* req,
+                         base::Optional<uint32_t> end_index) {
+  PERFETTO_DCHECK(is_valid());
+  CommitDataRequest::ChunkToPatch* last_chunk_to_patch = nullptr;
+  // Don't let a producer that keeps writing keep the service busy here
+  // forever. Records left behind are read on the next call, at the latest when
+  // the producer sends an IPC because the ring is full.
+  const uint32_t start_index = local_index_;
+  for (;;) {
+    // Pairs with the store of |write_index| in Write().
+    uint32_t write_index = write_index_ptr()->load(std::memory_order_seq_cst);
+    if (write_index - local_index_ > capacity_)
+      return false;
+    if (end_index) {
+      // The records before |end_index| might have been already consumed while
+      // processing a previous request.
+      if (static_cast<int32_t>(*end_index - local_index_) <= 0)
+        return true;
+      if (*end_index - local_index_ > write_index - local_index_)
+        return false;
+      write_index = *end_index;
+    }
+
+    for (; local_index_ != write_index; local_index_++) {
+      // Copy the record, the producer could change it while we're reading.
+      Record rec;
+      memcpy(&rec, record_at(local_index_), sizeof(rec));
+      if (rec.type == Record::kMoveChunk) {
+        auto* chunk = req->add_chunks_to_move();
+        chunk->set_page(rec.page_or_chunk_id);
+        chunk->set_chunk(rec.chunk_idx_or_offset);
+        chunk->set_target_buffer(rec.target_buffer);
+        last_chunk_to_patch = nullptr;
+        continue;
+      }
+      if (rec.type != Record::kPatch)
+        return false;
+      if (rec.flags & Record::kFirstPatch) {
+        last_chunk_to_patch = req->add_chunks_to_patch();
+        last_chunk_to_patch->set_writer_id(rec.writer_id);
+        last_chunk_to_patch->set_chunk_id(rec.page_or_chunk_id);
+        last_chunk_to_patch->set_target_buffer(rec.target_buffer);
+        if (rec.flags & Record::kHasMorePatches)
+          last_chunk_to_patch->set_has_more_patches(true);
+      } else if (!last_chunk_to_patch) {
+        return false;
+      }
+      if (rec.flags & Record::kNoPatch)
+        continue;
+      auto* patch = last_chunk_to_patch->add_patches();
+      patch->set_offset(rec.chunk_idx_or_offset);
+      patch->set_data(rec.patch_data, sizeof(rec.patch_data));
+    }
+
+    // Frees up the space for the producer. See the comment in Write().
+    read_index_ptr()->store(local_index_, std::memory_order_seq_cst);
+    if (end_index || local_index_ - start_index >= 2 * capacity_ ||
+        write_index_ptr()->load(std::memory_order_seq_cst) == local_index_) {
+      return true;
+    }
+  }
+}
+
+}  // namespace perfetto
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_SMB_COMMIT_RING_H_
+#define SRC_TRACING_CORE_SMB_COMMIT_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/tracing/core/commit_data_request.h"
+
+namespace perfetto {
+
+// A single-producer single-consumer ring of commit records, laid out in the
+// last page of the shared memory buffer (SMB). It allows the producer to pass
+// the |chunks_to_move| and |chunks_to_patch| of a CommitDataRequest to the
+// service without a CommitData() IPC for each request.
+//
+// The producer appends the records of a request with Write(), which tells it
+// whether the ring was empty, i.e. whether the service has already consumed
+// all the previous records. Only in that case the producer needs to wake up
+// the service, by sending a CommitData() IPC (possibly with an empty body).
+// The service consumes the records with Read() every time it receives a
+// CommitData() IPC from the producer, which is guaranteed to happen after the
+// records have been written.
+//
+// Layout of the ring:
+//
+// +-------------+-------------+----------+----------+-----+----------+
+// | write_index | read_index  | Record 0 | Record 1 | ... | Record N |
+// +-------------+-------------+----------+----------+-----+----------+
+// 0             64            128
+//
+// The two indexes are free-running counters of records (i.e. they wrap at
+// 2^32, not at the capacity) and live on different cache lines. The producer
+// only writes |write_index| and the service only writes |read_index|.
+//
+// The SMB is shared with an untrusted producer: the service keeps its own copy
+// of |read_index| and validates everything it reads from the ring. If the ring
+// is found to be corrupted, Read() returns false and the service should stop
+// using it.
+//
+// The producer is expected to serialize the calls to Write(): in practice
+// they happen with the SharedMemoryArbiterImpl lock held, on its task runner.
+// Read() must be called only on the service thread.
+class SmbCommitRing {
+ public:
+  static constexpr size_t kHeaderSize = 128;
+
+  // A single record of the ring. A ChunksToMove takes one record, a
+  // ChunkToPatch takes one record per patch (or a single record, if it has no
+  // patches).
+  struct Record {
+    enum Type : uint8_t {
+      kMoveChunk = 1,
+      kPatch = 2,
+    };
+    enum Flags : uint8_t {
+      // Set on the first record of a ChunkToPatch.
+      kFirstPatch = 1 << 0,
+      // ChunkToPatch.has_more_patches.
+      kHasMorePatches = 1 << 1,
+      // The record doesn't carry any patch (the ChunkToPatch has none).
+      kNoPatch = 1 << 2,
+    };
+
+    uint8_t type;
+    uint8_t flags;
+    uint16_t writer_id;  // kPatch only.
+    uint32_t target_buffer;
+
+    // kMoveChunk: the page index. kPatch: the ChunkID.
+    uint32_t page_or_chunk_id;
+
+    // kMoveChunk: the chunk index within the page. kPatch: the patch offset.
+    uint32_t chunk_idx_or_offset;
+
+    uint8_t patch_data[4];  // kPatch only.
+    uint32_t reserved;
+  };
+
+  SmbCommitRing();
+  ~SmbCommitRing();
+
+  // Initializes the ring over the |size| bytes at |start|. |size| must be big
+  // enough to hold at least a record after the header. The capacity of the
+  // ring is the biggest power of two that fits. Doesn't touch the memory:
+  // the memory is expected to be zero-filled when the SMB is created.
+  void Initialize(uint8_t* start, size_t size);
+
+  // Stops using the ring, e.g. after Read() found it corrupted.
+  void Reset();
+
+  bool is_valid() const { return start_ != nullptr; }
+  uint32_t capacity() const { return capacity_; }
+
+  // Producer side.
+
+  // Appends the |chunks_to_move| and |chunks_to_patch| of |req| to the ring,
+  // either all of them or none if there is not enough space, in which case it
+  // returns false. Sets |was_empty| if the service had consumed all the
+  // previous records when the new ones were published. Also returns false if
+  // any patch in |req| isn't SharedMemoryABI::kPacketHeaderSize bytes long.
+  bool Write(const CommitDataRequest& req, bool* was_empty);
+
+  // Returns the index past the last record written by the producer. A
+  // CommitDataRequest sent via IPC with this index in |commit_ring_write_index|
+  // tells the service that these records precede its contents.
+  uint32_t write_index() const { return local_index_; }
+
+  // Service side.
+
+  // Appends the records published by the producer to |req|, stopping at
+  // |end_index| if set. If |end_index| is not set, keeps reading until the
+  // ring is empty. Records are converted back to |chunks_to_move| and
+  // |chunks_to_patch|. Returns false if the ring is corrupted (in which case
+  // |req| may contain a subset of the records).
+  bool Read(CommitDataRequest* req, base::Optional<uint32_t> end_index);
+
+  // Returns true if the producer has published records that haven't been
+  // read yet.
+  bool HasRecordsToRead() const {
+    return write_index_ptr()->load(std::memory_order_acquire) != local_index_;
+  }
+
+ private:
+  SmbCommitRing(const SmbCommitRing&) = delete;
+  SmbCommitRing& operator=(const SmbCommitRing&) = delete;
+
+  std::atomic<uint32_t>* write_index_ptr() const {
+    return reinterpret_cast<std::atomic<uint32_t>*>(start_);
+  }
+  std::atomic<uint32_t>* read_index_ptr() const {
+    return reinterpret_cast<std::atomic<uint32_t>*>(start_ + 64);
+  }
+  Record* record_at(uint32_t index) const {
+    return reinterpret_cast<Record*>(start_ + kHeaderSize) +
+           (index & (capacity_ - 1));
+  }
+
+  uint8_t* start_ = nullptr;
+  uint32_t capacity_ = 0;
+
+  // The producer's |write_index| or the service's (trusted) |read_index|,
+  // depending on the side the ring is used from.
+  uint32_t local_index_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_SMB_COMMIT_RING_H_
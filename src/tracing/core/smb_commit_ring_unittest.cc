@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/smb_commit_ring.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#include "perfetto/ext/base/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kRingSize = 4096;
+
+class SmbCommitRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    buf_.reset(new uint64_t[kRingSize / sizeof(uint64_t)]());
+    producer_ring_.Initialize(buf(), kRingSize);
+    service_ring_.Initialize(buf(), kRingSize);
+  }
+
+  uint8_t* buf() { return reinterpret_cast<uint8_t*>(buf_.get()); }
+
+  std::atomic<uint32_t>* write_index() {
+    return reinterpret_cast<std::atomic<uint32_t>*>(buf());
+  }
+
+  static CommitDataRequest CreateRequest(uint32_t page) {
+    CommitDataRequest req;
+    auto* chunk = req.add_chunks_to_move();
+    chunk->set_page(page);
+    chunk->set_chunk(3);
+    chunk->set_target_buffer(42);
+
+    auto* chunk_to_patch = req.add_chunks_to_patch();
+    chunk_to_patch->set_writer_id(7);
+    chunk_to_patch->set_chunk_id(page);
+    chunk_to_patch->set_target_buffer(42);
+    chunk_to_patch->set_has_more_patches(true);
+    auto* patch = chunk_to_patch->add_patches();
+    patch->set_offset(16);
+    patch->set_data("abcd");
+    patch = chunk_to_patch->add_patches();
+    patch->set_offset(32);
+    patch->set_data("efgh");
+
+    chunk_to_patch = req.add_chunks_to_patch();
+    chunk_to_patch->set_writer_id(8);
+    chunk_to_patch->set_chunk_id(page + 1);
+    chunk_to_patch->set_target_buffer(43);
+    return req;
+  }
+
+  std::unique_ptr<uint64_t[]> buf_;
+  SmbCommitRing producer_ring_;
+  SmbCommitRing service_ring_;
+};
+
+TEST_F(SmbCommitRingTest, Capacity) {
+  // (4096 - 128) / 24 = 165 records fit, rounded down to a power of two.
+  EXPECT_EQ(producer_ring_.capacity(), 128u);
+}
+
+TEST_F(SmbCommitRingTest, WriteAndRead) {
+  bool was_empty = false;
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(1), &was_empty));
+  EXPECT_TRUE(was_empty);
+  // 1 chunk to move + 2 patches + 1 chunk to patch without patches.
+  EXPECT_EQ(producer_ring_.write_index(), 4u);
+
+  CommitDataRequest req;
+  ASSERT_TRUE(service_ring_.Read(&req, base::nullopt));
+  EXPECT_EQ(req, CreateRequest(1));
+
+  // Nothing left to read.
+  CommitDataRequest empty_req;
+  ASSERT_TRUE(service_ring_.Read(&empty_req, base::nullopt));
+  EXPECT_EQ(empty_req, CommitDataRequest());
+}
+
+TEST_F(SmbCommitRingTest, WasEmpty) {
+  bool was_empty = false;
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(1), &was_empty));
+  EXPECT_TRUE(was_empty);
+
+  // The service hasn't read the first request yet: no need to wake it up.
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(2), &was_empty));
+  EXPECT_FALSE(was_empty);
+
+  CommitDataRequest req;
+  ASSERT_TRUE(service_ring_.Read(&req, base::nullopt));
+  EXPECT_EQ(req.chunks_to_move_size(), 2);
+  EXPECT_EQ(req.chunks_to_patch_size(), 4);
+
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(3), &was_empty));
+  EXPECT_TRUE(was_empty);
+}
+
+TEST_F(SmbCommitRingTest, ReadUpToEndIndex) {
+  bool was_empty = false;
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(1), &was_empty));
+  const uint32_t end_index = producer_ring_.write_index();
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(2), &was_empty));
+
+  CommitDataRequest req;
+  ASSERT_TRUE(service_ring_.Read(&req, end_index));
+  EXPECT_EQ(req, CreateRequest(1));
+
+  // Reading again up to the same index is a no-op.
+  CommitDataRequest empty_req;
+  ASSERT_TRUE(service_ring_.Read(&empty_req, end_index));
+  EXPECT_EQ(empty_req, CommitDataRequest());
+
+  CommitDataRequest req2;
+  ASSERT_TRUE(service_ring_.Read(&req2, base::nullopt));
+  EXPECT_EQ(req2, CreateRequest(2));
+}
+
+TEST_F(SmbCommitRingTest, FullRing) {
+  // Each request takes 4 records.
+  const uint32_t num_requests = producer_ring_.capacity() / 4;
+  bool was_empty = false;
+  for (uint32_t i = 0; i < num_requests; i++)
+    ASSERT_TRUE(producer_ring_.Write(CreateRequest(i), &was_empty));
+  ASSERT_FALSE(producer_ring_.Write(CreateRequest(0), &was_empty));
+  EXPECT_EQ(producer_ring_.write_index(), producer_ring_.capacity());
+
+  CommitDataRequest req;
+  ASSERT_TRUE(service_ring_.Read(&req, base::nullopt));
+  EXPECT_EQ(static_cast<uint32_t>(req.chunks_to_move_size()), num_requests);
+
+  // Keep going around the ring.
+  for (uint32_t i = 0; i < 1000; i++) {
+    ASSERT_TRUE(producer_ring_.Write(CreateRequest(i), &was_empty));
+    EXPECT_TRUE(was_empty);
+    CommitDataRequest req2;
+    ASSERT_TRUE(service_ring_.Read(&req2, base::nullopt));
+    EXPECT_EQ(req2, CreateRequest(i));
+  }
+}
+
+TEST_F(SmbCommitRingTest, UnexpectedPatchSize) {
+  CommitDataRequest req;
+  auto* patch = req.add_chunks_to_patch()->add_patches();
+  patch->set_data("abcdef");
+  bool was_empty = false;
+  ASSERT_FALSE(producer_ring_.Write(req, &was_empty));
+  EXPECT_EQ(producer_ring_.write_index(), 0u);
+}
+
+TEST_F(SmbCommitRingTest, CorruptedWriteIndex) {
+  write_index()->store(service_ring_.capacity() + 1);
+  CommitDataRequest req;
+  ASSERT_FALSE(service_ring_.Read(&req, base::nullopt));
+}
+
+TEST_F(SmbCommitRingTest, EndIndexPastWriteIndex) {
+  bool was_empty = false;
+  ASSERT_TRUE(producer_ring_.Write(CreateRequest(1), &was_empty));
+  CommitDataRequest req;
+  ASSERT_FALSE(service_ring_.Read(&req, producer_ring_.write_index() + 1));
+}
+
+TEST_F(SmbCommitRingTest, CorruptedRecords) {
+  // Invalid record type.
+  memset(buf() + SmbCommitRing::kHeaderSize, 0xff,
+         sizeof(SmbCommitRing::Record));
+  write_index()->store(1);
+  CommitDataRequest req;
+  ASSERT_FALSE(service_ring_.Read(&req, base::nullopt));
+
+  // Patch record not preceded by a kFirstPatch one.
+  SetUp();
+  SmbCommitRing::Record rec{};
+  rec.type = SmbCommitRing::Record::kPatch;
+  memcpy(buf() + SmbCommitRing::kHeaderSize, &rec, sizeof(rec));
+  write_index()->store(1);
+  ASSERT_FALSE(service_ring_.Read(&req, base::nullopt));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -16,6 +16,7 @@
 
 #include "src/tracing/core/trace_buffer.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "perfetto/base/logging.h"
@@ -77,12 +78,103 @@ bool TraceBuffer::Initialize(size_t size) {
   stats_.set_buffer_size(size);
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
-  index_.clear();
-  last_chunk_id_written_.clear();
-  read_iter_ = GetReadIterForSequence(index_.end());
+  sequences_.clear();
+  read_iter_ = GetReadIterForSequence(sequences_.size());
   return true;
 }
 
+void TraceBuffer::ClearContentsAndResetRWCursors() {
+  // DeleteNextChunksFor() expects the part of the buffer that was never
+  // written to be zeroed.
+  memset(begin(), 0, used_size_);
+  used_size_ = 0;
+  wptr_ = begin();
+  sequences_.clear();
+  read_iter_ = GetReadIterForSequence(sequences_.size());
+  for (ProducerQuota& quota : producer_quotas_)
+    quota.bytes_in_buffer = 0;
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::Find(ChunkID chunk_id) {
+  // Fast path: lookups (e.g. when patching) are most often for one of the
+  // most recently written chunks.
+  if (PERFETTO_UNLIKELY(chunks.empty()) || chunk_id > chunks.back().chunk_id)
+    return nullptr;
+  auto it = std::lower_bound(chunks.begin(), chunks.end(), chunk_id,
+                             [](const ChunkMeta& meta, ChunkID id) {
+                               return meta.chunk_id < id;
+                             });
+  if (it == chunks.end() || it->chunk_id != chunk_id || it->is_erased())
+    return nullptr;
+  return &*it;
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::Insert(
+    const ChunkMeta& meta) {
+  PERFETTO_DCHECK(!meta.is_erased());
+  if (PERFETTO_LIKELY(chunks.empty() ||
+                      meta.chunk_id > chunks.back().chunk_id)) {
+    chunks.push_back(meta);
+    return &chunks.back();
+  }
+  auto it = std::lower_bound(chunks.begin(), chunks.end(), meta.chunk_id,
+                             [](const ChunkMeta& m, ChunkID id) {
+                               return m.chunk_id < id;
+                             });
+  if (it != chunks.end() && it->chunk_id == meta.chunk_id) {
+    // Reuse the erased entry for the same ChunkID.
+    PERFETTO_DCHECK(it->is_erased());
+    *it = meta;
+    num_erased--;
+    return &*it;
+  }
+  return &*chunks.insert(it, meta);
+}
+
+void TraceBuffer::ChunkSequence::MaybeCompact() {
+  if (num_erased == 0 || num_erased * 2 < chunks.size())
+    return;
+  chunks.erase(std::remove_if(chunks.begin(), chunks.end(),
+                              [](const ChunkMeta& meta) {
+                                return meta.is_erased();
+                              }),
+               chunks.end());
+  num_erased = 0;
+}
+
+TraceBuffer::ChunkSequence* TraceBuffer::FindSequence(ProducerID producer_id,
+                                                      WriterID writer_id) {
+  auto key = std::make_tuple(producer_id, writer_id);
+  auto it = std::lower_bound(sequences_.begin(), sequences_.end(), key,
+                             [](const ChunkSequence& seq,
+                                const std::tuple<ProducerID, WriterID>& k) {
+                               return std::tie(seq.producer_id, seq.writer_id) <
+                                      k;
+                             });
+  if (it == sequences_.end() || it->producer_id != producer_id ||
+      it->writer_id != writer_id) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+TraceBuffer::ChunkSequence* TraceBuffer::GetOrCreateSequence(
+    ProducerID producer_id,
+    WriterID writer_id) {
+  auto key = std::make_tuple(producer_id, writer_id);
+  auto it = std::lower_bound(sequences_.begin(), sequences_.end(), key,
+                             [](const ChunkSequence& seq,
+                                const std::tuple<ProducerID, WriterID>& k) {
+                               return std::tie(seq.producer_id, seq.writer_id) <
+                                      k;
+                             });
+  if (it != sequences_.end() && it->producer_id == producer_id &&
+      it->writer_id == writer_id) {
+    return &*it;
+  }
+  return &*sequences_.emplace(it, producer_id, writer_id);
+}
+
 // Note: |src| points to a shmem region that is shared with the producer. Assume
 // that the producer is malicious and will change the content of |src|
 // while we execute here. Don't do any processing on it other than memcpy().
@@ -139,9 +231,10 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // before receiving commit requests for them from the producer. Note that the
   // service may scrape and thus override chunks in arbitrary order since the
   // chunks aren't ordered in the SMB.
-  const auto it = index_.find(key);
-  if (PERFETTO_UNLIKELY(it != index_.end())) {
-    ChunkMeta* record_meta = &it->second;
+  ChunkSequence* existing_seq = FindSequence(producer_id_trusted, writer_id);
+  ChunkMeta* record_meta =
+      existing_seq ? existing_seq->Find(chunk_id) : nullptr;
+  if (PERFETTO_UNLIKELY(record_meta)) {
     ChunkRecord* prev = record_meta->chunk_record;
 
     // Verify that the old chunk's metadata corresponds to the new one.
@@ -173,13 +266,11 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     // chunk N after having read from chunk N+1, thereby violating sequential
     // read of packets. This shouldn't happen if the producer is well-behaved,
     // because it shouldn't start chunk N+1 before completing chunk N.
-    ChunkMeta::Key subsequent_key = key;
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "ChunkID wraps");
-    subsequent_key.chunk_id++;
-    const auto subsequent_it = index_.find(subsequent_key);
-    if (subsequent_it != index_.end() &&
-        subsequent_it->second.num_fragments_read > 0) {
+    const ChunkMeta* subsequent_meta =
+        existing_seq->Find(static_cast<ChunkID>(chunk_id + 1));
+    if (subsequent_meta && subsequent_meta->num_fragments_read > 0) {
       stats_.set_abi_violations(stats_.abi_violations() + 1);
       PERFETTO_DCHECK(suppress_client_dchecks_for_testing_);
       return;
@@ -215,20 +306,6 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   if (PERFETTO_UNLIKELY(discard_writes_))
     return DiscardWrite();
 
-  // If there isn't enough room from the given write position. Write a padding
-  // record to clear the end of the buffer and wrap back.
-  const size_t cached_size_to_end = size_to_end();
-  if (PERFETTO_UNLIKELY(record_size > cached_size_to_end)) {
-    ssize_t res = DeleteNextChunksFor(cached_size_to_end);
-    if (res == -1)
-      return DiscardWrite();
-    PERFETTO_DCHECK(static_cast<size_t>(res) <= cached_size_to_end);
-    AddPaddingRecord(cached_size_to_end);
-    wptr_ = begin();
-    stats_.set_write_wrap_count(stats_.write_wrap_count() + 1);
-    PERFETTO_DCHECK(size_to_end() >= record_size);
-  }
-
   // At this point either |wptr_| points to an untouched part of the buffer
   // (i.e. *wptr_ == 0) or we are about to overwrite one or more ChunkRecord(s).
   // In the latter case we need to first figure out where the next valid
@@ -249,7 +326,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // +---------------------------------+---------------+--------------------+
 
   // Deletes all chunks from |wptr_| to |wptr_| + |record_size|.
-  ssize_t del_res = DeleteNextChunksFor(record_size);
+  ssize_t del_res = DeleteChunksForRecord(record_size);
   if (del_res == -1)
     return DiscardWrite();
   size_t padding_size = static_cast<size_t>(del_res);
@@ -257,10 +334,18 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
-  auto it_and_inserted = index_.emplace(
-      key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
-                     chunk_flags, producer_uid_trusted, producer_pid_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
+  ChunkSequence* seq = GetOrCreateSequence(producer_id_trusted, writer_id);
+  PERFETTO_DCHECK(!seq->Find(chunk_id));
+  seq->stats.chunks_written++;
+  seq->stats.bytes_written += record_size;
+  if (PERFETTO_UNLIKELY(!producer_quotas_.empty())) {
+    ProducerQuota* quota = FindProducerQuota(producer_id_trusted);
+    if (quota)
+      quota->bytes_in_buffer += record_size;
+  }
+  seq->Insert(ChunkMeta(GetChunkRecordAt(wptr_), chunk_id, num_fragments,
+                        chunk_complete, chunk_flags, producer_uid_trusted,
+                        producer_pid_trusted));
   TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
                     uintptr_t(wptr_ - begin()) + record_size, record_size);
   WriteChunkRecord(wptr_, record, src, size);
@@ -285,8 +370,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
   // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
   // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  ChunkID& last_chunk_id = seq->last_chunk_id_written;
   static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                 "This code assumes that ChunkID wraps at kMaxChunkID");
   if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
@@ -300,7 +384,84 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     AddPaddingRecord(padding_size);
 }
 
-ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
+void TraceBuffer::SetProducerQuota(ProducerID producer_id,
+                                   size_t quota_bytes) {
+  ProducerQuota* quota = FindProducerQuota(producer_id);
+  if (quota_bytes == 0 || overwrite_policy_ == kDiscard) {
+    if (quota)
+      producer_quotas_.erase(producer_quotas_.begin() +
+                             (quota - producer_quotas_.data()));
+    return;
+  }
+  if (!quota) {
+    producer_quotas_.push_back(ProducerQuota{producer_id, 0, 0});
+    quota = &producer_quotas_.back();
+    // The producer might have written already into the buffer.
+    for (const ChunkSequence& seq : sequences_) {
+      if (seq.producer_id != producer_id)
+        continue;
+      for (const ChunkMeta& meta : seq.chunks) {
+        if (!meta.is_erased())
+          quota->bytes_in_buffer += meta.chunk_record->size;
+      }
+    }
+  }
+  quota->quota_bytes = quota_bytes;
+}
+
+ssize_t TraceBuffer::DeleteChunksForRecord(size_t record_size) {
+  // Bytes |wptr_| moved forward to step over protected chunks. Once they
+  // reach the size of the buffer, the protected chunks leave no room for
+  // |record_size| and are overwritten like the others.
+  size_t bytes_skipped = 0;
+  for (;;) {
+    uint8_t* protected_chunk = nullptr;
+    uint8_t** protected_chunk_ptr = nullptr;
+    if (PERFETTO_UNLIKELY(!producer_quotas_.empty()) && bytes_skipped < size_)
+      protected_chunk_ptr = &protected_chunk;
+
+    // If there isn't enough room from the given write position. Write a
+    // padding record to clear the end of the buffer and wrap back.
+    const size_t cached_size_to_end = size_to_end();
+    if (PERFETTO_UNLIKELY(record_size > cached_size_to_end)) {
+      ssize_t res =
+          DeleteNextChunksFor(cached_size_to_end, protected_chunk_ptr);
+      if (res == -1)
+        return -1;
+      if (protected_chunk) {
+        bytes_skipped += SkipProtectedChunk(protected_chunk);
+        continue;
+      }
+      PERFETTO_DCHECK(static_cast<size_t>(res) <= cached_size_to_end);
+      AddPaddingRecord(cached_size_to_end);
+      wptr_ = begin();
+      stats_.set_write_wrap_count(stats_.write_wrap_count() + 1);
+      PERFETTO_DCHECK(size_to_end() >= record_size);
+    }
+    ssize_t res = DeleteNextChunksFor(record_size, protected_chunk_ptr);
+    if (!protected_chunk)
+      return res;
+    bytes_skipped += SkipProtectedChunk(protected_chunk);
+  }
+}
+
+size_t TraceBuffer::SkipProtectedChunk(uint8_t* chunk_ptr) {
+  // The chunks between |wptr_| and |chunk_ptr| have been deleted already.
+  const size_t padding_size = static_cast<size_t>(chunk_ptr - wptr_);
+  if (padding_size)
+    AddPaddingRecord(padding_size);
+  const size_t chunk_size = GetChunkRecordAt(chunk_ptr)->size;
+  TRACE_BUFFER_DLOG("  skipping protected chunk @ %lu", chunk_ptr - begin());
+  wptr_ = chunk_ptr + chunk_size;
+  if (wptr_ >= end()) {
+    wptr_ = begin();
+    stats_.set_write_wrap_count(stats_.write_wrap_count() + 1);
+  }
+  return padding_size + chunk_size;
+}
+
+ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear,
+                                         uint8_t** protected_chunk) {
   PERFETTO_CHECK(!discard_writes_);
 
   // Find the position of the first chunk which begins at or after
@@ -311,7 +472,7 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   TRACE_BUFFER_DLOG("Delete [%zu %zu]", wptr_ - begin(), search_end - begin());
   DcheckIsAlignedAndWithinBounds(wptr_);
   PERFETTO_DCHECK(search_end <= end());
-  std::vector<ChunkMap::iterator> index_delete;
+  std::vector<ChunkSequence*> seqs_to_compact;
   uint64_t chunks_overwritten = stats_.chunks_overwritten();
   uint64_t bytes_overwritten = stats_.bytes_overwritten();
   uint64_t padding_bytes_cleared = stats_.padding_bytes_cleared();
@@ -337,17 +498,44 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     // records are not part of the index).
     if (PERFETTO_LIKELY(!next_chunk.is_padding)) {
       ChunkMeta::Key key(next_chunk);
-      auto it = index_.find(key);
+      ChunkSequence* seq = FindSequence(key.producer_id, key.writer_id);
+      ChunkMeta* meta = seq ? seq->Find(key.chunk_id) : nullptr;
       bool will_remove = false;
-      if (PERFETTO_LIKELY(it != index_.end())) {
-        const ChunkMeta& meta = it->second;
-        if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
+      if (PERFETTO_LIKELY(meta)) {
+        ProducerQuota* quota = PERFETTO_LIKELY(producer_quotas_.empty())
+                                   ? nullptr
+                                   : FindProducerQuota(key.producer_id);
+        if (PERFETTO_UNLIKELY(meta->num_fragments_read <
+                              meta->num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
+          if (PERFETTO_UNLIKELY(quota)) {
+            // Over the quota, drop the oldest chunks of the sequence first.
+            // The chunk is overwritten only if that isn't enough, or if the
+            // caller doesn't allow skipping it. In that case all the older
+            // chunks are dropped, otherwise a gap would be left in the
+            // sequence and reading would stop there.
+            DropOldestChunks(seq, meta->chunk_id,
+                             protected_chunk ? quota->quota_bytes : 0,
+                             &quota->bytes_in_buffer, &chunks_overwritten,
+                             &bytes_overwritten);
+            if (protected_chunk &&
+                quota->bytes_in_buffer <= quota->quota_bytes) {
+              *protected_chunk = next_chunk_ptr;
+              break;
+            }
+          }
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
+          seq->stats.chunks_overwritten++;
+          seq->stats.bytes_overwritten += next_chunk.size;
         }
-        index_delete.push_back(it);
+        if (PERFETTO_UNLIKELY(quota))
+          quota->bytes_in_buffer -= next_chunk.size;
+        // Erasing doesn't invalidate the other ChunkMeta pointers, compaction
+        // does: it must happen only after the loop.
+        seq->Erase(meta);
+        seqs_to_compact.push_back(seq);
         will_remove = true;
       }
       TRACE_BUFFER_DLOG(
@@ -369,18 +557,68 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     PERFETTO_CHECK(next_chunk_ptr <= end());
   }
 
-  // Remove from the index.
-  for (auto it : index_delete) {
-    index_.erase(it);
-  }
+  for (ChunkSequence* seq : seqs_to_compact)
+    seq->MaybeCompact();
   stats_.set_chunks_overwritten(chunks_overwritten);
   stats_.set_bytes_overwritten(bytes_overwritten);
   stats_.set_padding_bytes_cleared(padding_bytes_cleared);
 
+  if (protected_chunk && *protected_chunk)
+    return 0;
   PERFETTO_DCHECK(next_chunk_ptr >= search_end && next_chunk_ptr <= end());
   return static_cast<ssize_t>(next_chunk_ptr - search_end);
 }
 
+void TraceBuffer::DropOldestChunks(ChunkSequence* seq,
+                                   ChunkID chunk_id,
+                                   size_t max_bytes,
+                                   size_t* bytes_in_buffer,
+                                   uint64_t* chunks_overwritten,
+                                   uint64_t* bytes_overwritten) {
+  // The age of a chunk, in the order of SequenceIterator.
+  auto age = [seq](ChunkID id) {
+    return static_cast<ChunkID>(seq->last_chunk_id_written - id);
+  };
+  const ChunkID max_age = age(chunk_id);
+
+  // As in GetReadIterForSequence(), the oldest chunk is the first one after
+  // |last_chunk_id_written|. From there, |chunks| is sorted from the oldest
+  // to the most recent chunk, wrapping at the end.
+  std::vector<ChunkMeta>& chunks = seq->chunks;
+  size_t cur = static_cast<size_t>(
+      std::upper_bound(chunks.begin(), chunks.end(),
+                       seq->last_chunk_id_written,
+                       [](ChunkID id, const ChunkMeta& meta) {
+                         return id < meta.chunk_id;
+                       }) -
+      chunks.begin());
+  for (size_t visited = 0;
+       *bytes_in_buffer > max_bytes && visited < chunks.size();
+       visited++, cur++) {
+    if (cur == chunks.size())
+      cur = 0;
+    ChunkMeta& meta = chunks[cur];
+    if (meta.is_erased())
+      continue;
+    if (age(meta.chunk_id) <= max_age)
+      break;
+
+    // Turn the chunk into padding, DeleteNextChunksFor() will skip it.
+    ChunkRecord* record = meta.chunk_record;
+    TRACE_BUFFER_DLOG("  dropping chunk %u @ %lu", meta.chunk_id,
+                      reinterpret_cast<uint8_t*>(record) - begin());
+    record->is_padding = 1;
+    *bytes_in_buffer -= record->size;
+    if (meta.num_fragments_read < meta.num_fragments) {
+      (*chunks_overwritten)++;
+      *bytes_overwritten += record->size;
+      seq->stats.chunks_overwritten++;
+      seq->stats.bytes_overwritten += record->size;
+    }
+    seq->Erase(&meta);
+  }
+}
+
 void TraceBuffer::AddPaddingRecord(size_t size) {
   PERFETTO_DCHECK(size >= sizeof(ChunkRecord) && size <= ChunkRecord::kMaxSize);
   ChunkRecord record(size);
@@ -399,12 +637,13 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         size_t patches_size,
                                         bool other_patches_pending) {
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
-  auto it = index_.find(key);
-  if (it == index_.end()) {
+  ChunkSequence* seq = FindSequence(producer_id, writer_id);
+  ChunkMeta* meta = seq ? seq->Find(chunk_id) : nullptr;
+  if (!meta) {
     stats_.set_patches_failed(stats_.patches_failed() + 1);
     return false;
   }
-  ChunkMeta& chunk_meta = it->second;
+  ChunkMeta& chunk_meta = *meta;
 
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
@@ -442,6 +681,7 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
       base::HexDump(chunk_begin, chunk_meta.chunk_record->size).c_str());
 
   stats_.set_patches_succeeded(stats_.patches_succeeded() + patches_size);
+  seq->stats.patches_succeeded += patches_size;
   if (!other_patches_pending) {
     chunk_meta.flags &= ~kChunkNeedsPatching;
     chunk_meta.chunk_record->flags = chunk_meta.flags;
@@ -449,79 +689,108 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
   return true;
 }
 
+std::vector<TraceBuffer::WriterStats> TraceBuffer::GetWriterStats() const {
+  std::vector<WriterStats> res;
+  res.reserve(sequences_.size());
+  for (const ChunkSequence& seq : sequences_)
+    res.push_back(seq.stats);
+  return res;
+}
+
+std::unique_ptr<TraceBuffer> TraceBuffer::CloneReadOnly() const {
+  std::unique_ptr<TraceBuffer> buf(new TraceBuffer(overwrite_policy_));
+  if (!buf->Initialize(size_))
+    return nullptr;
+
+  // The ChunkRecord(s) are self-describing: a plain copy of the written part
+  // of the buffer is enough, only the pointers into |data_| need rebasing.
+  buf->data_.EnsureCommitted(used_size_);
+  memcpy(buf->begin(), begin(), used_size_);
+  buf->used_size_ = used_size_;
+  buf->wptr_ = buf->begin() + (wptr_ - begin());
+  buf->sequences_ = sequences_;
+  for (ChunkSequence& seq : buf->sequences_) {
+    for (ChunkMeta& meta : seq.chunks) {
+      if (meta.is_erased())
+        continue;
+      meta.chunk_record = reinterpret_cast<ChunkRecord*>(
+          buf->begin() + (reinterpret_cast<uint8_t*>(meta.chunk_record) -
+                          begin()));
+    }
+  }
+  buf->read_iter_ = buf->GetReadIterForSequence(buf->sequences_.size());
+  buf->discard_writes_ = discard_writes_;
+  buf->stats_ = stats_;
+  buf->suppress_client_dchecks_for_testing_ =
+      suppress_client_dchecks_for_testing_;
+  return buf;
+}
+
 void TraceBuffer::BeginRead() {
-  read_iter_ = GetReadIterForSequence(index_.begin());
+  read_iter_ = GetReadIterForSequence(0);
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
 #endif
 }
 
 TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
-    ChunkMap::iterator seq_begin) {
+    size_t seq_idx) {
   SequenceIterator iter;
-  iter.seq_begin = seq_begin;
-  if (seq_begin == index_.end()) {
-    iter.cur = iter.seq_end = index_.end();
+  iter.seq_idx = seq_idx;
+  if (seq_idx >= sequences_.size())
     return iter;
-  }
 
-#if PERFETTO_DCHECK_IS_ON()
-  // Either |seq_begin| is == index_.begin() or the item immediately before must
-  // belong to a different {ProducerID, WriterID} sequence.
-  if (seq_begin != index_.begin() && seq_begin != index_.end()) {
-    auto prev_it = seq_begin;
-    prev_it--;
-    PERFETTO_DCHECK(
-        seq_begin == index_.begin() ||
-        std::tie(prev_it->first.producer_id, prev_it->first.writer_id) <
-            std::tie(seq_begin->first.producer_id, seq_begin->first.writer_id));
+  ChunkSequence* seq = &sequences_[seq_idx];
+  const std::vector<ChunkMeta>& chunks = seq->chunks;
+  iter.seq = seq;
+  iter.wrapping_id = seq->last_chunk_id_written;
+
+  // Find the first chunk that is > |last_chunk_id_written|. This is where the
+  // sequence will start (see notes about wrapping of IDs in the header). If
+  // there is none, start from the first chunk.
+  auto it = std::upper_bound(chunks.begin(), chunks.end(), iter.wrapping_id,
+                             [](ChunkID id, const ChunkMeta& meta) {
+                               return id < meta.chunk_id;
+                             });
+  iter.cur = static_cast<size_t>(it - chunks.begin());
+  while (iter.cur < chunks.size() && chunks[iter.cur].is_erased())
+    iter.cur++;
+  if (iter.cur == chunks.size()) {
+    iter.cur = 0;
+    while (iter.cur < chunks.size() && chunks[iter.cur].is_erased())
+      iter.cur++;
   }
-#endif
-
-  // Find the first entry that has a greater {ProducerID, WriterID} (or just
-  // index_.end() if we reached the end).
-  ChunkMeta::Key key = seq_begin->first;  // Deliberate copy.
-  key.chunk_id = kMaxChunkID;
-  iter.seq_end = index_.upper_bound(key);
-  PERFETTO_DCHECK(iter.seq_begin != iter.seq_end);
-
-  // Now find the first entry between [seq_begin, seq_end) that is
-  // > last_chunk_id_written_. This is where we the sequence will start (see
-  // notes about wrapping of IDs in the header).
-  auto producer_and_writer_id = std::make_pair(key.producer_id, key.writer_id);
-  PERFETTO_DCHECK(last_chunk_id_written_.count(producer_and_writer_id));
-  iter.wrapping_id = last_chunk_id_written_[producer_and_writer_id];
-  key.chunk_id = iter.wrapping_id;
-  iter.cur = index_.upper_bound(key);
-  if (iter.cur == iter.seq_end)
-    iter.cur = iter.seq_begin;
   return iter;
 }
 
 void TraceBuffer::SequenceIterator::MoveNext() {
   // Stop iterating when we reach the end of the sequence.
-  // Note: |seq_begin| might be == |seq_end|.
-  if (cur == seq_end || cur->first.chunk_id == wrapping_id) {
-    cur = seq_end;
+  if (!is_valid() || seq->chunks[cur].chunk_id == wrapping_id) {
+    MoveToEnd();
     return;
   }
 
   // If the current chunk wasn't completed yet, we shouldn't advance past it as
   // it may be rewritten with additional packets.
-  if (!cur->second.is_complete()) {
-    cur = seq_end;
+  if (!seq->chunks[cur].is_complete()) {
+    MoveToEnd();
     return;
   }
 
-  ChunkID last_chunk_id = cur->first.chunk_id;
-  if (++cur == seq_end)
-    cur = seq_begin;
+  // Move to the next non-erased chunk, wrapping at the end of the sequence.
+  // This terminates as the current chunk is not erased.
+  const size_t size = seq->chunks.size();
+  ChunkID last_chunk_id = seq->chunks[cur].chunk_id;
+  do {
+    if (++cur == size)
+      cur = 0;
+  } while (seq->chunks[cur].is_erased());
 
   // There may be a missing chunk in the sequence of chunks, in which case the
   // next chunk's ID won't follow the last one's. If so, skip the rest of the
   // sequence. We'll return to it later once the hole is filled.
-  if (last_chunk_id + 1 != cur->first.chunk_id)
-    cur = seq_end;
+  if (last_chunk_id + 1 != seq->chunks[cur].chunk_id)
+    MoveToEnd();
 }
 
 bool TraceBuffer::ReadNextTracePacket(
@@ -551,16 +820,15 @@ bool TraceBuffer::ReadNextTracePacket(
   for (;; read_iter_.MoveNext()) {
     if (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
       // We ran out of chunks in the current {ProducerID, WriterID} sequence or
-      // we just reached the index_.end().
-
-      if (PERFETTO_UNLIKELY(read_iter_.seq_end == index_.end()))
-        return false;
-
-      // We reached the end of sequence, move to the next one.
-      // Note: ++read_iter_.seq_end might become index_.end(), but
-      // GetReadIterForSequence() knows how to deal with that.
-      read_iter_ = GetReadIterForSequence(read_iter_.seq_end);
-      PERFETTO_DCHECK(read_iter_.is_valid() && read_iter_.cur != index_.end());
+      // we just reached the end of the index.
+
+      // We reached the end of sequence, move to the next one. Sequences whose
+      // chunks have all been overwritten have no chunks to iterate over.
+      do {
+        if (PERFETTO_UNLIKELY(read_iter_.seq_idx + 1 >= sequences_.size()))
+          return false;
+        read_iter_ = GetReadIterForSequence(read_iter_.seq_idx + 1);
+      } while (!read_iter_.is_valid());
       previous_packet_dropped = true;
     }
 
@@ -689,8 +957,8 @@ bool TraceBuffer::ReadNextTracePacket(
 
         // TODO(primiano): optimization: this MoveToEnd() is the reason why
         // MoveNext() (that is called in the outer for(;;MoveNext)) needs to
-        // deal gracefully with the case of |cur|==|seq_end|. Maybe we can do
-        // something to avoid that check by reshuffling the code here?
+        // deal gracefully with the case of an iterator at the end. Maybe we can
+        // do something to avoid that check by reshuffling the code here?
         read_iter_.MoveToEnd();
 
         // This break will go back to beginning of the for(;;MoveNext()). That
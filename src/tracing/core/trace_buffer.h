@@ -20,10 +20,12 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <array>
 #include <limits>
-#include <map>
+#include <memory>
 #include <tuple>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -70,6 +72,14 @@ class TracePacket;
 //     to recover would be too hard (also due to the fact that, at the same
 //     time, we allow out-of-order commits and chunk re-writes).
 //
+// In kOverwrite mode, producers can be given a quota with SetProducerQuota().
+// Unread chunks of a producer that doesn't exceed its quota are not overwritten
+// when the write pointer reaches them: they stay in place and the write pointer
+// steps over them. Over the quota, the oldest chunks of the producer's
+// sequences are dropped first. This keeps the most recent data of
+// low-rate producers around, even if chattier producers write into the same
+// buffer.
+//
 // Chunks are (over)written in the same order of the CopyChunkUntrusted() calls.
 // When overwriting old content, entire chunks are overwritten or clobbered.
 // The buffer never leaves a partial chunk around. Chunks' payload is copied
@@ -110,8 +120,10 @@ class TracePacket;
 // quite useful in future to recover the buffer from crash reports).
 //
 // However, in order to keep some operations (patching and reading) fast, a
-// lookaside index is maintained (in |index_|), keeping each chunk in the buffer
-// indexed by their {ProducerID, WriterID, ChunkID} tuple.
+// lookaside index is maintained (in |sequences_|), keeping each chunk in the
+// buffer indexed by their {ProducerID, WriterID, ChunkID} tuple. The index is
+// two-level: a sorted vector of {ProducerID, WriterID} sequences, each holding
+// a sorted vector of the chunks of that sequence (see ChunkSequence).
 //
 // Patching data out-of-band
 // -------------------------
@@ -162,6 +174,17 @@ class TraceBuffer {
     WriterID writer_id;
   };
 
+  // Per-sequence subset of the BufferStats, see GetWriterStats().
+  struct WriterStats {
+    ProducerID producer_id = 0;
+    WriterID writer_id = 0;
+    uint64_t bytes_written = 0;
+    uint64_t chunks_written = 0;
+    uint64_t bytes_overwritten = 0;
+    uint64_t chunks_overwritten = 0;
+    uint64_t patches_succeeded = 0;
+  };
+
   // Can return nullptr if the memory allocation fails.
   static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
                                              OverwritePolicy = kOverwrite);
@@ -199,6 +222,13 @@ class TraceBuffer {
                           bool chunk_complete,
                           const uint8_t* src,
                           size_t size);
+  // Reserves |quota_bytes| of the buffer to the most recent chunks of
+  // |producer_id|, see the comment in the header above. Has no effect if the
+  // OverwritePolicy is kDiscard. A |quota_bytes| of 0 removes the quota. The
+  // sum of the quotas should not exceed half of the buffer size, otherwise
+  // the chunks of the other producers might be overwritten too quickly.
+  void SetProducerQuota(ProducerID producer_id, size_t quota_bytes);
+
   // Applies a batch of |patches| to the given chunk, if the given chunk is
   // still in the buffer. Does nothing if the given ChunkID is gone.
   // Returns true if the chunk has been found and patched, false otherwise.
@@ -264,6 +294,19 @@ class TraceBuffer {
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
 
+  // Returns the stats of each {ProducerID, WriterID} sequence that ever wrote
+  // into the buffer, sorted by {ProducerID, WriterID}. The stats of a sequence
+  // outlive its chunks, so that they add up to the BufferStats.
+  std::vector<WriterStats> GetWriterStats() const;
+
+  // Returns a copy of the buffer, with its contents, index and stats, or
+  // nullptr if the memory allocation fails. The unread data of this buffer
+  // can then be read from the copy as well, while this buffer keeps being
+  // written. Only the part of the buffer that has ever been written is
+  // copied. Producer quotas are not copied: the copy is meant to be read
+  // only, it's up to the caller to not let producers write into it.
+  std::unique_ptr<TraceBuffer> CloneReadOnly() const;
+
  private:
   friend class TraceBufferTest;
 
@@ -335,7 +378,7 @@ class TraceBuffer {
   // This struct should not have any field that is essential for reconstructing
   // the contents of the buffer from a crash dump.
   struct ChunkMeta {
-    // Key used for sorting in the map.
+    // Identifies a chunk in the index.
     struct Key {
       Key(ProducerID p, WriterID w, ChunkID c)
           : producer_id{p}, writer_id{w}, chunk_id{c} {}
@@ -380,6 +423,7 @@ class TraceBuffer {
     };
 
     ChunkMeta(ChunkRecord* r,
+              ChunkID c,
               uint16_t p,
               bool complete,
               uint8_t f,
@@ -388,6 +432,7 @@ class TraceBuffer {
         : chunk_record{r},
           trusted_uid{u},
           trusted_pid(pid),
+          chunk_id{c},
           flags{f},
           num_fragments{p} {
       if (complete)
@@ -416,9 +461,17 @@ class TraceBuffer {
       }
     }
 
-    ChunkRecord* const chunk_record;  // Addr of ChunkRecord within |data_|.
-    const uid_t trusted_uid;          // uid of the producer.
-    const pid_t trusted_pid;          // pid of the producer.
+    // Set to nullptr when the chunk is removed from the index. See
+    // ChunkSequence.
+    bool is_erased() const { return chunk_record == nullptr; }
+
+    ChunkRecord* chunk_record;  // Addr of ChunkRecord within |data_|.
+    uid_t trusted_uid;          // uid of the producer.
+    pid_t trusted_pid;          // pid of the producer.
+
+    // Corresponds to |chunk_record->chunk_id|. The chunks of a ChunkSequence
+    // are sorted by this.
+    ChunkID chunk_id = 0;
 
     // Flags set by TraceBuffer to track the state of the chunk in the index.
     uint8_t index_flags = 0;
@@ -439,62 +492,123 @@ class TraceBuffer {
     uint16_t cur_fragment_offset = 0;
   };
 
-  using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
+  // The index entries of all the chunks of a {ProducerID, WriterID} sequence,
+  // sorted by ChunkID (not taking into account wrapping, see
+  // SequenceIterator). This keeps lookups a binary search over contiguous
+  // memory and the common case of appending a chunk with a greater ChunkID
+  // a push_back().
+  // Removing a chunk just marks its entry as erased (ChunkMeta::is_erased()):
+  // the vector is compacted once erased entries make up half of it. As chunks
+  // are overwritten in roughly the same order in which they were written,
+  // this keeps removals amortized O(1) rather than O(N) memmoves.
+  struct ChunkSequence {
+    ChunkSequence(ProducerID p, WriterID w) : producer_id(p), writer_id(w) {
+      stats.producer_id = p;
+      stats.writer_id = w;
+    }
+
+    // Returns the entry for |chunk_id| or nullptr if not in the index.
+    ChunkMeta* Find(ChunkID chunk_id);
+
+    // Adds |meta| to the index. There must be no entry with the same ChunkID.
+    // Invalidates all the ChunkMeta pointers of this sequence.
+    ChunkMeta* Insert(const ChunkMeta& meta);
+
+    // Marks |meta| as erased. Does not invalidate ChunkMeta pointers.
+    void Erase(ChunkMeta* meta) {
+      PERFETTO_DCHECK(!meta->is_erased());
+      meta->chunk_record = nullptr;
+      num_erased++;
+    }
+
+    // Removes the erased entries if they make up at least half of |chunks|.
+    // Invalidates all the ChunkMeta pointers of this sequence.
+    void MaybeCompact();
+
+    ProducerID producer_id;
+    WriterID writer_id;
+
+    // Keeps track of the highest ChunkID written for this sequence, taking
+    // into account a potential overflow of ChunkIDs. In the case of overflow,
+    // stores the highest ChunkID written since the overflow.
+    ChunkID last_chunk_id_written = 0;
+
+    std::vector<ChunkMeta> chunks;
 
-  // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
-  // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
-  // of ChunkID. Instances are valid only as long as the |index_| is not altered
-  // (can be used safely only between adjacent ReadNextTracePacket() calls).
+    // Number of entries in |chunks| for which is_erased() is true.
+    size_t num_erased = 0;
+
+    // Updated together with the corresponding fields of |stats_|.
+    WriterStats stats;
+  };
+
+  // Allows to iterate over the chunks of a ChunkSequence, skipping erased
+  // ones. Takes into account the wrapping of ChunkID. Instances are valid only
+  // as long as the index is not altered (can be used safely only between
+  // adjacent ReadNextTracePacket() calls).
   // The order of the iteration will proceed in the following order:
-  // |wrapping_id| + 1 -> |seq_end|, |seq_begin| -> |wrapping_id|.
+  // |wrapping_id| + 1 -> last chunk, first chunk -> |wrapping_id|.
   // Practical example:
   // - Assume that kMaxChunkID == 7
   // - Assume that we have all 8 chunks in the range (0..7).
-  // - Hence, |seq_begin| == c0, |seq_end| == c7
   // - Assume |wrapping_id| = 4 (c4 is the last chunk copied over
   //   through a CopyChunkUntrusted()).
   // The resulting iteration order will be: c5, c6, c7, c0, c1, c2, c3, c4.
   struct SequenceIterator {
-    // Points to the 1st key (the one with the numerically min ChunkID).
-    ChunkMap::iterator seq_begin;
+    // Index of |seq| in |sequences_|.
+    size_t seq_idx = 0;
 
-    // Points one past the last key (the one with the numerically max ChunkID).
-    ChunkMap::iterator seq_end;
+    // The sequence being iterated. nullptr if |seq_idx| is past the end of
+    // |sequences_|.
+    ChunkSequence* seq = nullptr;
 
-    // Current iterator, always >= seq_begin && <= seq_end.
-    ChunkMap::iterator cur;
+    // Index of the current chunk in |seq->chunks|. Never points to an erased
+    // entry. == seq->chunks.size() once the iteration is over.
+    size_t cur = 0;
 
     // The latest ChunkID written. Determines the start/end of the sequence.
-    ChunkID wrapping_id;
+    ChunkID wrapping_id = 0;
 
-    bool is_valid() const { return cur != seq_end; }
+    bool is_valid() const { return seq && cur != seq->chunks.size(); }
 
     ProducerID producer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.producer_id;
+      return seq->producer_id;
     }
 
     WriterID writer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.writer_id;
+      return seq->writer_id;
     }
 
     ChunkID chunk_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.chunk_id;
+      return seq->chunks[cur].chunk_id;
     }
 
     ChunkMeta& operator*() {
       PERFETTO_DCHECK(is_valid());
-      return cur->second;
+      return seq->chunks[cur];
     }
 
-    // Moves |cur| to the next chunk in the index.
+    // Moves |cur| to the next chunk in the sequence.
     // is_valid() will become false after calling this, if this was the last
     // entry of the sequence.
     void MoveNext();
 
-    void MoveToEnd() { cur = seq_end; }
+    void MoveToEnd() {
+      if (seq)
+        cur = seq->chunks.size();
+    }
+  };
+
+  // See SetProducerQuota().
+  struct ProducerQuota {
+    ProducerID producer_id;
+    size_t quota_bytes;
+
+    // Size of the chunks of the producer in the index.
+    size_t bytes_in_buffer;
   };
 
   enum class ReadAheadResult {
@@ -515,14 +629,29 @@ class TraceBuffer {
 
   bool Initialize(size_t size);
 
-  // Returns an object that allows to iterate over chunks in the |index_| that
-  // have the same {ProducerID, WriterID} of
-  // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
-  // the first entry in the |index_| that has a different {ProducerID, WriterID}
-  // from the previous one. It is valid for |seq_begin| to be == index_.end()
-  // (i.e. if the index is empty). The iteration takes care of ChunkID wrapping,
-  // by using |last_chunk_id_|.
-  SequenceIterator GetReadIterForSequence(ChunkMap::iterator seq_begin);
+  // Returns an object that allows to iterate over the chunks of the
+  // |seq_idx|-th sequence in |sequences_|. It is valid for |seq_idx| to be
+  // == sequences_.size(), in which case the returned iterator is invalid.
+  // The iteration takes care of ChunkID wrapping, by using
+  // |last_chunk_id_written|.
+  SequenceIterator GetReadIterForSequence(size_t seq_idx);
+
+  // Returns the sequence for {ProducerID, WriterID} or nullptr if no chunk
+  // has ever been written for it.
+  ChunkSequence* FindSequence(ProducerID, WriterID);
+
+  // Like FindSequence() but adds the sequence if missing. Invalidates all the
+  // ChunkSequence and ChunkMeta pointers in the index.
+  ChunkSequence* GetOrCreateSequence(ProducerID, WriterID);
+
+  // Returns the quota of |producer_id| or nullptr if it doesn't have one.
+  ProducerQuota* FindProducerQuota(ProducerID producer_id) {
+    for (ProducerQuota& quota : producer_quotas_) {
+      if (quota.producer_id == producer_id)
+        return &quota;
+    }
+    return nullptr;
+  }
 
   // Used as a last resort when a buffer corruption is detected.
   void ClearContentsAndResetRWCursors();
@@ -539,8 +668,23 @@ class TraceBuffer {
   // packets.
   ReadAheadResult ReadAhead(TracePacket*);
 
+  // Makes room for a record of |record_size| bytes at |wptr_|, first wrapping
+  // |wptr_| if the record doesn't fit before the end of the buffer. Moves
+  // |wptr_| past the chunks protected by a quota (see DeleteNextChunksFor()).
+  // Returns the same as DeleteNextChunksFor(|record_size|).
+  ssize_t DeleteChunksForRecord(size_t record_size);
+
+  // Pads the (already deleted) range from |wptr_| to |chunk_ptr| and moves
+  // |wptr_| past the chunk at |chunk_ptr|, wrapping it at the end of the
+  // buffer. Returns the number of bytes |wptr_| was moved forward by.
+  size_t SkipProtectedChunk(uint8_t* chunk_ptr);
+
   // Deletes (by marking the record invalid and removing form the index) all
   // chunks from |wptr_| to |wptr_| + |bytes_to_clear|.
+  // If |protected_chunk| is not null, the deletion stops at the first unread
+  // chunk of a producer within its quota, which is left untouched and whose
+  // position is stored in |protected_chunk|. The chunks before it are deleted
+  // and the return value is 0.
   // Returns:
   //   * The size of the gap left between the next valid Chunk and the end of
   //     the deletion range.
@@ -557,7 +701,19 @@ class TraceBuffer {
   //
   // A call to DeleteNextChunksFor(32) will remove chunks 2,3,4 and return 18
   // (60 - 42), the distance between chunk 5 and the end of the deletion range.
-  ssize_t DeleteNextChunksFor(size_t bytes_to_clear);
+  ssize_t DeleteNextChunksFor(size_t bytes_to_clear,
+                              uint8_t** protected_chunk = nullptr);
+
+  // Drops the oldest chunks of |seq| (see SequenceIterator) that are older
+  // than |chunk_id|, until |bytes_in_buffer| (of ProducerQuota) is at most
+  // |max_bytes|. The dropped chunks become padding records. Updates the stats
+  // passed by DeleteNextChunksFor().
+  void DropOldestChunks(ChunkSequence* seq,
+                        ChunkID chunk_id,
+                        size_t max_bytes,
+                        size_t* bytes_in_buffer,
+                        uint64_t* chunks_overwritten,
+                        uint64_t* bytes_overwritten);
 
   // Decodes the boundaries of the next packet (or a fragment) pointed by
   // ChunkMeta and pushes that into |TracePacket|. It also increments the
@@ -602,7 +758,9 @@ class TraceBuffer {
     DcheckIsAlignedAndWithinBounds(wptr);
 
     // We may be writing to this area for the first time.
-    data_.EnsureCommitted(static_cast<size_t>(wptr + record.size - begin()));
+    const size_t record_end = static_cast<size_t>(wptr + record.size - begin());
+    data_.EnsureCommitted(record_end);
+    used_size_ = std::max(used_size_, record_end);
 
     // Deliberately not a *D*CHECK.
     PERFETTO_CHECK(wptr + sizeof(record) + size <= end());
@@ -635,12 +793,20 @@ class TraceBuffer {
   size_t max_chunk_size_ = 0;  // Max size in bytes allowed for a chunk.
   uint8_t* wptr_ = nullptr;    // Write pointer.
 
+  // Size of the initial part of |data_| that has ever been written.
+  size_t used_size_ = 0;
+
   // An index that keeps track of the positions and metadata of each
-  // ChunkRecord.
-  ChunkMap index_;
+  // ChunkRecord. Sorted by {ProducerID, WriterID}. Sequences are never removed
+  // (although realistically that is not a problem unless we have too many
+  // producers/writers within the same trace session).
+  std::vector<ChunkSequence> sequences_;
+
+  // See SetProducerQuota(). Usually contains few entries, if any.
+  std::vector<ProducerQuota> producer_quotas_;
 
   // Read iterator used for ReadNext(). It is reset by calling BeginRead().
-  // It becomes invalid after any call to methods that alters the |index_|.
+  // It becomes invalid after any call to methods that alters the index.
   SequenceIterator read_iter_;
 
   // See comments at the top of the file.
@@ -650,15 +816,6 @@ class TraceBuffer {
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
-  // Keeps track of the highest ChunkID written for a given sequence, taking
-  // into account a potential overflow of ChunkIDs. In the case of overflow,
-  // stores the highest ChunkID written since the overflow.
-  //
-  // TODO(primiano): should clean up keys from this map. Right now it grows
-  // without bounds (although realistically is not a problem unless we have too
-  // many producers/writers within the same trace session).
-  std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
-
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
 
@@ -0,0 +1,181 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace {
+
+using perfetto::ChunkID;
+using perfetto::ProducerID;
+using perfetto::TraceBuffer;
+using perfetto::TracePacket;
+using perfetto::WriterID;
+
+// Chunks as big as the typical SMB page, each containing 4 packets.
+constexpr size_t kChunkSize = 4096;
+constexpr size_t kPayloadSize = kChunkSize - 16;  // - sizeof(ChunkRecord).
+constexpr uint16_t kPacketsPerChunk = 4;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+size_t GetBufferSize() {
+  return IsBenchmarkFunctionalOnly() ? 1024 * 1024 : 64 * 1024 * 1024;
+}
+
+void ProducerCountArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(4);
+  } else {
+    b->RangeMultiplier(8);
+    b->Range(1, 4096);
+  }
+}
+
+std::vector<uint8_t> CreateChunkPayload() {
+  std::vector<uint8_t> payload(kPayloadSize);
+  const size_t packet_size = kPayloadSize / kPacketsPerChunk;
+  // All the packets are < 16KB so their size fits in a 2-byte varint.
+  const size_t packet_payload_size = packet_size - 2;
+  for (size_t i = 0; i < kPacketsPerChunk; i++) {
+    uint8_t* ptr = payload.data() + i * packet_size;
+    ptr = protozero::proto_utils::WriteVarInt(packet_payload_size, ptr);
+    memset(ptr, 'a' + static_cast<int>(i), packet_payload_size);
+  }
+  return payload;
+}
+
+// Copies |num_chunks| chunks into |buf|, interleaving |num_producers|
+// sequences. |next_chunk_ids| keeps the ChunkID of the next chunk of each
+// sequence.
+void CopyChunks(TraceBuffer* buf,
+                const std::vector<uint8_t>& payload,
+                size_t num_chunks,
+                std::vector<ChunkID>* next_chunk_ids) {
+  const size_t num_producers = next_chunk_ids->size();
+  for (size_t i = 0; i < num_chunks; i++) {
+    size_t producer = i % num_producers;
+    ChunkID chunk_id = (*next_chunk_ids)[producer]++;
+    buf->CopyChunkUntrusted(static_cast<ProducerID>(producer + 1),
+                            /*producer_uid_trusted=*/0,
+                            /*producer_pid_trusted=*/0,
+                            /*writer_id=*/1, chunk_id, kPacketsPerChunk,
+                            /*chunk_flags=*/0, /*chunk_complete=*/true,
+                            payload.data(), payload.size());
+  }
+}
+
+}  // namespace
+
+// Measures the throughput of copying chunks into a full buffer, which, after
+// the first pass, requires overwriting the oldest chunks for every commit.
+static void BM_TraceBuffer_Commit(benchmark::State& state) {
+  const size_t num_producers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(GetBufferSize());
+  std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_ids(num_producers);
+
+  // Start with a full buffer.
+  CopyChunks(buf.get(), payload, GetBufferSize() / kChunkSize,
+             &next_chunk_ids);
+
+  constexpr size_t kChunksPerIteration = 1024;
+  for (auto _ : state) {
+    CopyChunks(buf.get(), payload, kChunksPerIteration, &next_chunk_ids);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kChunksPerIteration);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          kChunksPerIteration * kChunkSize);
+  state.counters["chunks_overwritten"] =
+      static_cast<double>(buf->stats().chunks_overwritten());
+}
+
+// Measures the throughput of reading back all the packets of a full buffer.
+static void BM_TraceBuffer_Read(benchmark::State& state) {
+  const size_t num_producers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(GetBufferSize());
+  std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_ids(num_producers);
+  const size_t chunks_per_buffer = GetBufferSize() / kChunkSize;
+
+  uint64_t packets_read = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CopyChunks(buf.get(), payload, chunks_per_buffer, &next_chunk_ids);
+    state.ResumeTiming();
+
+    buf->BeginRead();
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties;
+    bool previous_packet_dropped;
+    while (buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                    &previous_packet_dropped)) {
+      packets_read++;
+      packet = TracePacket();
+    }
+  }
+  PERFETTO_CHECK(packets_read == static_cast<uint64_t>(state.iterations()) *
+                                     chunks_per_buffer * kPacketsPerChunk);
+  state.SetItemsProcessed(static_cast<int64_t>(packets_read));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(chunks_per_buffer * kChunkSize));
+}
+
+// Measures the cost of looking up chunks in the index, by patching chunks
+// spread across the whole buffer. Patches are otherwise cheap (4 bytes).
+static void BM_TraceBuffer_Patch(benchmark::State& state) {
+  const size_t num_producers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(GetBufferSize());
+  std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_ids(num_producers);
+  const size_t chunks_per_buffer = GetBufferSize() / kChunkSize;
+  CopyChunks(buf.get(), payload, chunks_per_buffer, &next_chunk_ids);
+
+  // Every producer has at least one chunk in the buffer as long as
+  // |chunks_per_buffer| >= |num_producers|.
+  const size_t chunks_per_producer =
+      std::max<size_t>(chunks_per_buffer / num_producers, 1);
+  TraceBuffer::Patch patch{};
+  patch.offset_untrusted = 0;
+  size_t i = 0;
+  bool res = true;
+  for (auto _ : state) {
+    size_t producer = i % num_producers;
+    ChunkID chunk_id = next_chunk_ids[producer] - 1 -
+                       static_cast<ChunkID>((i / num_producers * 7) %
+                                            chunks_per_producer);
+    res &= buf->TryPatchChunkContents(static_cast<ProducerID>(producer + 1),
+                                      /*writer_id=*/1, chunk_id, &patch, 1,
+                                      /*other_patches_pending=*/false);
+    i++;
+  }
+  PERFETTO_CHECK(res || num_producers > chunks_per_buffer);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+BENCHMARK(BM_TraceBuffer_Commit)->Apply(ProducerCountArgs);
+BENCHMARK(BM_TraceBuffer_Patch)->Apply(ProducerCountArgs);
+BENCHMARK(BM_TraceBuffer_Read)->Apply(ProducerCountArgs);
@@ -119,9 +119,12 @@ class TraceBufferTest : public testing::Test {
   }
 
   SequenceIterator GetReadIterForSequence(ProducerID p, WriterID w) {
-    TraceBuffer::ChunkMeta::Key key(p, w, 0);
-    return trace_buffer_->GetReadIterForSequence(
-        trace_buffer_->index_.lower_bound(key));
+    TraceBuffer::ChunkSequence* seq = trace_buffer_->FindSequence(p, w);
+    if (!seq)
+      return SequenceIterator();
+    size_t seq_idx =
+        static_cast<size_t>(seq - trace_buffer_->sequences_.data());
+    return trace_buffer_->GetReadIterForSequence(seq_idx);
   }
 
   void SuppressClientDchecksForTesting() {
@@ -130,12 +133,36 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<ChunkMetaKey> GetIndex() {
     std::vector<ChunkMetaKey> keys;
-    keys.reserve(trace_buffer_->index_.size());
-    for (const auto& it : trace_buffer_->index_)
-      keys.push_back(it.first);
+    for (const auto& seq : trace_buffer_->sequences_) {
+      for (const auto& meta : seq.chunks) {
+        if (!meta.is_erased())
+          keys.emplace_back(seq.producer_id, seq.writer_id, meta.chunk_id);
+      }
+    }
     return keys;
   }
 
+  // Returns the address of the ChunkRecord of the given chunk in the buffer.
+  const void* GetChunkAddress(ProducerID p, WriterID w, ChunkID c) {
+    TraceBuffer::ChunkSequence* seq = trace_buffer_->FindSequence(p, w);
+    TraceBuffer::ChunkMeta* meta = seq ? seq->Find(c) : nullptr;
+    return meta ? meta->chunk_record : nullptr;
+  }
+
+  size_t GetQuotaBytesInBuffer(ProducerID p) {
+    TraceBuffer::ProducerQuota* quota = trace_buffer_->FindProducerQuota(p);
+    return quota ? quota->bytes_in_buffer : 0;
+  }
+
+  void ClearContentsAndResetRWCursors() {
+    trace_buffer_->ClearContentsAndResetRWCursors();
+  }
+
+  // Makes the test read and write |*buf| instead of the current buffer.
+  void SwapBuffer(std::unique_ptr<TraceBuffer>* buf) {
+    trace_buffer_.swap(*buf);
+  }
+
   TraceBuffer* trace_buffer() { return trace_buffer_.get(); }
   size_t size_to_end() { return trace_buffer_->size_to_end(); }
 
@@ -869,6 +896,60 @@ TEST_F(TraceBufferTest, Patching_Simple) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+TEST_F(TraceBufferTest, WriterStats) {
+  ResetBuffer(4096);
+  // Don't read the buffer, so that the chunks of w1 are overwritten.
+  for (ChunkID chunk_id = 0; chunk_id < 3; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(1024 - 16, 'a')
+        .CopyIntoTraceBuffer();
+  }
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(9, 'b')
+      .ClearBytes(5, 4)
+      .CopyIntoTraceBuffer();
+  ASSERT_TRUE(TryPatchChunkContents(ProducerID(2), WriterID(1), ChunkID(0),
+                                    {{5, {{'Y', 'M', 'C', 'A'}}}}));
+  for (ChunkID chunk_id = 0; chunk_id < 2; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(2), chunk_id)
+        .AddPacket(1024 - 16, 'c')
+        .CopyIntoTraceBuffer();
+  }
+
+  std::vector<TraceBuffer::WriterStats> stats =
+      trace_buffer()->GetWriterStats();
+  ASSERT_EQ(3u, stats.size());
+
+  EXPECT_EQ(1u, stats[0].producer_id);
+  EXPECT_EQ(1u, stats[0].writer_id);
+  EXPECT_EQ(3u, stats[0].chunks_written);
+  EXPECT_EQ(3072u, stats[0].bytes_written);
+  EXPECT_EQ(2u, stats[0].chunks_overwritten);
+  EXPECT_EQ(2048u, stats[0].bytes_overwritten);
+  EXPECT_EQ(0u, stats[0].patches_succeeded);
+
+  EXPECT_EQ(1u, stats[1].producer_id);
+  EXPECT_EQ(2u, stats[1].writer_id);
+  EXPECT_EQ(2u, stats[1].chunks_written);
+  EXPECT_EQ(2048u, stats[1].bytes_written);
+  EXPECT_EQ(0u, stats[1].chunks_overwritten);
+
+  EXPECT_EQ(2u, stats[2].producer_id);
+  EXPECT_EQ(1u, stats[2].writer_id);
+  EXPECT_EQ(1u, stats[2].chunks_written);
+  EXPECT_EQ(1u, stats[2].patches_succeeded);
+
+  // The writer stats add up to the buffer stats.
+  uint64_t bytes_written = 0;
+  uint64_t bytes_overwritten = 0;
+  for (const TraceBuffer::WriterStats& writer : stats) {
+    bytes_written += writer.bytes_written;
+    bytes_overwritten += writer.bytes_overwritten;
+  }
+  EXPECT_EQ(trace_buffer()->stats().bytes_written(), bytes_written);
+  EXPECT_EQ(trace_buffer()->stats().bytes_overwritten(), bytes_overwritten);
+}
+
 TEST_F(TraceBufferTest, Patching_SkipIfChunkDoesntExist) {
   ResetBuffer(4096);
   CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
@@ -1371,6 +1452,55 @@ TEST_F(TraceBufferTest, Iterator_ManyStreamsWrapping) {
   ASSERT_TRUE(IteratorSeqEq(ProducerID(3), WriterID(1), {Neg(-1), 0, 1}));
 }
 
+// Overwritten chunks are first only marked as erased in the index and then
+// compacted away: check that both iteration and reads skip them.
+TEST_F(TraceBufferTest, Iterator_SkipsOverwrittenChunks) {
+  ResetBuffer(4096);
+  for (char i = 0; i < 8; i++) {
+    ASSERT_EQ(512u, CreateChunk(ProducerID(1), WriterID(1), ChunkID(i))
+                        .AddPacket(512 - 16, 'a' + i)
+                        .CopyIntoTraceBuffer());
+  }
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(1), WriterID(1), {0, 1, 2, 3, 4, 5, 6,
+                                                         7}));
+
+  // Overwrite c0 and c1 with chunks of another sequence.
+  for (char i = 0; i < 2; i++) {
+    ASSERT_EQ(512u, CreateChunk(ProducerID(2), WriterID(1), ChunkID(i))
+                        .AddPacket(512 - 16, 'A' + i)
+                        .CopyIntoTraceBuffer());
+  }
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(1), WriterID(1), {2, 3, 4, 5, 6, 7}));
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(2), WriterID(1), {0, 1}));
+
+  // Overwrite c2..c7: all the chunks of the first sequence are gone.
+  for (char i = 8; i < 14; i++) {
+    ASSERT_EQ(512u, CreateChunk(ProducerID(2), WriterID(1), ChunkID(i - 6))
+                        .AddPacket(512 - 16, 'A' + i - 6)
+                        .CopyIntoTraceBuffer());
+  }
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(1), WriterID(1), {}));
+  ASSERT_TRUE(
+      IteratorSeqEq(ProducerID(2), WriterID(1), {0, 1, 2, 3, 4, 5, 6, 7}));
+  ASSERT_EQ(8u, GetIndex().size());
+
+  trace_buffer()->BeginRead();
+  for (char i = 0; i < 8; i++) {
+    ASSERT_THAT(ReadPacket(),
+                ElementsAre(FakePacketFragment(512 - 16, 'A' + i)));
+  }
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // The first sequence can be written to again.
+  ASSERT_EQ(512u, CreateChunk(ProducerID(1), WriterID(1), ChunkID(8))
+                      .AddPacket(512 - 16, 'x')
+                      .CopyIntoTraceBuffer());
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(1), WriterID(1), {8}));
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'x')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
 // -------------------
 // Re-writing same chunk id
 // -------------------
@@ -1739,6 +1869,327 @@ TEST_F(TraceBufferTest, DiscardPolicy) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+TEST_F(TraceBufferTest, ProducerQuota_PreservesChunks) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 1024);
+
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(256 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(1))
+      .AddPacket(256 - 16, 'b', kChunkNeedsPatching)
+      .CopyIntoTraceBuffer();
+  const void* chunk_0 = GetChunkAddress(ProducerID(2), WriterID(1), ChunkID(0));
+  const void* chunk_1 = GetChunkAddress(ProducerID(2), WriterID(1), ChunkID(1));
+
+  // Wrap over the buffer a few times: the write pointer steps over the chunks
+  // of producer 2 every time, they are never moved.
+  for (ChunkID chunk_id = 0; chunk_id < 24; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('c' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_EQ(chunk_0, GetChunkAddress(ProducerID(2), WriterID(1), ChunkID(0)));
+  ASSERT_EQ(chunk_1, GetChunkAddress(ProducerID(2), WriterID(1), ChunkID(1)));
+
+  // The protected chunks can still be patched.
+  ASSERT_TRUE(TryPatchChunkContents(ProducerID(2), WriterID(1), ChunkID(1),
+                                    {{2, {{'P', 'A', 'T', 'C'}}}}));
+
+  trace_buffer()->BeginRead();
+  std::vector<FakePacketFragment> producer_1_packets;
+  std::vector<FakePacketFragment> producer_2_packets;
+  for (;;) {
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    auto packet = ReadPacket(&sequence_properties);
+    if (packet.empty())
+      break;
+    ASSERT_EQ(1u, packet.size());
+    if (sequence_properties.producer_id_trusted == 2) {
+      producer_2_packets.push_back(packet[0]);
+    } else {
+      producer_1_packets.push_back(packet[0]);
+    }
+  }
+  std::string patched_payload = FakePacketFragment(256 - 16, 'b').payload();
+  patched_payload.replace(0, 4, "PATC");
+  ASSERT_THAT(producer_2_packets,
+              ElementsAre(FakePacketFragment(256 - 16, 'a'),
+                          FakePacketFragment(patched_payload.data(),
+                                             patched_payload.size())));
+  // 4096 - 512 bytes are left to producer 1, the last 7 chunks fit.
+  ASSERT_EQ(7u, producer_1_packets.size());
+  ASSERT_EQ(FakePacketFragment(512 - 16, 'c' + 23), producer_1_packets.back());
+
+  std::vector<TraceBuffer::WriterStats> stats =
+      trace_buffer()->GetWriterStats();
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ(17u, stats[0].chunks_overwritten);
+  EXPECT_EQ(2u, stats[1].producer_id);
+  EXPECT_EQ(2u, stats[1].chunks_written);
+  EXPECT_EQ(0u, stats[1].chunks_overwritten);
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_OverQuota) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 512);
+  for (ChunkID chunk_id = 0; chunk_id < 4; chunk_id++) {
+    CreateChunk(ProducerID(2), WriterID(1), chunk_id)
+        .AddPacket(256 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  for (ChunkID chunk_id = 0; chunk_id < 16; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, 'x')
+        .CopyIntoTraceBuffer();
+  }
+
+  // Only the most recent 512 bytes of producer 2 are preserved.
+  trace_buffer()->BeginRead();
+  std::vector<FakePacketFragment> producer_2_packets;
+  for (;;) {
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    auto packet = ReadPacket(&sequence_properties);
+    if (packet.empty())
+      break;
+    if (sequence_properties.producer_id_trusted == 2)
+      producer_2_packets.push_back(packet[0]);
+  }
+  ASSERT_THAT(producer_2_packets,
+              ElementsAre(FakePacketFragment(256 - 16, 'c'),
+                          FakePacketFragment(256 - 16, 'd')));
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_ReadChunksAreOverwritten) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 1024);
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(256 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(256 - 16, 'a')));
+
+  for (ChunkID chunk_id = 0; chunk_id < 16; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, 'x')
+        .CopyIntoTraceBuffer();
+  }
+
+  // Removing the quota lets the other chunks be overwritten as well.
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(1))
+      .AddPacket(256 - 16, 'b')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->SetProducerQuota(ProducerID(2), 0);
+  for (ChunkID chunk_id = 16; chunk_id < 32; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, 'x')
+        .CopyIntoTraceBuffer();
+  }
+
+  std::vector<TraceBuffer::WriterStats> stats =
+      trace_buffer()->GetWriterStats();
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ(2u, stats[1].producer_id);
+  EXPECT_EQ(1u, stats[1].chunks_overwritten);
+  trace_buffer()->BeginRead();
+  for (;;) {
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    if (ReadPacket(&sequence_properties).empty())
+      break;
+    EXPECT_EQ(1u, sequence_properties.producer_id_trusted);
+  }
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_MultipleProducers) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(1), 1024);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 1024);
+
+  ChunkID next_chunk_id[4] = {};
+  for (uint32_t i = 0; i < 64; i++) {
+    for (ProducerID producer_id = 1; producer_id <= 3; producer_id++) {
+      // Producer 3 has no quota and writes most of the data.
+      if (producer_id != 3 && i % 4)
+        continue;
+      size_t size = 64 + (i * 37 + producer_id * 101) % 400;
+      CreateChunk(producer_id, WriterID(1), next_chunk_id[producer_id]++)
+          .AddPacket(size, static_cast<char>('a' + producer_id))
+          .CopyIntoTraceBuffer();
+    }
+  }
+
+  // No gaps are left in the sequences.
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(1), WriterID(1), {13, 14, 15}));
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(2), WriterID(1), {13, 14, 15}));
+  trace_buffer()->BeginRead();
+  size_t bytes_read[4] = {};
+  for (;;) {
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    auto packet = ReadPacket(&sequence_properties);
+    if (packet.empty())
+      break;
+    ASSERT_EQ(1u, packet.size());
+    bytes_read[sequence_properties.producer_id_trusted] +=
+        packet[0].payload().size();
+  }
+  // Each producer with a quota keeps at most its quota (and at least the
+  // quota minus a chunk) of its most recent data.
+  for (ProducerID producer_id = 1; producer_id <= 2; producer_id++) {
+    EXPECT_GT(bytes_read[producer_id], 1024u - 512u);
+    EXPECT_LE(bytes_read[producer_id], 1024u);
+  }
+  EXPECT_GT(bytes_read[3], 1024u);
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_QuotasExceedBufferSize) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(1), 4096);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 4096);
+
+  // The quotas leave no room for the new chunks: the write pointer stops
+  // skipping protected chunks after a lap of the buffer and overwrites them.
+  // Writes still go through and the buffer stays consistent.
+  for (ChunkID chunk_id = 0; chunk_id < 64; chunk_id++) {
+    for (ProducerID producer_id = 1; producer_id <= 2; producer_id++) {
+      size_t size = 64 + (chunk_id * 37 + producer_id * 101) % 900;
+      CreateChunk(producer_id, WriterID(1), chunk_id)
+          .AddPacket(size, static_cast<char>('a' + producer_id))
+          .CopyIntoTraceBuffer();
+    }
+  }
+  EXPECT_GT(trace_buffer()->stats().chunks_overwritten(), 0u);
+
+  trace_buffer()->BeginRead();
+  for (;;) {
+    auto packet = ReadPacket();
+    if (packet.empty())
+      break;
+    ASSERT_EQ(1u, packet.size());
+  }
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_ResetByClearContents) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 1024);
+  for (ChunkID chunk_id = 0; chunk_id < 2; chunk_id++) {
+    CreateChunk(ProducerID(2), WriterID(1), chunk_id)
+        .AddPacket(256 - 16, 'a')
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_EQ(512u, GetQuotaBytesInBuffer(ProducerID(2)));
+
+  ClearContentsAndResetRWCursors();
+  ASSERT_EQ(0u, GetQuotaBytesInBuffer(ProducerID(2)));
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // The quota still applies to the chunks written after the reset.
+  for (ChunkID chunk_id = 2; chunk_id < 6; chunk_id++) {
+    CreateChunk(ProducerID(2), WriterID(1), chunk_id)
+        .AddPacket(256 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_EQ(1024u, GetQuotaBytesInBuffer(ProducerID(2)));
+  for (ChunkID chunk_id = 0; chunk_id < 16; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, 'x')
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_TRUE(IteratorSeqEq(ProducerID(2), WriterID(1), {2, 3, 4, 5}));
+  ASSERT_EQ(1024u, GetQuotaBytesInBuffer(ProducerID(2)));
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_IgnoredWithDiscardPolicy) {
+  ResetBuffer(4096, TraceBuffer::kDiscard);
+  trace_buffer()->SetProducerQuota(ProducerID(2), 1024);
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(256 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  for (ChunkID chunk_id = 0; chunk_id < 8; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, 'x')
+        .CopyIntoTraceBuffer();
+  }
+  EXPECT_EQ(0u, trace_buffer()->stats().chunks_overwritten());
+  EXPECT_EQ(1u, trace_buffer()->stats().chunks_discarded());
+}
+
+// --------------------------
+// Cloning the buffer
+// --------------------------
+
+TEST_F(TraceBufferTest, Clone_ReadsOnlyUnreadData) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(10, 'b')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'c')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'a')));
+
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  EXPECT_EQ(clone->size(), trace_buffer()->size());
+  EXPECT_EQ(clone->stats(), trace_buffer()->stats());
+  ASSERT_EQ(clone->GetWriterStats().size(), 2u);
+  EXPECT_EQ(clone->GetWriterStats()[1].bytes_written,
+            trace_buffer()->GetWriterStats()[1].bytes_written);
+
+  // Writes into the original buffer don't show up in the clone.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(10, 'd')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'd')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  SwapBuffer(&clone);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_AfterWrapping) {
+  ResetBuffer(4096);
+  // Each chunk takes 512 bytes: only the last 8 chunks are kept.
+  for (ChunkID chunk_id = 0; chunk_id < 12; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  EXPECT_EQ(4u, clone->stats().chunks_overwritten());
+
+  for (ChunkID chunk_id = 12; chunk_id < 16; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  trace_buffer()->BeginRead();
+  for (ChunkID chunk_id = 8; chunk_id < 16; chunk_id++) {
+    const char seed = static_cast<char>('a' + chunk_id);
+    ASSERT_THAT(ReadPacket(),
+                ElementsAre(FakePacketFragment(512 - 16, seed)));
+  }
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  SwapBuffer(&clone);
+  trace_buffer()->BeginRead();
+  for (ChunkID chunk_id = 4; chunk_id < 12; chunk_id++) {
+    const char seed = static_cast<char>('a' + chunk_id);
+    ASSERT_THAT(ReadPacket(),
+                ElementsAre(FakePacketFragment(512 - 16, seed)));
+  }
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
 TEST_F(TraceBufferTest, MissingPacketsOnSequence) {
   ResetBuffer(4096);
   SuppressClientDchecksForTesting();
@@ -60,6 +60,7 @@
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/uuid.h"
 #include "perfetto/ext/base/version.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/consumer.h"
@@ -319,6 +320,7 @@ constexpr size_t TracingServiceImpl::kDefaultShmPageSize;
 constexpr size_t TracingServiceImpl::kMaxShmSize;
 constexpr uint32_t TracingServiceImpl::kDataSourceStopTimeoutMs;
 constexpr uint8_t TracingServiceImpl::kSyncMarker[];
+constexpr size_t TracingServiceImpl::kMaxWriterStats;
 
 std::string GetBugreportPath() {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) && \
@@ -365,7 +367,8 @@ TracingServiceImpl::ConnectProducer(Producer* producer,
                                     ProducerSMBScrapingMode smb_scraping_mode,
                                     size_t shared_memory_page_size_hint_bytes,
                                     std::unique_ptr<SharedMemory> shm,
-                                    const std::string& sdk_version) {
+                                    const std::string& sdk_version,
+                                    bool smb_commit_ring_supported) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
 
   if (lockdown_mode_ && uid != base::GetCurrentUserId()) {
@@ -395,7 +398,7 @@ TracingServiceImpl::ConnectProducer(Producer* producer,
 
   std::unique_ptr<ProducerEndpointImpl> endpoint(new ProducerEndpointImpl(
       id, uid, pid, this, task_runner_, producer, producer_name, sdk_version,
-      in_process, smb_scraping_enabled));
+      in_process, smb_scraping_enabled, smb_commit_ring_supported));
   auto it_and_inserted = producers_.emplace(id, endpoint.get());
   PERFETTO_DCHECK(it_and_inserted.second);
   endpoint->shmem_size_hint_bytes_ = shared_memory_size_hint_bytes;
@@ -679,6 +682,17 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
     return PERFETTO_SVC_ERR("Too many buffers configured (%d)",
                             cfg.buffers_size());
   }
+  for (const auto& buf : cfg.buffers()) {
+    uint64_t quota_size_sum = 0;
+    for (const auto& quota : buf.producer_quotas())
+      quota_size_sum += quota.size_kb();
+    if (quota_size_sum * 2 > buf.size_kb()) {
+      return PERFETTO_SVC_ERR(
+          "buffers.producer_quotas exceed half of the buffer size (%" PRIu64
+          " kB > %" PRIu32 " kB / 2)",
+          quota_size_sum, buf.size_kb());
+    }
+  }
   // Check that the config specifies all buffers for its data sources. This
   // is also checked in SetupDataSource, but it is simpler to return a proper
   // error to the consumer from here (and there will be less state to undo).
@@ -1443,6 +1457,8 @@ void TracingServiceImpl::ActivateTriggers(
     for (auto& id_and_tracing_session : tracing_sessions_) {
       auto& tracing_session = id_and_tracing_session.second;
       TracingSessionID tsid = id_and_tracing_session.first;
+      if (tracing_session.is_clone)
+        continue;
       auto iter = std::find_if(
           tracing_session.config.trigger_config().triggers().begin(),
           tracing_session.config.trigger_config().triggers().end(),
@@ -2078,14 +2094,66 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
   // ReadBuffersIntoConsumer, but that's not currently possible.
   // ReadBuffersIntoFile has to read the whole available data before returning,
   // to support the disable_immediately=true code paths.
+  //
+  // When compressing, batch N is compressed on the session's
+  // |compressor_task_runner| while batch N+1 is read. This is safe because
+  // reading doesn't modify the payload of the chunks that the packets of batch
+  // N point into, and nothing can write into the buffers until this function
+  // returns. The last batch is compressed on this thread, as there is nothing
+  // left to overlap it with.
+  CompressorFn compressor_fn =
+      tracing_session->config.compression_type() ==
+              TraceConfig::COMPRESSION_TYPE_UNSPECIFIED
+          ? nullptr
+          : compressor_fn_;
+  const TraceConfig& config = tracing_session->config;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // Set while |packets_being_compressed| is handed to the compressor thread.
+  std::unique_ptr<base::WaitableEvent> compression_done;
+  std::vector<TracePacket> packets_being_compressed;
+#endif
   bool has_more = true;
   bool stop_writing_into_file = false;
   do {
     std::vector<TracePacket> packets =
         ReadBuffers(tracing_session, kWriteIntoFileChunkSize, &has_more);
 
+    if (compressor_fn) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+      if (compression_done) {
+        compression_done->Wait();
+        compression_done.reset();
+        stop_writing_into_file =
+            WriteIntoFile(tracing_session, std::move(packets_being_compressed));
+        if (stop_writing_into_file)
+          break;
+      }
+      if (has_more) {
+        if (!tracing_session->compressor_task_runner) {
+          tracing_session->compressor_task_runner.reset(
+              new base::ThreadTaskRunner(
+                  base::ThreadTaskRunner::CreateAndStart("TracedCompress")));
+        }
+        packets_being_compressed = std::move(packets);
+        compression_done.reset(new base::WaitableEvent());
+        base::WaitableEvent* done = compression_done.get();
+        std::vector<TracePacket>* batch = &packets_being_compressed;
+        tracing_session->compressor_task_runner->PostTask(
+            [compressor_fn, batch, &config, done] {
+              compressor_fn(batch, config);
+              done->Notify();
+            });
+        continue;
+      }
+#endif
+      compressor_fn(&packets, config);
+    }
+
     stop_writing_into_file = WriteIntoFile(tracing_session, std::move(packets));
   } while (has_more && !stop_writing_into_file);
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  PERFETTO_DCHECK(!compression_done);
+#endif
 
   if (stop_writing_into_file || tracing_session->write_period_ms == 0) {
     // Ensure all data was written to the file before we close it.
@@ -2328,43 +2396,82 @@ bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
                                 ? tracing_session->max_file_size_bytes
                                 : std::numeric_limits<size_t>::max();
 
+  // When writing into a file, the file should look like a root trace.proto
+  // message. Each packet should be prepended with a proto preamble stating
+  // its field id (within trace.proto) and size.
+  //
+  // Passing each preamble and slice as its own iovec would need one writev()
+  // every IOV_MAX / 2 packets, which is a lot of syscalls when packets are
+  // small. Instead, the preambles and the slices smaller than
+  // kWriteIntoFileMaxCopySize are copied into |staging_buf|, where consecutive
+  // copies coalesce into a single iovec. Only the bigger slices are written
+  // directly from the buffers. A 1MB batch is written with a couple of
+  // writev() calls at most.
   size_t total_slices = 0;
+  size_t staging_buf_size = 0;
   for (const TracePacket& packet : packets) {
     total_slices += packet.slices().size();
+    staging_buf_size += TracePacket::kMaxPreambleBytes;
+    for (const Slice& slice : packet.slices()) {
+      if (slice.size < kWriteIntoFileMaxCopySize)
+        staging_buf_size += slice.size;
+    }
   }
-  // When writing into a file, the file should look like a root trace.proto
-  // message. Each packet should be prepended with a proto preamble stating
-  // its field id (within trace.proto) and size. Hence the addition below.
+  // Each preamble and each slice adds at most one iovec.
   const size_t max_iovecs = total_slices + packets.size();
 
   size_t num_iovecs = 0;
   bool stop_writing_into_file = false;
   std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
-  size_t num_iovecs_at_last_packet = 0;
-  uint64_t bytes_about_to_be_written = 0;
-  for (TracePacket& packet : packets) {
-    std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
-        packet.GetProtoPreamble();
-    bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
-    num_iovecs++;
-    for (const Slice& slice : packet.slices()) {
-      // writev() doesn't change the passed pointer. However, struct iovec
-      // take a non-const ptr because it's the same struct used by readv().
-      // Hence the const_cast here.
-      char* start = static_cast<char*>(const_cast<void*>(slice.start));
-      bytes_about_to_be_written += slice.size;
-      iovecs[num_iovecs++] = {start, slice.size};
+  std::unique_ptr<char[]> staging_buf(new char[staging_buf_size]);
+  size_t staging_buf_used = 0;
+
+  // Appends [start, start + size) to the iovecs, extending the last iovec if
+  // the two ranges are contiguous.
+  auto append_iovec = [&iovecs, &num_iovecs](char* start, size_t size) {
+    if (num_iovecs > 0) {
+      struct iovec& last = iovecs[num_iovecs - 1];
+      if (static_cast<char*>(last.iov_base) + last.iov_len == start) {
+        last.iov_len += size;
+        return;
+      }
     }
+    iovecs[num_iovecs++] = {start, size};
+  };
+  auto append_copy = [&](const void* data, size_t size) {
+    char* dst = &staging_buf[staging_buf_used];
+    memcpy(dst, data, size);
+    staging_buf_used += size;
+    append_iovec(dst, size);
+  };
 
-    if (tracing_session->bytes_written_into_file + bytes_about_to_be_written >=
+  uint64_t bytes_about_to_be_written = 0;
+  for (TracePacket& packet : packets) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    if (tracing_session->bytes_written_into_file + bytes_about_to_be_written +
+            preamble_size + packet.size() >=
         max_size) {
       stop_writing_into_file = true;
-      num_iovecs = num_iovecs_at_last_packet;
       break;
     }
+    bytes_about_to_be_written += preamble_size + packet.size();
 
-    num_iovecs_at_last_packet = num_iovecs;
+    append_copy(preamble, preamble_size);
+    for (const Slice& slice : packet.slices()) {
+      if (slice.size < kWriteIntoFileMaxCopySize) {
+        append_copy(slice.start, slice.size);
+        continue;
+      }
+      // writev() doesn't change the passed pointer. However, struct iovec
+      // take a non-const ptr because it's the same struct used by readv().
+      // Hence the const_cast here.
+      append_iovec(static_cast<char*>(const_cast<void*>(slice.start)),
+                   slice.size);
+    }
   }
+  PERFETTO_DCHECK(staging_buf_used <= staging_buf_size);
   PERFETTO_DCHECK(num_iovecs <= max_iovecs);
   int fd = *tracing_session->write_into_file;
 
@@ -2693,6 +2800,16 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
   PERFETTO_DCHECK(global_id);
   ds_config.set_target_buffer(global_id);
 
+  const TraceConfig::BufferConfig& buffer_cfg =
+      tracing_session->config.buffers()[relative_buffer_id];
+  for (const auto& quota : buffer_cfg.producer_quotas()) {
+    if (quota.producer_name() != producer->name_)
+      continue;
+    TraceBuffer* buf = GetBufferByID(global_id);
+    if (buf)
+      buf->SetProducerQuota(producer->id_, quota.size_kb() * 1024u);
+  }
+
   PERFETTO_DLOG("Setting up data source %s with target buffer %" PRIu16,
                 ds_config.name().c_str(), global_id);
   if (!producer->shared_memory()) {
@@ -2731,7 +2848,8 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
                   producer->name_.c_str());
     auto shared_memory = shm_factory_->CreateSharedMemory(shm_size);
     producer->SetupSharedMemory(std::move(shared_memory), page_size,
-                                /*provided_by_producer=*/false);
+                                /*provided_by_producer=*/false,
+                                producer_config.smb_commit_ring());
   }
   producer->SetupDataSource(inst_id, ds_config);
   return ds_instance;
@@ -3203,14 +3321,69 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     filt_stats->set_errors(tracing_session->filter_errors);
   }
 
-  for (BufferID buf_id : tracing_session->buffers_index) {
-    TraceBuffer* buf = GetBufferByID(buf_id);
+  std::map<ProducerID, TraceStats::ProducerStats> producer_stats;
+  std::vector<TraceStats::WriterStats> writer_stats;
+  for (size_t i = 0; i < tracing_session->buffers_index.size(); i++) {
+    TraceBuffer* buf = GetBufferByID(tracing_session->buffers_index[i]);
     if (!buf) {
       PERFETTO_DFATAL("Buffer not found.");
       continue;
     }
     *trace_stats.add_buffer_stats() = buf->stats();
+
+    for (const TraceBuffer::WriterStats& writer : buf->GetWriterStats()) {
+      TraceStats::ProducerStats& producer = producer_stats[writer.producer_id];
+      producer.set_bytes_written(producer.bytes_written() +
+                                 writer.bytes_written);
+      producer.set_chunks_written(producer.chunks_written() +
+                                  writer.chunks_written);
+      producer.set_bytes_overwritten(producer.bytes_overwritten() +
+                                     writer.bytes_overwritten);
+      producer.set_chunks_overwritten(producer.chunks_overwritten() +
+                                      writer.chunks_overwritten);
+      producer.set_patches_succeeded(producer.patches_succeeded() +
+                                     writer.patches_succeeded);
+
+      writer_stats.emplace_back();
+      TraceStats::WriterStats& stats = writer_stats.back();
+      stats.set_producer_id(writer.producer_id);
+      stats.set_writer_id(writer.writer_id);
+      stats.set_buffer_index(static_cast<uint32_t>(i));
+      stats.set_bytes_written(writer.bytes_written);
+      stats.set_chunks_written(writer.chunks_written);
+      stats.set_bytes_overwritten(writer.bytes_overwritten);
+      stats.set_chunks_overwritten(writer.chunks_overwritten);
+      stats.set_patches_succeeded(writer.patches_succeeded);
+    }
   }  // for (buf in session).
+
+  for (auto& kv : producer_stats) {
+    TraceStats::ProducerStats* stats = trace_stats.add_producer_stats();
+    *stats = std::move(kv.second);
+    stats->set_producer_id(kv.first);
+    ProducerEndpointImpl* producer = GetProducer(kv.first);
+    if (!producer)
+      continue;  // The producer has disconnected.
+    stats->set_producer_name(producer->name_);
+    stats->set_uid(static_cast<int32_t>(producer->uid()));
+    stats->set_pid(static_cast<int32_t>(producer->pid()));
+    stats->set_commit_data_requests(producer->num_commit_data_requests_);
+    stats->set_commit_data_time_ns(producer->commit_data_time_ns_);
+    stats->set_smb_writer_stalls(producer->smb_writer_stalls_);
+    stats->set_smb_chunks_dropped(producer->smb_chunks_dropped_);
+  }
+
+  size_t num_writer_stats = std::min(writer_stats.size(), kMaxWriterStats);
+  std::partial_sort(writer_stats.begin(),
+                    writer_stats.begin() +
+                        static_cast<ptrdiff_t>(num_writer_stats),
+                    writer_stats.end(),
+                    [](const TraceStats::WriterStats& a,
+                       const TraceStats::WriterStats& b) {
+                      return a.bytes_written() > b.bytes_written();
+                    });
+  for (size_t i = 0; i < num_writer_stats; i++)
+    *trace_stats.add_writer_stats() = std::move(writer_stats[i]);
   return trace_stats;
 }
 
@@ -3422,6 +3595,159 @@ bool TracingServiceImpl::MaybeSaveTraceForBugreport(
   return true;
 }
 
+void TracingServiceImpl::CloneSession(
+    ConsumerEndpointImpl* consumer,
+    TracingSessionID tsid,
+    ConsumerEndpoint::CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  TracingSession* tracing_session = GetTracingSession(tsid);
+  // Check the permissions before flushing: the flush is visible to the data
+  // sources of the session. FinishCloneSession() checks everything else.
+  if (!tracing_session || (consumer->uid_ != 0 &&
+                           consumer->uid_ != tracing_session->consumer_uid)) {
+    base::Status status = PERFETTO_SVC_ERR(
+        "Tracing session %" PRIu64 " not found or not accessible", tsid);
+    callback(false, status.message());
+    return;
+  }
+
+  // Flush the data sources first, so that the copy includes the data that is
+  // still in the shared memory buffers of the producers. This doesn't stop
+  // the session. If the flush fails (e.g. it times out), the copy is taken
+  // anyways.
+  if (tracing_session->state == TracingSession::STARTED) {
+    auto weak_this = weak_ptr_factory_.GetWeakPtr();
+    auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
+    Flush(tsid, 0, [weak_this, weak_consumer, tsid, callback](bool) {
+      if (!weak_this)
+        return;
+      if (!weak_consumer) {
+        callback(false, "The consumer disconnected");
+        return;
+      }
+      base::Status status =
+          weak_this->FinishCloneSession(weak_consumer.get(), tsid);
+      callback(status.ok(), status.message());
+    });
+    return;
+  }
+  base::Status status = FinishCloneSession(consumer, tsid);
+  callback(status.ok(), status.message());
+}
+
+base::Status TracingServiceImpl::FinishCloneSession(
+    ConsumerEndpointImpl* consumer,
+    TracingSessionID src_tsid) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // The session might have gone in the meantime, re-check everything.
+  TracingSession* src = GetTracingSession(src_tsid);
+  if (!src || (consumer->uid_ != 0 && consumer->uid_ != src->consumer_uid)) {
+    return PERFETTO_SVC_ERR(
+        "Tracing session %" PRIu64 " not found or not accessible", src_tsid);
+  }
+  if (consumer->tracing_session_id_) {
+    return PERFETTO_SVC_ERR(
+        "The consumer is already attached to another tracing session");
+  }
+  if (IsWaitingForTrigger(src))
+    return PERFETTO_SVC_ERR("The tracing session hasn't been triggered yet");
+  if (tracing_sessions_.size() >= kMaxConcurrentTracingSessions) {
+    return PERFETTO_SVC_ERR("Too many concurrent tracing sesions (%zu)",
+                            tracing_sessions_.size());
+  }
+
+  // The copy below is a synchronous memcpy on the service thread, which
+  // doesn't process commits meanwhile, and doubles the memory used by the
+  // buffers. Bound both by the same limit that EnableTracing() applies to
+  // the buffers of a session with extra guardrails, regardless of how the
+  // source session was created.
+  uint64_t clone_size_kb = 0;
+  for (BufferID src_buffer_id : src->buffers_index) {
+    TraceBuffer* src_buffer = GetBufferByID(src_buffer_id);
+    if (src_buffer)
+      clone_size_kb += src_buffer->size() / 1024;
+  }
+  if (clone_size_kb > kGuardrailsMaxTracingBufferSizeKb) {
+    return PERFETTO_SVC_ERR("Tracing session too large to clone (%" PRIu64
+                            " kB > %" PRIu32 " kB)",
+                            clone_size_kb, kGuardrailsMaxTracingBufferSizeKb);
+  }
+
+  // Copy the buffers. This happens on the service thread, the only one that
+  // writes into them, so the copy is consistent.
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  for (BufferID src_buffer_id : src->buffers_index) {
+    TraceBuffer* src_buffer = GetBufferByID(src_buffer_id);
+    PERFETTO_DCHECK(src_buffer);
+    std::unique_ptr<TraceBuffer> buffer;
+    if (src_buffer)
+      buffer = src_buffer->CloneReadOnly();
+    if (!buffer)
+      return PERFETTO_SVC_ERR("Failed to clone the tracing buffers: OOM");
+    buffers.emplace_back(std::move(buffer));
+  }
+
+  std::vector<BufferID> buffers_index;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    BufferID buffer_id = buffer_ids_.Allocate();
+    if (!buffer_id) {
+      for (BufferID allocated_id : buffers_index)
+        buffer_ids_.Free(allocated_id);
+      return PERFETTO_SVC_ERR("Failed to clone the tracing buffers: too many "
+                              "buffers");
+    }
+    buffers_index.push_back(buffer_id);
+  }
+
+  // If the session had a trace filter, the copy must be filtered as well.
+  // The bytecode has been validated already by EnableTracing().
+  std::unique_ptr<protozero::MessageFilter> trace_filter;
+  if (src->trace_filter) {
+    const std::string& bytecode = src->config.trace_filter().bytecode();
+    uint32_t packet_field_id = TracePacket::kPacketFieldNumber;
+    trace_filter.reset(new protozero::MessageFilter());
+    if (!trace_filter->LoadFilterBytecode(bytecode.data(), bytecode.size()) ||
+        !trace_filter->SetFilterRoot(&packet_field_id, 1)) {
+      for (BufferID buffer_id : buffers_index)
+        buffer_ids_.Free(buffer_id);
+      return PERFETTO_SVC_ERR("Failed to clone the trace filter");
+    }
+  }
+
+  const TracingSessionID tsid = ++last_tracing_session_id_;
+  TracingSession* tracing_session =
+      &tracing_sessions_
+           .emplace(std::piecewise_construct, std::forward_as_tuple(tsid),
+                    std::forward_as_tuple(tsid, consumer, src->config,
+                                          task_runner_))
+           .first->second;
+  for (size_t i = 0; i < buffers.size(); i++)
+    buffers_.emplace(buffers_index[i], std::move(buffers[i]));
+  tracing_session->buffers_index = std::move(buffers_index);
+  tracing_session->is_clone = true;
+  tracing_session->trace_filter = std::move(trace_filter);
+
+  // Keep the same sequence IDs and triggers of the original session, so that
+  // the packets read from the copy look the same as the original ones.
+  tracing_session->packet_sequence_ids = src->packet_sequence_ids;
+  tracing_session->last_packet_sequence_id = src->last_packet_sequence_id;
+  tracing_session->received_triggers = src->received_triggers;
+  tracing_session->invalid_packets = src->invalid_packets;
+  tracing_session->flushes_requested = src->flushes_requested;
+  tracing_session->flushes_succeeded = src->flushes_succeeded;
+  tracing_session->flushes_failed = src->flushes_failed;
+  SnapshotClocks(&tracing_session->initial_clock_snapshot);
+  tracing_session->should_emit_stats = true;
+
+  consumer->tracing_session_id_ = tsid;
+  UpdateMemoryGuardrail();
+
+  PERFETTO_LOG("Cloned tracing session %" PRIu64 " into %" PRIu64
+               ", total sessions:%zu",
+               src_tsid, tsid, tracing_sessions_.size());
+  return base::OkStatus();
+}
+
 void TracingServiceImpl::MaybeLogUploadEvent(const TraceConfig& cfg,
                                              PerfettoStatsdAtom atom,
                                              const std::string& trigger_name) {
@@ -3785,6 +4111,13 @@ void TracingServiceImpl::ConsumerEndpointImpl::SaveTraceForBugreport(
   }
 }
 
+void TracingServiceImpl::ConsumerEndpointImpl::CloneSession(
+    TracingSessionID tsid,
+    CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  service_->CloneSession(this, tsid, std::move(callback));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // TracingServiceImpl::ProducerEndpointImpl implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -3799,7 +4132,8 @@ TracingServiceImpl::ProducerEndpointImpl::ProducerEndpointImpl(
     const std::string& producer_name,
     const std::string& sdk_version,
     bool in_process,
-    bool smb_scraping_enabled)
+    bool smb_scraping_enabled,
+    bool smb_commit_ring_supported)
     : id_(id),
       uid_(uid),
       pid_(pid),
@@ -3810,6 +4144,9 @@ TracingServiceImpl::ProducerEndpointImpl::ProducerEndpointImpl(
       sdk_version_(sdk_version),
       in_process_(in_process),
       smb_scraping_enabled_(smb_scraping_enabled),
+      // The in-process arbiter is created by the service itself, see
+      // SetupSharedMemory().
+      smb_commit_ring_supported_(smb_commit_ring_supported || in_process),
       weak_ptr_factory_(this) {}
 
 TracingServiceImpl::ProducerEndpointImpl::~ProducerEndpointImpl() {
@@ -3865,6 +4202,35 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     return;
   }
   PERFETTO_DCHECK(shmem_abi_.is_valid());
+  const int64_t start_ns = base::GetWallTimeNs().count();
+
+  // The records written in the commit ring before the request was sent must be
+  // processed before it, the ones written afterwards can be processed now too.
+  if (commit_ring_.is_valid() && req_untrusted.has_commit_ring_write_index())
+    DrainCommitRing(req_untrusted.commit_ring_write_index());
+  MoveChunksAndApplyPatches(req_untrusted);
+  if (commit_ring_.is_valid())
+    DrainCommitRing(base::nullopt);
+
+  num_commit_data_requests_++;
+  commit_data_time_ns_ +=
+      static_cast<uint64_t>(base::GetWallTimeNs().count() - start_ns);
+  smb_writer_stalls_ += req_untrusted.smb_writer_stalls();
+  smb_chunks_dropped_ += req_untrusted.smb_chunks_dropped();
+
+  if (req_untrusted.flush_request_id()) {
+    service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
+  }
+
+  // Keep this invocation last. ProducerIPCService::CommitData() relies on this
+  // callback being invoked within the same callstack and not posted. If this
+  // changes, the code there needs to be changed accordingly.
+  if (callback)
+    callback();
+}
+
+void TracingServiceImpl::ProducerEndpointImpl::MoveChunksAndApplyPatches(
+    const CommitDataRequest& req_untrusted) {
   for (const auto& entry : req_untrusted.chunks_to_move()) {
     const uint32_t page_idx = entry.page();
     if (page_idx >= shmem_abi_.num_pages())
@@ -3901,22 +4267,55 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
   }  // for(chunks_to_move)
 
   service_->ApplyChunkPatches(id_, req_untrusted.chunks_to_patch());
+}
 
-  if (req_untrusted.flush_request_id()) {
-    service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
+void TracingServiceImpl::ProducerEndpointImpl::DrainCommitRing(
+    base::Optional<uint32_t> end_index) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  CommitDataRequest req_untrusted;
+  const bool ring_valid = commit_ring_.Read(&req_untrusted, end_index);
+  MoveChunksAndApplyPatches(req_untrusted);
+  if (!ring_valid) {
+    PERFETTO_ELOG("Producer %" PRIu16 " corrupted the SMB commit ring", id_);
+    DisableCommitRing();
+    return;
   }
 
-  // Keep this invocation last. ProducerIPCService::CommitData() relies on this
-  // callback being invoked within the same callstack and not posted. If this
-  // changes, the code there needs to be changed accordingly.
-  if (callback)
-    callback();
+  // Read() gives up after a while if the producer keeps writing, rather than
+  // blocking the service thread. Don't leave the records behind until the
+  // next IPC, the producer might not send any.
+  if (!end_index && commit_ring_.HasRecordsToRead()) {
+    auto weak_this = weak_ptr_factory_.GetWeakPtr();
+    task_runner_->PostTask([weak_this] {
+      if (weak_this && weak_this->commit_ring_.is_valid())
+        weak_this->DrainCommitRing(base::nullopt);
+    });
+  }
+}
+
+void TracingServiceImpl::ProducerEndpointImpl::DisableCommitRing() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  commit_ring_.Reset();
+
+  // The commits the producer writes into the ring until it sees this are lost.
+  // Their chunks stay in the SMB, they are still recovered by SMB scraping if
+  // enabled.
+  if (in_process_) {
+    inproc_shmem_arbiter_->DisableSmbCommitRing();
+    return;
+  }
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  task_runner_->PostTask([weak_this] {
+    if (weak_this)
+      weak_this->producer_->OnSmbCommitRingDisabled();
+  });
 }
 
 void TracingServiceImpl::ProducerEndpointImpl::SetupSharedMemory(
     std::unique_ptr<SharedMemory> shared_memory,
     size_t page_size_bytes,
-    bool provided_by_producer) {
+    bool provided_by_producer,
+    bool use_commit_ring) {
   PERFETTO_DCHECK(!shared_memory_ && !shmem_abi_.is_valid());
   PERFETTO_DCHECK(page_size_bytes % 1024 == 0);
 
@@ -3924,14 +4323,27 @@ void TracingServiceImpl::ProducerEndpointImpl::SetupSharedMemory(
   shared_buffer_page_size_kb_ = page_size_bytes / 1024;
   is_shmem_provided_by_producer_ = provided_by_producer;
 
-  shmem_abi_.Initialize(reinterpret_cast<uint8_t*>(shared_memory_->start()),
-                        shared_memory_->size(),
+  // The commit ring takes the last page of the SMB. A producer-provided SMB
+  // might already contain chunks in any page, so the ring can't be used. Nor
+  // can it with producers that don't know about it: they would keep writing
+  // chunks into that page.
+  uint8_t* shm_start = reinterpret_cast<uint8_t*>(shared_memory_->start());
+  size_t abi_size = shared_memory_->size();
+  if (use_commit_ring && smb_commit_ring_supported_ && !provided_by_producer &&
+      abi_size >= 2 * page_size_bytes) {
+    abi_size -= page_size_bytes;
+    commit_ring_.Initialize(shm_start + abi_size, page_size_bytes);
+  }
+
+  shmem_abi_.Initialize(shm_start, abi_size,
                         shared_buffer_page_size_kb() * 1024);
   if (in_process_) {
     inproc_shmem_arbiter_.reset(new SharedMemoryArbiterImpl(
         shared_memory_->start(), shared_memory_->size(),
         shared_buffer_page_size_kb_ * 1024, this, task_runner_));
     inproc_shmem_arbiter_->SetDirectSMBPatchingSupportedByService();
+    if (commit_ring_.is_valid())
+      inproc_shmem_arbiter_->EnableSmbCommitRing();
   }
 
   OnTracingSetup();
@@ -3984,6 +4396,10 @@ bool TracingServiceImpl::ProducerEndpointImpl::IsShmemProvidedByProducer()
   return is_shmem_provided_by_producer_;
 }
 
+bool TracingServiceImpl::ProducerEndpointImpl::IsSmbCommitRingEnabled() const {
+  return commit_ring_.is_valid();
+}
+
 // Can be called on any thread.
 std::unique_ptr<TraceWriter>
 TracingServiceImpl::ProducerEndpointImpl::CreateTraceWriter(
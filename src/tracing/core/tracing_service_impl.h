@@ -27,6 +27,7 @@
 #include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
@@ -46,6 +47,11 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "src/android_stats/perfetto_atoms.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/core/smb_commit_ring.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include "perfetto/ext/base/thread_task_runner.h"
+#endif
 
 namespace protozero {
 class MessageFilter;
@@ -92,6 +98,17 @@ class TracingServiceImpl : public TracingService {
   // allocates memory, this limits the amount of memory allocated.
   static constexpr size_t kWriteIntoFileChunkSize = 1024 * 1024ul;
 
+  // When writing into a file, slices smaller than this are copied into a
+  // contiguous staging buffer together with the packet preambles, rather than
+  // being passed to writev() as individual iovecs. This bounds the number of
+  // iovecs, hence of writev() calls, per MB written, regardless of the size of
+  // the packets.
+  static constexpr size_t kWriteIntoFileMaxCopySize = 1024;
+
+  // Max number of TraceStats.writer_stats entries returned by
+  // GetTraceStats(). Only the writers that wrote the most bytes are reported.
+  static constexpr size_t kMaxWriterStats = 64;
+
   // The implementation behind the service endpoint exposed to each producer.
   class ProducerEndpointImpl : public TracingService::ProducerEndpoint {
    public:
@@ -104,7 +121,8 @@ class TracingServiceImpl : public TracingService {
                          const std::string& producer_name,
                          const std::string& sdk_version,
                          bool in_process,
-                         bool smb_scraping_enabled);
+                         bool smb_scraping_enabled,
+                         bool smb_commit_ring_supported);
     ~ProducerEndpointImpl() override;
 
     // TracingService::ProducerEndpoint implementation.
@@ -117,12 +135,14 @@ class TracingServiceImpl : public TracingService {
     void CommitData(const CommitDataRequest&, CommitDataCallback) override;
     void SetupSharedMemory(std::unique_ptr<SharedMemory>,
                            size_t page_size_bytes,
-                           bool provided_by_producer);
+                           bool provided_by_producer,
+                           bool use_commit_ring = false);
     std::unique_ptr<TraceWriter> CreateTraceWriter(
         BufferID,
         BufferExhaustedPolicy) override;
     SharedMemoryArbiter* MaybeSharedMemoryArbiter() override;
     bool IsShmemProvidedByProducer() const override;
+    bool IsSmbCommitRingEnabled() const override;
     void NotifyFlushComplete(FlushRequestID) override;
     void NotifyDataSourceStarted(DataSourceInstanceID) override;
     void NotifyDataSourceStopped(DataSourceInstanceID) override;
@@ -160,6 +180,18 @@ class TracingServiceImpl : public TracingService {
     ProducerEndpointImpl(const ProducerEndpointImpl&) = delete;
     ProducerEndpointImpl& operator=(const ProducerEndpointImpl&) = delete;
 
+    // Moves the chunks and applies the patches listed in |req_untrusted|,
+    // coming either from a CommitData() IPC or from the |commit_ring_|.
+    void MoveChunksAndApplyPatches(const CommitDataRequest& req_untrusted);
+
+    // Consumes the records of the |commit_ring_| before |end_index|, or all of
+    // them if unset. Disables the ring if it turns out to be corrupted.
+    void DrainCommitRing(base::Optional<uint32_t> end_index);
+
+    // Stops reading the |commit_ring_| and tells the producer to commit via
+    // IPCs from now on.
+    void DisableCommitRing();
+
     ProducerID const id_;
     const uid_t uid_;
     const pid_t pid_;
@@ -172,10 +204,26 @@ class TracingServiceImpl : public TracingService {
     size_t shmem_size_hint_bytes_ = 0;
     size_t shmem_page_size_hint_bytes_ = 0;
     bool is_shmem_provided_by_producer_ = false;
+
+    // Ring in the last page of the SMB through which the producer commits
+    // chunks, if enabled by TraceConfig.ProducerConfig.smb_commit_ring and
+    // supported by the producer. Only the pages before it are covered by
+    // |shmem_abi_|.
+    SmbCommitRing commit_ring_;
+
     const std::string name_;
     std::string sdk_version_;
     bool in_process_;
     bool smb_scraping_enabled_;
+    const bool smb_commit_ring_supported_;
+
+    // Num. of CommitData() calls and the time spent handling them, and the
+    // SMB stats reported by the producer in them. Reported in
+    // TraceStats.producer_stats.
+    uint64_t num_commit_data_requests_ = 0;
+    uint64_t commit_data_time_ns_ = 0;
+    uint64_t smb_writer_stalls_ = 0;
+    uint64_t smb_chunks_dropped_ = 0;
 
     // Set of the global target_buffer IDs that the producer is configured to
     // write into in any active tracing session.
@@ -225,6 +273,7 @@ class TracingServiceImpl : public TracingService {
     void QueryServiceState(QueryServiceStateCallback) override;
     void QueryCapabilities(QueryCapabilitiesCallback) override;
     void SaveTraceForBugreport(SaveTraceForBugreportCallback) override;
+    void CloneSession(TracingSessionID, CloneSessionCallback) override;
 
     // Will queue a task to notify the consumer about the state change.
     void OnDataSourceInstanceStateChange(const ProducerEndpointImpl&,
@@ -301,6 +350,13 @@ class TracingServiceImpl : public TracingService {
              ConsumerEndpoint::FlushCallback);
   void FlushAndDisableTracing(TracingSessionID);
 
+  // Flushes the tracing session `tsid`, if it's running, and then attaches a
+  // read-only copy of its buffers to `*consumer`. See
+  // ConsumerEndpoint::CloneSession().
+  void CloneSession(ConsumerEndpointImpl* consumer,
+                    TracingSessionID tsid,
+                    ConsumerEndpoint::CloneSessionCallback);
+
   // Starts reading the internal tracing buffers from the tracing session `tsid`
   // and sends them to `*consumer` (which must be != nullptr).
   //
@@ -321,6 +377,10 @@ class TracingServiceImpl : public TracingService {
   // been an error, flushes the file and closes it. Otherwise, schedules itself
   // to be executed after write_period_ms.
   //
+  // If the session sets a compression_type and a CompressorFn was set, each
+  // batch of packets is compressed on a background thread while the next one
+  // is read from the buffers.
+  //
   // Returns false in case of error.
   bool ReadBuffersIntoFile(TracingSessionID);
 
@@ -338,7 +398,8 @@ class TracingServiceImpl : public TracingService {
           ProducerSMBScrapingMode::kDefault,
       size_t shared_memory_page_size_hint_bytes = 0,
       std::unique_ptr<SharedMemory> shm = nullptr,
-      const std::string& sdk_version = {}) override;
+      const std::string& sdk_version = {},
+      bool smb_commit_ring_supported = false) override;
 
   std::unique_ptr<TracingService::ConsumerEndpoint> ConnectConsumer(
       Consumer*,
@@ -350,6 +411,10 @@ class TracingServiceImpl : public TracingService {
     smb_scraping_enabled_ = enabled;
   }
 
+  void SetCompressorFn(CompressorFn compressor_fn) override {
+    compressor_fn_ = compressor_fn;
+  }
+
   // Exposed mainly for testing.
   size_t num_producers() const { return producers_.size(); }
   ProducerEndpointImpl* GetProducer(ProducerID) const;
@@ -625,11 +690,21 @@ class TracingServiceImpl : public TracingService {
     uint64_t max_file_size_bytes = 0;
     uint64_t bytes_written_into_file = 0;
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+    // Compresses the |write_into_file| batches in the background. Created on
+    // the first compressed batch and reused for the lifetime of the session.
+    std::unique_ptr<base::ThreadTaskRunner> compressor_task_runner;
+#endif
+
     // Set when using SaveTraceForBugreport(). This callback will be called
     // when the tracing session ends and the data has been saved into the file.
     std::function<void()> on_disable_callback_for_bugreport;
     bool seized_for_bugreport = false;
 
+    // Set for the read-only copies of a session created by CloneSession().
+    // These sessions stay DISABLED and don't react to triggers.
+    bool is_clone = false;
+
     // Periodic task for snapshotting service events (e.g. clocks, sync markers
     // etc)
     base::PeriodicTask snapshot_periodic_task;
@@ -691,6 +766,7 @@ class TracingServiceImpl : public TracingService {
   void MaybeEmitReceivedTriggers(TracingSession*, std::vector<TracePacket>*);
   void MaybeNotifyAllDataSourcesStarted(TracingSession*);
   bool MaybeSaveTraceForBugreport(std::function<void()> callback);
+  base::Status FinishCloneSession(ConsumerEndpointImpl*, TracingSessionID);
   void OnFlushTimeout(TracingSessionID, FlushRequestID);
   void OnDisableTracingTimeout(TracingSessionID);
   void DisableTracingNotifyConsumerAndFlushFile(TracingSession*);
@@ -763,6 +839,7 @@ class TracingServiceImpl : public TracingService {
   base::CircularQueue<TriggerHistory> trigger_history_;
 
   bool smb_scraping_enabled_ = false;
+  CompressorFn compressor_fn_ = nullptr;
   bool lockdown_mode_ = false;
   uint32_t min_write_period_ms_ = 100;       // Overridable for testing.
   int64_t trigger_window_ns_ = kOneDayInNs;  // Overridable for testing.
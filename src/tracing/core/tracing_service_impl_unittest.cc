@@ -21,6 +21,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/tracing/core/commit_data_request.h"
 #include "perfetto/ext/tracing/core/consumer.h"
 #include "perfetto/ext/tracing/core/observable_events.h"
 #include "perfetto/ext/tracing/core/producer.h"
@@ -33,6 +34,7 @@
 #include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_writer_impl.h"
+#include "src/tracing/core/zlib_compressor.h"
 #include "src/tracing/test/mock_consumer.h"
 #include "src/tracing/test/mock_producer.h"
 #include "src/tracing/test/test_shared_memory.h"
@@ -47,6 +49,10 @@
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 #include "protos/perfetto/trace/trigger.gen.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
 using ::testing::_;
 using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
@@ -55,6 +61,7 @@ using ::testing::Contains;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::ExplainMatchResult;
+using ::testing::HasSubstr;
 using ::testing::InSequence;
 using ::testing::Invoke;
 using ::testing::InvokeWithoutArgs;
@@ -1799,6 +1806,147 @@ TEST_F(TracingServiceImplTest, WriteIntoFileFilterMultipleChunks) {
   EXPECT_GT(total_size, kNumTestPackets * kPayloadSize);
 }
 
+// Packets smaller than kWriteIntoFileMaxCopySize are copied and coalesced
+// before being written, bigger ones are written in place. Check that
+// interleaving the two preserves the content and order of the packets.
+TEST_F(TracingServiceImplTest, WriteIntoFileMixedPacketSizes) {
+  static const size_t kNumTestPackets = 200;
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Sizes around kWriteIntoFileMaxCopySize, some of which span several SMB
+  // chunks and hence are read back as multiple slices.
+  auto payload_size = [](size_t i) {
+    static const size_t kSizes[] = {1, 10, 1000, 1023, 1024, 1025, 5000, 9000};
+    return kSizes[i % base::ArraySize(kSizes)] + i;
+  };
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    std::string payload(payload_size(i), static_cast<char>('a' + i % 26));
+    tp->set_for_testing()->set_str(payload.c_str(), payload.size());
+  }
+  writer->Flush();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  size_t num_test_packets = 0;
+  for (const auto& packet : trace.packet()) {
+    if (!packet.has_for_testing())
+      continue;
+    size_t i = num_test_packets++;
+    EXPECT_EQ(packet.for_testing().str(),
+              std::string(payload_size(i), static_cast<char>('a' + i % 26)));
+  }
+  EXPECT_EQ(kNumTestPackets, num_test_packets);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+TEST_F(TracingServiceImplTest, WriteIntoFileCompressed) {
+  static const size_t kNumTestPackets = 30;
+  static const size_t kPayloadSize = 100 * 1024UL;
+  static_assert(kNumTestPackets * kPayloadSize >
+                    2 * TracingServiceImpl::kWriteIntoFileChunkSize,
+                "This test covers compressing and reading concurrently");
+
+  svc->SetCompressorFn(ZlibCompressFn);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  trace_config.set_compression_type(
+      TraceConfig::COMPRESSION_TYPE_DEFLATE_FAST);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    std::string payload(kPayloadSize, 'a');
+    payload.append(std::to_string(i));
+    tp->set_for_testing()->set_str(payload.c_str(), payload.size());
+  }
+  writer->Flush();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  EXPECT_LT(trace_raw.size(), kNumTestPackets * kPayloadSize / 10);
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+
+  size_t num_test_packets = 0;
+  for (const auto& packet : trace.packet()) {
+    // All the packets, including the ones emitted by the service, are
+    // compressed.
+    ASSERT_TRUE(packet.has_compressed_packets());
+    const std::string& compressed = packet.compressed_packets();
+    std::string decompressed(kNumTestPackets * kPayloadSize, '\0');
+    uLongf decompressed_size = static_cast<uLongf>(decompressed.size());
+    ASSERT_EQ(uncompress(reinterpret_cast<Bytef*>(&decompressed[0]),
+                         &decompressed_size,
+                         reinterpret_cast<const Bytef*>(compressed.data()),
+                         static_cast<uLong>(compressed.size())),
+              Z_OK);
+    decompressed.resize(decompressed_size);
+    protos::gen::Trace inner_trace;
+    ASSERT_TRUE(inner_trace.ParseFromString(decompressed));
+    for (const auto& inner_packet : inner_trace.packet()) {
+      if (!inner_packet.has_for_testing())
+        continue;
+      const std::string& str = inner_packet.for_testing().str();
+      ASSERT_GT(str.size(), kPayloadSize);
+      EXPECT_EQ(std::to_string(num_test_packets++), str.substr(kPayloadSize));
+    }
+  }
+  EXPECT_EQ(kNumTestPackets, num_test_packets);
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
 // Test the logic that allows the trace config to set the shm total size and
 // page size from the trace config. Also check that, if the config doesn't
 // specify a value we fall back on the hint provided by the producer.
@@ -3124,6 +3272,469 @@ TEST_F(TracingServiceImplTest, GetTraceStats) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, GetTraceStatsPerProducerAndWriter) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer1 = CreateMockProducer();
+  producer1->Connect(svc.get(), "mock_producer1", 123u /* uid */,
+                     1001 /* pid */);
+  producer1->RegisterDataSource("data_source");
+
+  std::unique_ptr<MockProducer> producer2 = CreateMockProducer();
+  producer2->Connect(svc.get(), "mock_producer2", 456u /* uid */,
+                     2002 /* pid */);
+  producer2->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer1->WaitForTracingSetup();
+  producer1->WaitForDataSourceSetup("data_source");
+  producer2->WaitForTracingSetup();
+  producer2->WaitForDataSourceSetup("data_source");
+  producer1->WaitForDataSourceStart("data_source");
+  producer2->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer1a =
+      producer1->CreateTraceWriter("data_source");
+  std::unique_ptr<TraceWriter> writer1b =
+      producer1->CreateTraceWriter("data_source");
+  std::unique_ptr<TraceWriter> writer2a =
+      producer2->CreateTraceWriter("data_source");
+  for (int i = 0; i < 10; i++) {
+    auto tp = writer1a->NewTracePacket();
+    tp->set_for_testing()->set_str(std::string(1024, 'a'));
+  }
+  writer1b->NewTracePacket()->set_for_testing()->set_str("payload1b");
+  writer2a->NewTracePacket()->set_for_testing()->set_str("payload2a");
+
+  auto flush_request = consumer->Flush();
+  producer1->WaitForFlush({writer1a.get(), writer1b.get()});
+  producer2->WaitForFlush(writer2a.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // SMB exhaustion is reported by the producer in the CommitDataRequest(s).
+  CommitDataRequest commit_req;
+  commit_req.set_smb_writer_stalls(3);
+  commit_req.set_smb_chunks_dropped(2);
+  producer1->endpoint()->CommitData(commit_req);
+
+  // The stats of a disconnected producer are still reported, without the
+  // details of the producer.
+  writer2a.reset();
+  producer2.reset();
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+
+  ASSERT_EQ(stats.producer_stats_size(), 2);
+  const TraceStats::ProducerStats& p1 = stats.producer_stats()[0];
+  EXPECT_EQ(p1.producer_name(), "mock_producer1");
+  EXPECT_EQ(p1.uid(), 123);
+  EXPECT_EQ(p1.pid(), 1001);
+  EXPECT_GT(p1.bytes_written(), 10 * 1024u);
+  EXPECT_GT(p1.chunks_written(), 1u);
+  EXPECT_GT(p1.commit_data_requests(), 0u);
+  EXPECT_TRUE(p1.has_commit_data_time_ns());
+  EXPECT_EQ(p1.smb_writer_stalls(), 3u);
+  EXPECT_EQ(p1.smb_chunks_dropped(), 2u);
+
+  const TraceStats::ProducerStats& p2 = stats.producer_stats()[1];
+  EXPECT_GT(p2.producer_id(), p1.producer_id());
+  EXPECT_FALSE(p2.has_producer_name());
+  EXPECT_FALSE(p2.has_commit_data_requests());
+  EXPECT_EQ(p2.chunks_written(), 1u);
+
+  // Writers are sorted by decreasing bytes_written and add up to the stats of
+  // the buffer.
+  ASSERT_EQ(stats.writer_stats_size(), 3);
+  EXPECT_EQ(stats.writer_stats()[0].producer_id(), p1.producer_id());
+  uint64_t bytes_written = 0;
+  for (const TraceStats::WriterStats& writer : stats.writer_stats()) {
+    EXPECT_EQ(writer.buffer_index(), 0u);
+    EXPECT_GE(stats.writer_stats()[0].bytes_written(), writer.bytes_written());
+    bytes_written += writer.bytes_written();
+  }
+  EXPECT_EQ(bytes_written, stats.buffer_stats()[0].bytes_written());
+  EXPECT_EQ(bytes_written, p1.bytes_written() + p2.bytes_written());
+
+  consumer->DisableTracing();
+  producer1->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, SmbCommitRing) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(1024);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  auto* producer_config = trace_config.add_producers();
+  producer_config->set_producer_name("mock_producer");
+  producer_config->set_shm_size_kb(32);
+  producer_config->set_page_size_kb(4);
+  producer_config->set_smb_commit_ring(true);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // The last page of the SMB is taken by the ring.
+  ASSERT_TRUE(producer->endpoint()->IsSmbCommitRingEnabled());
+  auto* arbiter = static_cast<SharedMemoryArbiterImpl*>(
+      producer->endpoint()->MaybeSharedMemoryArbiter());
+  EXPECT_EQ(arbiter->num_pages(), 7u);
+
+  // Write more than the SMB can hold, with packets spanning several chunks
+  // (and hence requiring patches).
+  static constexpr int kNumPackets = 100;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < kNumPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    std::string payload(5000, 'a' + (i % 26));
+    payload += std::to_string(i);
+    tp->set_for_testing()->set_str(payload);
+  }
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  for (int i = 0; i < kNumPackets; i++) {
+    std::string payload(5000, 'a' + (i % 26));
+    payload += std::to_string(i);
+    EXPECT_THAT(packets,
+                Contains(Property(
+                    &protos::gen::TracePacket::for_testing,
+                    Property(&protos::gen::TestEvent::str, Eq(payload)))));
+  }
+}
+
+TEST_F(TracingServiceImplTest, ProducerQuota) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> rare_producer = CreateMockProducer();
+  rare_producer->Connect(svc.get(), "rare_producer");
+  rare_producer->RegisterDataSource("data_source");
+
+  std::unique_ptr<MockProducer> chatty_producer = CreateMockProducer();
+  chatty_producer->Connect(svc.get(), "chatty_producer");
+  chatty_producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  auto* buf_config = trace_config.add_buffers();
+  buf_config->set_size_kb(32);
+  auto* quota = buf_config->add_producer_quotas();
+  quota->set_producer_name("rare_producer");
+  quota->set_size_kb(8);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  rare_producer->WaitForTracingSetup();
+  rare_producer->WaitForDataSourceSetup("data_source");
+  chatty_producer->WaitForTracingSetup();
+  chatty_producer->WaitForDataSourceSetup("data_source");
+  rare_producer->WaitForDataSourceStart("data_source");
+  chatty_producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> rare_writer =
+      rare_producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < 4; i++) {
+    rare_writer->NewTracePacket()->set_for_testing()->set_str(
+        "rare_" + std::to_string(i));
+  }
+  auto flush_request = consumer->Flush();
+  rare_producer->WaitForFlush(rare_writer.get());
+  chatty_producer->WaitForFlush(nullptr);
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // Wrap over the buffer several times.
+  std::unique_ptr<TraceWriter> chatty_writer =
+      chatty_producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 16; j++) {
+      auto tp = chatty_writer->NewTracePacket();
+      tp->set_for_testing()->set_str(std::to_string(i * 16 + j) +
+                                     std::string(1024, 'x'));
+    }
+    flush_request = consumer->Flush();
+    rare_producer->WaitForFlush(nullptr);
+    chatty_producer->WaitForFlush(chatty_writer.get());
+    ASSERT_TRUE(flush_request.WaitForReply());
+  }
+
+  consumer->DisableTracing();
+  rare_producer->WaitForDataSourceStop("data_source");
+  chatty_producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets, Not(Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("0" + std::string(1024, 'x')))))));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_THAT(packets, Contains(Property(
+                             &protos::gen::TracePacket::for_testing,
+                             Property(&protos::gen::TestEvent::str,
+                                      Eq("rare_" + std::to_string(i))))));
+  }
+}
+
+TEST_F(TracingServiceImplTest, ProducerQuotaTooBig) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  auto* buf_config = trace_config.add_buffers();
+  buf_config->set_size_kb(32);
+  auto* quota = buf_config->add_producer_quotas();
+  quota->set_producer_name("mock_producer");
+  quota->set_size_kb(20);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+
+  EXPECT_CALL(*producer, SetupDataSource(_, _)).Times(0);
+  consumer->EnableTracing(trace_config);
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, CloneSession) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < 3; i++) {
+    writer->NewTracePacket()->set_for_testing()->set_str("before_clone_" +
+                                                         std::to_string(i));
+  }
+
+  TracingServiceState svc_state = consumer->QueryServiceState();
+  ASSERT_EQ(svc_state.tracing_sessions().size(), 1u);
+  TracingSessionID tsid = svc_state.tracing_sessions()[0].id();
+
+  // The packets haven't been committed yet: the clone flushes them.
+  std::unique_ptr<MockConsumer> clone_consumer = CreateMockConsumer();
+  clone_consumer->Connect(svc.get());
+  producer->WaitForFlush(writer.get());
+  auto clone_done = task_runner.CreateCheckpoint("clone_done");
+  clone_consumer->endpoint()->CloneSession(
+      tsid, [clone_done](bool success, const std::string& error) {
+        EXPECT_TRUE(success) << error;
+        clone_done();
+      });
+  task_runner.RunUntilCheckpoint("clone_done");
+  EXPECT_EQ(consumer->QueryServiceState().tracing_sessions().size(), 2u);
+
+  // The original session keeps recording.
+  writer->NewTracePacket()->set_for_testing()->set_str("after_clone");
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  auto clone_packets = clone_consumer->ReadBuffers();
+  for (int i = 0; i < 3; i++) {
+    EXPECT_THAT(clone_packets,
+                Contains(Property(&protos::gen::TracePacket::for_testing,
+                                  Property(&protos::gen::TestEvent::str,
+                                           Eq("before_clone_" +
+                                              std::to_string(i))))));
+  }
+  EXPECT_THAT(clone_packets,
+              Not(Contains(Property(&protos::gen::TracePacket::for_testing,
+                                    Property(&protos::gen::TestEvent::str,
+                                             Eq("after_clone"))))));
+  EXPECT_THAT(clone_packets, Contains(Property(
+                                 &protos::gen::TracePacket::has_trace_config,
+                                 Eq(true))));
+  clone_consumer->FreeBuffers();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets, Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("before_clone_0")))));
+  EXPECT_THAT(packets, Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("after_clone")))));
+}
+
+TEST_F(TracingServiceImplTest, CloneSessionFromOtherUid) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get(), 1000);
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  consumer->EnableTracing(trace_config);
+  TracingServiceState svc_state = consumer->QueryServiceState();
+  ASSERT_EQ(svc_state.tracing_sessions().size(), 1u);
+  TracingSessionID tsid = svc_state.tracing_sessions()[0].id();
+
+  std::unique_ptr<MockConsumer> clone_consumer = CreateMockConsumer();
+  clone_consumer->Connect(svc.get(), 1001);
+  auto clone_done = task_runner.CreateCheckpoint("clone_done");
+  clone_consumer->endpoint()->CloneSession(
+      tsid, [clone_done](bool success, const std::string&) {
+        EXPECT_FALSE(success);
+        clone_done();
+      });
+  task_runner.RunUntilCheckpoint("clone_done");
+  EXPECT_EQ(consumer->QueryServiceState().tracing_sessions().size(), 1u);
+}
+
+TEST_F(TracingServiceImplTest, CloneSessionOverGuardrailFails) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  // Without extra guardrails the session itself is allowed to exceed the
+  // limit, but it's too large to be copied.
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(64 * 1024);
+  trace_config.add_buffers()->set_size_kb(64 * 1024 + 4);
+  consumer->EnableTracing(trace_config);
+  TracingServiceState svc_state = consumer->QueryServiceState();
+  ASSERT_EQ(svc_state.tracing_sessions().size(), 1u);
+  TracingSessionID tsid = svc_state.tracing_sessions()[0].id();
+
+  std::unique_ptr<MockConsumer> clone_consumer = CreateMockConsumer();
+  clone_consumer->Connect(svc.get());
+  auto clone_done = task_runner.CreateCheckpoint("clone_done");
+  clone_consumer->endpoint()->CloneSession(
+      tsid, [clone_done](bool success, const std::string& error) {
+        EXPECT_FALSE(success);
+        EXPECT_THAT(error, HasSubstr("too large to clone"));
+        clone_done();
+      });
+  task_runner.RunUntilCheckpoint("clone_done");
+  EXPECT_EQ(consumer->QueryServiceState().tracing_sessions().size(), 1u);
+}
+
+TEST_F(TracingServiceImplTest, SmbCommitRingRequiresProducerSupport) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  // An out-of-process producer that didn't advertise support for the ring
+  // (e.g. an older client) keeps using the whole SMB for chunks.
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer", /*uid=*/42, /*pid=*/1025,
+                    /*shared_memory_size_hint_bytes=*/0,
+                    /*shared_memory_page_size_hint_bytes=*/0, /*shm=*/nullptr,
+                    /*in_process=*/false);
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+  auto* producer_config = trace_config.add_producers();
+  producer_config->set_producer_name("mock_producer");
+  producer_config->set_smb_commit_ring(true);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+  EXPECT_FALSE(producer->endpoint()->IsSmbCommitRingEnabled());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, SmbCommitRingCorrupted) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(1024);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+  auto* producer_config = trace_config.add_producers();
+  producer_config->set_producer_name("mock_producer");
+  producer_config->set_shm_size_kb(32);
+  producer_config->set_page_size_kb(4);
+  producer_config->set_smb_commit_ring(true);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+  ASSERT_TRUE(producer->endpoint()->IsSmbCommitRingEnabled());
+
+  // Claims that the ring holds records that were never written.
+  CommitDataRequest bad_req;
+  bad_req.set_commit_ring_write_index(1000);
+  producer->endpoint()->CommitData(bad_req, {});
+  EXPECT_FALSE(producer->endpoint()->IsSmbCommitRingEnabled());
+
+  // The producer is told and goes back to committing via IPC: no data is lost.
+  static constexpr int kNumPackets = 20;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < kNumPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload_" + std::to_string(i));
+  }
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  for (int i = 0; i < kNumPackets; i++) {
+    EXPECT_THAT(packets, Contains(Property(
+                             &protos::gen::TracePacket::for_testing,
+                             Property(&protos::gen::TestEvent::str,
+                                      Eq("payload_" + std::to_string(i))))));
+  }
+}
+
 TEST_F(TracingServiceImplTest, ObserveEventsDataSourceInstances) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/zlib_compressor.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+#include <zlib.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/slice.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/tracing/core/trace_config.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::WriteVarInt;
+
+// ID of |compressed_packets| in trace_packet.proto.
+constexpr uint32_t kCompressedPacketsId = 50;
+
+// Maximum number of uncompressed bytes deflated into a single output packet.
+// Matches the limit of ZipPacketWriter in perfetto_cmd, which keeps packets
+// below the 512KB limit of some transports.
+constexpr size_t kMaxPacketSize = 500 * 1024;
+
+// The compressed output is written into owned slices of this size.
+constexpr size_t kOutputSliceSize = 64 * 1024;
+
+// Same level used by ZipPacketWriter for COMPRESSION_TYPE_DEFLATE.
+constexpr int kDefaultCompressionLevel = 6;
+
+int GetCompressionLevel(const TraceConfig& config) {
+  switch (config.compression_type()) {
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE_FAST:
+      return Z_BEST_SPEED;
+    case TraceConfig::COMPRESSION_TYPE_UNSPECIFIED:
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE:
+      break;
+  }
+  return kDefaultCompressionLevel;
+}
+
+// Deflates a sequence of packets into a single |compressed_packets| packet.
+// The deflate stream is reset, rather than re-initialized, after each output
+// packet.
+class ZlibPacketCompressor {
+ public:
+  explicit ZlibPacketCompressor(int level) {
+    PERFETTO_CHECK(deflateInit(&stream_, level) == Z_OK);
+  }
+  ~ZlibPacketCompressor() { deflateEnd(&stream_); }
+
+  ZlibPacketCompressor(const ZlibPacketCompressor&) = delete;
+  ZlibPacketCompressor& operator=(const ZlibPacketCompressor&) = delete;
+
+  // Deflates |packet|, prefixed by its preamble as a field of trace.proto.
+  void PushPacket(const TracePacket& packet) {
+    uint8_t preamble[16];
+    uint8_t* end = WriteVarInt(
+        MakeTagLengthDelimited(TracePacket::kPacketFieldNumber), preamble);
+    end = WriteVarInt(packet.size(), end);
+    size_t preamble_size = static_cast<size_t>(end - preamble);
+    Deflate(preamble, preamble_size, Z_NO_FLUSH);
+    for (const Slice& slice : packet.slices())
+      Deflate(slice.start, slice.size, Z_NO_FLUSH);
+    input_size_ += preamble_size + packet.size();
+  }
+
+  // Finalizes the deflate stream and returns a packet with the data deflated
+  // since the previous call.
+  TracePacket Finish() {
+    Deflate(nullptr, 0, Z_FINISH);
+    slices_.back().size = kOutputSliceSize - stream_.avail_out;
+
+    size_t compressed_size = 0;
+    for (const Slice& slice : slices_)
+      compressed_size += slice.size;
+
+    Slice preamble = Slice::Allocate(16);
+    uint8_t* end = WriteVarInt(MakeTagLengthDelimited(kCompressedPacketsId),
+                               preamble.own_data());
+    end = WriteVarInt(compressed_size, end);
+    preamble.size = static_cast<size_t>(end - preamble.own_data());
+
+    TracePacket packet;
+    packet.AddSlice(std::move(preamble));
+    for (Slice& slice : slices_) {
+      if (slice.size)
+        packet.AddSlice(std::move(slice));
+    }
+    slices_.clear();
+    input_size_ = 0;
+    PERFETTO_CHECK(deflateReset(&stream_) == Z_OK);
+    stream_.avail_out = 0;
+    return packet;
+  }
+
+  // Uncompressed bytes pushed since the last Finish() call.
+  size_t input_size() const { return input_size_; }
+
+ private:
+  void Deflate(const void* data, size_t size, int flush) {
+    stream_.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    for (;;) {
+      if (stream_.avail_out == 0) {
+        slices_.emplace_back(Slice::Allocate(kOutputSliceSize));
+        stream_.next_out = slices_.back().own_data();
+        stream_.avail_out = static_cast<uInt>(kOutputSliceSize);
+      }
+      int res = deflate(&stream_, flush);
+      PERFETTO_CHECK(res != Z_STREAM_ERROR);
+      if (flush == Z_FINISH ? res == Z_STREAM_END : stream_.avail_in == 0)
+        break;
+    }
+  }
+
+  z_stream stream_{};
+  Slices slices_;
+  size_t input_size_ = 0;
+};
+
+}  // namespace
+
+void ZlibCompressFn(std::vector<TracePacket>* packets,
+                    const TraceConfig& config) {
+  if (packets->empty())
+    return;
+
+  ZlibPacketCompressor compressor(GetCompressionLevel(config));
+  std::vector<TracePacket> compressed_packets;
+  for (TracePacket& packet : *packets) {
+    if (compressor.input_size() > 0 &&
+        compressor.input_size() + packet.size() > kMaxPacketSize) {
+      compressed_packets.emplace_back(compressor.Finish());
+    }
+
+    // Like ZipPacketWriter, don't attempt to compress packets that don't fit
+    // in an output packet on their own.
+    if (packet.size() > kMaxPacketSize) {
+      compressed_packets.emplace_back(std::move(packet));
+      continue;
+    }
+    compressor.PushPacket(packet);
+  }
+  if (compressor.input_size() > 0)
+    compressed_packets.emplace_back(compressor.Finish());
+
+  *packets = std::move(compressed_packets);
+}
+
+}  // namespace perfetto
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
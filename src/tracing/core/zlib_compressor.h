@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_ZLIB_COMPRESSOR_H_
+#define SRC_TRACING_CORE_ZLIB_COMPRESSOR_H_
+
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/tracing/core/forward_decls.h"
+
+namespace perfetto {
+
+class TracePacket;
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+// Replaces |packets| with an equivalent, smaller, sequence of packets that
+// contain the original packets deflated into the |compressed_packets| field
+// (see trace_packet.proto), using the compression level implied by
+// |config.compression_type()|. Each output packet holds at most ~500KB of
+// input, so that the result respects the same size limits as the packets
+// produced by perfetto_cmd. Packets bigger than that are passed through
+// uncompressed.
+// This is a TracingService::CompressorFn: it doesn't touch any service state
+// and is safe to call on any thread.
+void ZlibCompressFn(std::vector<TracePacket>* packets,
+                    const TraceConfig& config);
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_ZLIB_COMPRESSOR_H_
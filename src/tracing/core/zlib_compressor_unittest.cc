@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/zlib_compressor.h"
+
+#include <string.h>
+
+#include <random>
+
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/tracing/core/trace_config.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/test_event.gen.h"
+#include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+
+namespace perfetto {
+namespace {
+
+using TracePacketProto = protos::gen::TracePacket;
+
+TracePacket CreateTracePacket(const std::string& str) {
+  TracePacketProto msg;
+  msg.mutable_for_testing()->set_str(str);
+  std::vector<uint8_t> buf = msg.SerializeAsArray();
+  Slice slice = Slice::Allocate(buf.size());
+  memcpy(slice.own_data(), buf.data(), buf.size());
+  TracePacket packet;
+  packet.AddSlice(std::move(slice));
+  return packet;
+}
+
+std::string RandomString(size_t size) {
+  std::minstd_rand0 rnd(0);
+  std::uniform_int_distribution<> dist(0, 255);
+  std::string s;
+  s.resize(size);
+  for (size_t i = 0; i < s.size(); i++)
+    s[i] = static_cast<char>(dist(rnd));
+  return s;
+}
+
+std::string Decompress(const std::string& data) {
+  uint8_t out[1024];
+
+  z_stream stream{};
+  stream.next_in = reinterpret_cast<uint8_t*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<unsigned int>(data.size());
+
+  EXPECT_EQ(inflateInit(&stream), Z_OK);
+  std::string s;
+
+  int ret;
+  do {
+    stream.next_out = out;
+    stream.avail_out = sizeof(out);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    EXPECT_NE(ret, Z_STREAM_ERROR);
+    EXPECT_NE(ret, Z_NEED_DICT);
+    EXPECT_NE(ret, Z_DATA_ERROR);
+    EXPECT_NE(ret, Z_MEM_ERROR);
+    EXPECT_NE(ret, Z_BUF_ERROR);
+    s.append(reinterpret_cast<char*>(out), sizeof(out) - stream.avail_out);
+  } while (ret != Z_STREAM_END);
+
+  inflateEnd(&stream);
+  return s;
+}
+
+// Parses |packets| as written into a file and expands all the
+// compressed_packets in them.
+std::vector<TracePacketProto> Decode(std::vector<TracePacket>* packets) {
+  std::vector<TracePacketProto> res;
+  for (TracePacket& packet : *packets) {
+    TracePacketProto msg;
+    EXPECT_TRUE(msg.ParseFromString(packet.GetRawBytesForTesting()));
+    if (!msg.has_compressed_packets()) {
+      res.push_back(std::move(msg));
+      continue;
+    }
+    protos::gen::Trace trace;
+    EXPECT_TRUE(trace.ParseFromString(Decompress(msg.compressed_packets())));
+    for (const TracePacketProto& inner : trace.packet())
+      res.push_back(inner);
+  }
+  return res;
+}
+
+class ZlibCompressorTest
+    : public ::testing::TestWithParam<TraceConfig::CompressionType> {
+ protected:
+  TraceConfig config() {
+    TraceConfig cfg;
+    cfg.set_compression_type(GetParam());
+    return cfg;
+  }
+};
+
+TEST_P(ZlibCompressorTest, Empty) {
+  std::vector<TracePacket> packets;
+  ZlibCompressFn(&packets, config());
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST_P(ZlibCompressorTest, SmallPackets) {
+  std::vector<TracePacket> packets;
+  size_t uncompressed_size = 0;
+  for (int i = 0; i < 1000; i++) {
+    packets.push_back(CreateTracePacket("packet " + std::to_string(i)));
+    uncompressed_size += packets.back().size();
+  }
+
+  ZlibCompressFn(&packets, config());
+
+  ASSERT_EQ(packets.size(), 1u);
+  EXPECT_LT(packets[0].size(), uncompressed_size / 3);
+  std::vector<TracePacketProto> decoded = Decode(&packets);
+  ASSERT_EQ(decoded.size(), 1000u);
+  for (int i = 0; i < 1000; i++)
+    EXPECT_EQ(decoded[i].for_testing().str(), "packet " + std::to_string(i));
+}
+
+TEST_P(ZlibCompressorTest, SplitsIntoMultiplePackets) {
+  // Random data doesn't compress: each output packet holds at most ~500KB of
+  // input, so 40 packets of 100KB must be split.
+  std::vector<TracePacket> packets;
+  for (int i = 0; i < 40; i++)
+    packets.push_back(CreateTracePacket(RandomString(100 * 1024)));
+
+  ZlibCompressFn(&packets, config());
+
+  EXPECT_GE(packets.size(), 8u);
+  for (const TracePacket& packet : packets)
+    EXPECT_LT(packet.size(), 512 * 1024u);
+  std::vector<TracePacketProto> decoded = Decode(&packets);
+  ASSERT_EQ(decoded.size(), 40u);
+  for (const TracePacketProto& packet : decoded)
+    EXPECT_EQ(packet.for_testing().str(), RandomString(100 * 1024));
+}
+
+TEST_P(ZlibCompressorTest, LargePacketsAreNotCompressed) {
+  std::vector<TracePacket> packets;
+  packets.push_back(CreateTracePacket("a"));
+  packets.push_back(CreateTracePacket(std::string(1024 * 1024, 'x')));
+  packets.push_back(CreateTracePacket("b"));
+
+  ZlibCompressFn(&packets, config());
+
+  ASSERT_EQ(packets.size(), 3u);
+  std::vector<TracePacketProto> decoded = Decode(&packets);
+  ASSERT_EQ(decoded.size(), 3u);
+  EXPECT_EQ(decoded[0].for_testing().str(), "a");
+  EXPECT_EQ(decoded[1].for_testing().str(), std::string(1024 * 1024, 'x'));
+  EXPECT_EQ(decoded[2].for_testing().str(), "b");
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    CompressionTypes,
+    ZlibCompressorTest,
+    ::testing::Values(TraceConfig::COMPRESSION_TYPE_DEFLATE,
+                      TraceConfig::COMPRESSION_TYPE_DEFLATE_FAST));
+
+}  // namespace
+}  // namespace perfetto
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
@@ -459,4 +459,27 @@ void ConsumerIPCClientImpl::SaveTraceForBugreport(
   consumer_port_.SaveTraceForBugreport(req, std::move(async_response));
 }
 
+void ConsumerIPCClientImpl::CloneSession(TracingSessionID tsid,
+                                         CloneSessionCallback callback) {
+  if (!connected_) {
+    PERFETTO_DLOG("Cannot CloneSession(), not connected to tracing service");
+    return;
+  }
+
+  protos::gen::CloneSessionRequest req;
+  req.set_session_id(tsid);
+  ipc::Deferred<protos::gen::CloneSessionResponse> async_response;
+  async_response.Bind(
+      [callback](ipc::AsyncResult<protos::gen::CloneSessionResponse> response) {
+        if (!response) {
+          // If the IPC fails, we are talking to an older version of the service
+          // that didn't support CloneSession at all.
+          callback(false, "The tracing service doesn't support CloneSession()");
+        } else {
+          callback(response->success(), response->error());
+        }
+      });
+  consumer_port_.CloneSession(req, std::move(async_response));
+}
+
 }  // namespace perfetto
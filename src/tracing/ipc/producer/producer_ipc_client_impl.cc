@@ -148,6 +148,7 @@ void ProducerIPCClientImpl::OnConnect() {
       static_cast<uint32_t>(shared_memory_size_hint_bytes_));
   req.set_shared_memory_page_size_hint_bytes(
       static_cast<uint32_t>(shared_memory_page_size_hint_bytes_));
+  req.set_smb_commit_ring_supported(true);
   switch (smb_scraping_mode_) {
     case TracingService::ProducerSMBScrapingMode::kDefault:
       // No need to set the mode, it defaults to use the service default if
@@ -285,6 +286,8 @@ void ProducerIPCClientImpl::OnServiceRequest(
           task_runner_);
       if (direct_smb_patching_supported_)
         shared_memory_arbiter_->SetDirectSMBPatchingSupportedByService();
+      if (cmd.setup_tracing().smb_commit_ring())
+        shared_memory_arbiter_->EnableSmbCommitRing();
     } else {
       // Producer-provided SMB (used by Chrome for startup tracing).
       PERFETTO_CHECK(is_shmem_provided_by_producer_ && shared_memory_ &&
@@ -320,6 +323,12 @@ void ProducerIPCClientImpl::OnServiceRequest(
     return;
   }
 
+  if (cmd.has_disable_smb_commit_ring()) {
+    if (shared_memory_arbiter_)
+      shared_memory_arbiter_->DisableSmbCommitRing();
+    return;
+  }
+
   PERFETTO_DFATAL("Unknown async request received from tracing service");
 }
 
@@ -338,6 +338,33 @@ void ConsumerIPCService::OnSaveTraceForBugreportCallback(
   response.Resolve(std::move(resp));
 }
 
+void ConsumerIPCService::CloneSession(
+    const protos::gen::CloneSessionRequest& req,
+    DeferredCloneSessionResponse resp) {
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  auto it = pending_clone_session_responses_.insert(
+      pending_clone_session_responses_.end(), std::move(resp));
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  auto callback = [weak_this, it](bool success, const std::string& error) {
+    if (weak_this)
+      weak_this->OnCloneSessionCallback(success, error, std::move(it));
+  };
+  remote_consumer->service_endpoint->CloneSession(req.session_id(), callback);
+}
+
+// Called by the service in response to service_endpoint->CloneSession().
+void ConsumerIPCService::OnCloneSessionCallback(
+    bool success,
+    const std::string& error,
+    PendingCloneSessionResponses::iterator pending_response_it) {
+  DeferredCloneSessionResponse response(std::move(*pending_response_it));
+  pending_clone_session_responses_.erase(pending_response_it);
+  auto resp = ipc::AsyncResult<protos::gen::CloneSessionResponse>::Create();
+  resp->set_success(success);
+  resp->set_error(error);
+  response.Resolve(std::move(resp));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RemoteConsumer methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -121,7 +121,7 @@ void ProducerIPCService::InitializeConnection(
       req.shared_memory_size_hint_bytes(),
       /*in_process=*/false, smb_scraping_mode,
       req.shared_memory_page_size_hint_bytes(), std::move(shmem),
-      req.sdk_version());
+      req.sdk_version(), req.smb_commit_ring_supported());
 
   // Could happen if the service has too many producers connected.
   if (!producer->service_endpoint) {
@@ -496,6 +496,8 @@ void ProducerIPCService::RemoteProducer::SendSetupTracing() {
             ->fd();
     cmd.set_fd(shm_fd);
 #endif
+    if (service_endpoint->IsSmbCommitRingEnabled())
+      setup_tracing->set_smb_commit_ring(true);
   }
   async_producer_commands.Resolve(std::move(cmd));
 }
@@ -535,4 +537,17 @@ void ProducerIPCService::RemoteProducer::ClearIncrementalState(
   async_producer_commands.Resolve(std::move(cmd));
 }
 
+void ProducerIPCService::RemoteProducer::OnSmbCommitRingDisabled() {
+  if (!async_producer_commands.IsBound()) {
+    PERFETTO_DLOG(
+        "The Service tried to disable the SMB commit ring, but the remote "
+        "Producer has not yet initialized the connection");
+    return;
+  }
+  auto cmd = ipc::AsyncResult<protos::gen::GetAsyncCommandResponse>::Create();
+  cmd.set_has_more(true);
+  cmd->mutable_disable_smb_commit_ring();
+  async_producer_commands.Resolve(std::move(cmd));
+}
+
 }  // namespace perfetto
@@ -97,6 +97,7 @@ class ProducerIPCService : public protos::gen::ProducerPort {
 
     void ClearIncrementalState(const DataSourceInstanceID* data_source_ids,
                                size_t num_data_sources) override;
+    void OnSmbCommitRingDisabled() override;
 
     void SendSetupTracing();
 
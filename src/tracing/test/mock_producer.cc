@@ -72,11 +72,12 @@ void MockProducer::Connect(TracingService* svc,
                            pid_t pid,
                            size_t shared_memory_size_hint_bytes,
                            size_t shared_memory_page_size_hint_bytes,
-                           std::unique_ptr<SharedMemory> shm) {
+                           std::unique_ptr<SharedMemory> shm,
+                           bool in_process) {
   producer_name_ = producer_name;
   service_endpoint_ = svc->ConnectProducer(
-      this, uid, pid, producer_name, shared_memory_size_hint_bytes,
-      /*in_process=*/true, TracingService::ProducerSMBScrapingMode::kDefault,
+      this, uid, pid, producer_name, shared_memory_size_hint_bytes, in_process,
+      TracingService::ProducerSMBScrapingMode::kDefault,
       shared_memory_page_size_hint_bytes, std::move(shm));
   auto checkpoint_name = "on_producer_connect_" + producer_name;
   auto on_connect = task_runner_->CreateCheckpoint(checkpoint_name);
@@ -16,7 +16,16 @@
 
 #include <benchmark/benchmark.h>
 
+#include <string.h>
+#include <unistd.h>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_splitter.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/traced/traced.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/trace_config.h"
@@ -218,6 +227,92 @@ static void BenchmarkConsumer(benchmark::State& state) {
                          static_cast<double>(read_time_taken_ns));
 }
 
+// Returns the number of write syscalls (write(), writev(), ...) done so far by
+// this process, or 0 if not available. Only meaningful when the service runs
+// in this process (i.e. not when using the system traced on Android).
+uint64_t GetWriteSyscallCount() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  std::string io;
+  if (!base::ReadFile("/proc/self/io", &io))
+    return 0;
+  static const char kSyscw[] = "syscw: ";
+  for (base::StringSplitter lines(std::move(io), '\n'); lines.Next();) {
+    if (strncmp(lines.cur_token(), kSyscw, sizeof(kSyscw) - 1) == 0)
+      return base::CStringToUInt64(lines.cur_token() + sizeof(kSyscw) - 1)
+          .value_or(0);
+  }
+#endif
+  return 0;
+}
+
+// Measures the cost of writing a whole buffer into a file when a
+// write_into_file session is disabled.
+static void BenchmarkWriteIntoFile(benchmark::State& state) {
+  static const uint32_t kBufferSizeBytes =
+      IsBenchmarkFunctionalOnly() ? 64 * 1024 : 16 * 1024 * 1024;
+  static constexpr uint32_t kRandomSeed = 42;
+  uint32_t message_bytes = static_cast<uint32_t>(state.range(0));
+  // Fill only half of the buffer, so that nothing is overwritten.
+  uint32_t message_count = kBufferSizeBytes / 2 / message_bytes;
+
+  uint64_t service_ns = 0;
+  uint64_t write_syscalls = 0;
+  uint64_t bytes_written = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    base::TestTaskRunner task_runner;
+    TestHelper helper(&task_runner);
+    helper.StartServiceIfRequired();
+    FakeProducer* producer = helper.ConnectFakeProducer();
+    helper.ConnectConsumer();
+    helper.WaitForConsumerConnect();
+
+    TraceConfig trace_config;
+    trace_config.add_buffers()->set_size_kb(kBufferSizeBytes / 1024);
+    trace_config.set_write_into_file(true);
+    // Make sure the whole buffer is written at the end of the session.
+    trace_config.set_file_write_period_ms(100000);
+    auto* ds_config = trace_config.add_data_sources()->mutable_config();
+    ds_config->set_name("android.perfetto.FakeProducer");
+    ds_config->set_target_buffer(0);
+    ds_config->mutable_for_testing()->set_seed(kRandomSeed);
+    ds_config->mutable_for_testing()->set_message_count(message_count);
+    ds_config->mutable_for_testing()->set_message_size(message_bytes);
+
+    base::TempFile tmp_file = base::TempFile::CreateUnlinked();
+    helper.StartTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+    helper.WaitForProducerEnabled();
+
+    auto on_produced_and_committed =
+        task_runner.CreateCheckpoint("produced.and.committed");
+    producer->ProduceEventBatch(helper.WrapTask(on_produced_and_committed));
+    task_runner.RunUntilCheckpoint("produced.and.committed");
+    state.ResumeTiming();
+
+    uint64_t service_start_ns =
+        helper.service_thread()->GetThreadCPUTimeNsForTesting();
+    uint64_t syscw_start = GetWriteSyscallCount();
+    helper.DisableTracing();
+    helper.WaitForTracingDisabled();
+    write_syscalls += GetWriteSyscallCount() - syscw_start;
+    service_ns +=
+        helper.service_thread()->GetThreadCPUTimeNsForTesting() -
+        service_start_ns;
+
+    state.PauseTiming();
+    bytes_written += static_cast<uint64_t>(lseek(tmp_file.fd(), 0, SEEK_END));
+    state.ResumeTiming();
+  }
+
+  double mb_written = static_cast<double>(bytes_written) / (1024 * 1024);
+  state.counters["Ser ns/MB"] =
+      benchmark::Counter(static_cast<double>(service_ns) / mb_written);
+  state.counters["syscw/MB"] =
+      benchmark::Counter(static_cast<double>(write_syscalls) / mb_written);
+  state.SetBytesProcessed(static_cast<int64_t>(bytes_written));
+}
+
 void SaturateCpuProducerArgs(benchmark::internal::Benchmark* b) {
   int min_message_count = 16;
   int max_message_count = IsBenchmarkFunctionalOnly() ? 16 : 1024 * 1024;
@@ -257,6 +352,13 @@ void ConstantRateConsumerArgs(benchmark::internal::Benchmark* b) {
   }
 }
 
+void WriteIntoFileArgs(benchmark::internal::Benchmark* b) {
+  int min_payload = 8;
+  int max_payload = IsBenchmarkFunctionalOnly() ? 8 : 32 * 1024;
+  for (int bytes = min_payload; bytes <= max_payload; bytes *= 8)
+    b->Args({bytes});
+}
+
 }  // namespace
 
 static void BM_EndToEnd_Producer_SaturateCpu(benchmark::State& state) {
@@ -295,4 +397,13 @@ BENCHMARK(BM_EndToEnd_Consumer_ConstantRate)
     ->UseRealTime()
     ->Apply(ConstantRateConsumerArgs);
 
+static void BM_EndToEnd_WriteIntoFile(benchmark::State& state) {
+  BenchmarkWriteIntoFile(state);
+}
+
+BENCHMARK(BM_EndToEnd_WriteIntoFile)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->Apply(WriteIntoFileArgs);
+
 }  // namespace perfetto